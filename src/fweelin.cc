@@ -100,7 +100,7 @@ void signal_handler (int iSignal) {
 
 
 #ifndef NO_COMPILE_MAIN
-int main (int /*argc*/, char *argv[]) {
+int main (int argc, char *argv[]) {
 #if !defined(WIN32)
   main_pid = getpid();
 #endif // WIN32
@@ -124,6 +124,11 @@ int main (int /*argc*/, char *argv[]) {
   sigaction(SIGUSR2, &sact, NULL);
 #endif // WIN32
 
+  if (argc > 1 && !strcmp(argv[1],"--bench-expressions")) {
+    ParsedExpression::Benchmark();
+    return 0;
+  }
+
   Fweelin flo;
   
   printf("FreeWheeling %s\n",VERSION);
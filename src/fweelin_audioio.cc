@@ -96,8 +96,21 @@ int AudioIO::process (nframes_t nframes, void *arg) {
       exit(1);
     }
 
+    // JACK MIDI in and out for this period- input is queued for the MIDI
+    // thread
+    if (inst->midiiport != 0) {
+      for (int i = 0; i < inst->nummidiouts; i++)
+        inst->midiobufs[i] = jack_port_get_buffer(inst->midioport[i], nframes);
+      inst->app->getMIDI()->
+        JackProcess(jack_port_get_buffer(inst->midiiport, nframes),
+                    inst->midiobufs, nframes);
+    }
+
     // Run through audio processors
     inst->rp->process(0, nframes, ab);
+
+    // Send MIDI sync generated this period
+    inst->app->getMIDI()->FlushOutput();
   }
 
   inst->timebase_master = 0; // Reset timebase master flag-
@@ -266,6 +279,10 @@ void AudioIO::close () {
   delete[] iport[1];
   delete[] oport[0];
   delete[] oport[1];
+  if (midioport != 0) {
+    delete[] midioport;
+    delete[] midiobufs;
+  }
 
   printf("AUDIO: end\n");
 }
@@ -351,6 +368,31 @@ int AudioIO::open () {
     } else
       oport[1][i] = 0;
   }
+
+  // JACK MIDI ports
+  if (app->getCFG()->IsJackMIDI()) {
+    nummidiouts = app->getCFG()->GetNumMIDIOuts();
+    printf("AUDIO: Creating JACK MIDI input and %d output(s)\n",nummidiouts);
+    midioport = new jack_port_t *[nummidiouts];
+    midiobufs = new void *[nummidiouts];
+    for (int i = 0; i < nummidiouts; i++) {
+      snprintf(tmp,255,"midi_out_%d",i+1);
+      midiobufs[i] = 0;
+      if ((midioport[i] = 
+           jack_port_register(client, tmp, JACK_DEFAULT_MIDI_TYPE,
+                              JackPortIsOutput, 0)) == 0) {
+        printf("AUDIO: ERROR: Can't create JACK MIDI port '%s'!\n",tmp);
+        return 1;
+      }
+    }
+    // Input last- the audio thread only handles JACK MIDI once it is set
+    if ((midiiport = 
+         jack_port_register(client, "midi_in", JACK_DEFAULT_MIDI_TYPE,
+                            JackPortIsInput, 0)) == 0) {
+      printf("AUDIO: ERROR: Can't create JACK MIDI port 'midi_in'!\n");
+      return 1;
+    }
+  }
   
   return 0;
 }
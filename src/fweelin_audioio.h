@@ -21,6 +21,7 @@
 extern "C"
 {
 #include <jack/jack.h>
+#include <jack/midiport.h>
 }
 
 typedef jack_default_audio_sample_t sample_t;
@@ -33,7 +34,8 @@ class Processor;
 
 class AudioIO {
 public:
-  AudioIO(Fweelin *app) : sync_start_frame(0), timebase_master(0), sync_active(0), audio_thread(0), app(app) {};
+  AudioIO(Fweelin *app) : midiiport(0), midioport(0), midiobufs(0), nummidiouts(0),
+    sync_start_frame(0), timebase_master(0), sync_active(0), audio_thread(0), app(app) {};
 
   // Open up system level audio
   int open ();
@@ -98,12 +100,28 @@ public:
   // Is the transport rolling?
   inline char IsTransportRolling() { return transport_roll; };
 
+  // Is the calling thread the RT audio thread?
+  inline char IsAudioThread() { 
+    return (audio_thread != 0 && pthread_equal(pthread_self(),audio_thread));
+  };
+
+  // Frames elapsed since the start of the current period
+  // (call from the audio thread)
+  inline nframes_t GetFramesSinceCycleStart() {
+    return jack_frames_since_cycle_start(client);
+  };
+
   // Audio system client
   jack_client_t *client;
 
   // Inputs and outputs- stereo pairs
   jack_port_t **iport[2], **oport[2];
 
+  // JACK MIDI input and outputs (if enabled)
+  jack_port_t *midiiport, **midioport;
+  void **midiobufs;
+  int nummidiouts;
+
   float cpuload; // Current approximate audio CPU load
   float timescale; // fragment length/sample rate = length (s) of one fragment
   nframes_t srate; // Sampling rate
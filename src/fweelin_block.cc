@@ -33,6 +33,8 @@
 #include <pthread.h>
 #include <sched.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include "fweelin_block.h"
 #include "fweelin_core.h"
@@ -183,28 +185,28 @@ int VorbisDecoder::ReadSamples(AudioBlockIterator *i, nframes_t max_len) {
 //   return ov_read_float(&vf,&pcm_channels,max_len,&current_section);
 // };
 
-iFileEncoder::iFileEncoder(Fweelin *app, char stereo) : app(app), 
-                                                        stereo(stereo),
-                                                        outfd(0) {
+iFileEncoder::iFileEncoder(Fweelin *app, char stereo, int channels) : 
+  app(app), stereo(stereo), 
+  channels(channels > 0 ? channels : (stereo ? 2 : 1)), outfd(0) {
 };
 
 SndFileEncoder::SndFileEncoder (Fweelin *app, nframes_t maxframes,
-                                char stereo, codec format) : 
-  iFileEncoder(app,stereo), tbuf(0) {
+                                char stereo, codec format, int channels) : 
+  iFileEncoder(app,stereo,channels), tbuf(0) {
   filetype = format;
   memset(&sfinfo, 0, sizeof (sfinfo)) ;
 
   // set params
   sfinfo.samplerate     = app->getAUDIO()->get_srate();
   sfinfo.frames         = 0x7FFFFFFF;
-  if (stereo) {
-    sfinfo.channels     = 2;
+  sfinfo.channels       = this->channels;
+  if (sfinfo.channels > 1)
     tbuf = new float[maxframes*sfinfo.channels];
-  } else 
-    sfinfo.channels     = 1;
 
   if (filetype == FLAC)
     sfinfo.format = (SF_FORMAT_FLAC | SF_FORMAT_PCM_24);
+  else if (channels > 0)
+    sfinfo.format = (SF_FORMAT_RF64 | SF_FORMAT_FLOAT);
   else 
     sfinfo.format = (SF_FORMAT_WAV | SF_FORMAT_FLOAT);
   
@@ -218,16 +220,24 @@ int SndFileEncoder::SetupFileForWriting (FILE *file) {
     printf("DISK: Couldn't open output sound file!\n");
     return 1;
   } 
+
+  // Files that never get past 4 GB are written as plain WAV
+  if ((sfinfo.format & SF_FORMAT_TYPEMASK) == SF_FORMAT_RF64)
+    sf_command(sndoutfd, SFC_RF64_AUTO_DOWNGRADE, 0, SF_TRUE);
+
   return 0;
 };
 
 long int SndFileEncoder::WriteSamplesToDisk (sample_t **ibuf, 
                                              nframes_t startframe, 
                                              nframes_t numframes) {
-  if (stereo) {
-    for (nframes_t i = 0; i < numframes; i++) {
-      tbuf[2*i] = ibuf[0][startframe+i];
-      tbuf[2*i+1] = ibuf[1][startframe+i];
+  if (channels > 1) {
+    // Interleave
+    for (int c = 0; c < channels; c++) {
+      sample_t *in = &ibuf[c][startframe];
+      float *out = &tbuf[c];
+      for (nframes_t i = 0; i < numframes; i++, out += channels)
+        *out = in[i];
     }
     if (filetype == FLAC)
       // FIXME: perhaps some error checking
@@ -250,10 +260,11 @@ void SndFileEncoder::PrepareFileForClosing(){
   sf_close(sndoutfd);
 }
 
-VorbisEncoder::VorbisEncoder(Fweelin *app, char stereo) : iFileEncoder(app,stereo) {
+VorbisEncoder::VorbisEncoder(Fweelin *app, char stereo, int channels) : 
+  iFileEncoder(app,stereo,channels) {
   // Setup vorbis
   vorbis_info_init(&vi);
-  if (vorbis_encode_init_vbr(&vi,(stereo ? 2 : 1),app->getAUDIO()->get_srate(),
+  if (vorbis_encode_init_vbr(&vi,this->channels,app->getAUDIO()->get_srate(),
                              app->getCFG()->GetVorbisEncodeQuality()))
     return;
   
@@ -309,15 +320,10 @@ long int VorbisEncoder::WriteSamplesToDisk (sample_t **ibuf,
                                             nframes_t startframe, 
                                             nframes_t numframes) {
   // Here we make assumption that sample_t is equivalent to float
-  // And that there is only 1 vorbis channel of data
   float **obuf = GetAnalysisBuffer(numframes);
     
-  if (stereo)  { 
-    memcpy(obuf[0], &ibuf[0][startframe], sizeof(float) * numframes);
-    memcpy(obuf[1], &ibuf[1][startframe], sizeof(float) * numframes);
-  } else {
-    memcpy(obuf[0], &ibuf[0][startframe], sizeof(float) * numframes);
-  }
+  for (int c = 0; c < channels; c++)
+    memcpy(obuf[c], &ibuf[c][startframe], sizeof(float) * numframes);
   
   WroteToBuffer(numframes);
   Encode();
@@ -381,7 +387,7 @@ BlockReadManager::BlockReadManager(FILE *in, AutoReadControl *arc,
                                    BlockManager *bmg, 
                                    nframes_t peaksavgs_chunksize) :
   ManagedChain(0,0), in(in), smooth_end(0), 
-  arc(arc), dec(0), bmg(bmg), pa_mgr(0),
+  arc(arc), job(0), dec(0), bmg(bmg), pa_mgr(0),
   peaksavgs_chunksize(peaksavgs_chunksize)
 {
   pthread_mutex_init(&decode_lock,0);
@@ -433,8 +439,14 @@ void BlockReadManager::Start(FILE *new_in) {
     i = new AudioBlockIterator(b,DECODE_CHUNKSIZE,
                                bmg->GetApp()->getPRE_EXTRACHANNEL());
     
-    // Compute audio peaks & averages for display
-    if (peaksavgs_chunksize != 0) {
+    // Peaks & averages for display- saved with the loop?
+    BED_PeaksAvgs *savedpa = 0;
+    if (peaksavgs_chunksize != 0 && arc != 0 &&
+        (savedpa = arc->GetPeaksAvgs(job,b,peaksavgs_chunksize)) != 0) {
+      b->AddExtendedData(savedpa);
+      pa_mgr = 0;
+    } else if (peaksavgs_chunksize != 0) {
+      // Compute audio peaks & averages for display
       AudioBlock *peaks = (AudioBlock *) b->RTNew(),
         *avgs = (AudioBlock *) b->RTNew();
       if (peaks == 0 || avgs == 0) {
@@ -512,9 +524,10 @@ void BlockReadManager::End(char error) {
     
     // Callback
     if (arc != 0)
-      arc->ReadComplete(b);
+      arc->ReadComplete(b,job);
 
     b = 0;
+    job = 0;
   }
 
   pthread_mutex_unlock(&decode_lock);
@@ -525,7 +538,7 @@ int BlockReadManager::Manage() {
     // Not currently decoding
     if (arc != 0) {
       // We have a callback, get a chain to load
-      arc->GetReadBlock(&in,&smooth_end);
+      arc->GetReadBlock(&in,&smooth_end,&filetype,&job);
       
       if (in != 0)
         // We got a chain to load, so begin
@@ -580,10 +593,102 @@ int BlockReadManager::Manage() {
   return 0;
 };
 
+BlockReadPool::BlockReadPool(AutoReadControl *arc, BlockManager *bmg, 
+                             nframes_t peaksavgs_chunksize, 
+                             int numdecoders, int maxthreads) : 
+  bmg(bmg), numdecoders(numdecoders), threadgo(1) {
+  if (this->numdecoders <= 0)
+    this->numdecoders = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (maxthreads > MAX_DECODERS)
+    maxthreads = MAX_DECODERS;
+  if (this->numdecoders > maxthreads)
+    this->numdecoders = maxthreads;
+  if (this->numdecoders < 1)
+    this->numdecoders = 1;
+  printf("DISK: Starting %d loop decoder(s).\n",this->numdecoders);
+
+  const static size_t STACKSIZE = 1024*128;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr,STACKSIZE);
+
+  for (int n = 0; n < this->numdecoders; n++) {
+    DecodeThread *t = &decoders[n];
+    t->pool = this;
+    t->mgr = ::new BlockReadManager(0,arc,bmg,peaksavgs_chunksize);
+
+    int ret = pthread_create(&t->thread,
+                             &attr,
+                             run_decode_thread,
+                             static_cast<void *>(t));
+    if (ret != 0) {
+      printf("(blockreadpool) pthread_create failed, exiting");
+      exit(1);
+    }
+    RT_RWThreads::RegisterReaderOrWriter(t->thread);
+  }
+
+  pthread_attr_destroy(&attr);
+};
+
+BlockReadPool::~BlockReadPool() {
+  End();
+  for (int n = 0; n < numdecoders; n++)
+    delete decoders[n].mgr;
+};
+
+void BlockReadPool::End() {
+  if (threadgo) {
+    // Terminate the decoder threads
+    threadgo = 0;
+    for (int n = 0; n < numdecoders; n++)
+      pthread_join(decoders[n].thread,0);
+
+    // End reading on all chains
+    for (int n = 0; n < numdecoders; n++)
+      decoders[n].mgr->End(0);
+  }
+};
+
+char BlockReadPool::CanStartDecode() {
+  int running = 0;
+  for (int n = 0; n < numdecoders; n++)
+    if (decoders[n].mgr->in != 0)
+      running++;
+
+  // One decoder can always run- it waits for blocks itself
+  return (running == 0 || 
+          bmg->GetApp()->getPRE_AUDIOBLOCK()->GetNumReady() >= 
+          (running+1) * BLOCKS_PER_DECODER);
+};
+
+void *BlockReadPool::run_decode_thread (void *ptr) {
+  DecodeThread *t = static_cast<DecodeThread *>(ptr);
+
+  while (t->pool->threadgo) {
+    if (t->mgr->in == 0 && !t->pool->CanStartDecode()) {
+      // Other decoders are using up free blocks- check again in 10 ms
+      usleep(10000);
+      continue;
+    }
+
+    if (t->mgr->Manage())
+      break; // AutoReadControl is gone- nothing more to read
+
+    if (t->mgr->in == 0)
+      // Nothing to read right now- check again in 10 ms
+      usleep(10000);
+    else
+      sched_yield();
+  }
+
+  return 0;
+};
+
 BlockWriteManager::BlockWriteManager(FILE *out, AutoWriteControl *awc, 
                                      BlockManager *bmg, AudioBlock *b, 
                                      AudioBlockIterator *i) : 
-  ManagedChain(b,i), out(out), len(0), awc(awc), enc(0), bmg(bmg)
+  ManagedChain(b,i), out(out), len(0), awc(awc), job(0), enc(0), bmg(bmg)
 {
   pthread_mutex_init(&encode_lock,0);
 };
@@ -670,6 +775,11 @@ void BlockWriteManager::End() {
   b = 0;
   i = 0;
   len = 0;
+
+  // Callback
+  if (awc != 0 && job != 0)
+    awc->WriteComplete(job);
+  job = 0;
   
   pthread_mutex_unlock(&encode_lock);
 };
@@ -679,7 +789,7 @@ int BlockWriteManager::Manage() {
     // Not currently encoding
     if (awc != 0) {
       // We have a callback, get a chain to save
-      awc->GetWriteBlock(&out,&b,&i,&len);
+      awc->GetWriteBlock(&out,&b,&i,&len,&job);
       
       if (b != 0)
         // We got a chain to save, so begin
@@ -729,11 +839,261 @@ int BlockWriteManager::Manage() {
   return 0;
 };
 
+BlockWritePool::BlockWritePool(AutoWriteControl *awc, BlockManager *bmg, 
+                               int numencoders, double maxrate,
+                               int maxthreads) : 
+  numencoders(numencoders), threadrate(0.0), threadgo(1) {
+  if (this->numencoders <= 0)
+    // Leave a core for the audio & block managing threads
+    this->numencoders = (int) sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  if (maxthreads > MAX_ENCODERS)
+    maxthreads = MAX_ENCODERS;
+  if (this->numencoders > maxthreads)
+    this->numencoders = maxthreads;
+  if (this->numencoders < 1)
+    this->numencoders = 1;
+  if (maxrate > 0.0)
+    threadrate = maxrate / this->numencoders;
+  printf("DISK: Starting %d loop encoder(s).\n",this->numencoders);
+
+  const static size_t STACKSIZE = 1024*128;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr,STACKSIZE);
+
+  for (int n = 0; n < this->numencoders; n++) {
+    EncodeThread *t = &encoders[n];
+    t->pool = this;
+    t->mgr = ::new BlockWriteManager(0,awc,bmg);
+
+    int ret = pthread_create(&t->thread,
+                             &attr,
+                             run_encode_thread,
+                             static_cast<void *>(t));
+    if (ret != 0) {
+      printf("(blockwritepool) pthread_create failed, exiting");
+      exit(1);
+    }
+    RT_RWThreads::RegisterReaderOrWriter(t->thread);
+
+    // Encoders are never realtime- and run below the block managing thread,
+    // which is at the top of SCHED_OTHER (whose only priority is 0)
+    struct sched_param schp;
+    memset(&schp, 0, sizeof(schp));
+#ifdef SCHED_IDLE
+    if (pthread_setschedparam(t->thread, SCHED_IDLE, &schp) != 0)
+#else
+    if (pthread_setschedparam(t->thread, SCHED_OTHER, &schp) != 0)
+#endif
+      printf("BLOCK: Can't set encoder thread priority!\n");
+  }
+
+  pthread_attr_destroy(&attr);
+};
+
+BlockWritePool::~BlockWritePool() {
+  End();
+  for (int n = 0; n < numencoders; n++)
+    delete encoders[n].mgr;
+};
+
+void BlockWritePool::End() {
+  if (threadgo) {
+    // Terminate the encoder threads
+    threadgo = 0;
+    for (int n = 0; n < numencoders; n++)
+      pthread_join(encoders[n].thread,0);
+
+    // Close all chains being written
+    for (int n = 0; n < numencoders; n++)
+      encoders[n].mgr->End();
+  }
+};
+
+void BlockWritePool::RefDeleted(void *ref) {
+  for (int n = 0; n < numencoders; n++)
+    encoders[n].mgr->RefDeleted(ref);
+};
+
+void *BlockWritePool::run_encode_thread (void *ptr) {
+  EncodeThread *t = static_cast<EncodeThread *>(ptr);
+  BlockWritePool *pool = t->pool;
+
+  // Throughput since this thread last went idle
+  double ratestart = 0.0;
+  double ratecount = 0.0;
+
+  while (pool->threadgo) {
+    char busy = (t->mgr->b != 0);
+    if (t->mgr->Manage())
+      break; // AutoWriteControl is gone- nothing more to write
+
+    if (!busy && t->mgr->b == 0) {
+      // Nothing to write right now- check again in 10 ms
+      ratestart = 0.0;
+      usleep(10000);
+    } else if (pool->threadrate > 0.0) {
+      // One chunk encoded- sleep if we are ahead of our rate
+      double now = mygettime();
+      if (ratestart == 0.0) {
+        ratestart = now;
+        ratecount = 0.0;
+      }
+      ratecount += BlockWriteManager::ENCODE_CHUNKSIZE;
+
+      double ahead = ratecount / pool->threadrate - (now - ratestart);
+      if (ahead > 0.0)
+        usleep((useconds_t) (ahead * 1000000));
+    } else
+      sched_yield();
+  }
+
+  return 0;
+};
+
 BED_PeaksAvgs::~BED_PeaksAvgs() {
   peaks->DeleteChain();
   avgs->DeleteChain();
 };
 
+static const char PEAKSAVGS_MAGIC[8] = {'F','W','P','E','A','K','S','\0'};
+
+char PeaksAvgsFile::HeaderMatches(Header *hdr, unsigned char *hash, 
+                                  int hashlen, nframes_t chunksize) {
+  return (!memcmp(hdr->magic,PEAKSAVGS_MAGIC,sizeof(hdr->magic)) &&
+          hdr->version == FORMAT_VERSION && hdr->chunksize == chunksize &&
+          hashlen <= MAX_HASH_LENGTH && hdr->hashlen == (unsigned) hashlen &&
+          !memcmp(hdr->hash,hash,hashlen));
+};
+
+int PeaksAvgsFile::Write(const char *filename, unsigned char *hash, 
+                         int hashlen, BED_PeaksAvgs *pa) {
+  if (pa == 0 || hashlen > MAX_HASH_LENGTH)
+    return 1;
+
+  Header hdr;
+  memset(&hdr,0,sizeof(Header));
+  memcpy(hdr.magic,PEAKSAVGS_MAGIC,sizeof(hdr.magic));
+  hdr.version = FORMAT_VERSION;
+  hdr.chunksize = pa->chunksize;
+  hdr.count = MIN(pa->peaks->GetTotalLen(),pa->avgs->GetTotalLen());
+  hdr.hashlen = hashlen;
+  memcpy(hdr.hash,hash,hashlen);
+
+  FILE *out = fopen(filename,"wb");
+  if (out == 0) {
+    printf("DISK: ERROR: Can't write peaks/avgs '%s'\n",filename);
+    return 1;
+  }
+
+  char err = (fwrite(&hdr,sizeof(Header),1,out) != 1);
+  AudioBlock *chains[2] = {pa->peaks, pa->avgs};
+  for (int c = 0; !err && c < 2; c++) {
+    nframes_t left = hdr.count;
+    for (AudioBlock *cur = chains[c]; !err && cur != 0 && left > 0;
+         cur = cur->next) {
+      nframes_t n = MIN(cur->len,left);
+      err = (fwrite(cur->buf,sizeof(sample_t),n,out) != n);
+      left -= n;
+    }
+  }
+
+  fclose(out);
+  if (err) {
+    printf("DISK: ERROR: Can't write peaks/avgs '%s'\n",filename);
+    unlink(filename);
+    return 1;
+  }
+
+  return 0;
+};
+
+AudioBlock *PeaksAvgsFile::MakeChain(AudioBlock *proto, sample_t *src,
+                                     nframes_t len) {
+  AudioBlock *first = (AudioBlock *) proto->RTNew(),
+    *cur = first;
+  nframes_t left = len;
+  while (cur != 0) {
+    nframes_t n = MIN(cur->len,left);
+    memcpy(cur->buf,src,sizeof(sample_t) * n);
+    src += n;
+    left -= n;
+    if (left == 0)
+      break;
+
+    AudioBlock *nw = (AudioBlock *) proto->RTNew();
+    if (nw == 0) {
+      first->DeleteChain();
+      return 0;
+    }
+    cur->Link(nw);
+    cur = nw;
+  }
+
+  // Chop last block to length
+  if (first != 0 && first->GetTotalLen() > len)
+    first->HackTotalLengthBy(first->GetTotalLen() - len);
+
+  return first;
+};
+
+BED_PeaksAvgs *PeaksAvgsFile::Read(const char *filename, unsigned char *hash,
+                                   int hashlen, nframes_t chunksize,
+                                   AudioBlock *proto) {
+  int fd = open(filename,O_RDONLY);
+  if (fd == -1)
+    return 0;
+
+  struct stat st;
+  if (fstat(fd,&st) != 0 || st.st_size < (off_t) sizeof(Header)) {
+    close(fd);
+    return 0;
+  }
+
+  void *map = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 0;
+
+  BED_PeaksAvgs *ret = 0;
+  Header *hdr = (Header *) map;
+  if (!HeaderMatches(hdr,hash,hashlen,chunksize))
+    printf("DISK: Peaks/avgs '%s' don't match loop- computing.\n",filename);
+  else if (hdr->count == 0 ||
+           st.st_size < (off_t) (sizeof(Header) + 
+                                 2 * sizeof(sample_t) * hdr->count))
+    printf("DISK: Peaks/avgs '%s' too short- computing.\n",filename);
+  else {
+    sample_t *src = (sample_t *) ((char *) map + sizeof(Header));
+    AudioBlock *peaks = MakeChain(proto,src,hdr->count),
+      *avgs = MakeChain(proto,src + hdr->count,hdr->count);
+    if (peaks == 0 || avgs == 0) {
+      printf("DISK: ERROR: No free blocks for peaks/avgs\n");
+      if (peaks != 0)
+        peaks->DeleteChain();
+      if (avgs != 0)
+        avgs->DeleteChain();
+    } else
+      ret = new BED_PeaksAvgs(peaks,avgs,chunksize);
+  }
+
+  munmap(map,st.st_size);
+  return ret;
+};
+
+char PeaksAvgsFile::Matches(const char *filename, unsigned char *hash, 
+                            int hashlen, nframes_t chunksize) {
+  FILE *in = fopen(filename,"rb");
+  if (in == 0)
+    return 0;
+
+  Header hdr;
+  char ret = (fread(&hdr,sizeof(Header),1,in) == 1 &&
+              HeaderMatches(&hdr,hash,hashlen,chunksize));
+  fclose(in);
+  return ret;
+};
+
 int BED_MarkerPoints::CountMarkers() {
   TimeMarker *cur = markers;
   int markcnt = 0;
@@ -1865,6 +2225,96 @@ int PeaksAvgsManager::Manage() {
   return 0;
 };
 
+void BlockHashManager::Setup() {
+  sha256_init(&ctx);
+  curblk = b;
+  hashlen = 0;
+  stereo = b->IsStereo();
+};
+
+void BlockHashManager::HashBlock(sha256_ctx *ctx, AudioBlock *blk, 
+                                 nframes_t len, char stereo) {
+  sha256_update(ctx,sizeof(sample_t) * len,(const uint8_t *) blk->buf);
+  if (stereo) {
+    BED_ExtraChannel *rightblk = (BED_ExtraChannel *) 
+      blk->GetExtendedData(T_BED_ExtraChannel);
+    if (rightblk != 0)
+      sha256_update(ctx,sizeof(sample_t) * len,
+                    (const uint8_t *) rightblk->buf);
+  }
+};
+
+void BlockHashManager::HashDigest(sha256_ctx *ctx, nframes_t totallen, 
+                                  unsigned char *digest, 
+                                  unsigned int digestlen) {
+  // Length of the chain is part of the hash
+  uint8_t lenbytes[4];
+  for (int n = 0; n < 4; n++)
+    lenbytes[n] = (uint8_t) (totallen >> (8*n));
+  sha256_update(ctx,sizeof(lenbytes),lenbytes);
+
+  sha256_digest(ctx,MIN(digestlen,(unsigned int) SHA256_DIGEST_SIZE),digest);
+};
+
+int BlockHashManager::Manage() {
+  pthread_mutex_lock(&hash_lock);
+  if (finished) {
+    pthread_mutex_unlock(&hash_lock);
+    return 1;
+  }
+
+  // Blocks behind the record position are complete- hash them
+  // (read the position before any of the audio behind it)
+  AudioBlock *recblk = i->GetCurBlock();
+  __sync_synchronize();
+  while (curblk != 0 && curblk != recblk) {
+    HashBlock(&ctx,curblk,curblk->len,stereo);
+    hashlen += curblk->len;
+    curblk = curblk->next;
+  }
+
+  pthread_mutex_unlock(&hash_lock);
+  return 0;
+};
+
+int BlockHashManager::Finish(unsigned char *digest, unsigned int digestlen) {
+  pthread_mutex_lock(&hash_lock);
+  if (finished) {
+    pthread_mutex_unlock(&hash_lock);
+    return 1;
+  }
+
+  // Hash what is left
+  while (curblk != 0) {
+    HashBlock(&ctx,curblk,curblk->len,stereo);
+    hashlen += curblk->len;
+    curblk = curblk->next;
+  }
+
+  HashDigest(&ctx,hashlen,digest,digestlen);
+  finished = 1;
+
+  pthread_mutex_unlock(&hash_lock);
+  return 0;
+};
+
+void BlockHashManager::HashChain(AudioBlock *b, nframes_t len, 
+                                 unsigned char *digest, 
+                                 unsigned int digestlen) {
+  sha256_ctx ctx;
+  sha256_init(&ctx);
+
+  char stereo = b->IsStereo();
+  nframes_t hashlen = 0;
+  for (AudioBlock *cur = b; cur != 0 && hashlen < len; cur = cur->next) {
+    nframes_t num = MIN(cur->len,len-hashlen);
+    HashBlock(&ctx,cur,num,stereo);
+    hashlen += num;
+  }
+
+  HashDigest(&ctx,hashlen,digest,digestlen);
+};
+
 void StripeBlockManager::Setup() {
   // Does this block have BED_MarkerPoints?
   mp = (BED_MarkerPoints *)(b->GetExtendedData(T_BED_MarkerPoints));
@@ -1957,6 +2407,9 @@ BlockManager::BlockManager (Fweelin *app) :
   pre_peaksavgs = new PreallocatedType(app->getMMG(),
                                        ::new PeaksAvgsManager(),
                                        sizeof(PeaksAvgsManager));
+  pre_hash = new PreallocatedType(app->getMMG(),
+                                  ::new BlockHashManager(),
+                                  sizeof(BlockHashManager));
   pre_hipri = new PreallocatedType(app->getMMG(),
                                    ::new HiPriManagedChain(),
                                    sizeof(HiPriManagedChain));
@@ -2002,6 +2455,7 @@ BlockManager::~BlockManager () {
 
   delete pre_growchain;
   delete pre_peaksavgs;
+  delete pre_hash;
   delete pre_hipri;
   delete pre_stripeblock;
 }
@@ -2048,6 +2502,24 @@ void BlockManager::PeakAvgOff (AudioBlock *b) {
   DelManager(&manageblocks,b,T_MC_PeaksAvgs);
 }
 
+BlockHashManager *BlockManager::HashOn (AudioBlock *b, 
+                                        AudioBlockIterator *i) {
+  // Check if the block is already being hashed
+  DelManager(&manageblocks,b,T_MC_Hash);
+  // Tell the manage thread to hash blocks as they are recorded
+  BlockHashManager *nw = (BlockHashManager *) pre_hash->RTNewWithWait();
+  nw->b = b;
+  nw->i = i;
+  nw->Setup();
+  AddManager(&manageblocks,nw);
+
+  return nw;
+}
+
+void BlockManager::HashOff (AudioBlock *b) {
+  DelManager(&manageblocks,b,T_MC_Hash);
+}
+
 void BlockManager::StripeBlockOn (void *trigger, AudioBlock *b, 
                                   AudioBlockIterator *i) {
   // Check if the block is already being watched
@@ -2157,47 +2629,36 @@ ManagedChain *BlockManager::GetBlockManager(AudioBlock *o,
 void BlockManager::AddManager (ManagedChain **first, ManagedChain *nw) {
   nw->status = T_MC_Running;
 
-  // Possibility of priority inversion if AddManager is run in RT,
-  // because non-RT manage thread also locks here. So far, AddManager shouldn't
-  // be run in RT
-  if (pthread_mutex_trylock (&manage_thread_lock) == 0) {
-    ManagedChain *cur = *first;
-    if (cur == 0)
-      *first = nw; // That was easy, now we have 1 item
-    else {
-      while (cur->next != 0)
-        cur = cur->next;
-      cur->next = nw; // Link up the last item to new1
-    }
-    
-    pthread_mutex_unlock (&manage_thread_lock);
+  // Never run in RT (managers come from RTNewWithWait)- so wait for the
+  // manage thread, which only holds the lock to unlink a chain
+  pthread_mutex_lock (&manage_thread_lock);
+  ManagedChain *cur = *first;
+  if (cur == 0)
+    *first = nw; // That was easy, now we have 1 item
+  else {
+    while (cur->next != 0)
+      cur = cur->next;
+    cur->next = nw; // Link up the last item to new1
   }
-  else
-    // Priority inversion
-    printf("BLOCK: WARNING: Priority inversion during AddManager\n");
+  pthread_mutex_unlock (&manage_thread_lock);
 }
 
 void BlockManager::AddHiManager (HiPriManagedChain **first, 
                                  HiPriManagedChain *nw) {
   nw->status = T_MC_Running;
 
-  // Possibility of priority inversion if AddHiManager is run in RT,
-  // because non-RT manage thread also locks here. 
-  // So far, AddHiManager shouldn't be run in RT
-  if (pthread_mutex_trylock (&manage_thread_lock) == 0) {
-    HiPriManagedChain *cur = *first;
-    if (cur == 0)
-      *first = nw; // That was easy, now we have 1 item
-    else {
-      while (cur->next != 0)
-        cur = (HiPriManagedChain *) cur->next;
-      cur->next = nw; // Link up the last item to new1
-    }
-    
-    pthread_mutex_unlock (&manage_thread_lock);
-  } else
-    // Priority inversion
-    printf("BLOCK: WARNING: Priority inversion during AddHiManager\n");
+  // Never run in RT (managers come from RTNewWithWait)- so wait for the
+  // manage thread, which only holds the lock to unlink a chain
+  pthread_mutex_lock (&manage_thread_lock);
+  HiPriManagedChain *cur = *first;
+  if (cur == 0)
+    *first = nw; // That was easy, now we have 1 item
+  else {
+    while (cur->next != 0)
+      cur = (HiPriManagedChain *) cur->next;
+    cur->next = nw; // Link up the last item to new1
+  }
+  pthread_mutex_unlock (&manage_thread_lock);
 }
 
 // Delete a managed chain for block o and manager type t
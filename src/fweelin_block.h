@@ -22,6 +22,8 @@
 #include <vorbis/vorbisfile.h>
 #include <vorbis/vorbisenc.h>
 
+#include <nettle/sha2.h>
+
 #ifdef __MACOSX__
 #include <Sndfile/sndfile.h>
 #else
@@ -103,6 +105,52 @@ class BED_PeaksAvgs : public BlockExtendedData {
   nframes_t chunksize; 
 };
 
+// PeaksAvgsFile stores the peaks & averages of a saved loop in a small
+// binary file next to the loop, so that they can be read back when the
+// loop is loaded instead of being computed again from the audio. The file
+// is keyed by the loop hash and the chunk size- if either doesn't match,
+// the file is ignored. Samples are stored in native format.
+class PeaksAvgsFile {
+ public:
+  const static int MAX_HASH_LENGTH = 32;
+
+  // Writes peaks & averages pa for the loop with given hash.
+  // Returns nonzero on error
+  static int Write(const char *filename, unsigned char *hash, int hashlen,
+                   BED_PeaksAvgs *pa);
+
+  // Reads peaks & averages for the loop with given hash, computed over
+  // chunksize. Blocks are allocated through proto. Returns a new
+  // BED_PeaksAvgs, or zero if the file is missing or doesn't match
+  static BED_PeaksAvgs *Read(const char *filename, unsigned char *hash,
+                             int hashlen, nframes_t chunksize,
+                             AudioBlock *proto);
+
+  // Returns nonzero if the file exists and matches hash & chunksize
+  static char Matches(const char *filename, unsigned char *hash, int hashlen,
+                      nframes_t chunksize);
+
+ private:
+  // Header at the start of each file
+  class Header {
+  public:
+    char magic[8];
+    unsigned int version,
+      chunksize,
+      count,       // Number of peaks (and averages) that follow
+      hashlen;
+    unsigned char hash[MAX_HASH_LENGTH];
+  };
+
+  const static unsigned int FORMAT_VERSION = 1;
+
+  static char HeaderMatches(Header *hdr, unsigned char *hash, int hashlen,
+                            nframes_t chunksize);
+  // Makes a chain of len samples from proto, filled from src
+  static AudioBlock *MakeChain(AudioBlock *proto, sample_t *src,
+                               nframes_t len);
+};
+
 class TimeMarker : public Preallocated {
  public:
   TimeMarker(nframes_t markofs = 0, long data = 0) : markofs(markofs), 
@@ -373,7 +421,8 @@ enum ManagedChainType {
   T_MC_BlockRead,
   T_MC_BlockWrite,
   T_MC_HiPri,
-  T_MC_StripeBlock
+  T_MC_StripeBlock,
+  T_MC_Hash
 };
 
 // Status of managed chain
@@ -440,7 +489,9 @@ class GrowChainManager : public ManagedChain {
 // Base class for different types of file encoders
 class iFileEncoder {
  public:
-  iFileEncoder (Fweelin *app, char stereo);
+  // Encodes mono or stereo audio- or, if channels is given, that many
+  // channels (for multichannel streams)
+  iFileEncoder (Fweelin *app, char stereo, int channels = 0);
   virtual ~iFileEncoder() {};
 
   // Tell the encoder to dump to this file we have just opened
@@ -462,11 +513,13 @@ class iFileEncoder {
   virtual void Preprocess (sample_t *l, sample_t *r, nframes_t len) = 0;
 
   inline char IsStereo() { return stereo; };
+  inline int GetNumChannels() { return channels; };
 
  protected:
 
   Fweelin *app;
   char stereo;
+  int channels;
   FILE *outfd;
 };
 
@@ -477,7 +530,10 @@ class SndFileEncoder : public iFileEncoder {
   // WriteSamplesToDisk
   // Codec type is one of those values.
   // We also specify wether we are using Mono or Stereo Encoding
-  SndFileEncoder (Fweelin *app, nframes_t maxframes, char stereo, codec type);
+  // If a number of channels is given, WAV is written as RF64, since 
+  // multichannel streams can grow past the 4 GB limit of WAV
+  SndFileEncoder (Fweelin *app, nframes_t maxframes, char stereo, codec type,
+                  int channels = 0);
   ~SndFileEncoder() {
     if (tbuf != 0)
       delete[] tbuf;
@@ -501,8 +557,8 @@ class VorbisEncoder : public iFileEncoder {
  public:
 
   // Vorbis encoder library init/end are done in constructor/destructor
-  // We specify stereo or mono encoding
-  VorbisEncoder (Fweelin *app, char stereo);
+  // We specify stereo or mono encoding, or a number of channels
+  VorbisEncoder (Fweelin *app, char stereo, int channels = 0);
   virtual ~VorbisEncoder();
 
   int SetupFileForWriting (FILE *file);
@@ -518,7 +574,7 @@ class VorbisEncoder : public iFileEncoder {
  private:
 
   // Returns vorbis encoder's analysis buffers for len frames
-  // Depending on mono/stereo it is an array of 1/2 by len samples
+  // It is an array of channels by len samples
   float **GetAnalysisBuffer(nframes_t len) { return vorbis_analysis_buffer(&vd,len); };
 
   // Tell vorbis we wrote some samples to its analysis buffer
@@ -631,8 +687,16 @@ class AutoWriteControl {
   // to get the next block chain to write. This allows the main app to 
   // decide which loops to save, while the BlockManager thread does the work
   // in the background
+  //
+  // 'job' is set to anything that identifies this chain- it is passed back
+  // in WriteComplete. Several BlockWriteManagers (BlockWritePool) may call
+  // at once, from their own threads.
   virtual void GetWriteBlock(FILE **out, AudioBlock **b, 
-                             AudioBlockIterator **i, nframes_t *len) = 0;
+                             AudioBlockIterator **i, nframes_t *len,
+                             void **job) = 0;
+  // When a chain is written (or writing is aborted), BlockWriteManager
+  // calls WriteComplete
+  virtual void WriteComplete(void *job) = 0;
 };
 
 class AutoReadControl {
@@ -647,10 +711,22 @@ class AutoReadControl {
   // This is the new way to deal with begin-end inconsistencies when loading
   // OGG loops. To accomodate loops saved without the extra data at the end,
   // we can set 'smooth_end' to zero.
-  virtual void GetReadBlock(FILE **in, char *smooth_end) = 0;
+  //
+  // 'type' is set to the codec of the file, and 'job' to anything that
+  // identifies this chain- it is passed back in ReadComplete. Several
+  // BlockReadManagers (BlockReadPool) may call at once, from their own
+  // threads.
+  virtual void GetReadBlock(FILE **in, char *smooth_end, codec *type,
+                            void **job) = 0;
   // When the audio data read is complete, BlockReadManager calls ReadComplete
-  // which tells you that you have a new loop in memory
-  virtual void ReadComplete(AudioBlock *b) = 0;
+  // which tells you that you have a new loop in memory (b is zero on error)
+  virtual void ReadComplete(AudioBlock *b, void *job) = 0;
+  // As reading begins, BlockReadManager asks for peaks & averages over
+  // 'chunksize' that are already known for this chain (allocating blocks
+  // through 'proto'). If zero is returned, they are computed as the chain
+  // is read.
+  virtual BED_PeaksAvgs *GetPeaksAvgs(void */*job*/, AudioBlock */*proto*/,
+                                      nframes_t /*chunksize*/) { return 0; };
 };
 
 // BlockReadManager reads & uncompresses an audio block chain
@@ -699,6 +775,7 @@ class BlockReadManager : public ManagedChain {
   FILE *in;                 // File to read from
   char smooth_end;          // Smooth end of loop into beginning?
   AutoReadControl *arc;     // A way to ask app what blocks to read
+  void *job;                // Chain being read, as given by arc
   iFileDecoder *dec;        // Decoder
   BlockManager *bmg; 
   codec filetype;
@@ -709,6 +786,52 @@ class BlockReadManager : public ManagedChain {
   pthread_mutex_t decode_lock;
 };
 
+// BlockReadPool decodes several block chains at once- one BlockReadManager
+// on each decoder thread, all asking the same AutoReadControl for chains.
+// Chains complete (ReadComplete) in any order.
+// Decoders fill blocks faster than the memory manager preallocates them, so
+// a decoder only starts on a new chain while enough preallocated blocks are
+// free for all decoders running.
+class BlockReadPool {
+ public:
+  // Maximum number of decoder threads
+  const static int MAX_DECODERS = 8;
+  // Free preallocated blocks needed for each running decoder
+  const static int BLOCKS_PER_DECODER = 4;
+
+  // Starts numdecoders threads, or one per CPU core if numdecoders is 0-
+  // but never more than maxthreads
+  BlockReadPool(AutoReadControl *arc, BlockManager *bmg, 
+                nframes_t peaksavgs_chunksize, int numdecoders = 0,
+                int maxthreads = MAX_DECODERS);
+  ~BlockReadPool();
+
+  // Stops all decoder threads- chains being read are ended where they are
+  void End();
+
+  inline int GetNumDecoders() { return numdecoders; };
+
+ private:
+
+  class DecodeThread {
+  public:
+    BlockReadPool *pool;
+    BlockReadManager *mgr;
+    pthread_t thread;
+  };
+
+  static void *run_decode_thread (void *ptr);
+
+  // Returns nonzero if there are enough free blocks to start decoding
+  // another chain
+  char CanStartDecode();
+
+  BlockManager *bmg;
+  DecodeThread decoders[MAX_DECODERS];
+  int numdecoders;
+  volatile char threadgo;
+};
+
 // BlockWriteManager compresses and writes a block chain (OGG vorbis format)
 // this implementation is used for saving loops,
 // unlike the BlockStreamer implementation in core_dsp, which streams
@@ -774,12 +897,57 @@ class BlockWriteManager : public ManagedChain {
   nframes_t len,          // Length of block to save
     pos;                  // Current save position
   AutoWriteControl *awc;  // A way to ask app what blocks to write
+  void *job;              // Chain being written, as given by awc
   iFileEncoder *enc;
   BlockManager *bmg; 
 
   pthread_mutex_t encode_lock;
 };
 
+// BlockWritePool encodes several block chains at once- one BlockWriteManager
+// on each encoder thread, all asking the same AutoWriteControl for chains.
+// Encoder threads run below the block managing thread, and their combined
+// throughput can be capped so that saving does not compete with recording.
+class BlockWritePool {
+ public:
+  // Maximum number of encoder threads
+  const static int MAX_ENCODERS = 8;
+
+  // Starts numencoders threads, or one per CPU core but one if numencoders
+  // is 0- but never more than maxthreads. maxrate caps the frames encoded 
+  // per second by all encoders together (0 for no limit).
+  BlockWritePool(AutoWriteControl *awc, BlockManager *bmg, 
+                 int numencoders = 0, double maxrate = 0.0,
+                 int maxthreads = MAX_ENCODERS);
+  ~BlockWritePool();
+
+  // Stops all encoder threads- chains being written are closed where
+  // they are
+  void End();
+
+  // Notify all encoders that the object pointed to has been deleted- 
+  // an encoder working on that chain stops
+  void RefDeleted(void *ref);
+
+  inline int GetNumEncoders() { return numencoders; };
+
+ private:
+
+  class EncodeThread {
+  public:
+    BlockWritePool *pool;
+    BlockWriteManager *mgr;
+    pthread_t thread;
+  };
+
+  static void *run_encode_thread (void *ptr);
+
+  EncodeThread encoders[MAX_ENCODERS];
+  int numencoders;
+  double threadrate;     // Max frames/s encoded by each thread
+  volatile char threadgo;
+};
+
 // PeaksAvgsManager periodically calculates peaks and averages for
 // blockchain b, keeping up with iterator i
 // using BlockExtendedData to store peaks & averages 
@@ -846,6 +1014,66 @@ class PeaksAvgsManager : public ManagedChain {
     ended;        // Nonzero if we have ended for good
 };
 
+// BlockHashManager hashes block chain b as iterator i records into it-
+// each block is hashed once i has moved past it, so that when recording
+// ends, only the last block is left to hash. Blocks must not change once
+// recorded- a chain that will be smoothed can't be hashed this way
+class BlockHashManager : public ManagedChain {
+ public:
+  BlockHashManager(AudioBlock *b = 0, AudioBlockIterator *i = 0) :
+    ManagedChain(b,i), curblk(0), stereo(0), finished(0) {
+    pthread_mutex_init(&hash_lock,0);
+  };
+  virtual ~BlockHashManager() { pthread_mutex_destroy(&hash_lock); };
+
+  virtual Preallocated *NewInstance() { return ::new BlockHashManager(); };
+
+  virtual int RefDeleted(void *ref) { 
+    if (ref == b || ref == i) {
+      // Block or iterator gone!! End this manager!
+      pthread_mutex_lock(&hash_lock);
+      finished = 1;
+      pthread_mutex_unlock(&hash_lock);
+      return 1;
+    }
+    else
+      return 0;
+  };
+
+  // Call before starting!
+  void Setup();
+
+  // Hashes the rest of the chain (which must have stopped growing)
+  // and writes a digest of 'digestlen' bytes- returns nonzero if no
+  // hash could be made
+  int Finish(unsigned char *digest, unsigned int digestlen);
+
+  // Hashes the first 'len' frames of chain b in one pass- the same hash
+  // that a BlockHashManager makes, for chains that were not hashed as
+  // they were recorded
+  static void HashChain(AudioBlock *b, nframes_t len, 
+                        unsigned char *digest, unsigned int digestlen);
+
+  virtual ManagedChainType GetType() { return T_MC_Hash; };
+
+  virtual int Manage();
+
+ private:
+
+  static void HashBlock(sha256_ctx *ctx, AudioBlock *blk, nframes_t len,
+                        char stereo);
+  static void HashDigest(sha256_ctx *ctx, nframes_t totallen, 
+                         unsigned char *digest, unsigned int digestlen);
+
+  sha256_ctx ctx;
+  AudioBlock *curblk; // Next block to hash
+  nframes_t hashlen;  // Frames hashed so far
+  char stereo,
+    finished;         // Nonzero once hash is finished or chain is gone
+
+  pthread_mutex_t hash_lock;
+};
+
 // Base class for hipriority managed blocks--
 // When a block becomes HiPriManaged it specifies a trigger pointer
 // A realtime process can then call BlockManager with a trigger pointer
@@ -940,6 +1168,11 @@ public:
                                char grow = 0);
   void PeakAvgOff (AudioBlock *b);
 
+  // Turns on hashing of the specified Block as the Iterator records
+  // into it (see BlockHashManager)
+  BlockHashManager *HashOn (AudioBlock *b, AudioBlockIterator *i);
+  void HashOff (AudioBlock *b);
+
   // Stripes the specified chain with TimeMarkers according to the specified
   // trigger. Works in conjunction with RT threads that call HiPriTrigger.
   void StripeBlockOn (void *trigger, AudioBlock *b, 
@@ -1001,6 +1234,7 @@ public:
   // ****************** PREALLOCATED TYPE MANAGERS
   PreallocatedType *pre_growchain,
     *pre_peaksavgs,
+    *pre_hash,
     *pre_hipri,
     *pre_stripeblock;
 
@@ -117,7 +117,11 @@ char ItemRenamer::HookEvent(Event *ev, EventProducer */*from*/) {
 // Nonzero if we should sort (according to the BrowserItem::Compare() method)
 void Browser::AddItem(BrowserItem *nw, char sort) {
   LockBrowser();
-  
+  InsertItem(nw,sort);
+  UnlockBrowser();
+};
+
+void Browser::InsertItem(BrowserItem *nw, char sort) {
   if (first == 0) {
     first = nw;
     cur = first;
@@ -148,7 +152,41 @@ void Browser::AddItem(BrowserItem *nw, char sort) {
       cur->next = nw;
     }
   }
-  
+};
+
+void Browser::AddItems(BrowserItem **items, int n, int maxdelta) {
+  LockBrowser();
+
+  // Find end of list
+  BrowserItem *tail = first;
+  while (tail != 0 && tail->next != 0)
+    tail = tail->next;
+  BrowserItem *start = tail;
+
+  for (int i = 0; i < n; i++) {
+    BrowserItem *nw = items[i];
+    if (tail != 0 && nw->Compare(tail) >= 0) {
+      // Goes at end
+      nw->next = 0;
+      nw->prev = tail;
+      tail->next = nw;
+      tail = nw;
+    } else {
+      // Out of order- sort it in, and divide the whole list
+      InsertItem(nw,1);
+      start = first;
+      tail = nw;
+      while (tail->next != 0)
+        tail = tail->next;
+    }
+  }
+
+  // Divide the new part of the list
+  InsertDivisions(start != 0 ? start : first,maxdelta);
+
+  if (cur == 0)
+    cur = first;
+
   UnlockBrowser();
 };
 
@@ -377,8 +415,14 @@ void Browser::Setup(Fweelin *a, BrowserCallback *c) {
 // We also put divisions around any items that have been given a unique
 // name
 void Browser::AddDivisions(int maxdelta) {
-  if (first != 0) {
-    BrowserItem *cur = first;
+  LockBrowser();
+  InsertDivisions(first,maxdelta);
+  UnlockBrowser();
+};
+
+void Browser::InsertDivisions(BrowserItem *start, int maxdelta) {
+  if (start != 0) {
+    BrowserItem *cur = start;
     char go = 1;
     do {
       while (cur->next != 0 && cur->next->Compare(cur) < maxdelta &&
@@ -268,6 +268,11 @@ class Browser : public FloDisplay, public EventListener, public EventProducer,
   // (Doubley linked list add with sort)
   // Nonzero if we should sort (according to the BrowserItem::Compare() method)
   virtual void AddItem(BrowserItem *nw, char sort = 0);
+
+  // Add a batch of n items, sorted and divided as above. Items should be
+  // in browser order (and follow any earlier batch)- then they are added
+  // at the end, and only the new part of the list is checked for divisions.
+  void AddItems(BrowserItem **items, int n, int maxdelta);
   
   // Remove an item from this browser
   // For each item we call the MatchItem(itemmatch) method in BrowserItem 
@@ -303,6 +308,10 @@ class Browser : public FloDisplay, public EventListener, public EventProducer,
   // derived classes may override
   virtual void ItemBrowsed() {};
 
+  // Sorted add/divisions, with browser already locked
+  void InsertItem(BrowserItem *nw, char sort);
+  void InsertDivisions(BrowserItem *start, int maxdelta);
+
   Fweelin *app; 
   
   BrowserItemType btype;     // Browser type
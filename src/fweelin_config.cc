@@ -32,6 +32,7 @@
 
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include <stdio.h>
 
@@ -67,6 +68,13 @@ char *FWEELIN_DATADIR = FWEELIN_datadir;
 const char CfgMathOperation::operators[] = {'/', '*', '+', '-'};
 const int CfgMathOperation::numops = 4;
 
+// Monotonic time in nanoseconds, for the binding profile
+static inline long GetProfileTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (long) ts.tv_sec * 1000000000L + ts.tv_nsec;
+};
+
 const int FloConfig::NUM_PREALLOCATED_AUDIO_BLOCKS = 40;
 const int FloConfig::NUM_PREALLOCATED_TIME_MARKERS = 40;
 const float FloConfig::AUDIO_MEMORY_LEN = 10.0;
@@ -344,40 +352,379 @@ void ParsedExpression::Print() {
   }
 };
 
+// Apply math operator otype to cur with operand
+void ParsedExpression::ApplyOp(UserVariable &cur, char otype, 
+                               UserVariable &operand) {
+  switch (otype) {
+  case '/' :
+    cur /= operand;
+    break;
+  case '*' :
+    cur *= operand;
+    break;
+  case '+' :
+    cur += operand;
+    break;
+  case '-' :
+    cur -= operand;
+    break;
+  default :
+    printf("Evaluate Expression: Invalid math operand\n");
+  }
+};
+
 // Evaluate this expression
 UserVariable ParsedExpression::Evaluate(Event *input) {
-  // Starting token..
   UserVariable cur;
-  start.Evaluate(&cur,input,1); // Setup cur with evaluation of start token
 
-  // Move through the math..
+  // Run compiled instructions, if we have them
+  long acc;
+  float facc;
+  CoreDataType atype;
+  if (proglen > 0 && Run(input,acc,facc,atype)) {
+    cur.type = atype;
+    switch (atype) {
+    case T_char : cur = (char) acc; break;
+    case T_int : cur = (int) acc; break;
+    case T_long : cur = acc; break;
+    default : cur = facc; break;
+    }
+  } else {
+    // Otherwise, interpret tokens- starting token..
+    start.Evaluate(&cur,input,1); // Setup cur with evaluation of start token
+    
+    // Move through the math..
+    CfgMathOperation *cop = ops;
+    while (cop != 0) {
+      // Evaluate the operand
+      UserVariable tmp;
+      cop->operand.Evaluate(&tmp,input,1);
+      ApplyOp(cur,cop->otype,tmp);
+      
+      cop = cop->next;
+    }
+  }
+
+  return cur;
+};
+
+// Setup instruction operand as the constant val- returns zero if val
+// is not a scalar
+static char SetConstOperand(ExpressionInstr *in, UserVariable &val) {
+  in->src = ExpressionInstr::EI_CONST;
+  in->stype = val.type;
+  switch (val.type) {
+  case T_char :
+  case T_int :
+  case T_long :
+    in->lval = (long) val;
+    return 1;
+  case T_float :
+    in->fval = (float) val;
+    return 1;
+  default :
+    return 0;
+  }
+};
+
+// Setup instruction operand from token tok- returns zero if tok can't be
+// compiled
+static char SetOperand(ExpressionInstr *in, CfgToken *tok) {
+  switch (tok->cvt) {
+  case T_CFG_Static :
+    return SetConstOperand(in,tok->val);
+  case T_CFG_EventParameter :
+    in->src = ExpressionInstr::EI_PARAM;
+    in->stype = tok->evparam.dtype;
+    in->ofs = tok->evparam.ofs;
+    break;
+  case T_CFG_UserVariable :
+    in->src = ExpressionInstr::EI_VAR;
+    in->stype = tok->var->type;
+    in->var = tok->var;
+    break;
+  default :
+    return 0;
+  }
+
+  return (in->stype == T_char || in->stype == T_int || in->stype == T_long ||
+          in->stype == T_float);
+};
+
+void ParsedExpression::Compile() {
+  if (prog != 0)
+    delete[] prog;
+  prog = 0;
+  proglen = -1;
+
+  int numops = 0;
+  for (CfgMathOperation *cop = ops; cop != 0; cop = cop->next)
+    numops++;
+  ExpressionInstr *nw = new ExpressionInstr[numops+1];
+  int n = 0;
+
+  // Fold static tokens at the start of the expression into one constant
   CfgMathOperation *cop = ops;
-  while (cop != 0) {
-    // Evaluate the operand
-    UserVariable tmp;
-    cop->operand.Evaluate(&tmp,input,1);
+  char ok;
+  if (start.cvt == T_CFG_Static) {
+    UserVariable cur;
+    start.Evaluate(&cur,0,1);
+    while (cop != 0 && cop->operand.cvt == T_CFG_Static) {
+      UserVariable tmp;
+      cop->operand.Evaluate(&tmp,0,1);
+      ApplyOp(cur,cop->otype,tmp);
+      cop = cop->next;
+    }
+    ok = SetConstOperand(nw,cur);
+  } else
+    ok = SetOperand(nw,&start);
+  nw[0].op = ExpressionInstr::EI_LOAD;
+  nw[0].atype = nw[0].stype;
+  n = 1;
+
+  for (; ok && cop != 0; cop = cop->next) {
+    ExpressionInstr in;
+    CoreDataType acc = nw[n-1].atype;
+    ok = SetOperand(&in,&cop->operand);
+    if (!ok)
+      break;
 
     switch (cop->otype) {
-    case '/' :
-      cur /= tmp;
+    case '+' : in.op = ExpressionInstr::EI_ADD; break;
+    case '-' : in.op = ExpressionInstr::EI_SUB; break;
+    case '*' : in.op = ExpressionInstr::EI_MUL; break;
+    case '/' : in.op = ExpressionInstr::EI_DIV; break;
+    default : ok = 0; break;
+    }
+    if (!ok)
       break;
-    case '*' :
-      cur *= tmp;
+
+    if (in.op == ExpressionInstr::EI_DIV) {
+      // Scalar division always gives a float- except division by zero,
+      // which leaves the accumulator (and its type) alone. So we can only 
+      // know the type here if it is float already, or the divisor is a 
+      // nonzero constant
+      float divisor = (in.stype == T_float ? in.fval : (float) in.lval);
+      if (acc != T_float && 
+          (in.src != ExpressionInstr::EI_CONST || divisor == 0)) {
+        ok = 0;
+        break;
+      }
+      in.atype = T_float;
+    } else
+      // Precision is raised to that of the operand
+      in.atype = (in.stype > acc ? in.stype : acc);
+
+    // Integer constants that don't change the accumulator type are folded
+    // with the constant before them: a+1+2 is a+3 and a*2*3 is a*6
+    if (in.src == ExpressionInstr::EI_CONST && in.atype != T_float &&
+        in.atype == acc) {
+      if (in.op == ExpressionInstr::EI_SUB) {
+        in.op = ExpressionInstr::EI_ADD;
+        in.lval = -in.lval;
+      }
+
+      ExpressionInstr *prev = &nw[n-1];
+      if (n > 1 && prev->src == ExpressionInstr::EI_CONST && 
+          prev->op == in.op) {
+        if (in.op == ExpressionInstr::EI_ADD) {
+          prev->lval += in.lval;
+          continue;
+        } else if (in.op == ExpressionInstr::EI_MUL) {
+          prev->lval *= in.lval;
+          continue;
+        }
+      }
+    }
+
+    nw[n++] = in;
+  }
+
+  if (ok) {
+    prog = nw;
+    proglen = n;
+  } else
+    delete[] nw;
+};
+
+// Run compiled instructions, storing the result in acc (for integer
+// types) or facc (for float) and its type in atype.
+// Returns zero if the instructions can't be run for this input.
+char ParsedExpression::Run(Event *input, long &acc, float &facc, 
+                           CoreDataType &atype) {
+  acc = 0;
+  facc = 0.0;
+
+  ExpressionInstr *in = prog;
+  for (int i = 0; i < proglen; i++, in++) {
+    // Fetch operand
+    long opl = 0;
+    float opf = 0.0;
+    char *ptr;
+    switch (in->src) {
+    case ExpressionInstr::EI_CONST :
+      opl = in->lval;
+      opf = in->fval;
+      ptr = 0;
       break;
-    case '+' :
-      cur += tmp;
+    case ExpressionInstr::EI_PARAM :
+      if (input == 0)
+        return 0;
+      ptr = (char *) input + in->ofs;
       break;
-    case '-' :
-      cur -= tmp;
+    default : 
+      if (in->var->type != in->stype)
+        return 0; // Variable type changed since we compiled
+      ptr = in->var->value;
       break;
-    default :
-      printf("Evaluate Expression: Invalid math operand\n");
     }
-    
-    cop = cop->next;
+
+    if (ptr != 0) 
+      switch (in->stype) {
+      case T_char : opl = *((char *) ptr); break;
+      case T_int : opl = *((int *) ptr); break;
+      case T_long : opl = *((long *) ptr); break;
+      default : opf = *((float *) ptr); break;
+      }
+
+    if (in->atype == T_float) {
+      if (in->stype != T_float)
+        opf = (float) opl;
+      if (i > 0 && in[-1].atype != T_float)
+        facc = (float) acc; // Raise to float
+
+      switch (in->op) {
+      case ExpressionInstr::EI_LOAD : facc = opf; break;
+      case ExpressionInstr::EI_ADD : facc += opf; break;
+      case ExpressionInstr::EI_SUB : facc -= opf; break;
+      case ExpressionInstr::EI_MUL : facc *= opf; break;
+      default : 
+        if (opf != 0) 
+          facc /= opf;
+        break;
+      }
+    } else {
+      switch (in->op) {
+      case ExpressionInstr::EI_LOAD : acc = opl; break;
+      case ExpressionInstr::EI_ADD : acc += opl; break;
+      case ExpressionInstr::EI_SUB : acc -= opl; break;
+      default : acc *= opl; break;
+      }
+
+      // Wrap to accumulator type
+      if (in->atype == T_char)
+        acc = (char) acc;
+      else if (in->atype == T_int)
+        acc = (int) acc;
+    }
   }
 
-  return cur;
+  atype = prog[proglen-1].atype;
+  return 1;
+};
+
+// Build an expression for Benchmark() from a short description-
+// 'v' is an int user variable, 'f' a float user variable, 'p' an input event
+// parameter and numbers are int constants, separated by math operators
+static void BenchBuildExpression(ParsedExpression *exp, const char *desc,
+                                 UserVariable *ivar, UserVariable *fvar,
+                                 EventParameter param) {
+  CfgToken *tok = &exp->start;
+  CfgMathOperation *last = 0;
+  for (const char *c = desc; *c != '\0'; c++) {
+    char isop = 0;
+    for (int i = 0; i < CfgMathOperation::numops; i++)
+      if (*c == CfgMathOperation::operators[i])
+        isop = 1;
+
+    if (isop) {
+      CfgMathOperation *nw = new CfgMathOperation();
+      nw->otype = *c;
+      if (last == 0)
+        exp->ops = nw;
+      else
+        last->next = nw;
+      last = nw;
+      tok = &nw->operand;
+    } else if (*c == 'v') {
+      tok->cvt = T_CFG_UserVariable;
+      tok->var = ivar;
+    } else if (*c == 'f') {
+      tok->cvt = T_CFG_UserVariable;
+      tok->var = fvar;
+    } else if (*c == 'p') {
+      tok->cvt = T_CFG_EventParameter;
+      tok->evparam = param;
+    } else {
+      tok->cvt = T_CFG_Static;
+      tok->val.type = T_int;
+      tok->val = (int) strtol(c,(char **) &c,10);
+      c--;
+    }
+  }
+};
+
+void ParsedExpression::Benchmark() {
+  const static char *descs[] = { "v*8+p+12", "p/127*f", "v-3-p*2+1+2",
+                                 "f*v/p-2", "p+v*f/4" };
+  const int numdescs = sizeof(descs)/sizeof(char *),
+    numchecks = 100000,
+    numruns = 2000000;
+
+  UserVariable ivar, fvar;
+  ivar.type = T_int;
+  fvar.type = T_float;
+  ivar = 0;
+  fvar = (float) 0.0;
+  MIDIControllerInputEvent ev;
+  EventParameter param = ev.GetParam(3); // controlval
+
+  printf("BENCH: Interpreted against compiled expressions, %d runs each\n",
+         numruns);
+  for (int i = 0; i < numdescs; i++) {
+    ParsedExpression interp, comp;
+    BenchBuildExpression(&interp,descs[i],&ivar,&fvar,param);
+    BenchBuildExpression(&comp,descs[i],&ivar,&fvar,param);
+    comp.Compile();
+
+    // Check both forms agree over random inputs
+    int mismatches = 0;
+    for (int j = 0; j < numchecks; j++) {
+      ivar = (int) (rand() % 2001 - 1000);
+      fvar = (float) rand()/RAND_MAX * 200 - 100;
+      ev.val = rand() % 128;
+
+      UserVariable a = interp.Evaluate(&ev),
+        b = comp.Evaluate(&ev);
+      if (a.type != b.type || (float) a != (float) b) {
+        if (mismatches == 0)
+          printf("BENCH: '%s' mismatch: v=%d f=%f p=%d gives %f/%f\n",
+                 descs[i],(int) ivar,(float) fvar,ev.val,(float) a,
+                 (float) b);
+        mismatches++;
+      }
+    }
+
+    // Time both forms
+    volatile float sink = 0;
+    double t1 = mygettime();
+    for (int j = 0; j < numruns; j++) {
+      ev.val = j & 127;
+      sink = (float) interp.Evaluate(&ev);
+    }
+    double t2 = mygettime();
+    for (int j = 0; j < numruns; j++) {
+      ev.val = j & 127;
+      sink = comp.EvaluateAs<float>(&ev);
+    }
+    double t3 = mygettime();
+    (void) sink;
+
+    printf("BENCH: %-12s interpreted %6.1f ns, %s %6.1f ns, "
+           "%d mismatches\n",descs[i],(t2-t1)*1e9/numruns,
+           (comp.proglen > 0 ? "compiled" : "not compiled- fallback"),
+           (t3-t2)*1e9/numruns,mismatches);
+  }
 };
 
 EventBinding::~EventBinding() {
@@ -404,13 +751,34 @@ EventBinding::~EventBinding() {
       cur = tmp;
     }
   }
+
+  // Erase compiled conditions and setters
+  if (conds != 0)
+    delete[] conds;
+  if (setters != 0)
+    delete[] setters;
+};
+
+BindingDecisionTable::BindingDecisionTable(int chanofs) : chanofs(chanofs) {
+  for (int i = 0; i <= MAX_MIDI_CHANNELS; i++)
+    lists[i] = 0;
+};
+
+BindingDecisionTable::~BindingDecisionTable() {
+  for (int i = 0; i <= MAX_MIDI_CHANNELS; i++)
+    if (lists[i] != 0)
+      delete[] lists[i];
 };
 
 InputMatrix::InputMatrix(Fweelin *app) : vars(0), app(app) {
   // Setup input bindings array
   input_bind = new EventBinding **[T_EV_Last_Bindable];
-  for (int i = 0; i < T_EV_Last_Bindable; i++)
+  input_table = new BindingDecisionTable **[T_EV_Last_Bindable];
+  input_prof = new InputProfile[T_EV_Last_Bindable];
+  for (int i = 0; i < T_EV_Last_Bindable; i++) {
     input_bind[i] = 0;
+    input_table[i] = 0;
+  }
 };
 
 void InputMatrix::Start() {
@@ -423,12 +791,16 @@ void InputMatrix::Start() {
     exit(1);
   }
 
+  // All bindings are configured now- compile them before we listen
+  CompileBindings();
+
   app->getEMG()->ListenEvent(this,0,T_EV_SetVariable);
   app->getEMG()->ListenEvent(this,0,T_EV_ToggleVariable);
   app->getEMG()->ListenEvent(this,0,T_EV_SplitVariableMSBLSB);
   app->getEMG()->ListenEvent(this,0,T_EV_LogFaderVolToLinear);
   app->getEMG()->ListenEvent(this,0,T_EV_ShowDebugInfo);
   app->getEMG()->ListenEvent(this,0,T_EV_AdjustMidiTranspose);
+  app->getEMG()->ListenEvent(this,0,T_EV_ReportBindingProfile);
 
   // Input events
   int evnum = (int) EventType(T_EV_Last_Bindable);
@@ -454,6 +826,7 @@ InputMatrix::~InputMatrix() {
   app->getEMG()->UnlistenEvent(this,0,T_EV_LogFaderVolToLinear);
   app->getEMG()->UnlistenEvent(this,0,T_EV_ShowDebugInfo);
   app->getEMG()->UnlistenEvent(this,0,T_EV_AdjustMidiTranspose);
+  app->getEMG()->UnlistenEvent(this,0,T_EV_ReportBindingProfile);
 
   // Input events
   int evnum = (int) EventType(T_EV_Last_Bindable);
@@ -462,12 +835,25 @@ InputMatrix::~InputMatrix() {
     app->getEMG()->UnlistenEvent(this,0,(EventType) i);
     
     EventBinding **cur_hash = input_bind[i];
+    BindingDecisionTable **cur_table = input_table[i];
     if (cur_hash != 0) {
       // & Free data structures
       int pidx = Event::GetParamIdxByType((EventType) i);
-      if (pidx == -1)
-        delete cur_hash; // No hash array, just one
-      else {
+      if (pidx == -1) {
+        // No hash array, just one
+        cur = *cur_hash;
+        while (cur != 0) {
+          tmp = cur->next;
+          delete cur;
+          cur = tmp;
+        }
+
+        delete cur_hash;
+        if (cur_table != 0) {
+          delete *cur_table;
+          delete cur_table;
+        }
+      } else {
         Event *tmpev = Event::GetEventByType((EventType) i,1);
         int hashsz = tmpev->GetParam(pidx).max_index+1;
         tmpev->RTDelete();
@@ -479,14 +865,21 @@ InputMatrix::~InputMatrix() {
             delete cur;
             cur = tmp;
           }
+
+          if (cur_table != 0 && cur_table[j] != 0)
+            delete cur_table[j];
         };
 
         delete[] cur_hash;
+        if (cur_table != 0)
+          delete[] cur_table;
       }
     }
   }
 
   delete[] input_bind;
+  delete[] input_table;
+  delete[] input_prof;
 
   {
     UserVariable *cur = vars;
@@ -678,6 +1071,7 @@ void InputMatrix::CreateVariable (xmlNode *declare) {
   // Insert into variable list
   nw->next = vars;
   vars = nw;
+  varsyms.Set(nw->name,nw);
 
   printf(" declare: variable '%s' type '%s' value '%s'\n", nw->name, type, 
          value);
@@ -746,10 +1140,12 @@ void InputMatrix::CreateParameterSets (int interfaceid,
         
         // Check LValue against output parameters
         char found = 0;
-        for (int i = 0; !found && i < bind->boundproto->GetNumParams(); i++) {
-          EventParameter param = bind->boundproto->GetParam(i);
-          
-          if (!strcmp(lv,param.name)) {
+        {
+          // Look up parameter by name
+          int i = Event::GetParamIdxByName(bind->boundproto->GetType(),lv);
+          if (i != -1) {
+            EventParameter param = bind->boundproto->GetParam(i);
+            
             // Config specifies a param set for this parameter
             found = 1;
 
@@ -820,48 +1216,47 @@ void InputMatrix::CreateParameterSets (int interfaceid,
     // if so, set implicitly based on what interface this binding is
     // defined in
     
-    char found = 0;
-    for (int i = 0; !found && i < bind->boundproto->GetNumParams(); i++) {
+    // Look up parameter by name
+    int i = Event::GetParamIdxByName(bind->boundproto->GetType(),
+                                     INTERFACEID);
+    if (i != -1) {
       EventParameter param = bind->boundproto->GetParam(i);
-      if (!strcmp(param.name,INTERFACEID)) {
-        // Yup, set implicitly
-        found = 1;
+      // Yup, set implicitly
+      
+      char tmp[20];
+      snprintf(tmp,20,"%d",interfaceid); // Set from interface ID
+      ParsedExpression *exp = ParseExpression(tmp, input);
+
+      // OK, check if expression is static
+      if (exp->IsStatic()) {
+        // Yup, so evaluate now
+        UserVariable val = exp->Evaluate(input);
         
-        char tmp[20];
-        snprintf(tmp,20,"%d",interfaceid); // Set from interface ID
-        ParsedExpression *exp = ParseExpression(tmp, input);
-
-        // OK, check if expression is static
-        if (exp->IsStatic()) {
-          // Yup, so evaluate now
-          UserVariable val = exp->Evaluate(input);
-          
-          // Store directly in output prototype event
-          char *nwofs = 
-            (char *)bind->boundproto + param.ofs; // Data location
-          StoreParameter(nwofs,param.dtype,&val);
-          printf("         -implicitly set '%s' = ",param.name);
-          val.Print();
-          printf("\n");
+        // Store directly in output prototype event
+        char *nwofs = 
+          (char *)bind->boundproto + param.ofs; // Data location
+        StoreParameter(nwofs,param.dtype,&val);
+        printf("         -implicitly set '%s' = ",param.name);
+        val.Print();
+        printf("\n");
 
-          delete exp;
-        } else {
-          // Dynamic expression
+        delete exp;
+      } else {
+        // Dynamic expression
 
-          DynamicToken *nwset = new DynamicToken();
-          CfgToken token;
-          token.cvt = T_CFG_EventParameter;
-          token.evparam = param;
-          nwset->token = token;
-          nwset->exp = exp;
-          nwset->next = bind->paramsets;
-          bind->paramsets = nwset;
-          
-          printf("         -implicitly set '%s' = ",param.name);
-          exp->Print();
-          printf("\n");
-        }       
-      }
+        DynamicToken *nwset = new DynamicToken();
+        CfgToken token;
+        token.cvt = T_CFG_EventParameter;
+        token.evparam = param;
+        nwset->token = token;
+        nwset->exp = exp;
+        nwset->next = bind->paramsets;
+        bind->paramsets = nwset;
+        
+        printf("         -implicitly set '%s' = ",param.name);
+        exp->Print();
+        printf("\n");
+      }       
     }
   }
 };
@@ -924,86 +1319,81 @@ int InputMatrix::CreateConditions (int interfaceid,
         // Check LValue against input parameters
         char found = 0;
         if (input != 0) {
-          for (int i = 0; !found && i < input->GetNumParams(); i++) {
+          // Look up parameter by name
+          int i = Event::GetParamIdxByName(input->GetType(),lv);
+          if (i != -1) {
             EventParameter param = input->GetParam(i);
             
-            if (!strcmp(lv,param.name)) {
-              // Config specifies a condition for this parameter
-              found = 1;
-              
-              if (!strcmp(param.name,INTERFACEID)) 
-                // Condition is interface ID
-                interfaceset = 1;
+            // Config specifies a condition for this parameter
+            found = 1;
+            
+            if (!strcmp(param.name,INTERFACEID)) 
+              // Condition is interface ID
+              interfaceset = 1;
  
-              // Parse RValue expression that specifies condition.
-              char enable_keynames = (input->GetType() == T_EV_Input_Key &&
-                                      !strcmp(param.name,"key"));
-              ParsedExpression *exp = 
-                ParseExpression(rv, input, enable_keynames);
-
-              // Is this parameter indexed?
-              if (i == paramidx) {
-                // OK, is the RValue static (ie can we store the binding 
-                // in a hash or do we need to compute during runtime)?
-                if (exp->IsStatic()) {
-                  // Yup, so evaluate now
-                  UserVariable val = exp->Evaluate(input);
-
-                  // Return hash value
-                  ret_index = (int) val % param.max_index;
-                } else {
-                  // Indexed parameter, but value is not static-
-                  // Use wildcard slot in hash
-                  ret_index = param.max_index;
-                }
+            // Parse RValue expression that specifies condition.
+            char enable_keynames = (input->GetType() == T_EV_Input_Key &&
+                                    !strcmp(param.name,"key"));
+            ParsedExpression *exp = 
+              ParseExpression(rv, input, enable_keynames);
+
+            // Is this parameter indexed?
+            if (i == paramidx) {
+              // OK, is the RValue static (ie can we store the binding 
+              // in a hash or do we need to compute during runtime)?
+              if (exp->IsStatic()) {
+                // Yup, so evaluate now
+                UserVariable val = exp->Evaluate(input);
+
+                // Return hash value
+                ret_index = (int) val % param.max_index;
+              } else {
+                // Indexed parameter, but value is not static-
+                // Use wildcard slot in hash
+                ret_index = param.max_index;
               }
-        
-              // Create DynamicToken to hold condition
-              DynamicToken *nwcond = new DynamicToken();
-              CfgToken token;
-              token.cvt = T_CFG_EventParameter;
-              token.evparam = param;
-              nwcond->token = token;
-              nwcond->exp = exp;
-              nwcond->next = bind->tokenconds;
-              bind->tokenconds = nwcond;
-        
-              printf("         -condition '%s' == ",param.name);
-              exp->Print();
-              if (enable_keynames) 
-                printf(" [%s]",rv);
-              printf("\n");
             }
+      
+            // Create DynamicToken to hold condition
+            DynamicToken *nwcond = new DynamicToken();
+            CfgToken token;
+            token.cvt = T_CFG_EventParameter;
+            token.evparam = param;
+            nwcond->token = token;
+            nwcond->exp = exp;
+            nwcond->next = bind->tokenconds;
+            bind->tokenconds = nwcond;
+      
+            printf("         -condition '%s' == ",param.name);
+            exp->Print();
+            if (enable_keynames) 
+              printf(" [%s]",rv);
+            printf("\n");
           }
         }
 
         // Check LValue against user variables
-        UserVariable *cur = vars;
-        while (!found && cur != 0) {
-          if (cur->name != 0) { 
-            if (!strcmp(lv,cur->name)) {
-              // Config specifies a condition for this variable
-              found = 1;
-
-              // Parse RValue expression that specifies condition.
-              ParsedExpression *exp = ParseExpression(rv, input);
-        
-              // Create DynamicToken to hold condition
-              DynamicToken *nwcond = new DynamicToken();
-              CfgToken token;
-              token.cvt = T_CFG_UserVariable;
-              token.var = cur;
-              nwcond->token = token;
-              nwcond->exp = exp;
-              nwcond->next = bind->tokenconds;
-              bind->tokenconds = nwcond;
-              
-              printf("         -condition '%s' == ",cur->name);
-              exp->Print();
-              printf("\n");
-            }
-          }
-          cur = cur->next;
+        UserVariable *cur = (found ? 0 : GetVariable(lv));
+        if (cur != 0) {
+          // Config specifies a condition for this variable
+          found = 1;
+          
+          // Parse RValue expression that specifies condition.
+          ParsedExpression *exp = ParseExpression(rv, input);
+          
+          // Create DynamicToken to hold condition
+          DynamicToken *nwcond = new DynamicToken();
+          CfgToken token;
+          token.cvt = T_CFG_UserVariable;
+          token.var = cur;
+          nwcond->token = token;
+          nwcond->exp = exp;
+          nwcond->next = bind->tokenconds;
+          bind->tokenconds = nwcond;
+          
+          printf("         -condition '%s' == ",cur->name);
+          exp->Print();
+          printf("\n");
         }
 
         // Debugging for invalid condition
@@ -1029,48 +1419,46 @@ int InputMatrix::CreateConditions (int interfaceid,
     // if so, set implicitly based on what interface this binding is
     // defined in
     
-    char found = 0;
-    for (int i = 0; !found && i < input->GetNumParams(); i++) {
-      EventParameter param = input->GetParam(i);        
-      if (!strcmp(param.name,INTERFACEID)) {
-        // Yup, set implicitly
-        found = 1;
-        
-        char tmp[20];
-        snprintf(tmp,20,"%d",interfaceid); // Set from interface ID
-        ParsedExpression *exp = ParseExpression(tmp, input);
-        
-        // Is this parameter indexed?
-        if (i == paramidx) {
-          // OK, is the RValue static (ie can we store the binding 
-          // in a hash or do we need to compute during runtime)?
-          if (exp->IsStatic()) {
-            // Yup, so evaluate now
-            UserVariable val = exp->Evaluate(input);
-            
-            // Return hash value
-            ret_index = (int) val % param.max_index;
-          } else {
-            // Indexed parameter, but value is not static-
-            // Use wildcard slot in hash
-            ret_index = param.max_index;
-          }
+    // Look up parameter by name
+    int i = Event::GetParamIdxByName(input->GetType(),INTERFACEID);
+    if (i != -1) {
+      EventParameter param = input->GetParam(i);
+      // Yup, set implicitly
+      
+      char tmp[20];
+      snprintf(tmp,20,"%d",interfaceid); // Set from interface ID
+      ParsedExpression *exp = ParseExpression(tmp, input);
+      
+      // Is this parameter indexed?
+      if (i == paramidx) {
+        // OK, is the RValue static (ie can we store the binding 
+        // in a hash or do we need to compute during runtime)?
+        if (exp->IsStatic()) {
+          // Yup, so evaluate now
+          UserVariable val = exp->Evaluate(input);
+          
+          // Return hash value
+          ret_index = (int) val % param.max_index;
+        } else {
+          // Indexed parameter, but value is not static-
+          // Use wildcard slot in hash
+          ret_index = param.max_index;
         }
-        
-        // Create DynamicToken to hold condition
-        DynamicToken *nwcond = new DynamicToken();
-        CfgToken token;
-        token.cvt = T_CFG_EventParameter;
-        token.evparam = param;
-        nwcond->token = token;
-        nwcond->exp = exp;
-        nwcond->next = bind->tokenconds;
-        bind->tokenconds = nwcond;
-        
-        printf("         -implicit condition '%s' == ",param.name);
-        exp->Print();
-        printf("\n");
       }
+      
+      // Create DynamicToken to hold condition
+      DynamicToken *nwcond = new DynamicToken();
+      CfgToken token;
+      token.cvt = T_CFG_EventParameter;
+      token.evparam = param;
+      nwcond->token = token;
+      nwcond->exp = exp;
+      nwcond->next = bind->tokenconds;
+      bind->tokenconds = nwcond;
+      
+      printf("         -implicit condition '%s' == ",param.name);
+      exp->Print();
+      printf("\n");
     }
   }
   
@@ -1136,6 +1524,15 @@ void InputMatrix::CreateBinding (int interfaceid, xmlNode *binding) {
           xmlFree(echo);
         }
 
+        // Coalesce?
+        xmlChar *coalesce = xmlGetProp(binding, (const xmlChar *)"coalesce");
+        if (coalesce != 0) {
+          nw->coalesce = atoi((char *)coalesce);
+          if (nw->coalesce)
+            printf(" (coalesce)");
+          xmlFree(coalesce);
+        }
+
         // Conditions
         printf("\n");
         int store_idx = CreateConditions(interfaceid,
@@ -1259,27 +1656,23 @@ void InputMatrix::ParseToken(char *str, CfgToken *dst, Event *ref,
   }
 
   // Check if token references an event parameter
-  if (ref != 0)
-    for (int j = 0; j < ref->GetNumParams(); j++) {
-      EventParameter evparam = ref->GetParam(j);
-      if (!strcmp(str,evparam.name)) {
-        // Matching parameter
-        dst->cvt = T_CFG_EventParameter;
-        dst->evparam = evparam;
-        return;
-      }
+  if (ref != 0) {
+    int j = Event::GetParamIdxByName(ref->GetType(),str);
+    if (j != -1) {
+      // Matching parameter
+      dst->cvt = T_CFG_EventParameter;
+      dst->evparam = ref->GetParam(j);
+      return;
     }
+  }
 
   // Check if token references a user variable
-  UserVariable *cur = vars;
-  while (cur != 0) {
-    if (!strcmp(str,cur->name)) {
-      // Matching user variable
-      dst->cvt = T_CFG_UserVariable;
-      dst->var = cur;
-      return;
-    }
-    cur = cur->next;
+  UserVariable *cur = GetVariable(str);
+  if (cur != 0) {
+    // Matching user variable
+    dst->cvt = T_CFG_UserVariable;
+    dst->var = cur;
+    return;
   }
 
   // No matches to variables or parameters, interpret as static token
@@ -1392,6 +1785,7 @@ ParsedExpression *InputMatrix::ParseExpression(char *str, Event *ref,
   }
 
   exp->ops = first;
+  exp->Compile();
   return exp;
 };
 
@@ -1433,10 +1827,87 @@ void InputMatrix::StoreParameter(char *ptr, CoreDataType dtype,
   }
 };
 
+// Parameter setters, one per output parameter type
+template <class T> static void SetScalarParam(ParamSetter *ps, Event *input,
+                                              Event *output) {
+  *((T *) ((char *) output + ps->ofs)) = ps->exp->EvaluateAs<T>(input);
+};
+
+static void SetRangeParam(ParamSetter *ps, Event *input, Event *output) {
+  UserVariable val = ps->exp->Evaluate(input);
+  *((Range *) ((char *) output + ps->ofs)) = (Range) val;
+};
+
+static void SetVariableParam(ParamSetter *ps, Event *input, Event *output) {
+  UserVariable val = ps->exp->Evaluate(input);
+  *((UserVariable *) ((char *) output + ps->ofs)) = val;
+};
+
+static void SetVariableRefParam(ParamSetter *ps, Event */*input*/, 
+                                Event *output) {
+  *((UserVariable **) ((char *) output + ps->ofs)) = ps->ref;
+};
+
+void InputMatrix::CompileParamSetters (EventBinding *bind) {
+  if (bind->setters != 0)
+    delete[] bind->setters;
+  bind->setters = 0;
+  bind->numsetters = 0;
+
+  int cnt = 0;
+  for (DynamicToken *cur = bind->paramsets; cur != 0; cur = cur->next)
+    cnt++;
+  if (cnt == 0)
+    return;
+
+  bind->setters = new ParamSetter[cnt];
+  for (DynamicToken *cur = bind->paramsets; cur != 0; cur = cur->next) {
+    if (cur->token.cvt != T_CFG_EventParameter) {
+      printf("CONFIG: SetDynamicParameters: Unknown destination in token!\n");
+      continue;
+    }
+
+    ParamSetter *ps = &bind->setters[bind->numsetters];
+    ps->ofs = cur->token.evparam.ofs;
+    ps->exp = cur->exp;
+    switch (cur->token.evparam.dtype) {
+    case T_char : ps->set = SetScalarParam<char>; break;
+    case T_int : ps->set = SetScalarParam<int>; break;
+    case T_long : ps->set = SetScalarParam<long>; break;
+    case T_float : ps->set = SetScalarParam<float>; break;
+    case T_range : ps->set = SetRangeParam; break;
+    case T_variable : ps->set = SetVariableParam; break;
+    case T_variableref :
+      // Output event wants a reference to a variable-- not an evaluation!
+      // See if the starting token is a UserVariable
+      ps->set = SetVariableRefParam;
+      if (cur->exp->start.cvt == T_CFG_UserVariable)
+        ps->ref = cur->exp->start.var;
+      else
+        printf("CONFIG: SetDynamicParameters: Event expects UserVariable but"
+               " another type is given by config!\n");
+      break;
+    default :
+      printf("CONFIG: SetDynamicParameters: Invalid parameter type\n");
+      continue;
+    }
+
+    bind->numsetters++;
+  }
+};
+
 // Using the eventbinding's parametersets as a template, dynamically
 // sets parameters in the output event
 void InputMatrix::SetDynamicParameters(Event *input, Event *output,
                                        EventBinding *bind) {
+  if (bind->numsetters >= 0) {
+    // Compiled setters
+    ParamSetter *ps = bind->setters;
+    for (int i = 0; i < bind->numsetters; i++, ps++)
+      ps->set(ps,input,output);
+    return;
+  }
+
   // Go through the settings 
   DynamicToken *cur = bind->paramsets;
   while (cur != 0) {
@@ -1474,6 +1945,31 @@ void InputMatrix::SetDynamicParameters(Event *input, Event *output,
 // given input event and user variables?
 char InputMatrix::CheckConditions(Event *input, 
                                   EventBinding *bind) {
+  if (bind->numconds >= 0) {
+    // Compiled conditions
+    CompiledCondition *cc = bind->conds;
+    for (int i = 0; i < bind->numconds; i++, cc++) {
+      char ok;
+      if (cc->op != CompiledCondition::CC_DYNAMIC)
+        ok = cc->Accepts(cc->GetParam(input));
+      else {
+        UserVariable cmp1;
+        cc->dyn->token.Evaluate(&cmp1,input,1);
+        UserVariable cmp2 = cc->dyn->exp->Evaluate(input);
+        ok = (cmp1 == cmp2);
+      }
+
+      if (!ok) {
+        __sync_fetch_and_add(&bind->prof.condevals,i+1);
+        __sync_fetch_and_add(&bind->prof.fails,1);
+        return 0;
+      }
+    }
+
+    __sync_fetch_and_add(&bind->prof.condevals,bind->numconds);
+    return 1;
+  }
+
   char match = 1;
 
   // Check dynamic token conditions
@@ -1483,50 +1979,272 @@ char InputMatrix::CheckConditions(Event *input,
     UserVariable cmp1;
     cur->token.Evaluate(&cmp1,input,1);
     UserVariable cmp2 = cur->exp->Evaluate(input);
-    if (cmp1 != cmp2)
+    __sync_fetch_and_add(&bind->prof.condevals,1);
+    if (cmp1 != cmp2) {
       match = 0;
-    else
+      __sync_fetch_and_add(&bind->prof.fails,1);
+    } else
       cur = cur->next;
   }
 
   return match;
 };
 
-// Traverses through the list of event bindings beginning at 'start'
-// looking for a binding that matches current user variables and input
-// event 'ev'
-EventBinding *InputMatrix::MatchBinding(Event *ev, EventBinding *start) {
-#if 0
-  {
-    EventBinding *cur = start;
-    int count = 0;
+void InputMatrix::CompileConditions (EventBinding *bind) {
+  if (bind->conds != 0)
+    delete[] bind->conds;
+  bind->conds = 0;
+  bind->numconds = 0;
+
+  DynamicToken *cur = bind->tokenconds;
+  while (cur != 0) {
+    bind->numconds++;
+    cur = cur->next;
+  }
+  if (bind->numconds == 0)
+    return;
+
+  // Direct comparisons go first, since they are cheapest to reject on
+  bind->conds = new CompiledCondition[bind->numconds];
+  int n = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    cur = bind->tokenconds;
     while (cur != 0) {
-      count++;
+      CompiledCondition cc;
+      cc.dyn = cur;
+
+      CoreDataType dt = cur->token.evparam.dtype;
+      if (cur->token.cvt == T_CFG_EventParameter && 
+          (dt == T_char || dt == T_int || dt == T_long) &&
+          cur->exp->IsStatic()) {
+        UserVariable val = cur->exp->Evaluate(0);
+        switch (val.type) {
+        case T_char :
+        case T_int :
+        case T_long :
+          // Integer compare- both sides are raised to the wider type,
+          // so comparing as long is the same
+          cc.op = CompiledCondition::CC_EQUAL;
+          cc.val = (long) val;
+          break;
+          
+        case T_range :
+          {
+            Range r = (Range) val;
+            cc.op = CompiledCondition::CC_RANGE;
+            cc.lo = r.lo;
+            cc.hi = r.hi;
+          }
+          break;
+          
+        default :
+          break;
+        }
+        
+        cc.ofs = cur->token.evparam.ofs;
+        cc.dtype = dt;
+      }
+
+      if ((pass == 0) == (cc.op != CompiledCondition::CC_DYNAMIC))
+        bind->conds[n++] = cc;
+      
       cur = cur->next;
     }
-    printf(" [SCAN] Hash size: %d",count);
   }
-#endif
+};
 
-  EventBinding *cur = start;
-  char go = 1, prevcont = 0;
-  while (cur != 0 && go) {
-    if (!prevcont && CheckConditions(ev,cur))
-      go = 0;
-    else {
+BindingDecisionTable *InputMatrix::CompileDecisionTable (EventBinding *start,
+                                                         int chanofs) {
+  BindingDecisionTable *tbl = new BindingDecisionTable(chanofs);
+
+  // Count the bindings that start a group- continued bindings are only
+  // ever fired after the binding before them
+  int cnt = 0;
+  char prevcont = 0;
+  for (EventBinding *cur = start; cur != 0; cur = cur->next) {
+    if (!prevcont)
+      cnt++;
+    prevcont = cur->continued;
+  }
+
+  int numlists = (chanofs == -1 ? 1 : MAX_MIDI_CHANNELS+1);
+  for (int l = 0; l < numlists; l++) {
+    EventBinding **lst = new EventBinding *[cnt+1];
+    int n = 0;
+
+    prevcont = 0;
+    for (EventBinding *cur = start; cur != 0; cur = cur->next) {
+      if (!prevcont) {
+        // Last list has all bindings, for channels out of range
+        char keep = 1;
+        if (l < MAX_MIDI_CHANNELS && chanofs != -1) {
+          // Does a static channel condition exclude this binding?
+          for (int i = 0; keep && i < cur->numconds; i++) {
+            CompiledCondition *cc = &cur->conds[i];
+            if (cc->op != CompiledCondition::CC_DYNAMIC && 
+                cc->ofs == chanofs && !cc->Accepts(l))
+              keep = 0;
+          }
+        }
+
+        if (keep)
+          lst[n++] = cur;
+      }
       prevcont = cur->continued;
-      cur = cur->next;
+    }
+
+    lst[n] = 0;
+    tbl->lists[l] = lst;
+  }
+
+  return tbl;
+};
+
+void InputMatrix::CompileBindings () {
+  int evnum = (int) EventType(T_EV_Last_Bindable);
+  int numbinds = 0,
+    numdirect = 0,
+    numdyn = 0;
+  for (int i = 0; i < evnum; i++) {
+    EventBinding **cur_hash = input_bind[i];
+    if (cur_hash == 0 || input_table[i] != 0)
+      continue;
+
+    int pidx = Event::GetParamIdxByType((EventType) i);
+    Event *tmpev = Event::GetEventByType((EventType) i,1);
+    int hashsz = (pidx == -1 ? 1 : tmpev->GetParam(pidx).max_index+1);
+
+    // Split on MIDI channel if this input has one (and it isn't already
+    // what we hash on)
+    int chanofs = -1;
+    for (int j = 0; j < tmpev->GetNumParams(); j++) {
+      EventParameter param = tmpev->GetParam(j);
+      if (j != pidx && param.dtype == T_int && 
+          !strcmp(param.name,"midichannel")) {
+        chanofs = param.ofs;
+      }
+    }
+    tmpev->RTDelete();
+
+    input_table[i] = new BindingDecisionTable *[hashsz];
+    for (int j = 0; j < hashsz; j++) {
+      for (EventBinding *cur = cur_hash[j]; cur != 0; cur = cur->next) {
+        // System variables are linked after bindings are parsed, so
+        // expressions may need to be compiled again for their types
+        for (DynamicToken *dt = cur->tokenconds; dt != 0; dt = dt->next)
+          dt->exp->Compile();
+        for (DynamicToken *dt = cur->paramsets; dt != 0; dt = dt->next)
+          dt->exp->Compile();
+
+        CompileConditions(cur);
+        CompileParamSetters(cur);
+        numbinds++;
+        for (int k = 0; k < cur->numconds; k++)
+          if (cur->conds[k].op == CompiledCondition::CC_DYNAMIC)
+            numdyn++;
+          else
+            numdirect++;
+      }
+
+      input_table[i][j] = (cur_hash[j] != 0 ? 
+                           CompileDecisionTable(cur_hash[j],chanofs) : 0);
     }
   }
 
-#if 0
-  if (cur != 0)
-    printf(" HIT!\n");
+  printf("INIT: Compiled %d input bindings (%d direct, %d dynamic "
+         "conditions).\n",numbinds,numdirect,numdyn);
+};
+
+// Searches the decision table 'tbl' for a binding that matches current
+// user variables and input event 'ev'. Adds the number of bindings 
+// scanned to 'scanned'
+EventBinding *InputMatrix::MatchBinding(Event *ev, BindingDecisionTable *tbl,
+                                        long &scanned) {
+  EventBinding **cur = tbl->GetList(ev);
+  while (*cur != 0) {
+    scanned++;
+    if (CheckConditions(ev,*cur))
+      return *cur;
+    cur++;
+  }
+
+  return 0;
+};
+
+int InputMatrix::GetNumBindingBuckets(EventType typ) {
+  if (input_bind[typ] == 0)
+    return 0;
+
+  int pidx = Event::GetParamIdxByType(typ);
+  if (pidx == -1 || Event::ett[typ].proto == 0)
+    return 1;
   else
-    printf("\n");
-#endif
+    return Event::ett[typ].proto->GetParam(pidx).max_index+1;
+};
 
-  return cur;
+void InputMatrix::ReportProfile() {
+  printf("BINDING PROFILE REPORT:\n");
+  if (!app->getCFG()->IsBindingProfileTimed())
+    printf(" (times not kept- set profilebindingtime to time bindings)\n");
+
+  int evnum = (int) EventType(T_EV_Last_Bindable);
+  for (int i = 0; i < evnum; i++) {
+    int nbuckets = GetNumBindingBuckets((EventType) i);
+    InputProfile *ip = &input_prof[i];
+    if (nbuckets == 0 || ip->events == 0)
+      continue;
+
+    printf(" input '%s': %ld events, %ld matched, scan avg %.1f max %ld, "
+           "match avg %.2f us\n",
+           Event::GetEventName((EventType) i),ip->events,ip->matched,
+           (float) ip->scanned / ip->events,ip->maxscan,
+           (float) ip->time / ip->events / 1000.0);
+
+    for (int j = 0; j < nbuckets; j++) {
+      EventBinding *cur = input_bind[i][j];
+      if (cur == 0)
+        continue;
+
+      // Chain length, and whether anything in it was checked
+      int len = 0;
+      char active = 0;
+      for (EventBinding *b = cur; b != 0; b = b->next) {
+        len++;
+        if (b->prof.condevals != 0 || b->prof.hits != 0)
+          active = 1;
+      }
+      if (!active)
+        continue;
+
+      if (j == nbuckets-1 && nbuckets > 1)
+        printf("  bucket * (wildcard): %d bindings\n",len);
+      else
+        printf("  bucket %d: %d bindings\n",j,len);
+
+      for (int k = 0; cur != 0; k++, cur = cur->next) {
+        BindingProfile *bp = &cur->prof;
+        if (bp->condevals == 0 && bp->hits == 0)
+          continue;
+        printf("   #%d -> '%s': %ld hits, %ld conditions checked, "
+               "%ld failed, fire avg %.2f us\n",
+               k,Event::GetEventName(cur->boundproto->GetType()),
+               bp->hits,bp->condevals,bp->fails,
+               (bp->hits > 0 ? (float) bp->time / bp->hits / 1000.0 : 0.0));
+      }
+    }
+  }
+};
+
+void InputMatrix::ResetProfile() {
+  int evnum = (int) EventType(T_EV_Last_Bindable);
+  for (int i = 0; i < evnum; i++) {
+    input_prof[i].Reset();
+
+    int nbuckets = GetNumBindingBuckets((EventType) i);
+    for (int j = 0; j < nbuckets; j++)
+      for (EventBinding *cur = input_bind[i][j]; cur != 0; cur = cur->next)
+        cur->prof.Reset();
+  }
 };
 
 void InputMatrix::ReceiveEvent(Event *ev, EventProducer *from) {
@@ -1542,11 +2260,11 @@ void InputMatrix::ReceiveEvent(Event *ev, EventProducer *from) {
       if (CRITTERS && ev->GetType() == T_EV_GoSub)
         printf("CONFIG: GoSub(%d)\n",((GoSubEvent *) ev)->sub);
       
-      if (input_bind[i] != 0) {
-        EventBinding **cur_hash = input_bind[i];
+      if (input_table[i] != 0) {
+        BindingDecisionTable **cur_hash = input_table[i];
         
         // Find indexed parameter
-        EventBinding *search = 0;
+        BindingDecisionTable *search = 0;
         EventParameter param;
         int pidx = Event::GetParamIdxByType((EventType) i);
         if (pidx == -1) {
@@ -1572,12 +2290,28 @@ void InputMatrix::ReceiveEvent(Event *ev, EventProducer *from) {
         }
         
         // Now, check for matching binding in the search list
+        char timed = app->getCFG()->IsBindingProfileTimed();
+        long t0 = (timed ? GetProfileTime() : 0),
+          scanned = 0;
         if (search != 0)
-          match = MatchBinding(ev,search);
+          match = MatchBinding(ev,search,scanned);
         if (match == 0 && pidx != -1 && cur_hash[param.max_index] != 0)
           // OK, no match on the exact hash! -- check wildcards stored at the
           // end of the hashtable
-          match = MatchBinding(ev,cur_hash[param.max_index]);
+          match = MatchBinding(ev,cur_hash[param.max_index],scanned);
+
+        // Profile
+        InputProfile *ip = &input_prof[i];
+        __sync_fetch_and_add(&ip->events,1);
+        __sync_fetch_and_add(&ip->scanned,scanned);
+        long mx = ip->maxscan;
+        while (scanned > mx && 
+               !__sync_bool_compare_and_swap(&ip->maxscan,mx,scanned))
+          mx = ip->maxscan;
+        if (match != 0)
+          __sync_fetch_and_add(&ip->matched,1);
+        if (timed)
+          __sync_fetch_and_add(&ip->time,GetProfileTime() - t0);
       }
       
       // First matching binding, check if she says to echo
@@ -1590,15 +2324,28 @@ void InputMatrix::ReceiveEvent(Event *ev, EventProducer *from) {
       
       // printf("CONFIG: Binding match %p (echo %d)\n",match,echo);
       
+      EventBinding *firstmatch = match;
+      char timed = (firstmatch != 0 && 
+                    app->getCFG()->IsBindingProfileTimed());
+      long t0 = (timed ? GetProfileTime() : 0);
       while (match != 0) {
-        // So we have a binding.. trigger the bound event!
-        Event *shot = (Event *) match->boundproto->RTNew();
-        if (shot == 0) 
-          printf("CONFIG: WARNING: Can't send event- RTNew() failed\n");
+        if (ev->superseded && match->coalesce)
+          // A later input replaces this one, and the binding only wants
+          // the latest value
+          app->getEMG()->CountCoalesced(ev->GetType());
         else {
-          *shot = *match->boundproto; // Copy from prototype
-          SetDynamicParameters(ev,shot,match);
-          app->getEMG()->BroadcastEventNow(shot, this);
+          // So we have a binding.. trigger the bound event!
+          // (copied by value from the prototype where it fits)
+          EventRecord rec;
+          Event *shot = rec.CopyFrom(match->boundproto);
+          if (shot == 0) 
+            printf("CONFIG: WARNING: Can't send event- RTNew() failed\n");
+          else {
+            shot->CopyStamp(ev); // Derived from this input
+            SetDynamicParameters(ev,shot,match);
+            app->getEMG()->BroadcastEventNow(shot, this, 1, 0);
+            rec.Release();
+          }
         }
         
         // Trigger any continued bindings..
@@ -1607,16 +2354,28 @@ void InputMatrix::ReceiveEvent(Event *ev, EventProducer *from) {
         else
           match = 0;
       }
+
+      if (firstmatch != 0) {
+        __sync_fetch_and_add(&firstmatch->prof.hits,1);
+        if (timed)
+          __sync_fetch_and_add(&firstmatch->prof.time,GetProfileTime() - t0);
+      }
       
       // Echo the incoming event back?
-      if (echo) {
-        Event *echo = (Event *) ev->RTNew();
+      if (echo && MidiIO::IsRoutedInput(ev->GetType()) && 
+          app->getMIDI() != 0)
+        // MIDI input goes straight out through the patch routes, from
+        // this (input) thread- no copy to broadcast
+        app->getMIDI()->EchoInput(ev);
+      else if (echo) {
+        EventRecord rec;
+        Event *echo = rec.CopyFrom(ev); // Copy from incoming input
         if (echo == 0) 
           printf("CONFIG: WARNING: Can't send event- RTNew() failed\n");
         else {
-          *echo = *ev;    // Copy from incoming input
           echo->echo = 1; // Set echo flag
-          app->getEMG()->BroadcastEventNow(echo, this);    
+          app->getEMG()->BroadcastEventNow(echo, this, 1, 0);
+          rec.Release();
         }
       }
     } else if (ev_hook != 0) {
@@ -1764,6 +2523,21 @@ void InputMatrix::ReceiveEvent(Event *ev, EventProducer *from) {
       }
       break;
       
+    case T_EV_ReportBindingProfile :
+      {
+        ReportBindingProfileEvent *rev = (ReportBindingProfileEvent *) ev;
+        ReportProfile();
+#ifndef __MACOSX__
+        if (rev->osc && app->getOSC() != 0)
+          app->getOSC()->SendBindingProfile();
+#endif
+
+        // Reset only once both reports are made
+        if (rev->reset)
+          ResetProfile();
+      }
+      break;
+
     case T_EV_AdjustMidiTranspose :
       {
         AdjustMidiTransposeEvent *tev = (AdjustMidiTransposeEvent *) ev;
@@ -1900,6 +2674,24 @@ void FloConfig::ConfigureBasics(xmlDocPtr /*doc*/, xmlNode *gen) {
                  FWEELIN_ERROR_COLOR_OFF,n);
         else
           printf("CONFIG: Loop out format is: %s\n", GetCodecName(loopoutformat));
+      } else if ((n = xmlGetProp(cur_node,
+                                 (const xmlChar *)"loopsaveencoders")) != 0) {
+        loopsaveencoders = atoi((char *) n);
+        if (loopsaveencoders < 0)
+          loopsaveencoders = 0;
+        printf("CONFIG: Loop save encoders: %d\n",loopsaveencoders);
+      } else if ((n = xmlGetProp(cur_node,
+                                 (const xmlChar *)"loopsaverate")) != 0) {
+        loopsaverate = atof((char *) n);
+        if (loopsaverate < 0.0)
+          loopsaverate = 0.0;
+        printf("CONFIG: Loop save rate: %.1fx realtime\n",loopsaverate);
+      } else if ((n = xmlGetProp(cur_node,
+                                 (const xmlChar *)"loopcachesize")) != 0) {
+        loopcachesize = atof((char *) n);
+        if (loopcachesize < 0.0)
+          loopcachesize = 0.0;
+        printf("CONFIG: Loop cache size: %.0f MB\n",loopcachesize);
       } else if ((n = xmlGetProp(cur_node,
                                  (const xmlChar *)"streamoutformat")) != 0) {
         streamoutformat = GetCodecFromName((const char *) n);
@@ -1910,6 +2702,30 @@ void FloConfig::ConfigureBasics(xmlDocPtr /*doc*/, xmlNode *gen) {
         else
           printf("CONFIG: Stream out format is: %s\n", 
                  GetCodecName(streamoutformat));
+      } else if ((n = xmlGetProp(cur_node,
+                                 (const xmlChar *)"streamdropcache")) != 0) {
+        if (n[0] == 'Y' || n[0] == 'y')
+          streamdropcache = 1;
+        else
+          streamdropcache = 0;
+        printf("CONFIG: %s dropping streams from file cache\n",
+               (streamdropcache ? "Enable" : "Disable"));
+      } else if ((n = xmlGetProp(cur_node,
+                                 (const xmlChar *)"streamsinglefile")) != 0) {
+        if (n[0] == 'Y' || n[0] == 'y')
+          streamsinglefile = 1;
+        else
+          streamsinglefile = 0;
+        printf("CONFIG: %s streaming to a single multichannel file\n",
+               (streamsinglefile ? "Enable" : "Disable"));
+      } else if ((n = xmlGetProp(cur_node,
+                                 (const xmlChar *)"streamdeferencode")) != 0) {
+        if (n[0] == 'Y' || n[0] == 'y')
+          streamdeferencode = 1;
+        else
+          streamdeferencode = 0;
+        printf("CONFIG: %s encoding streams after they stop\n",
+               (streamdeferencode ? "Enable" : "Disable"));
       } else if ((n = xmlGetProp(cur_node, 
                                  (const xmlChar *)"oggquality")) != 0) {
         float q = atof((char *) n);
@@ -1927,6 +2743,41 @@ void FloConfig::ConfigureBasics(xmlDocPtr /*doc*/, xmlNode *gen) {
         if (midiouts < 1)
           midiouts = 1;
         printf("CONFIG: Config sets %d MIDI outputs.\n",midiouts);
+      } else if ((n = xmlGetProp(cur_node,
+                                 (const xmlChar *)"midibackend")) != 0) {
+        if (!xmlStrcmp(n, (const xmlChar *) "jack"))
+          jackmidi = 1;
+        else if (!xmlStrcmp(n, (const xmlChar *) "alsa"))
+          jackmidi = 0;
+        else
+          printf(FWEELIN_ERROR_COLOR_ON
+                 "CONFIG: Invalid MIDI backend: %s\n"
+                 FWEELIN_ERROR_COLOR_OFF,n);
+#ifdef __MACOSX__
+        if (jackmidi) {
+          printf("CONFIG: JACK MIDI is not supported on Mac OS X- "
+                 "using CoreMIDI.\n");
+          jackmidi = 0;
+        }
+#endif
+        printf("CONFIG: MIDI backend is: %s\n",
+               (jackmidi ? "JACK" : "system"));
+      } else if ((n = xmlGetProp(cur_node,
+                                 (const xmlChar *)"midifeedbackrate")) != 0) {
+        midifeedbackrate = atof((char *) n);
+        if (midifeedbackrate < 0.0)
+          midifeedbackrate = 0.0;
+        printf("CONFIG: MIDI controller feedback rate: %.1f/s\n",
+               midifeedbackrate);
+      } else if ((n = xmlGetProp(cur_node,
+                                 (const xmlChar *)"oscprofileport")) != 0) {
+        oscprofileport = atoi((char *) n);
+        printf("CONFIG: OSC binding profile port: %d\n",oscprofileport);
+      } else if ((n = xmlGetProp(cur_node,
+                                 (const xmlChar *)"profilebindingtime")) != 0) {
+        profilebindingtime = (atoi((char *) n) != 0);
+        printf("CONFIG: Binding profile timing: %s\n",
+               (profilebindingtime ? "on" : "off"));
       } else if ((n = xmlGetProp(cur_node,
                                  (const xmlChar *)"midisyncouts")) != 0) {
         msouts = ExtractArrayInt((char *)n, &msnumouts);
@@ -2865,6 +3716,8 @@ void FloConfig::ConfigureDisplay_Common(xmlNode *disp, FloDisplay *nw, FloDispla
       cur = cur->next;
     cur->next = nw;
   }
+  if (displaysyms.GetKey(GetDisplayKey(nw->iid,nw->id)) == 0)
+    displaysyms.SetKey(GetDisplayKey(nw->iid,nw->id),nw);
 
   printf("\n");
 }
@@ -3472,6 +4325,8 @@ UserVariable *FloConfig::AddEmptyVariable(char *name) {
   // Insert into variable list
   nw->next = im.vars;
   im.vars = nw;
+  if (name != 0)
+    im.varsyms.Set(name,nw);
   
   return nw;
 };
@@ -3479,38 +4334,15 @@ UserVariable *FloConfig::AddEmptyVariable(char *name) {
 // Makes the given variable into a system variable by linking it to
 // the pointer
 void FloConfig::LinkSystemVariable(char *name, CoreDataType type, char *ptr) {
-  UserVariable *cur = im.vars;
-  while (cur != 0) {
-    if (cur->name != 0) {
-      if (!strcmp(cur->name,name)) {
-        // Variable found!- Link it with a system variable
-        printf("CONFIG: Link system variable: %s -> %p\n",name,ptr);
-        cur->type = type;
-        cur->value = ptr;
-      }
-    }
-
-    cur = cur->next;
+  UserVariable *cur = GetVariable(name);
+  if (cur != 0) {
+    // Variable found!- Link it with a system variable
+    printf("CONFIG: Link system variable: %s -> %p\n",name,ptr);
+    cur->type = type;
+    cur->value = ptr;
   }
 };
 
-// Returns a pointer to the given variable
-UserVariable *FloConfig::GetVariable(char *name) {
-  UserVariable *cur = im.vars;
-  while (cur != 0) {
-    if (cur->name != 0) {
-      if (!strcmp(cur->name,name)) {
-        // Variable found!
-        return cur;
-      }
-    }
-
-    cur = cur->next;
-  }
-
-  return 0;
-};
-
 FloConfig::~FloConfig() 
 {
   // Erase displays
@@ -3586,15 +4418,18 @@ FloConfig::~FloConfig()
 
 FloConfig::FloConfig(Fweelin *app) : im(app), 
   
-  ev_hook(0), librarypath(0), midiouts(1), msnumouts(0), msouts(0),
+  ev_hook(0), librarypath(0), midiouts(1), jackmidi(0), 
+  midifeedbackrate(0.0), msnumouts(0), 
+  msouts(0), oscprofileport(5001), profilebindingtime(0),
 
   ms_inputs(0), monitor_inputs(0), extaudioins(0),
 
   maxplayvol(0.0), maxlimitergain(1.0), limiterthreshhold(0.9), 
   limiterreleaserate(0.000020),
 
-  loopoutformat(VORBIS), streamoutformat(VORBIS),
-  vorbis_encode_quality(0.5),
+  loopoutformat(VORBIS), loopsaveencoders(0), loopsaverate(0.0), 
+  loopcachesize(0.0), streamoutformat(VORBIS), streamdropcache(0),
+  streamsinglefile(0), streamdeferencode(0), vorbis_encode_quality(0.5),
 
   num_triggers(1024), 
   vdelay(50000), showdebug(0), 
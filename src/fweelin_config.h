@@ -55,6 +55,8 @@
 #define FWEELIN_OUTPUT_SNAPSHOT_NAME "snapshot"
 #define FWEELIN_OUTPUT_LOOPSNAPSHOT_NAME "loopsnap"
 #define FWEELIN_OUTPUT_DATA_EXT    ".xml"
+#define FWEELIN_OUTPUT_PEAKS_EXT   ".peaks"
+#define FWEELIN_OUTPUT_SPILL_EXT   ".spill"
 
 // Console sequence for error color
 #define FWEELIN_ERROR_COLOR_ON "\033[31;1m"
@@ -141,10 +143,41 @@ class CfgMathOperation {
   CfgMathOperation *next;
 };
 
+// One instruction of a compiled expression. The expression runs on a single
+// accumulator register- each instruction combines the accumulator with one
+// operand, and the types involved are fixed when the expression is compiled.
+class ExpressionInstr {
+ public:
+  enum InstrOp {
+    EI_LOAD, // Accumulator = operand
+    EI_ADD,
+    EI_SUB,
+    EI_MUL,
+    EI_DIV
+  };
+  enum InstrSrc {
+    EI_CONST, // Operand is lval/fval
+    EI_PARAM, // Operand is input event parameter at ofs
+    EI_VAR    // Operand is user variable var
+  };
+
+  ExpressionInstr() : op(EI_LOAD), src(EI_CONST), stype(T_invalid), 
+    atype(T_invalid), ofs(0), var(0), lval(0), fval(0.0) {};
+
+  char op,                  // One of InstrOp
+    src;                    // One of InstrSrc
+  CoreDataType stype,       // Type of operand
+    atype;                  // Type of accumulator after this instruction
+  int ofs;
+  UserVariable *var;
+  long lval;
+  float fval;
+};
+
 // A complete expression of config tokens modified by math operations
 class ParsedExpression {
  public:
-  ParsedExpression() : ops(0) {};
+  ParsedExpression() : ops(0), prog(0), proglen(-1) {};
   ~ParsedExpression() {
     // Erase math ops
     CfgMathOperation *cur = ops;
@@ -153,6 +186,9 @@ class ParsedExpression {
       delete cur;
       cur = tmp;
     }
+
+    if (prog != 0)
+      delete[] prog;
   };
 
   // Evaluate this expression
@@ -162,11 +198,49 @@ class ParsedExpression {
   // and no user variables and no input parameters
   char IsStatic();
 
+  // Compile this expression into typed instructions, folding constants.
+  // Types of user variables are taken as they are now- if a variable
+  // changes type later, evaluation falls back to interpreting the tokens
+  // until the expression is compiled again.
+  void Compile();
+
   // Dump expression to stdout
   void Print();
 
+  // Time interpreted against compiled evaluation of a few sample
+  // expressions, and check that both give the same results
+  static void Benchmark();
+
+  // Evaluate this expression and convert the result to scalar type T,
+  // without going through a UserVariable when compiled
+  template <class T> inline T EvaluateAs(Event *input) {
+    long acc;
+    float facc;
+    CoreDataType atype;
+    if (proglen > 0 && Run(input,acc,facc,atype))
+      return (atype == T_float ? (T) facc : (T) acc);
+
+    UserVariable val = Evaluate(input);
+    return (T) val;
+  };
+
+  // Apply math operator otype to cur with operand
+  static void ApplyOp(UserVariable &cur, char otype, UserVariable &operand);
+
   CfgToken start; // Starting token of expression
   CfgMathOperation *ops; // Optional sequence of math ops to perform on 'val'
+
+ private:
+
+  // Run compiled instructions, storing the result in acc (for integer
+  // types) or facc (for float) and its type in atype.
+  // Returns zero if the instructions can't be run for this input.
+  char Run(Event *input, long &acc, float &facc, CoreDataType &atype);
+
+  // Compiled instructions (proglen is -1 if the expression can't be 
+  // compiled)
+  ExpressionInstr *prog;
+  int proglen;
 };
 
 // DynamicToken is an expression and a config token, 
@@ -191,13 +265,101 @@ class DynamicToken {
   DynamicToken *next;
 };
 
+// One condition of an EventBinding, compiled when the config is loaded.
+// The common case- an integer input event parameter compared against a
+// static value or range- is checked directly against the event data.
+// Anything else falls back to evaluating the DynamicToken.
+class CompiledCondition {
+ public:
+  enum CondOp {
+    CC_EQUAL,   // Parameter at ofs == val
+    CC_RANGE,   // lo <= parameter at ofs <= hi
+    CC_DYNAMIC  // Evaluate dyn
+  };
+
+  CompiledCondition() : op(CC_DYNAMIC), ofs(0), dtype(T_invalid), 
+    val(0), lo(0), hi(0), dyn(0) {};
+
+  // Returns the value of the input parameter for this condition in ev
+  inline long GetParam(Event *ev) {
+    char *evofs = (char *) ev + ofs;
+    switch (dtype) {
+    case T_char : return *((char *) evofs);
+    case T_int : return *((int *) evofs);
+    default : return *((long *) evofs);
+    }
+  };
+
+  // Returns nonzero if the static condition accepts parameter value v
+  inline char Accepts(long v) {
+    if (op == CC_EQUAL)
+      return (v == val);
+    else {
+      int iv = (int) v; // Ranges compare as int
+      return (iv >= lo && iv <= hi);
+    }
+  };
+
+  char op;            // One of CondOp
+  int ofs;            // Offset of input parameter in input event
+  CoreDataType dtype; // Type of input parameter (T_char, T_int or T_long)
+  long val;           // Static value to compare with
+  int lo, hi;         // Static range to compare with
+  DynamicToken *dyn;  // Condition to evaluate, for CC_DYNAMIC
+};
+
+// One parameter assignment of an EventBinding, compiled when the config is
+// loaded. The setter is picked by the type of the output parameter, and
+// stores straight into the output event at ofs.
+class ParamSetter {
+ public:
+  typedef void (*SetFunc)(ParamSetter *ps, Event *input, Event *output);
+
+  ParamSetter() : set(0), ofs(0), exp(0), ref(0) {};
+
+  SetFunc set;
+  int ofs;               // Offset of parameter in output event
+  ParsedExpression *exp; // Expression to evaluate
+  UserVariable *ref;     // Variable to store, for T_variableref parameters
+};
+
+// Profiling counters for one EventBinding. Counters are updated atomically
+// from whichever thread delivers the input. Times are only kept if
+// profilebindingtime is set.
+class BindingProfile {
+ public:
+  BindingProfile() { Reset(); };
+
+  void Reset() { hits = condevals = fails = time = 0; };
+
+  long hits,     // Times this binding fired
+    condevals,   // Conditions evaluated for this binding
+    fails,       // Times conditions were checked and didn't match
+    time;        // Nanoseconds spent firing (including continued bindings)
+};
+
+// Profiling counters for one input event type
+class InputProfile {
+ public:
+  InputProfile() { Reset(); };
+
+  void Reset() { events = scanned = maxscan = matched = time = 0; };
+
+  long events,   // Input events received
+    scanned,     // Bindings scanned, over all input events
+    maxscan,     // Most bindings scanned for one input event
+    matched,     // Input events that matched a binding
+    time;        // Nanoseconds spent matching
+};
+
 // Binding between a freewheeling event and some input action
 // controls basic user interface
 class EventBinding {
  public:
   EventBinding() : 
-    boundproto(0), echo(0), 
-    tokenconds(0), paramsets(0), continued(0), next(0) {};
+    boundproto(0), echo(0), coalesce(0), 
+    tokenconds(0), conds(0), numconds(-1), 
+    paramsets(0), setters(0), numsetters(-1), continued(0), next(0) {};
   virtual ~EventBinding();
 
   Event *boundproto; // Prototype instance of the output event
@@ -206,26 +368,72 @@ class EventBinding {
   // if they are consumed in this binding
   char echo;
 
+  // Nonzero if this binding only needs the latest value of a control- 
+  // inputs already replaced by a later input for the same control (see
+  // Event::superseded) don't trigger it. Bindings that use each value 
+  // (relative encoders) leave this off.
+  char coalesce;
+
   // ** Conditions
 
   // List of dynamic token conditions
   // (for example, MIDI channel on input must match given expression)
   DynamicToken *tokenconds;
 
+  // Conditions compiled from tokenconds (numconds is -1 until compiled)
+  CompiledCondition *conds;
+  int numconds;
+
   // ** Parameter mappings
 
   // List of dynamic parameter assignments for output events
   // (for example, when triggering from MIDI keyboard: loop # = notenum + 12)
   DynamicToken *paramsets;
 
+  // Setters compiled from paramsets (numsetters is -1 until compiled)
+  ParamSetter *setters;
+  int numsetters;
+
   // Continued is nonzero if the next binding should always be triggered
   // when this binding is triggered- so the next binding is a 
   // continuation of this binding
   char continued;
 
+  // Hit and timing counters
+  BindingProfile prof;
+
   EventBinding *next;
 };
 
+// Decision table for one hash bucket of input bindings, compiled when the
+// config is loaded. The binding chain is split on MIDI channel, so that an
+// input event only scans the bindings that can match its channel, and
+// continued bindings are left out. Each list holds the first binding of
+// each group, in original chain order, and is 0-terminated.
+class BindingDecisionTable {
+ public:
+  BindingDecisionTable(int chanofs);
+  ~BindingDecisionTable();
+
+  // Returns the list of bindings to scan for the given input event
+  inline EventBinding **GetList(Event *ev) {
+    if (chanofs == -1)
+      return lists[0];
+
+    int chan = *((int *) ((char *) ev + chanofs));
+    return (chan >= 0 && chan < MAX_MIDI_CHANNELS ? lists[chan] : 
+            lists[MAX_MIDI_CHANNELS]);
+  };
+
+  // Offset of the MIDI channel parameter in the input event, or -1 if
+  // the chain isn't split on channel
+  int chanofs;
+
+  // One list per MIDI channel, and one list of all bindings for
+  // channels out of range (or just one list, if not split)
+  EventBinding **lists[MAX_MIDI_CHANNELS+1];
+};
+
 class InputMatrix : public EventProducer, public EventListener {
  public:
 
@@ -252,9 +460,33 @@ class InputMatrix : public EventProducer, public EventListener {
   // Start function, called shortly before Fweelin begins running
   void Start();
 
+  // *********** Binding profile
+
+  // Dump binding and input counters to stdout
+  void ReportProfile();
+  // Clear binding and input counters
+  void ResetProfile();
+
+  // Returns the number of hash buckets of bindings for the given input type
+  // (0 if no bindings)
+  int GetNumBindingBuckets(EventType typ);
+  // Returns the first binding in the given hash bucket
+  inline EventBinding *GetBindingBucket(EventType typ, int bucket) {
+    return input_bind[typ][bucket];
+  };
+  inline InputProfile *GetInputProfile(EventType typ) { 
+    return &input_prof[typ]; 
+  };
+
   // *********** User defined variables
 
   UserVariable *vars;
+  SymbolTable varsyms; // Variable names to variables
+
+  // Returns a pointer to the given variable, or 0 if there is none
+  inline UserVariable *GetVariable(char *name) {
+    return (UserVariable *) varsyms.Get(name);
+  };
 
   Fweelin *app;
 
@@ -306,16 +538,38 @@ class InputMatrix : public EventProducer, public EventListener {
   int CreateConditions (int interfaceid, EventBinding *bind, 
                         xmlNode *binding, Event *input, int paramidx);
 
-  // Traverses through the list of event bindings beginning at 'start'
-  // looking for a binding that matches current user variables and input
-  // event 'ev'
-  EventBinding *MatchBinding(Event *ev, EventBinding *start);
+  // Compile the conditions of the given binding into bind->conds
+  void CompileConditions (EventBinding *bind);
+
+  // Compile the parameter assignments of the given binding into
+  // bind->setters
+  void CompileParamSetters (EventBinding *bind);
+
+  // Compile the binding chain beginning at 'start' into a decision table,
+  // splitting on the input parameter at chanofs (or not if -1)
+  BindingDecisionTable *CompileDecisionTable (EventBinding *start, 
+                                              int chanofs);
+
+  // Compile decision tables for all input bindings- called once bindings
+  // are all configured
+  void CompileBindings ();
+
+  // Searches the decision table 'tbl' for a binding that matches current
+  // user variables and input event 'ev'. Adds the number of bindings 
+  // scanned to 'scanned'
+  EventBinding *MatchBinding(Event *ev, BindingDecisionTable *tbl, 
+                             long &scanned);
 
   // *********** Event Bindings
 
   // Bindings that trigger on input events- for each input event type,
   // a hashtable of bindings along an indexed parameter
   EventBinding ***input_bind;
+  // Compiled decision tables- for each input event type, one per
+  // hashtable entry in input_bind
+  BindingDecisionTable ***input_table;
+  // Profile counters for each input event type
+  InputProfile *input_prof;
 };
 
 class FloLayoutElementGeometry {
@@ -792,7 +1046,9 @@ class FloConfig {
   UserVariable *AddEmptyVariable(char *name);
 
   // Returns a pointer to the given variable
-  UserVariable *GetVariable(char *name);
+  inline UserVariable *GetVariable(char *name) { 
+    return im.GetVariable(name); 
+  };
 
   // Makes the given variable into a system variable by linking it to
   // the pointer
@@ -851,10 +1107,28 @@ class FloConfig {
   inline int GetNumMIDIOuts() { return midiouts; };
   int midiouts;
 
+  // Nonzero if MIDI goes through JACK ports, handled in the audio thread,
+  // instead of the ALSA sequencer
+  inline char IsJackMIDI() { return jackmidi; };
+  char jackmidi;
+
+  // Maximum rate (messages/s) at which controller feedback is sent to
+  // each controller- or 0 to send all feedback as it is generated
+  inline float GetMIDIFeedbackRate() { return midifeedbackrate; };
+  float midifeedbackrate;
+
   // List of MIDI ports to transmit sync info to
   inline int GetNumMIDISyncOuts() { return msnumouts; };
   inline int *GetMIDISyncOuts() { return msouts; };
   int msnumouts, *msouts;
+
+  // Local UDP port where OSC binding profile reports are sent
+  inline int GetOSCProfilePort() { return oscprofileport; };
+  int oscprofileport;
+
+  // Nonzero if the binding profile times matching and firing
+  inline char IsBindingProfileTimed() { return profilebindingtime; };
+  char profilebindingtime;
   
   // Is input/output #n stereo?
   inline char IsStereoInput(int out_n) { return ms_inputs[out_n]; };
@@ -903,10 +1177,40 @@ class FloConfig {
   inline codec GetLoopOutFormat() { return loopoutformat; };
   codec loopoutformat;
 
+  // Number of loops hashed & encoded at once when saving (0 for one per
+  // CPU core, less one)
+  inline int GetLoopSaveEncoders() { return loopsaveencoders; };
+  int loopsaveencoders;
+
+  // Maximum speed of loop saving, as a multiple of realtime, for all
+  // encoders together- or 0 for no limit
+  inline float GetLoopSaveRate() { return loopsaverate; };
+  float loopsaverate;
+
+  // Memory (MB) for keeping the audio of erased loops, in case they are
+  // loaded again- or 0 to always load loops from disk
+  inline float GetLoopCacheSize() { return loopcachesize; };
+  float loopcachesize;
+
   // File format to save streams to
   inline codec GetStreamOutFormat() { return streamoutformat; }; 
   codec streamoutformat;
 
+  // Nonzero if streamed audio is dropped from the OS file cache once it
+  // is on disk
+  inline char IsStreamDropCache() { return streamdropcache; };
+  char streamdropcache;
+
+  // Nonzero if all streams are recorded into one multichannel file,
+  // instead of one file per stream
+  inline char IsStreamSingleFile() { return streamsinglefile; };
+  char streamsinglefile;
+
+  // Nonzero if OGG and FLAC streams are captured raw while streaming, and
+  // encoded once the stream stops
+  inline char IsStreamDeferEncode() { return streamdeferencode; };
+  char streamdeferencode;
+
   inline char *GetCodecName (codec i) {
     switch (i) {
       case VORBIS: return "ogg"; 
@@ -982,13 +1286,7 @@ class FloConfig {
   // Graphical displays
   inline FloDisplay *GetDisplays() { return displays; };
   inline FloDisplay *GetDisplayById (int iid, int id) {
-    FloDisplay *cur = displays;
-    while (cur != 0) {
-      if (cur->iid == iid && cur->id == id)
-        return cur;
-      cur = cur->next;
-    }
-    return 0;
+    return (FloDisplay *) displaysyms.GetKey(GetDisplayKey(iid,id));
   };
   inline FloDisplay *GetDisplayByType (FloDisplayType typ) {
     FloDisplay *cur = displays;
@@ -1000,6 +1298,11 @@ class FloConfig {
     return 0;
   };
   FloDisplay *displays;
+  // Interface id + display id to display
+  static inline uint64_t GetDisplayKey (int iid, int id) {
+    return ((uint64_t) (unsigned int) iid << 32) | (unsigned int) id;
+  };
+  SymbolTable displaysyms;
 
   // Help text
   int GetNumHelpLines() {
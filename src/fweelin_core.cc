@@ -292,91 +292,80 @@ void Loop::Save(Fweelin *app) {
 };
 
 void LoopManager::AddToSaveQueue(Event *ev) {
+  pthread_mutex_lock (&savelock);
   numsave++;
   EventManager::QueueEvent(&savequeue,ev);
+  pthread_mutex_unlock (&savelock);
 };
 
 void LoopManager::AddLoopToSaveQueue(Loop *l) {
   if (!autosave && l->GetSaveStatus() == NO_SAVE) {
-    numsave++;
-
     LoopListEvent *ll = (LoopListEvent *) 
       Event::GetEventByType(T_EV_LoopList,1);
     ll->l = l;
         
+    pthread_mutex_lock (&savelock);
+    numsave++;
     EventManager::QueueEvent(&savequeue,ll);
+    pthread_mutex_unlock (&savelock);
   }
 };
 
 void LoopManager::AddLoopToLoadQueue(char *filename, int index, float vol) {
-  numload++;
-
   LoopListEvent *ll = (LoopListEvent *) 
     Event::GetEventByType(T_EV_LoopList,1);
   strcpy(ll->l_filename,filename);
   ll->l_idx = index;
   ll->l_vol = vol;
   
+  pthread_mutex_lock (&loadlock);
+  numload++;
   EventManager::QueueEvent(&loadqueue,ll);
+  pthread_mutex_unlock (&loadlock);
 };
 
 // Adds the loop with given filename to the loop browser br
 void LoopManager::AddLoopToBrowser(Browser *br, char *filename) {
-  char tmp[FWEELIN_OUTNAME_LEN];
-  
   struct stat st;
-  if (stat(filename,&st) == 0) {
-    char default_name = 
-      br->GetDisplayName(filename,&st.st_mtime,tmp,FWEELIN_OUTNAME_LEN);
+  if (stat(filename,&st) == 0)
+    AddLoopToBrowser(br,filename,st.st_mtime);
+};
 
-    br->AddItem(new LoopBrowserItem(st.st_mtime,tmp,default_name,filename),1);
-  }
+void LoopManager::AddLoopToBrowser(Browser *br, char *filename, 
+                                   time_t mtime) {
+  char tmp[FWEELIN_OUTNAME_LEN];
+  char default_name = 
+    br->GetDisplayName(filename,&mtime,tmp,FWEELIN_OUTNAME_LEN);
+
+  br->AddItem(new LoopBrowserItem(mtime,tmp,default_name,filename),1);
 };
 
 // Populate the loop browser with any loops on disk
 void LoopManager::SetupLoopBrowser() {
   Browser *br = app->getBROWSER(B_Loop);
-
-  if (br != 0) {
-    // Clear
-    br->ClearAllItems();
-
-    // Look for loops on disk 
-    glob_t globbuf;
-    char tmp[FWEELIN_OUTNAME_LEN];
-    for (codec lformat = FIRST_FORMAT; lformat < END_OF_FORMATS; 
-         lformat = (codec) (lformat+1)) {
-      snprintf(tmp,FWEELIN_OUTNAME_LEN,"%s/%s*%s",
-             app->getCFG()->GetLibraryPath(),FWEELIN_OUTPUT_LOOP_NAME,
-             app->getCFG()->GetAudioFileExt(lformat)); 
-      printf("BROWSER: (Loop) Scanning for loops in library: %s\n",tmp);
-      if (glob(tmp, 0, NULL, &globbuf) == 0) {
-        for (size_t i = 0; i < globbuf.gl_pathc; i++) {
-          //printf("BROWSER: (Loop) Loop: %s\n",globbuf.gl_pathv[i]);
-          AddLoopToBrowser(br,globbuf.gl_pathv[i]);
-        }
-
-        br->AddDivisions(FWEELIN_FILE_BROWSER_DIVISION_TIME);
-        br->MoveToBeginning();
-        globfree(&globbuf);
-      }
-    }
-  }
+  if (br != 0)
+    PopulateBrowser(br,LibraryIndexEntry::LOOP);
 };
 
 // Adds the scene with given filename to the scene browser br
 SceneBrowserItem *LoopManager::AddSceneToBrowser(Browser *br, char *filename) {
+  struct stat st;
+  if (stat(filename,&st) == 0)
+    return AddSceneToBrowser(br,filename,st.st_mtime);
+
+  return 0;
+};
+
+SceneBrowserItem *LoopManager::AddSceneToBrowser(Browser *br, char *filename,
+                                                 time_t mtime) {
   char tmp[FWEELIN_OUTNAME_LEN];
   SceneBrowserItem *ret = 0;
 
-  struct stat st;
-  if (stat(filename,&st) == 0) {
-    char default_name = 
-      br->GetDisplayName(filename,&st.st_mtime,tmp,FWEELIN_OUTNAME_LEN);
+  char default_name = 
+    br->GetDisplayName(filename,&mtime,tmp,FWEELIN_OUTNAME_LEN);
 
-    br->AddItem(ret = 
-                new SceneBrowserItem(st.st_mtime,tmp,default_name,filename),1);
-  }
+  br->AddItem(ret = 
+              new SceneBrowserItem(mtime,tmp,default_name,filename),1);
 
   return ret;
 };
@@ -384,27 +373,102 @@ SceneBrowserItem *LoopManager::AddSceneToBrowser(Browser *br, char *filename) {
 // Populate the scene browser with any scenes on disk
 void LoopManager::SetupSceneBrowser() {
   Browser *br = app->getBROWSER(B_Scene);
+  if (br != 0)
+    PopulateBrowser(br,LibraryIndexEntry::SCENE);
+};
 
-  if (br != 0) {
-    // Clear
-    br->ClearAllItems();
+// Newest items first, as the file browsers sort them
+static int CompareBrowserItems(const void *a, const void *b) {
+  return (*(BrowserItem **) a)->Compare(*(BrowserItem **) b);
+};
 
-    // Look for scenes on disk 
-    glob_t globbuf;
-    char tmp[FWEELIN_OUTNAME_LEN];
-    snprintf(tmp,FWEELIN_OUTNAME_LEN,"%s/%s*%s",
-             app->getCFG()->GetLibraryPath(),FWEELIN_OUTPUT_SCENE_NAME,
-             FWEELIN_OUTPUT_DATA_EXT);
-    printf("BROWSER: (Scene) Scanning for scenes in library: %s\n",tmp);
-    if (glob(tmp, 0, NULL, &globbuf) == 0) {
-      for (size_t i = 0; i < globbuf.gl_pathc; i++) {
-        // printf("BROWSER: (Scene) Scene: %s\n",globbuf.gl_pathv[i]);
-        AddSceneToBrowser(br,globbuf.gl_pathv[i]);
-      }
-      br->AddDivisions(FWEELIN_FILE_BROWSER_DIVISION_TIME);
-      br->MoveToBeginning();
-      globfree(&globbuf);
+void LoopManager::PopulateBrowser(Browser *br, char type) {
+  // Clear
+  br->ClearAllItems();
+
+  // Look in the library index- only scan the disk if the library has changed
+  if (!libindex->IsCurrent())
+    libindex->Rescan();
+
+  // Make items for all loops/scenes in the index
+  char tmp[FWEELIN_OUTNAME_LEN];
+  libindex->Lock();
+  int cnt = 0;
+  for (LibraryIndexEntry *e = libindex->GetFirst(); e != 0; e = e->next)
+    if (e->type == type)
+      cnt++;
+
+  BrowserItem **items = new BrowserItem *[cnt > 0 ? cnt : 1];
+  int n = 0;
+  for (LibraryIndexEntry *e = libindex->GetFirst(); e != 0; e = e->next)
+    if (e->type == type) {
+      snprintf(tmp,FWEELIN_OUTNAME_LEN,"%s/%s",
+               app->getCFG()->GetLibraryPath(),e->file.c_str());
+      char nametmp[FWEELIN_OUTNAME_LEN];
+      time_t mtime = e->mtime;
+      char default_name = 
+        br->GetDisplayName(tmp,&mtime,nametmp,FWEELIN_OUTNAME_LEN);
+      if (type == LibraryIndexEntry::LOOP)
+        items[n++] = new LoopBrowserItem(mtime,nametmp,default_name,tmp);
+      else
+        items[n++] = new SceneBrowserItem(mtime,nametmp,default_name,tmp);
     }
+  libindex->Unlock();
+
+  // Hand them to the browser in batches, in browser order- so the browser
+  // fills in while we are already playing
+  qsort(items,n,sizeof(BrowserItem *),CompareBrowserItems);
+  int i;
+  for (i = 0; i < n && !scan_stop; i += LIBRARY_SCAN_BATCH) {
+    br->AddItems(items+i,MIN(LIBRARY_SCAN_BATCH,n-i),
+                 FWEELIN_FILE_BROWSER_DIVISION_TIME);
+    sched_yield();
+  }
+
+  // Stopped early?
+  for (; i < n; i++)
+    delete items[i];
+  delete[] items;
+
+  printf("BROWSER: (%s) %d items from library.\n",
+         Browser::GetTypeName(br->GetType()),n);
+};
+
+void *LoopManager::run_scan_thread(void *ptr) {
+  LoopManager *inst = static_cast<LoopManager *>(ptr);
+
+  printf("BROWSER: Start library scan thread.\n");
+  double scantime = mygettime();
+  inst->SetupLoopBrowser();
+  inst->SetupSceneBrowser();
+  printf("BROWSER: Library scan done in %f ms.\n",
+         (mygettime()-scantime) * 1000);
+
+  return 0;
+};
+
+void LoopManager::StartLibraryScan() {
+  if (scan_running)
+    return;
+
+  scan_stop = 0;
+  int ret = pthread_create(&scan_thread,
+                           0,
+                           run_scan_thread,
+                           static_cast<void *>(this));
+  if (ret != 0) {
+    printf("BROWSER: (library scan) pthread_create failed- "
+           "scanning now\n");
+    run_scan_thread(this);
+  } else
+    scan_running = 1;
+};
+
+void LoopManager::EndLibraryScan() {
+  if (scan_running) {
+    scan_stop = 1;
+    pthread_join(scan_thread,0);
+    scan_running = 0;
   }
 };
 
@@ -435,10 +499,18 @@ void LoopManager::ItemRenamed(BrowserItem *item) {
       LoopTrayItem *curl = (LoopTrayItem *) item;
       char *old_filename = 0, 
         *new_filename = 0;
+
+      // Loop may have been erased meanwhile
+      LockLoops();
+      if (app->getTMAP()->SearchMap(curl->l) == -1) {
+        UnlockLoops();
+        break;
+      }
       
       // Rename on disk
       const static char *exts[] = {app->getCFG()->GetAudioFileExt(curl->l->format),
                                    FWEELIN_OUTPUT_DATA_EXT};
+      long long dirbefore = libindex->GetDirTime();
       curl->l->RenameSaveable(app->getCFG()->GetLibraryPath(), 
                               FWEELIN_OUTPUT_LOOP_NAME,
                               curl->l->name, curl->name,
@@ -446,10 +518,12 @@ void LoopManager::ItemRenamed(BrowserItem *item) {
                               &old_filename,
                               &new_filename);
     
-      // We also need to rename in the loop browser
+      // We also need to rename in the loop browser and library index
       if (app->getBROWSER(B_Loop) != 0) 
         app->getBROWSER(B_Loop)->
           ItemRenamedOnDisk(old_filename,new_filename,curl->name);
+      if (new_filename != 0)
+        libindex->Renamed(LibraryIndexEntry::LOOP,new_filename,dirbefore);
       
       if (old_filename != 0)
         delete[] old_filename;
@@ -458,6 +532,7 @@ void LoopManager::ItemRenamed(BrowserItem *item) {
 
       // And in memory..
       RenameLoop(curl->l,curl->name);
+      UnlockLoops();
     }
     break;
 
@@ -476,8 +551,11 @@ void LoopManager::ItemRenamed(BrowserItem *item) {
 
       // Rename all possible audio files + XML metadata to new name
       printf("DISK: Rename '%s'\n",((LoopBrowserItem *) item)->filename);
+      long long dirbefore = libindex->GetDirTime();
       Saveable::RenameSaveable(&((LoopBrowserItem *) item)->filename,baselen,
                                item->name,(const char **) exts,numexts);
+      libindex->Renamed(LibraryIndexEntry::LOOP,
+                        ((LoopBrowserItem *) item)->filename,dirbefore);
 
       // Is this loop loaded? If so, rename it
 
@@ -488,6 +566,7 @@ void LoopManager::ItemRenamed(BrowserItem *item) {
         // Convert text 'fn_hash' to binary hash and scan for it
         Saveable tmp;
         if (!(tmp.SetSaveableHashFromText(fn_hash))) {
+          LockLoops();
           int foundidx;
           if ((foundidx = 
                app->getTMAP()->ScanForHash(tmp.GetSaveHash())) != -1) {
@@ -503,6 +582,7 @@ void LoopManager::ItemRenamed(BrowserItem *item) {
             if (tray != 0)
               tray->ItemRenamedFromOutside(foundloop,item->name);
           }     
+          UnlockLoops();
         }
       }      
     }
@@ -515,8 +595,11 @@ void LoopManager::ItemRenamed(BrowserItem *item) {
       const static char *exts[] = {FWEELIN_OUTPUT_DATA_EXT};
       
       printf("DISK: Rename '%s'\n",((SceneBrowserItem *) item)->filename);
+      long long dirbefore = libindex->GetDirTime();
       Saveable::RenameSaveable(&((SceneBrowserItem *) item)->filename,baselen,
                                item->name,exts,1);
+      libindex->Renamed(LibraryIndexEntry::SCENE,
+                        ((SceneBrowserItem *) item)->filename,dirbefore);
     }
     break;
 
@@ -525,14 +608,609 @@ void LoopManager::ItemRenamed(BrowserItem *item) {
   }
 };
 
+LoopCache::LoopCache(long maxbytes) : newest(0), oldest(0), bytes(0), 
+  maxbytes(maxbytes), hits(0), misses(0), evictions(0) {
+  memset(buckets, 0, sizeof(Entry *) * NUM_BUCKETS);
+  pthread_mutex_init (&cachelock,0);
+};
+
+LoopCache::~LoopCache() {
+  printf("DISK: Loop cache: %d hits, %d misses, %d evictions.\n",
+         hits,misses,evictions);
+
+  while (oldest != 0) {
+    Entry *e = oldest;
+    Unlink(e);
+    e->b->DeleteChain();
+    delete e;
+  }
+
+  pthread_mutex_destroy (&cachelock);
+};
+
+long LoopCache::ChainBytes(AudioBlock *b) {
+  long chans = (b->IsStereo() ? 2 : 1);
+  return (long) b->GetTotalLen() * chans * sizeof(sample_t);
+};
+
+void LoopCache::Unlink(Entry *e) {
+  Entry **prev = &buckets[e->hash[0]];
+  while (*prev != e)
+    prev = &(*prev)->bnext;
+  *prev = e->bnext;
+
+  if (e->newer != 0)
+    e->newer->older = e->older;
+  else
+    newest = e->older;
+  if (e->older != 0)
+    e->older->newer = e->newer;
+  else
+    oldest = e->newer;
+
+  bytes -= e->bytes;
+};
+
+int LoopCache::Put(unsigned char *hash, AudioBlock *b) {
+  long bbytes = ChainBytes(b);
+  if (bbytes > maxbytes)
+    return 1; // Too big to cache (or cache is off)
+
+  pthread_mutex_lock (&cachelock);
+
+  // Make room- erase old chains, and any old copy of this loop
+  Entry *evict = 0;
+  for (Entry *e = buckets[hash[0]]; e != 0; e = e->bnext)
+    if (!memcmp(e->hash,hash,SAVEABLE_HASH_LENGTH))
+      evict = e;
+  while (evict != 0 || bytes + bbytes > maxbytes) {
+    if (evict == 0)
+      evict = oldest;
+    Unlink(evict);
+    evict->b->DeleteChain();
+    delete evict;
+    evictions++;
+    evict = 0;
+  }
+
+  Entry *nw = new Entry();
+  memcpy(nw->hash,hash,SAVEABLE_HASH_LENGTH);
+  nw->b = b;
+  nw->bytes = bbytes;
+  nw->bnext = buckets[hash[0]];
+  buckets[hash[0]] = nw;
+  nw->newer = 0;
+  nw->older = newest;
+  if (newest != 0)
+    newest->newer = nw;
+  else
+    oldest = nw;
+  newest = nw;
+  bytes += bbytes;
+
+  pthread_mutex_unlock (&cachelock);
+  return 0;
+};
+
+AudioBlock *LoopCache::Take(unsigned char *hash) {
+  if (maxbytes <= 0)
+    return 0;
+
+  pthread_mutex_lock (&cachelock);
+
+  Entry *e = buckets[hash[0]];
+  while (e != 0 && memcmp(e->hash,hash,SAVEABLE_HASH_LENGTH))
+    e = e->bnext;
+
+  AudioBlock *b = 0;
+  if (e != 0) {
+    Unlink(e);
+    b = e->b;
+    delete e;
+    hits++;
+  } else
+    misses++;
+
+  pthread_mutex_unlock (&cachelock);
+  return b;
+};
+
+LibraryIndex::LibraryIndex(Fweelin *app) : app(app), first(0), dirmtime(0),
+  current(0), dirty(0) {
+  memset(buckets, 0, sizeof(LibraryIndexEntry *) * NUM_BUCKETS);
+  pthread_mutex_init (&indexlock,0);
+
+  // Read index from library
+  char tmp[FWEELIN_OUTNAME_LEN];
+  snprintf(tmp,FWEELIN_OUTNAME_LEN,"%s/%s",app->getCFG()->GetLibraryPath(),
+           FWEELIN_LIBRARY_INDEX_NAME);
+
+  struct stat st;
+  if (stat(tmp,&st) != 0) {
+    printf("DISK: No library index- library will be scanned.\n");
+    return;
+  }
+
+  xmlDocPtr dat = xmlParseFile(tmp);
+  if (dat == 0) {
+    printf("DISK: Library index '%s' invalid- library will be scanned.\n",
+           tmp);
+    return;
+  }
+
+  xmlNode *root = xmlDocGetRootElement(dat);
+  xmlChar *n;
+  if (!root || !root->name ||
+      xmlStrcmp(root->name,(const xmlChar *) "library") ||
+      (n = xmlGetProp(root,(const xmlChar *) "dirmtime")) == 0) {
+    printf("DISK: Library index '%s' bad format- library will be scanned.\n",
+           tmp);
+    xmlFreeDoc(dat);
+    return;
+  }
+  dirmtime = atoll((char *) n);
+  xmlFree(n);
+
+  int cnt = 0;
+  for (xmlNode *cur_node = root->children; cur_node != NULL;
+       cur_node = cur_node->next) {
+    char type;
+    if (!xmlStrcmp(cur_node->name,(const xmlChar *) FWEELIN_OUTPUT_LOOP_NAME))
+      type = LibraryIndexEntry::LOOP;
+    else if (!xmlStrcmp(cur_node->name,
+                        (const xmlChar *) FWEELIN_OUTPUT_SCENE_NAME))
+      type = LibraryIndexEntry::SCENE;
+    else
+      continue;
+
+    // Hash and name come from the filename
+    LibraryIndexEntry *e = new LibraryIndexEntry();
+    e->type = type;
+    if ((n = xmlGetProp(cur_node,(const xmlChar *) "file")) != 0) {
+      e->file = (char *) n;
+      xmlFree(n);
+    }
+    if (SplitName(type,e->file.c_str(),e->hash,&e->name) ||
+        Find(type,e->hash) != 0) {
+      delete e;
+      continue;
+    }
+
+    if ((n = xmlGetProp(cur_node,(const xmlChar *) "codec")) != 0) {
+      int c = atoi((char *) n);
+      if (c >= FIRST_FORMAT && c < END_OF_FORMATS)
+        e->c = (codec) c;
+      xmlFree(n);
+    }
+    if ((n = xmlGetProp(cur_node,(const xmlChar *) "mtime")) != 0) {
+      e->mtime = (time_t) atol((char *) n);
+      xmlFree(n);
+    }
+    if ((n = xmlGetProp(cur_node,(const xmlChar *) "len")) != 0) {
+      e->len = (nframes_t) atol((char *) n);
+      xmlFree(n);
+    }
+    if ((n = xmlGetProp(cur_node,(const xmlChar *) "nbeats")) != 0) {
+      e->nbeats = atol((char *) n);
+      xmlFree(n);
+    }
+    if ((n = xmlGetProp(cur_node,(const xmlChar *) "pulselen")) != 0) {
+      e->pulselen = atoi((char *) n);
+      xmlFree(n);
+    }
+
+    Insert(e);
+    cnt++;
+  }
+
+  xmlFreeDoc(dat);
+  current = 1;
+  printf("DISK: Library index: %d items.\n",cnt);
+};
+
+LibraryIndex::~LibraryIndex() {
+  Write();
+
+  while (first != 0) {
+    LibraryIndexEntry *e = first;
+    first = first->next;
+    delete e;
+  }
+
+  pthread_mutex_destroy (&indexlock);
+};
+
+int LibraryIndex::SplitName(char type, const char *filename, char *hash,
+                            std::string *name) {
+  const char *base = strrchr(filename,'/');
+  base = (base != 0 ? base+1 : filename);
+
+  const char *prefix = (type == LibraryIndexEntry::LOOP ? 
+                        FWEELIN_OUTPUT_LOOP_NAME : FWEELIN_OUTPUT_SCENE_NAME);
+  int plen = strlen(prefix);
+  if (strncmp(base,prefix,plen) || base[plen] != '-')
+    return 1;
+
+  // Hash follows prefix
+  const char *ptr = base+plen+1;
+  for (int i = 0; i < SAVEABLE_HASH_LENGTH*2; i++, ptr++) {
+    if (!isxdigit(*ptr))
+      return 1;
+    hash[i] = *ptr;
+  }
+  hash[SAVEABLE_HASH_LENGTH*2] = '\0';
+  if (*ptr != '\0' && *ptr != '-' && *ptr != '.')
+    return 1;
+
+  // Optional name follows hash
+  if (name != 0) {
+    if (*ptr == '-') {
+      const char *extptr = strrchr(ptr,'.');
+      *name = (extptr != 0 ? std::string(ptr+1,extptr-ptr-1) : 
+               std::string(ptr+1));
+    } else
+      *name = "";
+  }
+
+  return 0;
+};
+
+int LibraryIndex::GetBucket(const char *hash) {
+  char tmp[3] = {hash[0], hash[1], '\0'};
+  return (int) strtol(tmp,0,16);
+};
+
+std::string LibraryIndex::GetPath(LibraryIndexEntry *e) {
+  std::string s = app->getCFG()->GetLibraryPath();
+  return s + "/" + e->file;
+};
+
+LibraryIndexEntry *LibraryIndex::Find(char type, const char *hash) {
+  for (LibraryIndexEntry *e = buckets[GetBucket(hash)]; e != 0; e = e->bnext)
+    if (e->type == type && !strcasecmp(e->hash,hash))
+      return e;
+  return 0;
+};
+
+void LibraryIndex::Insert(LibraryIndexEntry *e) {
+  int bkt = GetBucket(e->hash);
+  e->bnext = buckets[bkt];
+  buckets[bkt] = e;
+  e->next = first;
+  first = e;
+  dirty = 1;
+};
+
+void LibraryIndex::Remove(LibraryIndexEntry *e) {
+  LibraryIndexEntry **prev = &buckets[GetBucket(e->hash)];
+  while (*prev != e)
+    prev = &(*prev)->bnext;
+  *prev = e->bnext;
+
+  prev = &first;
+  while (*prev != e)
+    prev = &(*prev)->next;
+  *prev = e->next;
+
+  delete e;
+  dirty = 1;
+};
+
+long long LibraryIndex::GetDirTime() {
+  // Nanoseconds- a file copied in within the same second as our own 
+  // write must still change the time
+  struct stat st;
+  if (stat(app->getCFG()->GetLibraryPath(),&st) == 0)
+#ifdef __MACOSX__
+    return (long long) st.st_mtimespec.tv_sec * 1000000000LL + 
+      st.st_mtimespec.tv_nsec;
+#else
+    return (long long) st.st_mtim.tv_sec * 1000000000LL + 
+      st.st_mtim.tv_nsec;
+#endif
+  return 0;
+};
+
+void LibraryIndex::Touch(long long before) {
+  if (!current)
+    return;
+
+  if (before == dirmtime) {
+    // Only our own change since the index was current
+    long long now = GetDirTime();
+    if (now != dirmtime) {
+      dirmtime = now;
+      dirty = 1;
+    }
+  } else
+    // Library changed behind our back- scan next time
+    current = 0;
+};
+
+char LibraryIndex::IsCurrent() {
+  pthread_mutex_lock (&indexlock);
+  char ret = (current && GetDirTime() == dirmtime);
+  pthread_mutex_unlock (&indexlock);
+  return ret;
+};
+
+void LibraryIndex::ScanFiles(char type, const char *pattern, codec c) {
+  glob_t globbuf;
+  if (glob(pattern, 0, NULL, &globbuf) == 0) {
+    for (size_t i = 0; i < globbuf.gl_pathc; i++) {
+      char hash[SAVEABLE_HASH_LENGTH*2+1];
+      std::string name;
+      if (SplitName(type,globbuf.gl_pathv[i],hash,&name))
+        continue;
+
+      const char *base = strrchr(globbuf.gl_pathv[i],'/');
+      base = (base != 0 ? base+1 : globbuf.gl_pathv[i]);
+
+      LibraryIndexEntry *e = Find(type,hash);
+      if (e != 0) {
+        if (e->seen)
+          continue; // Same loop, other format- first format found wins
+        e->seen = 1;
+        if (e->file == base)
+          continue; // Already known- no need to look at the file
+      } else {
+        e = new LibraryIndexEntry();
+        e->type = type;
+        strcpy(e->hash,hash);
+        e->seen = 1;
+        Insert(e);
+      }
+
+      // New or renamed file
+      struct stat st;
+      e->file = base;
+      e->name = name;
+      e->c = c;
+      e->mtime = (stat(globbuf.gl_pathv[i],&st) == 0 ? st.st_mtime : 0);
+      dirty = 1;
+    }
+    globfree(&globbuf);
+  }
+};
+
+void LibraryIndex::Rescan() {
+  pthread_mutex_lock (&indexlock);
+
+  // Directory time before scanning- any change made during the scan
+  // will cause another scan next time
+  long long scantime = GetDirTime();
+  for (LibraryIndexEntry *e = first; e != 0; e = e->next)
+    e->seen = 0;
+
+  char tmp[FWEELIN_OUTNAME_LEN];
+  for (codec lformat = FIRST_FORMAT; lformat < END_OF_FORMATS; 
+       lformat = (codec) (lformat+1)) {
+    snprintf(tmp,FWEELIN_OUTNAME_LEN,"%s/%s*%s",
+             app->getCFG()->GetLibraryPath(),FWEELIN_OUTPUT_LOOP_NAME,
+             app->getCFG()->GetAudioFileExt(lformat)); 
+    printf("DISK: Scanning for loops in library: %s\n",tmp);
+    ScanFiles(LibraryIndexEntry::LOOP,tmp,lformat);
+  }
+  snprintf(tmp,FWEELIN_OUTNAME_LEN,"%s/%s*%s",
+           app->getCFG()->GetLibraryPath(),FWEELIN_OUTPUT_SCENE_NAME,
+           FWEELIN_OUTPUT_DATA_EXT);
+  printf("DISK: Scanning for scenes in library: %s\n",tmp);
+  ScanFiles(LibraryIndexEntry::SCENE,tmp,UNKNOWN);
+
+  // Drop files which are gone
+  LibraryIndexEntry *e = first;
+  while (e != 0) {
+    LibraryIndexEntry *nxt = e->next;
+    if (!e->seen)
+      Remove(e);
+    e = nxt;
+  }
+
+  dirmtime = scantime;
+  current = 1;
+  dirty = 1;
+
+  pthread_mutex_unlock (&indexlock);
+
+  Write();
+};
+
+void LibraryIndex::Write() {
+  pthread_mutex_lock (&indexlock);
+  if (!dirty || !current) {
+    pthread_mutex_unlock (&indexlock);
+    return;
+  }
+
+  char tmp[FWEELIN_OUTNAME_LEN];
+  snprintf(tmp,FWEELIN_OUTNAME_LEN,"%s/%s",app->getCFG()->GetLibraryPath(),
+           FWEELIN_LIBRARY_INDEX_NAME);
+
+  // Creating the index changes the library directory- 
+  // in that case, write twice so the index records the new time
+  struct stat st;
+  int passes = (stat(tmp,&st) == 0 ? 1 : 2);
+  long long before = GetDirTime();
+  for (int p = 0; p < passes; p++) {
+    if (p == 1) {
+      // Unless someone else changed the library meanwhile
+      Touch(before);
+      if (!current)
+        break;
+    }
+
+    xmlDocPtr ldat = xmlNewDoc((xmlChar *) "1.0");
+    if (ldat == 0)
+      break;
+
+    const static int XT_LEN = 32;
+    char xmltmp[XT_LEN];
+
+    ldat->children = xmlNewDocNode(ldat,0,(xmlChar *) "library",0);
+    snprintf(xmltmp,XT_LEN,"%lld",dirmtime);
+    xmlSetProp(ldat->children,(xmlChar *) "dirmtime",(xmlChar *) xmltmp);
+
+    for (LibraryIndexEntry *e = first; e != 0; e = e->next) {
+      xmlNodePtr nd = xmlNewChild(ldat->children, 0, (xmlChar *) 
+                                  (e->type == LibraryIndexEntry::LOOP ?
+                                   FWEELIN_OUTPUT_LOOP_NAME :
+                                   FWEELIN_OUTPUT_SCENE_NAME), 0);
+      xmlSetProp(nd,(xmlChar *) "hash",(xmlChar *) e->hash);
+      xmlSetProp(nd,(xmlChar *) "name",(xmlChar *) e->name.c_str());
+      xmlSetProp(nd,(xmlChar *) "file",(xmlChar *) e->file.c_str());
+      snprintf(xmltmp,XT_LEN,"%ld",(long) e->mtime);
+      xmlSetProp(nd,(xmlChar *) "mtime",(xmlChar *) xmltmp);
+      if (e->type == LibraryIndexEntry::LOOP) {
+        snprintf(xmltmp,XT_LEN,"%d",(int) e->c);
+        xmlSetProp(nd,(xmlChar *) "codec",(xmlChar *) xmltmp);
+        snprintf(xmltmp,XT_LEN,"%ld",(long) e->len);
+        xmlSetProp(nd,(xmlChar *) "len",(xmlChar *) xmltmp);
+        snprintf(xmltmp,XT_LEN,"%ld",e->nbeats);
+        xmlSetProp(nd,(xmlChar *) "nbeats",(xmlChar *) xmltmp);
+        snprintf(xmltmp,XT_LEN,"%d",e->pulselen);
+        xmlSetProp(nd,(xmlChar *) "pulselen",(xmlChar *) xmltmp);
+      }
+    }
+
+    if (xmlSaveFormatFile(tmp,ldat,1) < 0)
+      printf("DISK: ERROR: Can't write library index '%s'\n",tmp);
+    xmlFreeDoc(ldat);
+  }
+  dirty = 0;
+
+  pthread_mutex_unlock (&indexlock);
+};
+
+char LibraryIndex::FindLoop(const char *stubname, LibraryFileInfo *ret) {
+  char hash[SAVEABLE_HASH_LENGTH*2+1];
+  if (SplitName(LibraryIndexEntry::LOOP,stubname,hash,0))
+    return 0;
+
+  pthread_mutex_lock (&indexlock);
+  LibraryIndexEntry *e = Find(LibraryIndexEntry::LOOP,hash);
+  std::string path;
+  codec c = UNKNOWN;
+  if (e != 0) {
+    path = GetPath(e);
+    c = e->c;
+  }
+  pthread_mutex_unlock (&indexlock);
+
+  // Index entry must match the stub given
+  if (e == 0 || c == UNKNOWN || strncmp(path.c_str(),stubname,strlen(stubname)))
+    return 0;
+
+  // Check that the file is still there
+  struct stat st;
+  if (stat(path.c_str(),&st) != 0) {
+    printf("DISK: Library index: '%s' is gone.\n",path.c_str());
+    pthread_mutex_lock (&indexlock);
+    if ((e = Find(LibraryIndexEntry::LOOP,hash)) != 0)
+      Remove(e);
+    pthread_mutex_unlock (&indexlock);
+    return 0;
+  }
+
+  ret->exists = 1;
+  ret->c = c;
+  ret->name = path;
+  return 1;
+};
+
+void LibraryIndex::Add(char type, const char *filename, codec c, 
+                       time_t mtime, nframes_t len, long nbeats, 
+                       int pulselen) {
+  char hash[SAVEABLE_HASH_LENGTH*2+1];
+  std::string name;
+  if (SplitName(type,filename,hash,&name))
+    return;
+
+  const char *base = strrchr(filename,'/');
+  base = (base != 0 ? base+1 : filename);
+
+  pthread_mutex_lock (&indexlock);
+  LibraryIndexEntry *e = Find(type,hash);
+  if (e == 0) {
+    e = new LibraryIndexEntry();
+    e->type = type;
+    strcpy(e->hash,hash);
+    Insert(e);
+  }
+  e->file = base;
+  e->name = name;
+  e->c = c;
+  e->mtime = mtime;
+  if (len != 0) {
+    e->len = len;
+    e->nbeats = nbeats;
+    e->pulselen = pulselen;
+  }
+  dirty = 1;
+  pthread_mutex_unlock (&indexlock);
+};
+
+void LibraryIndex::SetLoopInfo(unsigned char *hash, nframes_t len, 
+                               long nbeats, int pulselen) {
+  GET_SAVEABLE_HASH_TEXT(hash);
+
+  pthread_mutex_lock (&indexlock);
+  LibraryIndexEntry *e = Find(LibraryIndexEntry::LOOP,hashtext);
+  if (e != 0 && (e->len != len || e->nbeats != nbeats || 
+                 e->pulselen != pulselen)) {
+    e->len = len;
+    e->nbeats = nbeats;
+    e->pulselen = pulselen;
+    dirty = 1;
+  }
+  pthread_mutex_unlock (&indexlock);
+};
+
+void LibraryIndex::Renamed(char type, const char *newstub, long long before) {
+  char hash[SAVEABLE_HASH_LENGTH*2+1];
+  std::string name;
+  if (SplitName(type,newstub,hash,&name))
+    return;
+
+  const char *base = strrchr(newstub,'/');
+  base = (base != 0 ? base+1 : newstub);
+
+  pthread_mutex_lock (&indexlock);
+  LibraryIndexEntry *e = Find(type,hash);
+  if (e != 0) {
+    // Keep the extension
+    std::string::size_type extpos = e->file.rfind('.');
+    e->file = std::string(base) + 
+      (extpos != std::string::npos ? e->file.substr(extpos) : "");
+    e->name = name;
+    dirty = 1;
+    Touch(before);
+  } else
+    // Renamed something we don't know about
+    current = 0;
+  pthread_mutex_unlock (&indexlock);
+};
+
+void LibraryIndex::FileWritten(long long before) {
+  pthread_mutex_lock (&indexlock);
+  Touch(before);
+  pthread_mutex_unlock (&indexlock);
+};
+
 LoopManager::LoopManager (Fweelin *app) : 
   renamer(0), rename_loop(0), 
-  savequeue(0), loadqueue(0), cursave(0), curload(0), numsave(0), numload(0),
+  savequeue(0), saving(0), loadqueue(0), loading(0), cursave(0), curload(0), numsave(0), numload(0),
   loadloopid(0), needs_saving_stamp(0),
   default_looprange(Range(0,app->getCFG()->GetNumTriggers())),
 
-  autosave(0), app(app), newloopvol(1.0), subdivide(1), curpulseindex(-1) {
-  pthread_mutex_init (&loops_lock,0);
+  autosave(0), app(app), scan_running(0), scan_stop(0),
+  newloopvol(1.0), subdivide(1), curpulseindex(-1) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init (&attr);
+  pthread_mutexattr_settype (&attr,PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init (&loops_lock,&attr);
+  pthread_mutexattr_destroy (&attr);
+  pthread_mutex_init (&loadlock,0);
+  pthread_mutex_init (&savelock,0);
 
   int mapsz = app->getTMAP()->GetMapSize();
 
@@ -562,12 +1240,30 @@ LoopManager::LoopManager (Fweelin *app) :
   memset(waitactivate_od_fb, 0, sizeof(float) * mapsz);
   memset(pulses, 0, sizeof(Pulse *) * MAX_PULSES);
 
-  // Turn on block read/write managers for loading & saving loops
-  bread = ::new BlockReadManager(0,this,app->getBMG(),
-                                 app->getCFG()->loop_peaksavgs_chunksize);
-  bwrite = ::new BlockWriteManager(0,this,app->getBMG());
-  app->getBMG()->AddManager(bread);
-  app->getBMG()->AddManager(bwrite);
+  // Index of loops & scenes on disk
+  libindex = new LibraryIndex(app);
+
+  // Turn on block read/write managers for loading & saving loops.
+  // Their threads hold ring buffer writer slots for good- leave slots for
+  // the threads started after us: one disk streamer per input, the final
+  // and loop mix streamers, and the audio, MIDI and SDL threads
+  int laterthreads = app->getISET()->GetNumInputs() + 2 + 3,
+    poolslots = RT_RWThreads::GetNumFree() - laterthreads;
+  if (poolslots < 2) {
+    printf("CORE: ERROR: Too many threads- no room for loop decoders and "
+           "encoders!\n");
+    exit(1);
+  }
+  bread = ::new BlockReadPool(this,app->getBMG(),
+                              app->getCFG()->loop_peaksavgs_chunksize,
+                              0,poolslots/2);
+  bwrite = ::new BlockWritePool(this,app->getBMG(),
+                               app->getCFG()->GetLoopSaveEncoders(),
+                               app->getCFG()->GetLoopSaveRate() *
+                               app->getAUDIO()->get_srate(),
+                               poolslots - bread->GetNumDecoders());
+  loopcache = new LoopCache((long) (app->getCFG()->GetLoopCacheSize() * 
+                                    1024 * 1024));
 
   // Listen for important events
   app->getEMG()->ListenEvent(this,0,T_EV_EndRecord);
@@ -602,6 +1298,7 @@ LoopManager::LoopManager (Fweelin *app) :
   app->getEMG()->ListenEvent(this,0,T_EV_SetSyncType);
   app->getEMG()->ListenEvent(this,0,T_EV_SetSyncSpeed);
   app->getEMG()->ListenEvent(this,0,T_EV_SetMidiSync);
+  app->getEMG()->ListenEvent(this,0,T_EV_SetMidiSyncReceive);
 
   app->getEMG()->ListenEvent(this,0,T_EV_SetTriggerVolume);
   app->getEMG()->ListenEvent(this,0,T_EV_SlideLoopAmp);
@@ -623,11 +1320,15 @@ LoopManager::LoopManager (Fweelin *app) :
 };
 
 LoopManager::~LoopManager() { 
+  EndLibraryScan();
+
   // Stop block read/write managers
-  bread->End(0);
+  bread->End();
+  delete bread;
   bwrite->End();
-  app->getBMG()->DelManager(bread);
-  app->getBMG()->DelManager(bwrite);
+  delete bwrite;
+  delete loopcache;
+  delete libindex;
 
   Loop::TakedownLoopPreallocation();
 
@@ -664,6 +1365,7 @@ LoopManager::~LoopManager() {
   app->getEMG()->UnlistenEvent(this,0,T_EV_SetSyncType);
   app->getEMG()->UnlistenEvent(this,0,T_EV_SetSyncSpeed);
   app->getEMG()->UnlistenEvent(this,0,T_EV_SetMidiSync);
+  app->getEMG()->UnlistenEvent(this,0,T_EV_SetMidiSyncReceive);
 
   app->getEMG()->UnlistenEvent(this,0,T_EV_SetTriggerVolume);
   app->getEMG()->UnlistenEvent(this,0,T_EV_SlideLoopAmp);
@@ -684,7 +1386,9 @@ LoopManager::~LoopManager() {
   app->getEMG()->UnlistenEvent(this,0,T_EV_ALSAMixerControlSet);
 
   EventManager::DeleteQueue(savequeue);
+  EventManager::DeleteQueue(saving);
   EventManager::DeleteQueue(loadqueue);
+  EventManager::DeleteQueue(loading);
 
   // Let BMG know that we are ending
   app->getBMG()->RefDeleted((AutoWriteControl *) this);
@@ -697,6 +1401,8 @@ LoopManager::~LoopManager() {
   delete[] waitactivate_od_fb;
 
   pthread_mutex_destroy (&loops_lock);
+  pthread_mutex_destroy (&loadlock);
+  pthread_mutex_destroy (&savelock);
 };
 
 // Get length returns the length of any loop on the specified index
@@ -1088,6 +1794,8 @@ void TriggerMap::GoSave(char *filename) {
 
       xmlSaveFormatFile(tmp,ldat,1);
       xmlFreeDoc(ldat);
+      app->getLOOPMGR()->GetLibraryIndex()->
+        Add(LibraryIndexEntry::SCENE,tmp,UNKNOWN,time(0));
 
       if (newScene) {
         // Add scene to browser so we can load it
@@ -1108,8 +1816,10 @@ void LoopManager::CheckSaveMap() {
   if (needs_saving_stamp != app->getTMAP()->GetLastUpdate()) {
     //printf("Rebuild save map.\n");
 
-    // No, rebuild!
-    numsave = 0;
+    // No, rebuild! Loops being saved now still count toward the total
+    numsave = cursave;
+    for (Event *cur = saving; cur != 0; cur = cur->next)
+      numsave++;
     savequeue = EventManager::DeleteQueue(savequeue);
 
     // Scan for loops that haven't yet been saved, add them to our list
@@ -1140,8 +1850,6 @@ void LoopManager::SetupSaveLoop(Loop *l, int /*l_idx*/, FILE **out,
                                 AudioBlock **b, 
                                 AudioBlockIterator **i,
                                 nframes_t *len) {
-  const static nframes_t LOOP_HASH_CHUNKSIZE = 10000;
-
   if (l->GetSaveStatus() == NO_SAVE) {
     // Now return blocks from this loop to save
     *b = l->blocks;
@@ -1157,56 +1865,22 @@ void LoopManager::SetupSaveLoop(Loop *l, int /*l_idx*/, FILE **out,
       *len = l->blocks->GetTotalLen();
     *i = 0;
     
-    // Generate hash from audio data
-    double hashtime = mygettime();
-
-    // *** Hopefully this won't take so long- or we may have to split it up
-    // as we split up the write phase
-    AudioBlockIterator *hashi = new AudioBlockIterator(l->blocks,
-                                                       LOOP_HASH_CHUNKSIZE);
-    md5_ctx md5gen;
-    md5_init(&md5gen);
-    char go = 1;
-    char stereo = l->blocks->IsStereo();
-    
-    do {
-      nframes_t pos = hashi->GetTotalLength2Cur(),
-        remaining = *len-pos;
-      nframes_t num = MIN(LOOP_HASH_CHUNKSIZE,remaining);
-      
-      sample_t *ibuf[2];
-
-      if (stereo) {
-        // Stereo
-        hashi->GetFragment(&ibuf[0],&ibuf[1]);
-        const uint8_t data0 = (uint8_t)(*ibuf[0] * (sample_t)256.0);
-        const uint8_t data1 = (uint8_t)(*ibuf[1] * (sample_t)256.0);
-        md5_update(&md5gen,sizeof(uint8_t) * num,&data0);
-        md5_update(&md5gen,sizeof(uint8_t) * num,&data1);
-      } else {
-        // Mono
-        hashi->GetFragment(&ibuf[0],0);
-        const uint8_t data = (uint8_t)(*ibuf[0] * (sample_t)256.0);
-        md5_update(&md5gen,sizeof(uint8_t) * num,&data);
-      }
-
-      if (remaining <= LOOP_HASH_CHUNKSIZE) {
-        // Finished encoding
-        go = 0;
-      } else
-        hashi->NextFragment();
-    } while (go);
-    
-    // Done- compute final hash
-    md5_digest(&md5gen,SAVEABLE_HASH_LENGTH,l->GetSaveHash());
+    if (!l->IsHashReady()) {
+      // No hash from recording (loop was overdubbed)- 
+      // generate hash from audio data
+      double hashtime = mygettime();
+      BlockHashManager::HashChain(l->blocks,*len,l->GetSaveHash(),
+                                  SAVEABLE_HASH_LENGTH);
+      l->SetHashReady(1);
+
+      double dhashtime = mygettime()-hashtime;
+      printf("HASH TIME: %f ms\n",dhashtime * 1000);
+    }
     l->SetSaveStatus(SAVE_DONE);
-    delete hashi;
-
-    double dhashtime = mygettime()-hashtime;
-    printf("HASH TIME: %f ms\n",dhashtime * 1000);
 
     // Compose filenames & start writing
-    char tmp[FWEELIN_OUTNAME_LEN];
+    char tmp[FWEELIN_OUTNAME_LEN],
+      savename[FWEELIN_OUTNAME_LEN];
     GET_SAVEABLE_HASH_TEXT(l->GetSaveHash());
     if (l->name == 0 || strlen(l->name) == 0)
       snprintf(tmp,FWEELIN_OUTNAME_LEN,"%s/%s-%s%s",
@@ -1233,6 +1907,7 @@ void LoopManager::SetupSaveLoop(Loop *l, int /*l_idx*/, FILE **out,
       }
     } else {
       // Go save!
+      long long dirbefore = libindex->GetDirTime();
       *out = fopen(tmp,"wb");
       if (*out == 0) {
         printf("DISK: ERROR: Couldn't open file! Does the folder exist and "
@@ -1245,11 +1920,16 @@ void LoopManager::SetupSaveLoop(Loop *l, int /*l_idx*/, FILE **out,
           *out = 0;
         }       
       } else {
+        strcpy(savename,tmp);
+
         // Add loop to browser so we can load it
         Browser *br = app->getBROWSER(B_Loop);
         if (br != 0) {
+          // Other encoders may be adding too
+          pthread_mutex_lock (&savelock);
           AddLoopToBrowser(br,tmp);
           br->AddDivisions(FWEELIN_FILE_BROWSER_DIVISION_TIME);
+          pthread_mutex_unlock (&savelock);
         }
 
         // Main file open, now save loop XML data
@@ -1289,6 +1969,15 @@ void LoopManager::SetupSaveLoop(Loop *l, int /*l_idx*/, FILE **out,
           xmlSaveFormatFile(tmp,ldat,1);
           xmlFreeDoc(ldat);
         }
+
+        // Peaks/avgs from recording, so they needn't be computed on load
+        SavePeaksAvgs(l,0);
+
+        // Both files are in place- add to library index
+        libindex->Add(LibraryIndexEntry::LOOP,savename,
+                      app->getCFG()->GetLoopOutFormat(),time(0),*len,
+                      l->nbeats,(l->pulse != 0 ? l->pulse->GetLength() : 0));
+        libindex->FileWritten(dirbefore);
       }
     }
   } else {
@@ -1305,7 +1994,8 @@ void LoopManager::SetupSaveLoop(Loop *l, int /*l_idx*/, FILE **out,
 };
 
 // Loads loop XML data & prepares to load loop audio
-int LoopManager::SetupLoadLoop(FILE **in, char *smooth_end, Loop **new_loop,
+int LoopManager::SetupLoadLoop(FILE **in, char *smooth_end, codec *type,
+                               Loop **new_loop,
                                int /*l_idx*/, float l_vol, char *l_filename) {
   // Open up right file and begin loading
   LibraryFileInfo f = LibraryHelper::GetLoopFilenameFromStub(app,l_filename);
@@ -1313,7 +2003,7 @@ int LoopManager::SetupLoadLoop(FILE **in, char *smooth_end, Loop **new_loop,
   if (f.c != UNKNOWN) {
     printf("DISK: Open loop '%s'\n",f.name.c_str());
     *in = fopen(f.name.c_str(),"rb");
-    bread->SetLoopType(f.c);
+    *type = f.c;
   } else {
     if (*in == 0) {
       printf("DISK: ERROR: Couldn't open loop '%s'!\n",l_filename);
@@ -1434,12 +2124,20 @@ void LoopManager::RenameLoop(int loopid) {
 };
 
 void LoopManager::ItemRenamed(char *nw) {
+  // Loop may have been erased while it was being renamed
+  LockLoops();
+  if (nw != 0 && app->getTMAP()->SearchMap(rename_loop) == -1) {
+    printf("RENAME: Loop no longer exists- abort rename!\n");
+    nw = 0;
+  }
+
   if (nw != 0) {
     // Rename on disk
     const static char *exts[] = {app->getCFG()->GetAudioFileExt(rename_loop->format), 
                                  FWEELIN_OUTPUT_DATA_EXT};
     char *old_filename = 0, 
       *new_filename = 0;
+    long long dirbefore = libindex->GetDirTime();
     rename_loop->RenameSaveable(app->getCFG()->GetLibraryPath(), 
                                 FWEELIN_OUTPUT_LOOP_NAME,
                                 rename_loop->name, nw,
@@ -1447,10 +2145,12 @@ void LoopManager::ItemRenamed(char *nw) {
                                 &old_filename,
                                 &new_filename);
     
-    // We also need to rename in the loop browser
+    // We also need to rename in the loop browser and library index
     if (app->getBROWSER(B_Loop) != 0) 
       app->getBROWSER(B_Loop)->
         ItemRenamedOnDisk(old_filename,new_filename,nw);
+    if (new_filename != 0)
+      libindex->Renamed(LibraryIndexEntry::LOOP,new_filename,dirbefore);
     
     if (old_filename != 0)
       delete[] old_filename;
@@ -1474,11 +2174,20 @@ void LoopManager::ItemRenamed(char *nw) {
     renamer = 0;
     rename_loop = 0;
   }
+  UnlockLoops();
 };
 
+// We receive calls periodically for saving of loops- each encoder thread
+// takes the next loop from the save queue, hashes it and returns its
+// blocks to encode, so several loops save at once
 void LoopManager::GetWriteBlock(FILE **out, AudioBlock **b, 
                                 AudioBlockIterator **i,
-                                nframes_t *len) {
+                                nframes_t *len, void **job) {
+  // Loops in the save queue are checked against the map, and scenes are
+  // written from it- don't let them be erased meanwhile
+  LockLoops();
+  pthread_mutex_lock (&savelock);
+
   // If we are autosaving, check that our list is up to date
   if (autosave)
     CheckSaveMap();
@@ -1487,7 +2196,7 @@ void LoopManager::GetWriteBlock(FILE **out, AudioBlock **b,
   Event *cur = savequeue,
     *prev = 0;
 
-  if (cursave >= numsave) {
+  if (cursave >= numsave && saving == 0) {
     numsave = 0;
     cursave = 0;
   }
@@ -1497,17 +2206,31 @@ void LoopManager::GetWriteBlock(FILE **out, AudioBlock **b,
   while (cur != 0 && go) {
     if (cur->GetType() == T_EV_LoopList) {
       // Loop in save queue- does it exist and is it ready to save?
-      if ((l_idx = app->getTMAP()->SearchMap(((LoopListEvent *) cur)->l)) == -1
+      Loop *l = ((LoopListEvent *) cur)->l;
+      char inflight = 0;
+      for (Event *s = saving; s != 0 && !inflight; s = s->next)
+        if (((LoopListEvent *) s)->l == l)
+          inflight = 1;
+
+      if ((l_idx = app->getTMAP()->SearchMap(l)) == -1
           || GetStatus(l_idx) == T_LS_Overdubbing
           || GetStatus(l_idx) == T_LS_Recording) {
         if (l_idx == -1) {
           printf("DEBUG: Loop no longer exists- abort save!\n");
           EventManager::RemoveEvent(&savequeue,prev,&cur);
+          cursave++;
           advance = 0;
         }
 
         // If we are overdubbing or recording, just ignore this loop
         // we will come back to it
+      } else if (inflight) {
+        // Another encoder is saving this loop- come back to it
+      } else if (l->GetSaveStatus() != NO_SAVE) {
+        // Saved since it was queued
+        EventManager::RemoveEvent(&savequeue,prev,&cur);
+        cursave++;
+        advance = 0;
       } else {
         go = 0; // Found a suitable loop to save- stop!
         advance = 0;
@@ -1515,7 +2238,7 @@ void LoopManager::GetWriteBlock(FILE **out, AudioBlock **b,
     } else {
       if (cur->GetType() == T_EV_SceneMarker) {
         // Scene marker in queue indicates we need to save a scene-
-        if (cur == savequeue) {
+        if (cur == savequeue && saving == 0) {
           // No loops are waiting to be saved.. go
           app->getTMAP()->GoSave(((SceneMarkerEvent *) cur)->s_filename);
           EventManager::RemoveEvent(&savequeue,prev,&cur);
@@ -1534,20 +2257,38 @@ void LoopManager::GetWriteBlock(FILE **out, AudioBlock **b,
       advance = 1;
   }
 
+  Loop *curl = 0;
   if (cur != 0) {
     if (cur->GetType() != T_EV_LoopList) {
       printf("DISK: ERROR: LoopList event type mismatch!\n");
       EventManager::RemoveEvent(&savequeue,prev,&cur);
     } else {
-      // Remove from list
-      Loop *curl = ((LoopListEvent *) cur)->l;
-      EventManager::RemoveEvent(&savequeue,prev,&cur);
+      // Move to the list of loops being saved
+      LoopListEvent *ll = (LoopListEvent *) cur;
+      curl = ll->l;
+      EventManager::UnlinkEvent(&savequeue,prev,&cur);
+      EventManager::QueueEvent(&saving,ll);
+      *job = ll;
+    }
+  }
 
-      // Open up right files, save data & setup for audio save
-      SetupSaveLoop(curl,l_idx,out,b,i,len);
-      cursave++;
+  pthread_mutex_unlock (&savelock);
+
+  if (curl != 0) {
+    // Open up right files, save data & setup for audio save-
+    // outside the save lock, so other encoders can queue meanwhile. The
+    // loops stay locked so the loop can't be erased while its XML and 
+    // chain are taken
+    SetupSaveLoop(curl,l_idx,out,b,i,len);
+    UnlockLoops();
+    if (*b == 0 && *job != 0) {
+      // Nothing to write for this loop
+      WriteComplete(*job);
+      *job = 0;
     }
   } else {
+    UnlockLoops();
+
     // No loops to save right now
     *b = 0;
     *len = 0;
@@ -1559,31 +2300,85 @@ void LoopManager::GetWriteBlock(FILE **out, AudioBlock **b,
   }
 }
 
-// We receive calls periodically for loading of loops-
-void LoopManager::GetReadBlock(FILE **in, char *smooth_end) {
-  if (curload >= numload) {
+void LoopManager::WriteComplete(void *job) {
+  pthread_mutex_lock (&savelock);
+
+  Event *cur = saving,
+    *prev = 0;
+  while (cur != 0 && cur != job) {
+    prev = cur;
+    cur = cur->next;
+  }
+
+  if (cur == 0)
+    printf("DISK: ERROR: Save list mismatch!\n");
+  else {
+    EventManager::RemoveEvent(&saving,prev,&cur);
+    cursave++;
+  }
+
+  pthread_mutex_unlock (&savelock);
+}
+
+// We receive calls periodically for loading of loops- each decoder thread
+// takes the next loop from the load queue, so several loops decode at once
+void LoopManager::GetReadBlock(FILE **in, char *smooth_end, codec *type,
+                               void **job) {
+  pthread_mutex_lock (&loadlock);
+
+  if (curload >= numload && loading == 0) {
     numload = 0;
     curload = 0;
   }
 
   // Do we have a loop to load?
-  Event *cur = loadqueue;
-  if (cur != 0) {
+  Event *cur = loadqueue,
+    *prev = 0;
+  while (cur != 0 && *job == 0) {
     if (cur->GetType() == T_EV_LoopList) {
-      // Open up right files, load data & setup for audio load
       LoopListEvent *ll = (LoopListEvent *) cur;
-      if (SetupLoadLoop(in,smooth_end,
-                        &ll->l,ll->l_idx,ll->l_vol,ll->l_filename)) {
+
+      // If the same loop is being decoded now, leave it in the queue- 
+      // once loaded, it will be found as a duplicate
+      char inflight = 0;
+      for (Event *l = loading; l != 0 && !inflight; l = l->next)
+        if (!strcmp(((LoopListEvent *) l)->l_filename,ll->l_filename))
+          inflight = 1;
+
+      if (inflight) {
+        prev = cur;
+        cur = cur->next;
+      } else if (SetupLoadLoop(in,smooth_end,type,
+                               &ll->l,ll->l_idx,ll->l_vol,ll->l_filename)) {
         // Not a loop or there was an error in loading
-        EventManager::RemoveEvent(&loadqueue,0,&cur);
+        EventManager::RemoveEvent(&loadqueue,prev,&cur);
         curload++;
+      } else {
+        AudioBlock *cached = loopcache->Take(ll->l->GetSaveHash());
+        if (cached != 0) {
+          // Audio is still in memory- no need to decode
+          printf("DISK: Loop '%s' loaded from cache.\n",ll->l_filename);
+          fclose(*in);
+          *in = 0;
+
+          PlaceLoadedLoop(ll,cached);
+          EventManager::RemoveEvent(&loadqueue,prev,&cur);
+          curload++;
+        } else {
+          // Loop is set up- move it to the list of loops being decoded
+          EventManager::UnlinkEvent(&loadqueue,prev,&cur);
+          EventManager::QueueEvent(&loading,ll);
+          *job = ll;
+        }
       }
     } else {
       // Not a loop- remove
-      EventManager::RemoveEvent(&loadqueue,0,&cur);
+      EventManager::RemoveEvent(&loadqueue,prev,&cur);
       curload++;
     }
-  } else {
+  }
+
+  if (*job == 0) {
     // Nothing to load right now
     if (*in != 0) {
       printf("DISK: (Load) Nothing to load- close input!\n");
@@ -1591,48 +2386,120 @@ void LoopManager::GetReadBlock(FILE **in, char *smooth_end) {
       *in = 0;
     }
   }
+
+  pthread_mutex_unlock (&loadlock);
 }
 
-void LoopManager::ReadComplete(AudioBlock *b) {
+void LoopManager::ReadComplete(AudioBlock *b, void *job) {
+  Loop *savepa = 0;
+  int savepa_idx = -1;
+
+  pthread_mutex_lock (&loadlock);
+
   curload++;
 
-  // Add loop to triggermap and remove from load queue
-  Event *cur = loadqueue;
-  if (cur == 0 || cur->GetType() != T_EV_LoopList)
+  // Add loop to triggermap and remove from the loops being decoded
+  Event *cur = loading,
+    *prev = 0;
+  while (cur != 0 && cur != job) {
+    prev = cur;
+    cur = cur->next;
+  }
+
+  if (cur == 0)
     printf("DISK: ERROR: Load list mismatch!\n");
   else {
     if (b == 0)
       printf("DISK: ERROR: .. during load!\n");
     else {
-      LoopListEvent *ll = (LoopListEvent *) cur;
+      PlaceLoadedLoop((LoopListEvent *) cur,b);
 
-      // Put blocks into loop
-      ll->l->blocks = b;
+      // Loops saved before peaks/avgs files were- save them below,
+      // without holding up loading
+      savepa = ((LoopListEvent *) cur)->l;
+      savepa_idx = ((LoopListEvent *) cur)->l_idx;
+    }
 
-      if (app->getTMAP()->GetMap(ll->l_idx) != 0) {
-        // Loop ID is full. Choose another
-        int newidx = app->getTMAP()->GetFirstFree(default_looprange.lo,
-                                                  default_looprange.hi);
-        
-        if (newidx != -1) {
-          printf("LOOP MANAGER: LoopID #%d full, got new ID: #%d!\n",
-                 ll->l_idx,newidx);
-          ll->l_idx = newidx;
-        } else {
-          printf("LOOP MANAGER: No free loopids in default placement range.\n"
-                 "I will erase the loop at id #%d.\n",ll->l_idx);
-          DeleteLoop(ll->l_idx);
-        }
-      }
+    // And remove from load list
+    EventManager::RemoveEvent(&loading,prev,&cur);
+  }
+
+  pthread_mutex_unlock (&loadlock);
 
-      // Add loop to our map
-      app->getTMAP()->SetMap(ll->l_idx,ll->l);
-      lastindex = ll->l_idx; // Set this so we can make a pulse from this loop
+  if (savepa != 0) {
+    // Loop may have been erased meanwhile
+    LockLoops();
+    if (app->getTMAP()->GetMap(savepa_idx) == savepa) {
+      long long dirbefore = libindex->GetDirTime();
+      SavePeaksAvgs(savepa,1);
+      // Don't let our own file make the library index look stale
+      libindex->FileWritten(dirbefore);
     }
+    UnlockLoops();
+  }
+}
 
-    // And remove from load list
-    EventManager::RemoveEvent(&loadqueue,0,&cur);
+void LoopManager::GetPeaksAvgsFilename(Loop *l, char *fn, int maxlen) {
+  GET_SAVEABLE_HASH_TEXT(l->GetSaveHash());
+  snprintf(fn,maxlen,"%s/%s-%s%s",
+           app->getCFG()->GetLibraryPath(),FWEELIN_OUTPUT_LOOP_NAME,
+           hashtext,FWEELIN_OUTPUT_PEAKS_EXT);
+};
+
+void LoopManager::SavePeaksAvgs(Loop *l, char missing) {
+  nframes_t chunksize = app->getCFG()->loop_peaksavgs_chunksize;
+  BED_PeaksAvgs *pa = (l->blocks == 0 ? 0 : (BED_PeaksAvgs *) 
+                       l->blocks->GetExtendedData(T_BED_PeaksAvgs));
+  if (pa == 0 || chunksize == 0 || l->GetSaveStatus() != SAVE_DONE)
+    return;
+
+  char tmp[FWEELIN_OUTNAME_LEN];
+  GetPeaksAvgsFilename(l,tmp,FWEELIN_OUTNAME_LEN);
+  if (!missing || !PeaksAvgsFile::Matches(tmp,l->GetSaveHash(),
+                                          SAVEABLE_HASH_LENGTH,chunksize))
+    PeaksAvgsFile::Write(tmp,l->GetSaveHash(),SAVEABLE_HASH_LENGTH,pa);
+};
+
+// Decoders ask for peaks/avgs saved with the loop as they start
+BED_PeaksAvgs *LoopManager::GetPeaksAvgs(void *job, AudioBlock *proto,
+                                         nframes_t chunksize) {
+  Loop *l = ((LoopListEvent *) job)->l;
+  if (l == 0 || l->GetSaveStatus() != SAVE_DONE)
+    return 0;
+
+  char tmp[FWEELIN_OUTNAME_LEN];
+  GetPeaksAvgsFilename(l,tmp,FWEELIN_OUTNAME_LEN);
+  return PeaksAvgsFile::Read(tmp,l->GetSaveHash(),SAVEABLE_HASH_LENGTH,
+                             chunksize,proto);
+};
+
+void LoopManager::PlaceLoadedLoop(LoopListEvent *ll, AudioBlock *b) {
+  // Put blocks into loop
+  ll->l->blocks = b;
+
+  if (app->getTMAP()->GetMap(ll->l_idx) != 0) {
+    // Loop ID is full. Choose another
+    int newidx = app->getTMAP()->GetFirstFree(default_looprange.lo,
+                                              default_looprange.hi);
+    
+    if (newidx != -1) {
+      printf("LOOP MANAGER: LoopID #%d full, got new ID: #%d!\n",
+             ll->l_idx,newidx);
+      ll->l_idx = newidx;
+    } else {
+      printf("LOOP MANAGER: No free loopids in default placement range.\n"
+             "I will erase the loop at id #%d.\n",ll->l_idx);
+      DeleteLoop(ll->l_idx);
+    }
   }
+
+  // Add loop to our map
+  app->getTMAP()->SetMap(ll->l_idx,ll->l);
+  lastindex = ll->l_idx; // Set this so we can make a pulse from this loop
+
+  // Fill in details for library index
+  libindex->SetLoopInfo(ll->l->GetSaveHash(),b->GetTotalLen(),ll->l->nbeats,
+                        (ll->l->pulse != 0 ? ll->l->pulse->GetLength() : 0));
 }
 
 void LoopManager::StripePulseOn(Pulse *pulse) {
@@ -1897,6 +2764,7 @@ void LoopManager::DeleteLoop (int index) {
       AudioBlock *recblk = recp->GetFirstRecordedBlock();
       if (recblk != 0) {
         app->getBMG()->RefDeleted(recblk);
+        bwrite->RefDeleted(recblk);
         recblk->DeleteChain(); // *** Not RT Safe
         if (lp != 0)
           lp->blocks = 0;
@@ -1922,7 +2790,13 @@ void LoopManager::DeleteLoop (int index) {
     if (lp->blocks != 0) {
       // Notify any blockmanagers working on this loop's audio to end!
       app->getBMG()->RefDeleted(lp->blocks);
-      lp->blocks->DeleteChain(); // *** Not RT Safe
+      bwrite->RefDeleted(lp->blocks);
+
+      // Audio that matches a saved loop is kept in case it is loaded again
+      if (lp->GetSaveStatus() != SAVE_DONE ||
+          loopcache->Put(lp->GetSaveHash(),lp->blocks))
+        lp->blocks->DeleteChain(); // *** Not RT Safe
+      lp->blocks = 0;
     }
 
     lp->RTDelete();
@@ -2063,7 +2937,7 @@ int LoopManager::GetLongCountForAllPlayingLoops(Pulse *&p) {
 // this loop and the settings passed- see configuration documentation
 // *** Not RT Safe
 void LoopManager::Activate (int index, char shot, float vol, nframes_t ofs, 
-                            char overdub, float *od_feedback) {
+                            char overdub, float *od_feedback, Event *cause) {
   // printf("ACTIVATE plist %p status %d\n",plist[index],status[index]);
 
   if (plist[index] != 0) {
@@ -2087,7 +2961,10 @@ void LoopManager::Activate (int index, char shot, float vol, nframes_t ofs,
                                                app->getAUDIOMEM(),
                                                app->getAUDIOMEMI(),
                                                app->getCFG()->
-                                               loop_peaksavgs_chunksize));
+                                               loop_peaksavgs_chunksize),
+                           ProcessorItem::TYPE_DEFAULT,0,cause,
+                           LatencyStats::GetPath(cause,
+                                                 LatencyStats::TARGET_RECORD));
     
     numrecordingloops++;
     status[index] = T_LS_Recording;
@@ -2107,13 +2984,20 @@ void LoopManager::Activate (int index, char shot, float vol, nframes_t ofs,
       app->getRP()->AddChild(plist[index] = 
                              new RecordProcessor(app,
                                                  app->getISET(),inputvol,
-                                                 lp,vol,ofs,od_feedback));
+                                                 lp,vol,ofs,od_feedback),
+                             ProcessorItem::TYPE_DEFAULT,0,cause,
+                             LatencyStats::GetPath(cause,
+                                                   LatencyStats::
+                                                   TARGET_OVERDUB));
       numrecordingloops++;
       status[index] = T_LS_Overdubbing;
     } else {
       // Play
       app->getRP()->AddChild(plist[index] = 
-                             new PlayProcessor(app,lp,vol,ofs));
+                             new PlayProcessor(app,lp,vol,ofs),
+                             ProcessorItem::TYPE_DEFAULT,0,cause,
+                             LatencyStats::GetPath(cause,
+                                                   LatencyStats::TARGET_PLAY));
       status[index] = T_LS_Playing;
     }
           
@@ -2194,9 +3078,13 @@ void LoopManager::Deactivate (int index) {
 }
 
 void LoopManager::SaveLoop(int index) {
+  // Saves and erases run on different threads- keep the loop while
+  // queueing it
+  LockLoops();
   Loop *l = app->getTMAP()->GetMap(index);
   if (l != 0)
     l->Save(app);
+  UnlockLoops();
 };
 
 // Saves a new scene
@@ -2416,6 +3304,14 @@ void LoopManager::ReceiveEvent(Event *ev, EventProducer *from) {
             // left off
             if (recsync != 0)
               playofs = recsync->GetPos();
+
+            // Loop was hashed as it was recorded- finish now so that
+            // saving doesn't have to
+            Loop *lp = app->getTMAP()->GetMap(i);
+            if (lp != 0 && 
+                !((RecordProcessor *) plist[i])->
+                FinishHash(lp->GetSaveHash(),SAVEABLE_HASH_LENGTH))
+              lp->SetHashReady(1);
           } else if (status[i] == T_LS_Overdubbing) {
             // Start play at position where overdub left off
             playofs = ((RecordProcessor *) plist[i])->GetRecordedLength();
@@ -2946,6 +3842,18 @@ void LoopManager::ReceiveEvent(Event *ev, EventProducer *from) {
       app->RefreshPulseSync();
     }
     break;
+
+  case T_EV_SetMidiSyncReceive :
+    {
+      SetMidiSyncReceiveEvent *sev = (SetMidiSyncReceiveEvent *) ev;
+      
+      // OK!
+      if (CRITTERS)
+        printf("CORE: Received SetMidiSyncReceive(%d)\n", 
+               sev->midisyncreceive);
+      app->getMIDI()->SetMIDISyncReceive(sev->midisyncreceive);
+    }
+    break;
     
   case T_EV_SetTriggerVolume :
     {
@@ -3047,14 +3955,14 @@ void LoopManager::ReceiveEvent(Event *ev, EventProducer *from) {
         }
 
         Deactivate(index);                // Stop
-        Activate(index,shot,vol,ofs,od,od_fb_ptr); // Start
+        Activate(index,shot,vol,ofs,od,od_fb_ptr,ev); // Start
       } else if ((engage == -1 || engage == 0) && IsActive(index)) {
         // Stop case (play and no overdub)
         Deactivate(index);
       }
       else if (engage == -1 || engage == 1) {
         // Start case (record)
-        Activate(index,shot,vol,0,od,od_fb_ptr);
+        Activate(index,shot,vol,0,od,od_fb_ptr,ev);
       }
     }
     break;
@@ -3079,7 +3987,7 @@ void LoopManager::ReceiveEvent(Event *ev, EventProducer *from) {
           } else {
             // Loop idle-- start play
             // No overdub/shot/etc, just straight play
-            Activate(cur->l_idx,0,tev->vol,0,0,0);
+            Activate(cur->l_idx,0,tev->vol,0,0,0,ev);
           }
 
           cur = cur->next;
@@ -3219,6 +4127,7 @@ int Fweelin::go()
 #endif
   
   // Cleanup
+  loopmgr->EndLibraryScan();
   if (vid != 0)
     vid->close();
   sdlio->close();
@@ -3353,6 +4262,8 @@ Browser *Fweelin::GetBrowserFromConfig(BrowserItemType b) {
 char Fweelin::CheckStreamStatus(char status) {
   char check = 1;
 
+  if (fs_multi != 0)
+    check &= fs_multi->GetStatus() == status;
   if (fs_finalout != 0)
     check &= fs_finalout->GetStatus() == status;
   if (fs_loopout != 0)
@@ -3372,6 +4283,10 @@ void Fweelin::ToggleDiskOutput()
 
     // Now start all streamers
     char write_timing = 1;  // Only write timing file once
+    if (fs_multi != 0) {
+      fs_multi->StartWriting(streamoutname,"-multi",write_timing,getCFG()->GetStreamOutFormat());
+      write_timing = 0;
+    }
     if (fs_finalout != 0) {
       fs_finalout->StartWriting(streamoutname,"-final",write_timing,getCFG()->GetStreamOutFormat());
       write_timing = 0;
@@ -3389,6 +4304,8 @@ void Fweelin::ToggleDiskOutput()
       }
   } else {
     // Stop disk output
+    if (fs_multi != 0)
+      fs_multi->StopWriting();
     if (fs_finalout != 0)
       fs_finalout->StopWriting();
     if (fs_loopout != 0)
@@ -3423,6 +4340,13 @@ float Fweelin::getSTREAMSTATS(char *&stream_type, int &num_streams) {
   char frames;
   long int totalsize = 0;
 
+  if (fs_multi != 0) {
+    long int tmp = getSTREAMSIZE(fs_multi,frames);
+    if (!frames)
+      totalsize += tmp;
+    num_streams += fs_multi->GetNumStreams();
+  }
+
   if (fs_finalout != 0) {
     long int tmp = getSTREAMSIZE(fs_finalout,frames);
     if (!frames)
@@ -3452,6 +4376,11 @@ long int Fweelin::getSTREAMER_TotalOutputSize(int &numstreams) {
   long int totalsize = 0;
   numstreams = 0;
 
+  if (fs_multi != 0) {
+    totalsize += fs_multi->GetOutputSize();
+    numstreams += fs_multi->GetNumStreams();
+  }
+
   if (fs_finalout != 0) {
     totalsize += fs_finalout->GetOutputSize();
     numstreams++;
@@ -3471,6 +4400,34 @@ long int Fweelin::getSTREAMER_TotalOutputSize(int &numstreams) {
   return totalsize;
 };
 
+long int Fweelin::getSTREAMER_Overruns(long int &droppedframes) {
+  long int overruns = 0;
+  droppedframes = 0;
+
+  if (fs_multi != 0) {
+    overruns += fs_multi->GetOverruns();
+    droppedframes += fs_multi->GetDroppedFrames();
+  }
+
+  if (fs_finalout != 0) {
+    overruns += fs_finalout->GetOverruns();
+    droppedframes += fs_finalout->GetDroppedFrames();
+  }
+
+  if (fs_loopout != 0) {
+    overruns += fs_loopout->GetOverruns();
+    droppedframes += fs_loopout->GetDroppedFrames();
+  }
+
+  for (int i = 0; i < iset->GetNumInputs(); i++)
+    if (fs_inputs[i] != 0) {
+      overruns += fs_inputs[i]->GetOverruns();
+      droppedframes += fs_inputs[i]->GetDroppedFrames();
+    }
+
+  return overruns;
+};
+
 int Fweelin::setup()
 {
   char tmp[255];
@@ -3539,6 +4496,7 @@ int Fweelin::setup()
   cfg->AddEmptyVariable("SYSTEM_sync_active");
   cfg->AddEmptyVariable("SYSTEM_sync_transmit");
   cfg->AddEmptyVariable("SYSTEM_midisync_transmit");
+  cfg->AddEmptyVariable("SYSTEM_midisync_receive");
 #if USE_FLUIDSYNTH
   cfg->AddEmptyVariable("SYSTEM_fluidsynth_enabled");
 #endif
@@ -3707,20 +4665,21 @@ int Fweelin::setup()
       browsers[B_Loop] = br;
       br->Setup(this,loopmgr);
     }
-    loopmgr->SetupLoopBrowser();
 
     br = GetBrowserFromConfig(B_Scene);
     if (br != 0) {
       browsers[B_Scene] = br;
       br->Setup(this,loopmgr);
     }
-    loopmgr->SetupSceneBrowser();
 
     br = GetBrowserFromConfig(B_Loop_Tray);
     if (br != 0) {
       browsers[B_Loop_Tray] = br;
       br->Setup(this,loopmgr);
     }
+
+    // Fill loop & scene browsers in the background
+    loopmgr->StartLibraryScan();
   }
 
   // Create snapshots
@@ -3767,6 +4726,8 @@ int Fweelin::setup()
                           (char *) &(audio->timebase_master));
   cfg->LinkSystemVariable("SYSTEM_midisync_transmit",T_char,
                           (char *) &(midi->midisyncxmit));
+  cfg->LinkSystemVariable("SYSTEM_midisync_receive",T_char,
+                          (char *) &(midi->midisyncrecv));
 #if USE_FLUIDSYNTH
   cfg->LinkSystemVariable("SYSTEM_fluidsynth_enabled",T_char,
                           (char *) &(fluidp->enable));
@@ -3825,23 +4786,42 @@ int Fweelin::setup()
   }
 
   // Add disk output threads
-  if (cfg->IsStreamFinal())
-    fs_finalout = new FileStreamer(this,0,cfg->IsStereoMaster());
-  else
-    fs_finalout = 0;
-
-  if (cfg->IsStreamLoops())
-    fs_loopout = new FileStreamer(this,0,cfg->IsStereoMaster());
-  else
-    fs_loopout = 0;
-
-  printf("CORE: Creating disk streamers for %d inputs\n",iset->GetNumInputs());
   fs_inputs = new FileStreamer *[iset->GetNumInputs()];
+  fs_finalout = 0;
+  fs_loopout = 0;
+  for (int i = 0; i < iset->GetNumInputs(); i++)
+    fs_inputs[i] = 0;
+
+  // Channels of each stream in a single multichannel stream file, in order:
+  // final mix, loop mix, inputs
+  int masterchans = (cfg->IsStereoMaster() ? 2 : 1),
+    finalchan = 0,
+    loopchan = finalchan + (cfg->IsStreamFinal() ? masterchans : 0),
+    inputchan = loopchan + (cfg->IsStreamLoops() ? masterchans : 0),
+    numchans = inputchan;
   for (int i = 0; i < iset->GetNumInputs(); i++)
     if (cfg->IsStreamInputs(i))
-      fs_inputs[i] = new FileStreamer(this,i,cfg->IsStereoInput(i));
-    else
-      fs_inputs[i] = 0;
+      numchans += (cfg->IsStereoInput(i) ? 2 : 1);
+
+  if (cfg->IsStreamSingleFile()) {
+    fs_multi = 0;
+    if (numchans > 0) {
+      printf("CORE: Creating disk streamer for %d channels\n",numchans);
+      fs_multi = new MultiFileStreamer(this,numchans);
+    }
+  } else {
+    fs_multi = 0;
+    if (cfg->IsStreamFinal())
+      fs_finalout = new FileStreamer(this,0,cfg->IsStereoMaster());
+
+    if (cfg->IsStreamLoops())
+      fs_loopout = new FileStreamer(this,0,cfg->IsStereoMaster());
+
+    printf("CORE: Creating disk streamers for %d inputs\n",iset->GetNumInputs());
+    for (int i = 0; i < iset->GetNumInputs(); i++)
+      if (cfg->IsStreamInputs(i))
+        fs_inputs[i] = new FileStreamer(this,i,cfg->IsStereoInput(i));
+  }
 
   // *** ALL THREADS THAT WRITE TO SRMWRingBuffers MUST BE CREATED BEFORE THIS POINT ***
 
@@ -3855,12 +4835,25 @@ int Fweelin::setup()
   for (int i = 0; i < iset->GetNumInputs(); i++)
     if (fs_inputs[i] != 0)
       rp->AddChild(fs_inputs[i],ProcessorItem::TYPE_GLOBAL,1);  // Silent- no output from file streamer
+    else if (fs_multi != 0 && cfg->IsStreamInputs(i)) {
+      printf("CORE: Input #%d is streamed to channel %d%s\n",i+1,inputchan+1,
+             (cfg->IsStereoInput(i) ? " (stereo)" : ""));
+      rp->AddChild(new StreamTap(this,fs_multi,i,cfg->IsStereoInput(i),inputchan),
+                   ProcessorItem::TYPE_GLOBAL,1);
+      inputchan += (cfg->IsStereoInput(i) ? 2 : 1);
+    }
 
   // Add 'loop output' disk stream
   // In series following a limiter just for loop outputs
   if (fs_loopout != 0) {
     rp->AddChild(new AutoLimitProcessor(this),ProcessorItem::TYPE_GLOBAL_SECOND_CHAIN);
     rp->AddChild(fs_loopout,ProcessorItem::TYPE_GLOBAL_SECOND_CHAIN,1); // Streamer is silent
+  } else if (fs_multi != 0 && cfg->IsStreamLoops()) {
+    printf("CORE: Loop mix is streamed to channel %d%s\n",loopchan+1,
+           (masterchans == 2 ? " (stereo)" : ""));
+    rp->AddChild(new AutoLimitProcessor(this),ProcessorItem::TYPE_GLOBAL_SECOND_CHAIN);
+    rp->AddChild(new StreamTap(this,fs_multi,0,cfg->IsStereoMaster(),loopchan),
+                 ProcessorItem::TYPE_GLOBAL_SECOND_CHAIN,1);
   }
 
   // Add monitor mix
@@ -3878,6 +4871,17 @@ int Fweelin::setup()
   if (fs_finalout != 0)
     rp->AddChild(fs_finalout,ProcessorItem::TYPE_FINAL,1);
 
+  // Add single multichannel disk stream- after all of its taps
+  if (fs_multi != 0) {
+    if (cfg->IsStreamFinal()) {
+      printf("CORE: Final mix is streamed to channel %d%s\n",finalchan+1,
+             (masterchans == 2 ? " (stereo)" : ""));
+      rp->AddChild(new StreamTap(this,fs_multi,0,cfg->IsStereoMaster(),finalchan),
+                   ProcessorItem::TYPE_FINAL,1);
+    }
+    rp->AddChild(fs_multi,ProcessorItem::TYPE_FINAL,1);
+  }
+
   // Begin recording into audio memory (use mono/stereo memory as appropriate)
   amrec = new RecordProcessor(this,iset,inputvol,audiomem,
                               cfg->IsStereoMaster());
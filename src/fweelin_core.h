@@ -56,10 +56,12 @@ class Loop;
 class Pulse;
 class BED_MarkerPoints;
 class FileStreamer;
+class MultiFileStreamer;
 class PreallocatedType;
 class AudioBuffers;
 class InputSettings;
 class Browser;
+class LibraryIndex;
 class HardwareMixerInterface;
 
 #ifndef __MACOSX__
@@ -99,7 +101,7 @@ enum SaveStatus {
 
 class Saveable {
  public:
-  Saveable() : savestatus(NO_SAVE) {};
+  Saveable() : savestatus(NO_SAVE), hashready(0) {};
 
   virtual void Save(Fweelin */*app*/) {}; // Save the object
 
@@ -109,7 +111,11 @@ class Saveable {
   };
   inline SaveStatus GetSaveStatus() { return savestatus; };
   inline void SetSaveStatus(SaveStatus s) { savestatus = s; };
-  inline void ClearSaveHash() { memset(savehash,0,sizeof(unsigned char) * SAVEABLE_HASH_LENGTH); };
+  inline void ClearSaveHash() { memset(savehash,0,sizeof(unsigned char) * SAVEABLE_HASH_LENGTH); hashready = 0; };
+  // Nonzero if savehash was already made (as the loop was recorded)
+  // and the save can skip hashing
+  inline char IsHashReady() { return hashready; };
+  inline void SetHashReady(char ready) { hashready = ready; };
   inline int SetSaveableHashFromText(char *stext) {
     int slen = strlen(stext);
     if (slen != SAVEABLE_HASH_LENGTH*2) {
@@ -196,11 +202,13 @@ class Saveable {
 
  protected:
 
-  // When we save an object, we first compute the MD5 hash for that object
+  // When we save an object, we first compute the hash for that object
+  // (MD5 for scenes- loops are hashed with SHA-256, cut to the same length)
   // and put that in the filename for the object. Other objects can refer to
   // the object by hash. 
   SaveStatus savestatus;
   unsigned char savehash[SAVEABLE_HASH_LENGTH+1];
+  char hashready;
 };
 
 // An audio loop
@@ -620,6 +628,57 @@ class SceneBrowserItem : public BrowserItem {
   char *filename;
 };
 
+// LoopCache keeps the audio of saved loops after they are erased, indexed
+// by loop hash, so that loading the same loop again (for example, switching
+// back to a scene) does not decode it from disk. A chain belongs either to
+// one loop or to the cache- Put hands it to the cache and Take hands it
+// back. When the cache is over budget, the least recently cached chains
+// are deleted.
+class LoopCache {
+ public:
+  // Number of hash buckets- indexed by the first byte of the loop hash
+  const static int NUM_BUCKETS = 256;
+
+  // Cache holds at most 'maxbytes' of audio (0 disables the cache)
+  LoopCache(long maxbytes);
+  ~LoopCache();
+
+  // Caches chain b under the given loop hash. Returns nonzero if the chain
+  // was not cached, in which case the caller still owns it. Not RT safe!
+  int Put(unsigned char *hash, AudioBlock *b);
+
+  // Takes the chain cached under the given hash out of the cache, or
+  // returns 0 if there is none
+  AudioBlock *Take(unsigned char *hash);
+
+  inline long GetBytes() { return bytes; };
+
+ private:
+
+  class Entry {
+  public:
+    unsigned char hash[SAVEABLE_HASH_LENGTH];
+    AudioBlock *b;
+    long bytes;
+    Entry *bnext,    // Next in hash bucket
+      *newer, *older; // LRU order
+  };
+
+  // Size of the audio in chain b
+  static long ChainBytes(AudioBlock *b);
+
+  // Unlinks e from its bucket and the LRU list
+  void Unlink(Entry *e);
+
+  Entry *buckets[NUM_BUCKETS];
+  Entry *newest, *oldest;
+  long bytes, maxbytes;
+  int hits, misses, evictions;
+
+  // Put is called from the event thread, Take from loop decoder threads
+  pthread_mutex_t cachelock;
+};
+
 // LoopManager contains all loops, and wraps up recording, playing, and
 // other RT & non-RT processing on loops
 class LoopManager : public EventListener, public AutoWriteControl, 
@@ -644,6 +703,11 @@ public:
   void SetupLoopBrowser();
   void SetupSceneBrowser();
 
+  // Populate both browsers in the background- they fill in, in batches,
+  // while we are already running. EndLibraryScan stops and waits for it.
+  void StartLibraryScan();
+  void EndLibraryScan();
+
   // Get long count (number of beats for whole pattern) for all playing loops
   // Assumes only one pulse for all playing loops.
   //
@@ -778,8 +842,10 @@ public:
   // Trigger the loop at index within the map
   // The exact behavior varies depending on what is already happening with
   // this loop and the settings passed- see ~/.fweelin/.fweelin.rc
+  // cause is the event that triggered the loop, if any- for measuring
+  // input-to-audio latency
   void Activate (int index, char shot = 0, float vol = 1.0, nframes_t ofs = 0,
-                 char overdub = 0, float *od_feedback = 0);
+                 char overdub = 0, float *od_feedback = 0, Event *cause = 0);
 
   void Deactivate (int index);
 
@@ -798,11 +864,17 @@ public:
   // We receive calls periodically for saving of loops-
   // here, we return blocks to save from loops which need saving
   virtual void GetWriteBlock(FILE **out, AudioBlock **b, 
-                             AudioBlockIterator **i, nframes_t *len);
-
-  // We receive calls periodically for loading of loops-
-  virtual void GetReadBlock(FILE **in, char *smooth_end);
-  virtual void ReadComplete(AudioBlock *b);
+                             AudioBlockIterator **i, nframes_t *len,
+                             void **job);
+  virtual void WriteComplete(void *job);
+
+  // We receive calls periodically for loading of loops- from each of the
+  // decoder threads in our BlockReadPool
+  virtual void GetReadBlock(FILE **in, char *smooth_end, codec *type,
+                            void **job);
+  virtual void ReadComplete(AudioBlock *b, void *job);
+  virtual BED_PeaksAvgs *GetPeaksAvgs(void *job, AudioBlock *proto,
+                                      nframes_t chunksize);
 
   // Check if the needs_saving map is up to date, rebuild if needed.
   void CheckSaveMap();
@@ -810,6 +882,16 @@ public:
   // Adds the loop/scene with given filename to the browser br
   void AddLoopToBrowser(Browser *br, char *filename);
   SceneBrowserItem *AddSceneToBrowser(Browser *br, char *filename);
+  // Add with known file time (no stat)
+  void AddLoopToBrowser(Browser *br, char *filename, time_t mtime);
+  SceneBrowserItem *AddSceneToBrowser(Browser *br, char *filename,
+                                      time_t mtime);
+
+  // Fill browser br with loops or scenes from the library index
+  void PopulateBrowser(Browser *br, char type);
+
+  // Library scanning thread
+  static void *run_scan_thread(void *ptr);
 
   inline void SetAutoLoopSaving(char save) { autosave = save; };
   void AddToSaveQueue(Event *ev);
@@ -819,8 +901,14 @@ public:
   inline int GetNumLoad() { return numload; };
   inline int GetCurLoad() { return curload; };
 
+  inline LibraryIndex *GetLibraryIndex() { return libindex; };
+
   Event *savequeue,          // Loop/scene save queue
-    *loadqueue;              // Loop/scene load queue
+    *saving,                 // Loops being hashed/encoded right now
+    *loadqueue,              // Loop/scene load queue
+    *loading;                // Loops being decoded right now
+  pthread_mutex_t loadlock;  // Locks loadqueue/loading between decoders
+  pthread_mutex_t savelock;  // Locks savequeue/saving between encoders
   int cursave, curload,      // # of loops/scenes saved/loaded
     numsave, numload;        // Total # of loops/scenes to save/load
     
@@ -864,9 +952,17 @@ public:
   // Saves loop XML data & prepares to save loop audio
   void SetupSaveLoop(Loop *l, int /*l_idx*/, FILE **out, AudioBlock **b,
                      AudioBlockIterator **i, nframes_t *len);
+  // Puts blocks loaded for the given loop into the map- with loadlock held
+  void PlaceLoadedLoop(LoopListEvent *ll, AudioBlock *b);
+  // Filename of the peaks/avgs file saved with loop l (by hash)
+  void GetPeaksAvgsFilename(Loop *l, char *fn, int maxlen);
+  // Save peaks/avgs for loop l next to the loop- if 'missing' is set, 
+  // only if there is no matching file yet. The caller tells the library
+  // index about the write
+  void SavePeaksAvgs(Loop *l, char missing);
   // Loads loop XML data & prepares to load loop audio-
   // returns nonzero on error
-  int SetupLoadLoop(FILE **in, char *smooth_end,
+  int SetupLoadLoop(FILE **in, char *smooth_end, codec *type,
                     Loop **new_loop, int /*l_idx*/, float l_vol,
                     char *l_filename);
 
@@ -895,9 +991,21 @@ public:
   float **waitactivate_od_fb;
   LoopStatus *status; // For each index, what's the status?
 
-  // Block managers that load/save loops
-  BlockReadManager *bread;
-  BlockWriteManager *bwrite;
+  // Block managers that load/save loops- loops load in parallel
+  BlockReadPool *bread;
+  BlockWritePool *bwrite;
+
+  // Audio of erased loops, for reuse when they are loaded again
+  LoopCache *loopcache;
+
+  // Index of loops & scenes in the library
+  LibraryIndex *libindex;
+
+  // Number of items to add to the browser at once when scanning library
+  const static int LIBRARY_SCAN_BATCH = 64;
+  pthread_t scan_thread;
+  char scan_running,   // Is the scan thread running?
+    scan_stop;         // Nonzero tells the scan thread to stop
 
   // Initial volume of new loops
   float newloopvol;
@@ -912,7 +1020,8 @@ public:
   Pulse *pulses[MAX_PULSES];
   
   pthread_mutex_t loops_lock; // A way to lock up loops so two threads
-                              // don't race on one loop
+                              // don't race on one loop (recursive)- 
+                              // take it before savelock, not after
 };
 
 // This is Fweelin
@@ -924,7 +1033,7 @@ class Fweelin : public EventProducer, public BrowserCallback {
     fluidp(0), 
 #endif
 
-    mmg(0), bmg(0), emg(0), rp(0), tmap(0), 
+    osc(0), mmg(0), bmg(0), emg(0), rp(0), tmap(0), 
     loopmgr(0), browsers(0), abufs(0), iset(0), audio(0), midi(0), sdlio(0), 
     vid(0), scope(0), scope_len(0), audiomem(0), amrec(0),  
     sync_type(0), sync_speed(1), running(0) {};
@@ -972,6 +1081,10 @@ class Fweelin : public EventProducer, public BrowserCallback {
   // Also returns the number of streams being written.
   long int getSTREAMER_TotalOutputSize(int &numstreams);
 
+  // Returns the total number of overruns in all disk streamer instances,
+  // and the number of frames they dropped
+  long int getSTREAMER_Overruns(long int &droppedframes);
+
   inline TriggerMap *getTMAP() { return tmap; };
   inline LoopManager *getLOOPMGR() { return loopmgr; };
   
@@ -980,6 +1093,9 @@ class Fweelin : public EventProducer, public BrowserCallback {
   inline VideoIO *getVIDEO() { return vid; };
   inline SDLIO *getSDLIO() { return sdlio; };
   inline HardwareMixerInterface *getHMIX() { return hmix; };
+#ifndef __MACOSX__
+  inline OSCClient *getOSC() { return osc; };
+#endif
 
   inline FloConfig *getCFG() { return cfg; };
 
@@ -1122,6 +1238,7 @@ class Fweelin : public EventProducer, public BrowserCallback {
   FileStreamer *fs_finalout,        // Final output disk stream
     *fs_loopout,                    // Loop output disk stream
     **fs_inputs;                    // Array of pointers to disk streams for audio inputs
+  MultiFileStreamer *fs_multi;      // All streams in one multichannel file (replaces the above)
 
   int writenum;                     // Number of audio output file currently being written
   std::string streamoutname,        // Full path and base name of output stream (for example, fw-lib/live52)
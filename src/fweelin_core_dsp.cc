@@ -33,6 +33,7 @@
 #include <pthread.h>
 #include <sched.h>
 #include <sys/mman.h>
+#include <fcntl.h>
 
 #include "fweelin_config.h"
 #include "fweelin_core_dsp.h"
@@ -470,14 +471,68 @@ int Pulse::ExtendLongCount (long nbeats, char endjustify) {
 // period boundary
 //
 
+int Pulse::GetClocksPerPulse() {
+  // 1 pulse = how many MIDI clocks?
+  // In sync-beat mode, each pulse is SyncSpeed beats, so MIDI_CLOCK_FREQUENCY*SyncSpeed clocks
+  // In sync-bar mode, each pulse is one bar, so MIDI_CLOCK_FREQUENCY*BeatsPerBar*SyncSpeed clocks
+  int clocksperpulse = MIDI_CLOCK_FREQUENCY*app->GetSyncSpeed();
+  if (!app->GetSyncType())
+    clocksperpulse *= SYNC_BEATS_PER_BAR;
+  return clocksperpulse;
+}
+
+void Pulse::FollowMIDIClock() {
+  double now = MIDIClockSlave::GetTime(),
+    period, nexttime;
+  long nexttick;
+  if (!app->getMIDI()->GetClockSlave()->GetState(now,period,nexttime,nexttick))
+    return; // Not locked to a running clock- free run at the last tempo
+
+  // Frames per pulse at the external tempo
+  int cpp = GetClocksPerPulse();
+  double nominal = period*cpp*app->getAUDIO()->get_srate();
+  if (nominal < app->getBUFSZ())
+    return;
+
+  // Where the external clock is, now, within one pulse
+  double postick = nexttick - (nexttime-now)/period,
+    phase = fmod(postick,(double) cpp);
+  if (phase < 0)
+    phase += cpp;
+  phase = phase/cpp*nominal;
+
+  // Phase error, taking the shorter way around
+  double err = phase - curpos;
+  if (err > nominal/2)
+    err -= nominal;
+  else if (err < -nominal/2)
+    err += nominal;
+
+  // Length follows the tempo only- phase is corrected through our
+  // position, so loops synced to the pulse never see a stretched pulse
+  SetLength((nframes_t) nominal);
+  if (err > 0 && phase < curpos)
+    // External downbeat has already passed- wrap now
+    Wrap();
+  else if (err < 0 && phase > curpos)
+    // We wrapped early- hold at our downbeat until the external one
+    curpos = 0;
+  else
+    curpos = (nframes_t) phase;
+}
+
 void Pulse::process(char pre, nframes_t l, AudioBuffers *ab) {
   static int midi_clock_count = 0,
       midi_beat_count = 0;
 
-  // If we're using Jack transport (audio) sync, and we're slave to another app,
+  // If we're receiving MIDI clock, follow it. Otherwise, if we're using
+  // Jack transport (audio) sync, and we're slave to another app,
   // adjust pulse to stay in-sync  
-  if (app->getAUDIO()->IsTransportRolling() &&
-      !app->getAUDIO()->IsTimebaseMaster()) {
+  if (app->getMIDI()->GetMIDISyncReceive()) {
+    if (!pre && !stopped)
+      FollowMIDIClock();
+  } else if (app->getAUDIO()->IsTransportRolling() &&
+             !app->getAUDIO()->IsTimebaseMaster()) {
     char sync_type = app->GetSyncType();
     int sync_speed = app->GetSyncSpeed();
     if (sync_type != prev_sync_type ||
@@ -536,24 +591,18 @@ void Pulse::process(char pre, nframes_t l, AudioBuffers *ab) {
     
     // If we are transmitting MIDI sync, do so now
     if (clockrun != SS_NONE && app->getMIDI()->GetMIDISyncTransmit()) {
-      char sync_type = app->GetSyncType();
-      int sync_speed = app->GetSyncSpeed();
-      
       // 1 pulse = how many MIDI clock messages to send?
-      // In sync-beat mode, each pulse is SyncSpeed beats, so MIDI_CLOCK_FREQUENCY*SyncSpeed clocks to send
-      // In sync-bar mode, each pulse is one bar, so MIDI_CLOCK_FREQUENCY*BeatsPerBar*SyncSpeed clocks to send
-      int clocksperpulse = MIDI_CLOCK_FREQUENCY*sync_speed;
-      if (!sync_type)
-        clocksperpulse *= SYNC_BEATS_PER_BAR;
+      int clocksperpulse = GetClocksPerPulse();
       
-      // Check timing of pulse
+      // Check timing of pulse- every clock that falls in this period is
+      // sent, stamped with its frame offset, so that MIDI output can
+      // schedule it exactly
       float framesperclock = (float) len/clocksperpulse;
       int oldclock = (int) ((float) oldpos/framesperclock),
-        newclock = (int) ((float) curpos/framesperclock);
-      if ((clockrun == SS_BEAT && newclock != oldclock) || curpos >= len) {
-        // printf("CLOCKY-OO %d!\n",newclock);
-        
-        if (clockrun == SS_START) {
+        newclock = (curpos >= len ? clocksperpulse :
+                    (int) ((float) curpos/framesperclock));
+      if (clockrun == SS_START) {
+        if (curpos >= len) {
           // Send MIDI start for pulse
           metrohiofs = 0; // Sound metronome high tone
           midi_clock_count = 0;
@@ -562,11 +611,16 @@ void Pulse::process(char pre, nframes_t l, AudioBuffers *ab) {
           MIDIStartStopInputEvent *ssevt = 
             (MIDIStartStopInputEvent *) Event::GetEventByType(T_EV_Input_MIDIStartStop);
           ssevt->start = 1;
+          ssevt->frameofs = len-oldpos;
           app->getEMG()->BroadcastEventNow(ssevt, this);    
 
           // If this is the first downbeat, start the clock proper
           clockrun = SS_BEAT;
-        } else {
+        }
+      } else {
+        for (int clk = oldclock+1; clk <= newclock; clk++) {
+          // printf("CLOCKY-OO %d!\n",clk);
+
           midi_clock_count++;
           if (midi_clock_count >= MIDI_CLOCK_FREQUENCY) {
             // Quarter not has passed, sound metronome low tone
@@ -582,12 +636,16 @@ void Pulse::process(char pre, nframes_t l, AudioBuffers *ab) {
           }
 
           // Time for another clock message
-          MIDIClockInputEvent *clkevt = (MIDIClockInputEvent *) Event::GetEventByType(T_EV_Input_MIDIClock);
-          // *** Broadcast immediately-- this will yield lowest MIDI sync latency,
-          // but may cause problems if MIDI transmit code blocks/conflicts with RT audio thread
-          // (which it very well might)
-          // _experimental_
-          app->getEMG()->BroadcastEventNow(clkevt, this);
+          // (by value- no preallocated instance needed)
+          MIDIClockInputEvent clkevt;
+          clkevt.frameofs = (int) ceil(clk*framesperclock) - (int) oldpos;
+          if (clkevt.frameofs < 0)
+            clkevt.frameofs = 0;
+          else if (clkevt.frameofs > (int) l)
+            clkevt.frameofs = l;
+          // Broadcast immediately- MIDI output queues the clock for its
+          // exact time and sends all of this period's messages at once
+          app->getEMG()->BroadcastEventNow(&clkevt, this, 1, 0);
         }
       }
     }
@@ -913,6 +971,8 @@ RootProcessor::~RootProcessor() {
 
   // printf(" :: Processor: RootProcessor end\n");
   app->getEMG()->UnlistenEvent(this,0,T_EV_CleanupProcessor);
+
+  latency.Report();
 }
 
 void RootProcessor::FinalPrep () {
@@ -935,17 +995,83 @@ void RootProcessor::AdjustInputVolume(float adjust) {
     dinputvol = 0.0;
 }
 
+const char *LatencyStats::GetPathTargetName(int path) {
+  switch (path % NUM_TARGETS) {
+  case TARGET_RECORD : return "record";
+  case TARGET_OVERDUB : return "overdub";
+  default : return "play";
+  }
+};
+
+void LatencyStats::Record(int path, struct timespec *intime) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  long us = (now.tv_sec - intime->tv_sec) * 1000000L + 
+    (now.tv_nsec - intime->tv_nsec) / 1000;
+  if (us < 0)
+    us = 0;
+
+  int bin = us / BIN_US;
+  if (bin >= NUM_BINS)
+    bin = NUM_BINS-1;
+  bins[path][bin]++;
+  sum[path] += us;
+  if (us > max[path])
+    max[path] = us;
+  cnt[path]++;
+};
+
+float LatencyStats::GetPercentile(int path, float pct) {
+  long n = cnt[path];
+  if (n == 0)
+    return 0.0;
+
+  // Walk bins until we pass the given fraction of all measurements
+  long target = (long) ceil(pct / 100.0 * n);
+  if (target < 1)
+    target = 1;
+  long running = 0;
+  for (int i = 0; i < NUM_BINS-1; i++) {
+    running += bins[path][i];
+    if (running >= target)
+      return MIN((float) (i+1) * BIN_US / 1000.0, GetMax(path));
+  }
+
+  return GetMax(path);
+};
+
+void LatencyStats::Report() {
+  char header = 0;
+  for (int i = 0; i < NUM_PATHS; i++)
+    if (cnt[i] > 0) {
+      if (!header) {
+        printf("CORE: Input to audio latency (ms):\n");
+        header = 1;
+      }
+      printf("  %s -> %s: %ld starts, mean %.2f, median %.1f, "
+             "95%% %.1f, 99%% %.1f, max %.2f\n",
+             Event::GetEventName(GetPathInput(i)),GetPathTargetName(i),
+             cnt[i],GetMean(i),GetPercentile(i,50),GetPercentile(i,95),
+             GetPercentile(i,99),GetMax(i));
+    }
+};
+
 // Adds a child processor.. the processor begins processing immediately
 // Not realtime safe
 //
 // If the processor should not produce any output, pass nonzero in silent
-void RootProcessor::AddChild (Processor *o, int type, char silent) {
+void RootProcessor::AddChild (Processor *o, int type, char silent,
+                              Event *cause, int latpath) {
   // Do a preprocess for fadein
   dopreprocess();
 
   // Prepare an event for RT process to add a new processor to its list
   AddProcessorEvent *addevt = (AddProcessorEvent *) Event::GetEventByType(T_EV_AddProcessor);
-  addevt->new_processor = new ProcessorItem(o,type,silent);
+  ProcessorItem *nw = addevt->new_processor = new ProcessorItem(o,type,silent);
+  if (cause != 0 && latpath != -1) {
+    nw->intime = cause->time;
+    nw->latpath = latpath;
+  }
 
   // Add event to queue
   eq->WriteElement(addevt);
@@ -997,6 +1123,12 @@ void RootProcessor::processchain(char pre, nframes_t len, AudioBuffers *ab,
       // Run audio processing...
       cur->p->process(pre, len, abchild);
 
+      if (!pre && cur->latpath != -1) {
+        // First audio from a processor started by input
+        latency.Record(cur->latpath,&cur->intime);
+        cur->latpath = -1;
+      }
+
       if (!pre && cur->status == ProcessorItem::STATUS_LIVE_PENDING_DELETE) {
         cur->status = ProcessorItem::STATUS_PENDING_DELETE; // Last run finished, now delete
 
@@ -1279,7 +1411,7 @@ RecordProcessor::RecordProcessor(Fweelin *app,
   Processor(app), sync_state(SS_NONE), 
   iset(iset), inputvol(inputvol), nbeats(0), endsyncidx(-2), endsyncwait(0), 
   sync_idx(-1), sync_add_pos(0), sync_add(0),
-  stopped(0), pa_mgr(0), od_loop(od_loop), od_playvol(od_playvol), 
+  stopped(0), pa_mgr(0), hash_mgr(0), od_loop(od_loop), od_playvol(od_playvol), 
   od_feedback(od_feedback), od_curbeat(0), od_fadein(1), od_fadeout(0), 
   od_stop(0), od_prefadeout(0), od_lastofs(0) {
   // Store initial value for overdub feedback
@@ -1293,6 +1425,7 @@ RecordProcessor::RecordProcessor(Fweelin *app,
   
   // Clear the hash for the loop, since overdubbing will change it
   od_loop->SetSaveStatus(NO_SAVE);
+  od_loop->SetHashReady(0);
   
   mbuf[0] = new sample_t[app->getBUFSZ()];
   od_last_mbuf[0] = new sample_t[app->getBUFSZ()];
@@ -1356,7 +1489,7 @@ RecordProcessor::RecordProcessor(Fweelin *app,
   Processor(app), sync_state(SS_NONE),
   iset(iset), inputvol(inputvol), sync(0), tmpi(0), nbeats(0), 
   sync_idx(-1), sync_add_pos(0), sync_add(0),
-  stopped(0), pa_mgr(0), od_loop(0), od_feedback(0), od_fadeout(0), od_stop(0), 
+  stopped(0), pa_mgr(0), hash_mgr(0), od_loop(0), od_feedback(0), od_fadeout(0), od_stop(0), 
   od_prefadeout(0) {
   // Use the block supplied-- fixed length
   growchain = 0;
@@ -1397,7 +1530,7 @@ RecordProcessor::RecordProcessor(Fweelin *app,
   iset(iset), inputvol(inputvol), sync(sync), tmpi(0), 
   nbeats(0), endsyncidx(-2), endsyncwait(0), 
   sync_idx(-1), sync_add_pos(0), sync_add(0),
-  stopped(0), pa_mgr(0), od_loop(0), od_feedback(0), od_fadeout(0), od_stop(0), 
+  stopped(0), pa_mgr(0), hash_mgr(0), od_loop(0), od_feedback(0), od_fadeout(0), od_stop(0), 
   od_prefadeout(0) {
   // Grow the length of record as necessary
   growchain = 1;
@@ -1497,6 +1630,9 @@ RecordProcessor::RecordProcessor(Fweelin *app,
                                               peaksavgs_chunksize));
     pa_mgr = app->getBMG()->PeakAvgOn(recblk,i,1);
   }
+
+  // Hash as we record, so the loop is ready to save when we end
+  hash_mgr = app->getBMG()->HashOn(recblk,i);
   
   // Tell the block manager to auto-grow this block chain for recording
   app->getBMG()->GrowChainOn(recblk,i);
@@ -1588,8 +1724,15 @@ void RecordProcessor::EndNow() {
       // For new non syncronized loops--
       // Bend our strip of audio into a loop
       // Smooth beginning into end, shorten loop-
-      if (sync == 0)
+      if (sync == 0) {
+        // Smoothing rewrites the first and last blocks after they were
+        // hashed- drop the hash, the loop is hashed in full when saved
+        if (hash_mgr != 0) {
+          app->getBMG()->HashOff(recblk);
+          hash_mgr = 0;
+        }
         recblk->Smooth();
+      }
       /* else
         printf("reclen: %d, synclen: %d\n",recblk->GetTotalLen(),
         sync->GetLength()); */
@@ -1633,6 +1776,12 @@ void RecordProcessor::AbortRecording() {
     pa_mgr = 0;
   }
 
+  // No hash for an aborted recording
+  if (hash_mgr != 0) {
+    app->getBMG()->HashOff(recblk);
+    hash_mgr = 0;
+  }
+
   // Blocks are deleted nonRT in DeleteLoop
 
   if (growchain)
@@ -1640,6 +1789,18 @@ void RecordProcessor::AbortRecording() {
     app->getBMG()->GrowChainOff(recblk);
 }
 
+int RecordProcessor::FinishHash(unsigned char *digest, 
+                                unsigned int digestlen) {
+  if (hash_mgr == 0)
+    return 1;
+
+  int ret = hash_mgr->Finish(digest,digestlen);
+  app->getBMG()->HashOff(recblk);
+  hash_mgr = 0;
+
+  return ret;
+}
+
 void RecordProcessor::PulseSync (int syncidx, nframes_t /*actualpos*/) {
   // printf("RecSync: %d ESIdx: %d Sync_Idx: %d ActualPos: %d\n",syncidx,endsyncidx,sync_idx,actualpos);
   
@@ -2317,8 +2478,29 @@ void PlayProcessor::process(char pre, nframes_t len, AudioBuffers *ab) {
 }
 
 FileStreamer::FileStreamer(Fweelin *app, int input_idx, char stereo, nframes_t outbuflen) :
-  Processor(app), writerstatus(STATUS_STOPPED), input_idx(input_idx), stereo(stereo),
-  outname(""), timingname(""), write_timing(0), nbeats(0), outbuflen(outbuflen), threadgo(1) {
+  Processor(app), nchannels(stereo ? 2 : 1), multichannel(0), 
+  outbuflen((outbuflen + WRITEBATCH - 1) / WRITEBATCH * WRITEBATCH),
+  writecnt(0), readcnt(0), writerstatus(STATUS_STOPPED), input_idx(input_idx), 
+  outname(""), timingname(""), write_timing(0), nbeats(0), 
+  overruns(0), droppedframes(0), reportedoverruns(0),
+  cacheofs(0), dropofs(0), threadgo(1) {
+  StartEncodeThread();
+}
+
+FileStreamer::FileStreamer(Fweelin *app, int nchannels, nframes_t outbuflen) :
+  Processor(app), nchannels(nchannels), multichannel(1), 
+  outbuflen((outbuflen + WRITEBATCH - 1) / WRITEBATCH * WRITEBATCH),
+  writecnt(0), readcnt(0), writerstatus(STATUS_STOPPED), input_idx(0), 
+  outname(""), timingname(""), write_timing(0), nbeats(0), 
+  overruns(0), droppedframes(0), reportedoverruns(0),
+  cacheofs(0), dropofs(0), threadgo(1) {
+  StartEncodeThread();
+}
+
+void FileStreamer::StartEncodeThread() {
+  pthread_mutex_init(&wake_lock,0);
+  pthread_cond_init(&wake_ready,0);
+
   const static size_t STACKSIZE = 1024*128;
   pthread_attr_t attr;
   pthread_attr_init(&attr);
@@ -2347,8 +2529,12 @@ FileStreamer::~FileStreamer() {
 
   // Terminate the management thread
   threadgo = 0;
+  Wake();
   pthread_join(encode_thread,0);
 
+  pthread_cond_destroy(&wake_ready);
+  pthread_mutex_destroy(&wake_lock);
+
   // Erase space for time markers
   ::delete[] marks;
 
@@ -2357,37 +2543,57 @@ FileStreamer::~FileStreamer() {
 
 void FileStreamer::InitStreamer() {
   // Allocate output buffer 
-  outbuf[0] = new sample_t[outbuflen];
-  if (stereo)
-    outbuf[1] = new sample_t[outbuflen];
-  else 
-    outbuf[1] = 0;
-
-  // Setup encoder
+  outbuf = new sample_t *[nchannels];
+  spillbuf = new sample_t *[nchannels];
+  for (int c = 0; c < nchannels; c++) {
+    outbuf[c] = new sample_t[outbuflen];
+    spillbuf[c] = new sample_t[WRITEBATCH];
+  }
+
+  // Spill file is created only when needed
+  spillfd = 0;
+  spillwritten = 0;
+  spillread = 0;
+  spillfailed = 0;
+  spilldefer = (app->getCFG()->IsStreamDeferEncode() &&
+                (filetype == VORBIS || filetype == FLAC));
+
+  // Setup encoder- multichannel streams give the number of channels
+  char stereo = (nchannels > 1);
+  int channels = (multichannel ? nchannels : 0);
   switch (filetype) {
   case VORBIS: // OGG VORBIS
-    enc = new VorbisEncoder(app,stereo);
+    enc = new VorbisEncoder(app,stereo,channels);
     break;
   case WAV: //WAV 
-    enc = new SndFileEncoder(app, outbuflen, stereo, WAV);
+    enc = new SndFileEncoder(app, outbuflen, stereo, WAV, channels);
     break;
   case FLAC: //FLAC
-    enc = new SndFileEncoder(app, outbuflen, stereo, FLAC);
+    enc = new SndFileEncoder(app, outbuflen, stereo, FLAC, channels);
     break;
   case AU: //AU
-    enc = new SndFileEncoder(app, outbuflen, stereo, AU);
+    enc = new SndFileEncoder(app, outbuflen, stereo, AU, channels);
     break;
   default: 
-    enc = new VorbisEncoder(app,stereo);
+    enc = new VorbisEncoder(app,stereo,channels);
     break;
   }
 };
 
 void FileStreamer::EndStreamer() {
   // Free output buffer
-  delete[] outbuf[0];
-  if (outbuf[1] != 0)
-    delete[] outbuf[1];
+  for (int c = 0; c < nchannels; c++) {
+    delete[] outbuf[c];
+    delete[] spillbuf[c];
+  }
+  delete[] outbuf;
+  delete[] spillbuf;
+
+  // Spill file was unlinked when created- it is removed on close
+  if (spillfd != 0) {
+    fclose(spillfd);
+    spillfd = 0;
+  }
 
   // Cleanup encoder
   delete enc;
@@ -2397,6 +2603,12 @@ int FileStreamer::StartWriting(const std::string &filename_stub, const char *str
   if (writerstatus != STATUS_STOPPED)
     return -1; // Already writing!
 
+  if (type == FLAC && nchannels > MAX_FLAC_CHANNELS) {
+    printf("DISK: FLAC can't hold %d channels- writing WAV instead.\n",
+           nchannels);
+    type = WAV;
+  }
+
   outname = filename_stub + stream_type_name + app->getCFG()->GetAudioFileExt(type);
   printf("DISK: Open %s for writing\n",outname.c_str());
   outputsize = 0;
@@ -2407,10 +2619,178 @@ int FileStreamer::StartWriting(const std::string &filename_stub, const char *str
   else
     this->timingname = "";
   writerstatus = STATUS_START_PENDING;
+  Wake();
+
+  return 0;
+};
+
+void FileStreamer::Wake() {
+  // Never wait on the lock- if the encode thread holds it, it is about to
+  // check the buffer (or, at worst, wakes on its own in 100 ms)
+  if (pthread_mutex_trylock(&wake_lock) == 0) {
+    pthread_cond_signal(&wake_ready);
+    pthread_mutex_unlock(&wake_lock);
+  }
+};
+
+void FileStreamer::WriteFromBuffer(char flush) {
+  // Spilled audio comes before what is in the buffer
+  if (flush)
+    while (spillread != spillwritten)
+      EncodeSpilled();
+
+  nframes_t num;
+  while ((num = (nframes_t) (__atomic_load_n(&writecnt,__ATOMIC_ACQUIRE) -
+                             readcnt)) >= WRITEBATCH || (flush && num > 0)) {
+    // Spill if we are more than half behind- and keep spilling until
+    // the spill file is encoded, so audio stays in order
+    if (!flush && (spilldefer || spillread != spillwritten || 
+                   num >= outbuflen / 2) && SpillBatch())
+      continue;
+
+    // Spill failed- what was spilled before goes first. Catch up on it
+    // below, one batch per pass, so the thread never blocks on the backlog
+    if (spillread != spillwritten)
+      break;
+
+    // Batches never straddle the end of the buffer, only a final flush can
+    unsigned long r = readcnt;
+    nframes_t pos = (nframes_t) (r % outbuflen),
+      span = (flush ? MIN(num, outbuflen - pos) : WRITEBATCH);
+    outputsize += enc->WriteSamplesToDisk(outbuf,pos,span);
+    __atomic_store_n(&readcnt,r+span,__ATOMIC_RELEASE);
+  }
+
+  // Catch up one batch at a time, so the buffer is checked in between
+  if (!flush && (!spilldefer || spillfailed) && spillread != spillwritten) {
+    EncodeSpilled();
+    if (spillread == spillwritten)
+      printf("DISK: Encoder caught up with spilled audio.\n");
+  }
+
+  if (app->getCFG()->IsStreamDropCache())
+    DropWrittenCache();
+};
+
+char FileStreamer::SpillBatch() {
+  if (spillfailed)
+    return 0;
+
+  if (spillfd == 0) {
+    // Next to the stream, so it is on the same disk (/tmp may be in
+    // memory)- unlinked right away, so it is removed on close
+    std::string spillname = outname + FWEELIN_OUTPUT_SPILL_EXT;
+    spillfd = fopen(spillname.c_str(),"w+b");
+    if (spillfd == 0) {
+      printf("DISK: ERROR: Can't create spill file '%s' (%s).\n",
+             spillname.c_str(),strerror(errno));
+      spillfailed = 1;
+      return 0;
+    }
+    unlink(spillname.c_str());
+  }
+
+  if (!spilldefer && spillread == spillwritten)
+    printf("DISK: Encoder is behind- spilling audio to a temporary file "
+           "until it catches up.\n");
+
+  // Write each channel of the batch
+  const size_t batchlen = sizeof(sample_t) * WRITEBATCH;
+  unsigned long r = readcnt;
+  nframes_t pos = (nframes_t) (r % outbuflen);
+  off_t ofs = (off_t) spillwritten * nchannels * batchlen;
+  int fd = fileno(spillfd);
+  for (int c = 0; c < nchannels; c++, ofs += batchlen)
+    if (pwrite(fd,&outbuf[c][pos],batchlen,ofs) != (ssize_t) batchlen) {
+      printf("DISK: ERROR: Can't write spill file (%s)- no longer "
+             "spilling.\n",strerror(errno));
+      spillfailed = 1;
+      return 0;
+    }
+
+  spillwritten++;
+  __atomic_store_n(&readcnt,r+WRITEBATCH,__ATOMIC_RELEASE);
+
+  return 1;
+};
+
+void FileStreamer::EncodeSpilled() {
+  const size_t batchlen = sizeof(sample_t) * WRITEBATCH;
+  off_t ofs = (off_t) spillread * nchannels * batchlen;
+  int fd = fileno(spillfd);
+  for (int c = 0; c < nchannels; c++, ofs += batchlen)
+    if (pread(fd,spillbuf[c],batchlen,ofs) != (ssize_t) batchlen) {
+      printf("DISK: ERROR: Can't read spill file (%s).\n",strerror(errno));
+      memset(spillbuf[c],0,batchlen);
+    }
+
+  outputsize += enc->WriteSamplesToDisk(spillbuf,0,WRITEBATCH);
+  spillread++;
+
+  if (spillread == spillwritten) {
+    // All encoded- start the spill file over
+    spillread = 0;
+    spillwritten = 0;
+    if (ftruncate(fd,0) != 0)
+      printf("DISK: ERROR: Can't truncate spill file (%s).\n",
+             strerror(errno));
+  }
+};
+
+void FileStreamer::DropWrittenCache() {
+#ifndef __MACOSX__
+  // Start writing out what was just written, and drop what was sent to
+  // disk last time from the cache- so that long streams don't fill memory
+  // with file data. Only the range since the last call is waited on
+  int fd = fileno(outfd);
+  off_t ofs = lseek(fd,0,SEEK_CUR);
+  if (ofs > cacheofs) {
+    sync_file_range(fd,cacheofs,ofs-cacheofs,SYNC_FILE_RANGE_WRITE);
+    if (cacheofs > dropofs) {
+      sync_file_range(fd,dropofs,cacheofs-dropofs,
+                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                      SYNC_FILE_RANGE_WAIT_AFTER);
+      posix_fadvise(fd,dropofs,cacheofs-dropofs,POSIX_FADV_DONTNEED);
+      dropofs = cacheofs;
+    }
+    cacheofs = ofs;
+  }
+#endif
+};
+
+char FileStreamer::PutFrames(int firstchan, int nch, sample_t **in, 
+                             nframes_t len) {
+  unsigned long w = writecnt,
+    r = __atomic_load_n(&readcnt,__ATOMIC_ACQUIRE);
+  if (w - r + len > outbuflen)
+    return 1;
+
+  // Copy in at most two spans- to the end of the buffer, then
+  // from the beginning
+  nframes_t pos = (nframes_t) (w % outbuflen),
+    n1 = MIN(len, outbuflen - pos);
+  for (int c = 0; c < nch; c++) {
+    sample_t *o = outbuf[firstchan+c];
+    if (in[c] != 0) {
+      memcpy(&o[pos],in[c],sizeof(sample_t) * n1);
+      memcpy(o,in[c]+n1,sizeof(sample_t) * (len-n1));
+    } else {
+      memset(&o[pos],0,sizeof(sample_t) * n1);
+      memset(o,0,sizeof(sample_t) * (len-n1));
+    }
+  }
 
   return 0;
 };
 
+void FileStreamer::CommitFrames(nframes_t len) {
+  unsigned long w = writecnt + len;
+  __atomic_store_n(&writecnt,w,__ATOMIC_RELEASE);
+
+  if (w - __atomic_load_n(&readcnt,__ATOMIC_ACQUIRE) >= WRITEBATCH)
+    Wake();
+};
+
 void FileStreamer::process(char pre, nframes_t len, AudioBuffers *ab) {
   // Stream a given input to disk
   sample_t *in[2] = {ab->ins[0][input_idx], ab->ins[1][input_idx]};
@@ -2421,57 +2801,15 @@ void FileStreamer::process(char pre, nframes_t len, AudioBuffers *ab) {
     // for later encoding
 
     // Vorbis clips near 1.0
-    sample_t *b_l = in[0],
-      *b_r = in[1];
-    if (stereo && b_r != 0) {
-      // Stereo
-      enc->Preprocess(b_l,b_r,len);
-
-      if (outpos < encodepos && outpos + len > encodepos)
-        // Encode thread is not keeping up. We are about to wrap around the ring buffer
-        printf("DISK: FileStreamer encoder thread is behind. CPU use too high / too many streams.\n");
-
-      if (outpos + len < outbuflen) {
-        memcpy(&outbuf[0][outpos],in[0],sizeof(sample_t) * len);
-        memcpy(&outbuf[1][outpos],in[1],sizeof(sample_t) * len);
-        outpos += len;
-      }
-      else {
-        // Wrap case- byte-by-byte
-        nframes_t n;
-        sample_t *o_l = outbuf[0],
-          *o_r = outbuf[1];
-        for (n = 0; outpos < outbuflen; outpos++, n++) {
-          o_l[outpos] = b_l[n];
-          o_r[outpos] = b_r[n];
-        }
-        outpos = 0;
-        wrap = 1; 
-        for (; n < len; outpos++, n++) {
-          o_l[outpos] = b_l[n];
-          o_r[outpos] = b_r[n];
-        }
-      }
-    } else {
-      // Mono
-      enc->Preprocess(b_l,0,len);
+    char st = (nchannels > 1 && in[1] != 0);
+    enc->Preprocess(in[0],(st ? in[1] : 0),len);
 
-      if (outpos + len < outbuflen) {
-        memcpy(&outbuf[0][outpos],in[0],sizeof(sample_t) * len);
-        outpos += len;
-      }
-      else {
-        // Wrap case- byte-by-byte
-        nframes_t n;
-        sample_t *o_l = outbuf[0];
-        for (n = 0; outpos < outbuflen; outpos++, n++)
-          o_l[outpos] = b_l[n];
-        outpos = 0;
-        wrap = 1; 
-        for (; n < len; outpos++, n++)
-          o_l[outpos] = b_l[n];
-      }
-    }
+    if (PutFrames(0,nchannels,in,len))
+      // Encode thread is not keeping up- buffer is full, so this block
+      // is lost. Encode thread reports it
+      DropFrames(len);
+    else
+      CommitFrames(len);
   }
 };
 
@@ -2496,49 +2834,73 @@ void FileStreamer::ReceiveEvent(Event *ev, EventProducer */*from*/) {
   }
 };
 
+MultiFileStreamer::MultiFileStreamer(Fweelin *app, int nchannels, 
+                                     nframes_t outbuflen) :
+  FileStreamer(app,nchannels,outbuflen), tapping(0), dropfragment(0), 
+  numtaps(0) {};
+
+void MultiFileStreamer::process(char pre, nframes_t len, 
+                                AudioBuffers */*ab*/) {
+  if (pre)
+    return;
+
+  // All taps have put this fragment- pass it on as a whole, or drop it as
+  // a whole if any part didn't fit
+  if (tapping && GetStatus() == STATUS_RUNNING) {
+    if (dropfragment)
+      DropFrames(len);
+    else {
+      // Vorbis clips near 1.0- scale our copy, not the taps' audio
+      nframes_t pos = (nframes_t) (writecnt % outbuflen),
+        n1 = MIN(len, outbuflen - pos);
+      for (int c = 0; c < nchannels; c++) {
+        enc->Preprocess(&outbuf[c][pos],0,n1);
+        if (len > n1)
+          enc->Preprocess(outbuf[c],0,len-n1);
+      }
+
+      CommitFrames(len);
+    }
+  }
+
+  // Taps start putting only at the start of a fragment
+  dropfragment = 0;
+  tapping = (GetStatus() == STATUS_RUNNING);
+};
+
+StreamTap::StreamTap(Fweelin *app, MultiFileStreamer *fs, int input_idx,
+                     char stereo, int firstchan) :
+  Processor(app), fs(fs), input_idx(input_idx), firstchan(firstchan),
+  stereo(stereo) {
+  fs->AddTap();
+};
+
+void StreamTap::process(char pre, nframes_t len, AudioBuffers *ab) {
+  if (!pre) {
+    sample_t *in[2] = {ab->ins[0][input_idx], ab->ins[1][input_idx]};
+    fs->PutTap(firstchan,(stereo ? 2 : 1),in,len);
+  }
+};
+
 void *FileStreamer::run_encode_thread (void *ptr) {
   FileStreamer *inst = static_cast<FileStreamer *>(ptr);
-  nframes_t curpos;
 
   // *** Could FileStreamer be rewritten as a BlockManager, using the
   // BMG manage thread? It could still be a core DSP processor, no?
   while (inst->threadgo || inst->writerstatus != STATUS_STOPPED) {
     switch (inst->writerstatus) {
     case STATUS_RUNNING:
-      // We're running, so feed data to the chosen audio encoder.
-      // Make a local copy of outpos-- because it is liable to change
-      // during this loop!-- RT thread
-      curpos = inst->outpos;
-      if (curpos != inst->encodepos) {
-        nframes_t num;
-        if (inst->wrap) {
-          // Wrap case- so take from the end & beginning of circular buffer 
-          nframes_t numend = inst->outbuflen - inst->encodepos;
-          num = curpos + numend;
-
-          if (numend > 0) {
-            inst->outputsize += inst->enc->WriteSamplesToDisk (inst->outbuf, inst->encodepos, numend);
-          }
-          if (curpos > 0) {
-             inst->outputsize += inst->enc->WriteSamplesToDisk (inst->outbuf, 0, curpos);
-          }
-
-          inst->wrap = 0;
-        } else {
-          if (curpos > inst->encodepos) {           
-            num = curpos - inst->encodepos;
-            inst->outputsize += inst->enc->WriteSamplesToDisk (inst->outbuf, inst->encodepos, num);
-          } else {
-            // Wrap not set but buffer seems wrapped- this could be caused
-            // by extreme processor load and this thread not keeping up with
-            // RT- print warning
-            printf("DISK: WARNING: FileStreamer Buffer wrap possible?\n");
-          }
-        }
-
-        inst->encodepos = curpos;
+      // We're running, so feed whole batches to the chosen audio encoder
+      inst->WriteFromBuffer(0);
+
+      if (inst->overruns != inst->reportedoverruns) {
+        inst->reportedoverruns = inst->overruns;
+        printf("DISK: FileStreamer encoder thread is behind- %ld frames "
+               "dropped (%ld times). CPU use too high / too many streams / "
+               "disk too slow.\n",(long int) inst->droppedframes,
+               (long int) inst->reportedoverruns);
       }
-      
+
       // Now dump markers to gnusound USX for later edit points
       while (inst->mkreadidx != inst->mkwriteidx) {
         if (inst->timingfd != 0)
@@ -2588,9 +2950,13 @@ void *FileStreamer::run_encode_thread (void *ptr) {
         inst->enc->SetupFileForWriting(inst->outfd);
         
         inst->outputsize = 0;
-        inst->outpos = 0;
-        inst->encodepos = 0;
-        inst->wrap = 0;
+        inst->writecnt = 0;
+        inst->readcnt = 0;
+        inst->overruns = 0;
+        inst->droppedframes = 0;
+        inst->reportedoverruns = 0;
+        inst->cacheofs = 0;
+        inst->dropofs = 0;
         inst->startcnt = inst->app->getRP()->GetSampleCnt();
         inst->writerstatus = STATUS_RUNNING;
         
@@ -2612,6 +2978,13 @@ void *FileStreamer::run_encode_thread (void *ptr) {
     case STATUS_STOP_PENDING:
       printf("DISK: Closing streamer.\n");
 
+      // Write what is left in the buffer
+      if (inst->spillwritten != inst->spillread)
+        printf("DISK: Encoding %.1f seconds of spilled audio.\n",
+               (float) (inst->spillwritten - inst->spillread) * WRITEBATCH /
+               inst->app->getAUDIO()->get_srate());
+      inst->WriteFromBuffer(1);
+
       // Tell encoder we are stopping
       inst->enc->PrepareFileForClosing();
 
@@ -2634,8 +3007,25 @@ void *FileStreamer::run_encode_thread (void *ptr) {
       break; 
     }
 
-    // 100 ms delay between encoding cycles- give other processes a go!
-    usleep(100000);
+    // Sleep until a batch is waiting to be written, or for at most 100 ms
+    pthread_mutex_lock(&inst->wake_lock);
+    char idle = (inst->writerstatus == STATUS_STOPPED ||
+                 (inst->writerstatus == STATUS_RUNNING &&
+                  __atomic_load_n(&inst->writecnt,__ATOMIC_ACQUIRE) - 
+                  inst->readcnt < WRITEBATCH &&
+                  ((inst->spilldefer && !inst->spillfailed) || 
+                   inst->spillread == inst->spillwritten)));
+    if (inst->threadgo && idle) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME,&ts);
+      ts.tv_nsec += 100000000;
+      if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&inst->wake_ready,&inst->wake_lock,&ts);
+    }
+    pthread_mutex_unlock(&inst->wake_lock);
   }
 
   return 0;
@@ -290,13 +290,71 @@ public:
     TYPE_FINAL = 4;
 
   ProcessorItem(Processor *p, int type = TYPE_DEFAULT, char silent = 0) : p(p), next(0),
-    status(STATUS_GO), type(type), silent(silent) {};
+    status(STATUS_GO), type(type), silent(silent), latpath(-1) {};
 
   Processor *p;
   ProcessorItem *next;
   int status,
     type;
   char silent;    // Nonzero if this processor should always be silent (no output)
+
+  // Input that started this processor- latency is measured when the
+  // processor first runs, then latpath is cleared
+  struct timespec intime;
+  int latpath;    // Latency path (see LatencyStats), or -1 for none
+};
+
+// Histograms of the latency from user input (MIDI, keys, joystick) to the
+// first audio cycle of the processor that input started- one histogram per
+// path (input event type -> record, overdub or play). Written only by the
+// RT audio thread, read without locking by the display and on exit.
+class LatencyStats {
+public:
+  const static int TARGET_RECORD = 0,
+    TARGET_OVERDUB = 1,
+    TARGET_PLAY = 2,
+    NUM_TARGETS = 3;
+  const static int NUM_PATHS = T_EV_Last_Bindable * NUM_TARGETS;
+
+  // Bins are BIN_US microseconds wide- the last bin holds all latencies
+  // beyond the others
+  const static int BIN_US = 500,
+    NUM_BINS = 128;
+
+  LatencyStats() { memset(this,0,sizeof(LatencyStats)); };
+
+  // Returns the path for a processor of the given target started by
+  // the input stamped on ev, or -1 if ev is not stamped
+  static inline int GetPath(Event *ev, int target) {
+    if (ev == 0 || !ev->IsStamped() || ev->intype >= T_EV_Last_Bindable)
+      return -1;
+    return ev->intype * NUM_TARGETS + target;
+  };
+  static inline EventType GetPathInput(int path) {
+    return (EventType) (path / NUM_TARGETS);
+  };
+  static const char *GetPathTargetName(int path);
+
+  // Record latency from intime until now along the given path. RT safe.
+  void Record(int path, struct timespec *intime);
+
+  inline long GetCount(int path) { return cnt[path]; };
+  // Returns the given percentile (0-100) of latency along path, in ms-
+  // to the upper edge of the bin it falls in
+  float GetPercentile(int path, float pct);
+  inline float GetMean(int path) {
+    return (cnt[path] > 0 ? (float) sum[path] / cnt[path] / 1000.0 : 0.0);
+  };
+  inline float GetMax(int path) { return (float) max[path] / 1000.0; };
+
+  // Print all paths with measurements
+  void Report();
+
+private:
+  long bins[NUM_PATHS][NUM_BINS],
+    cnt[NUM_PATHS],
+    sum[NUM_PATHS], // Microseconds
+    max[NUM_PATHS];
 };
 
 class PulseSyncCallback {
@@ -344,6 +402,10 @@ public:
 
   // Start/stop sending MIDI clock for this pulse
   void SetMIDIClock (char start);
+
+  // Number of MIDI clocks in one revolution of this pulse,
+  // given the current sync type and speed
+  int GetClocksPerPulse ();
   
   // Quantizes src length to fit to this pulse length 
   nframes_t QuantizeLength(nframes_t src);
@@ -432,6 +494,10 @@ public:
 
   int ExtendLongCount (long nbeats, char endjustify);
   void ResetLongCount() { lc_len = 1; };
+
+  // Slave this pulse to incoming MIDI clock- sets length to the external
+  // tempo and moves our position onto the external phase (RT safe)
+  void FollowMIDIClock ();
   
   nframes_t len, // Length of one revolution of this pulse in samples
     curpos;      // Current position in samples into this pulse
@@ -552,7 +618,12 @@ public:
 
   // Adds a child processor.. the processor begins processing immediately
   // Possibly realtime safe?
-  void AddChild (Processor *o, int type = ProcessorItem::TYPE_DEFAULT, char silent = 0);
+  //
+  // If the processor was started by user input, pass the event that
+  // started it and the latency path- so that input-to-audio latency
+  // can be measured
+  void AddChild (Processor *o, int type = ProcessorItem::TYPE_DEFAULT, char silent = 0,
+                 Event *cause = 0, int latpath = -1);
 
   // Removes a child processor from receiving processing time..
   // also, deletes the child processor
@@ -564,6 +635,8 @@ public:
 
   void ReceiveEvent(Event *ev, EventProducer */*from*/);
 
+  inline LatencyStats *GetLatencyStats() { return &latency; };
+
 private:
 
   // Update the list of processors
@@ -589,6 +662,9 @@ private:
  
   // Count samples processed from start of execution
   volatile nframes_t samplecnt;
+
+  // Input-to-audio latency
+  LatencyStats latency;
 };
 
 class RecordProcessor : public Processor, public PulseSyncCallback {
@@ -650,6 +726,11 @@ public:
   AudioBlock *GetFirstRecordedBlock() { return recblk; }
   PeaksAvgsManager *GetPAMgr() { return pa_mgr; }
 
+  // Finishes the hash that was made as we recorded, writing it to
+  // 'digest'- call nonRT, once recording has ended. Returns nonzero if
+  // there is no hash (overdubs are not hashed)
+  int FinishHash(unsigned char *digest, unsigned int digestlen);
+
   // Is this an overdub record (1) or a fresh record (0)?
   char IsOverdub() { return (od_loop != 0); };
 
@@ -730,6 +811,8 @@ public:
 
   // Manager for peaks & averages computation alongside this record
   PeaksAvgsManager *pa_mgr;
+  // Manager for hashing alongside this record
+  BlockHashManager *hash_mgr;
 
   // Overdub settings
   Loop *od_loop;
@@ -798,9 +881,13 @@ public:
   long curbeat;
 };
 
+// FileStreamer records one input (or mix) to its own file on disk
 class FileStreamer : public Processor, public EventListener {
  public:
-  const static nframes_t OUTPUTBUFLEN = 100000;
+  const static nframes_t OUTPUTBUFLEN = 131072;
+  // Frames written to disk at once- the encode thread wakes when this 
+  // much is waiting. The buffer length is rounded up to a multiple of this
+  const static nframes_t WRITEBATCH = 16384;
   const static int MARKERBUFLEN = 50;
 
   // Initialize a disk stream recording input #input_idx, with the given buffer size
@@ -818,6 +905,7 @@ class FileStreamer : public Processor, public EventListener {
   // Note all the heavy work is done in the encode thread!
   void StopWriting() {
     writerstatus = STATUS_STOP_PENDING;
+    Wake();
   };
 
   char GetStatus() { return writerstatus; };
@@ -827,6 +915,11 @@ class FileStreamer : public Processor, public EventListener {
   // The actual file size will vary depending on the codec used
   long int GetOutputSize() { return outputsize; };
 
+  // Number of times audio was dropped because the encode thread fell 
+  // behind, and the number of frames dropped, in this stream
+  long int GetOverruns() { return overruns; };
+  long int GetDroppedFrames() { return droppedframes; };
+
   static void *run_encode_thread (void *ptr);
 
   // Writer status flags
@@ -835,13 +928,61 @@ class FileStreamer : public Processor, public EventListener {
     STATUS_STOP_PENDING = 2,
     STATUS_START_PENDING = 3;
 
+  // Most channels FLAC can hold- streams with more use WAV
+  const static int MAX_FLAC_CHANNELS = 8;
+
+ protected:
+  // Initialize a disk stream recording nchannels channels into one file,
+  // which are put into the buffer by the subclass
+  FileStreamer(Fweelin *app, int nchannels, nframes_t outbuflen);
+
+  // Realtime: copies len frames of nch channels (in) into the output buffer
+  // at the write position, starting at channel firstchan. Channels not given
+  // (zero) are silent. Returns nonzero if the buffer is full and nothing
+  // was copied
+  char PutFrames(int firstchan, int nch, sample_t **in, nframes_t len);
+  // Realtime: passes the len frames just put on to the encode thread
+  void CommitFrames(nframes_t len);
+  // Realtime: counts len frames dropped because the buffer was full
+  void DropFrames(nframes_t len) {
+    overruns++;
+    droppedframes += len;
+  };
+
+  int nchannels;         // Number of channels recorded
+  char multichannel;     // Nonzero if recording several streams to one file
+  iFileEncoder *enc;     // Encoder
+
+  // Output buffers- one ring buffer per channel, filled by the realtime 
+  // thread and emptied by the encode thread. The counts are of all frames 
+  // put into and taken out of the buffer- positions are taken modulo 
+  // outbuflen
+  sample_t **outbuf;
+  nframes_t outbuflen;
+  volatile unsigned long writecnt, // Written by realtime thread (release)
+    readcnt;                       // Written by encode thread (release)
+
  private:
+  void StartEncodeThread();
   void InitStreamer();
   void EndStreamer();
+
+  // Wakes the encode thread- never blocks (safe from RT thread)
+  void Wake();
+  // Encodes whole batches waiting in the output buffer, or everything
+  // waiting if flush is set- spilling to disk if the encoder is behind
+  void WriteFromBuffer(char flush);
+  // Drops audio already written from the OS file cache
+  void DropWrittenCache();
+
+  // Moves one batch from the output buffer to the spill file, unencoded
+  // Returns nonzero on success
+  char SpillBatch();
+  // Encodes the oldest batch in the spill file
+  void EncodeSpilled();
   
   char writerstatus;     // Status flag
   int input_idx;         // Index of input to record
-  char stereo;           // Encoding in stereo?
   codec filetype;        // Audio file type
 
   // File
@@ -861,12 +1002,29 @@ class FileStreamer : public Processor, public EventListener {
   // Global sample count at start of stream file
   nframes_t startcnt;
 
-  // Output buffers
-  sample_t *outbuf[2];       // Two channel ring buffer
-  nframes_t outbuflen;
-  volatile nframes_t outpos, // Current position of realtime data coming into output buffer
-    encodepos;               // Current position of encoder in buffer (lags behind outpos)
-  char wrap; // Nonzero if outpos has wrapped but encodepos hasn't yet
+  // Audio dropped because the buffer was full
+  volatile long int overruns,
+    droppedframes;
+  long int reportedoverruns; // Overruns already reported by encode thread
+
+  // Encode thread sleeps on this until a batch is waiting
+  pthread_mutex_t wake_lock;
+  pthread_cond_t wake_ready;
+
+  off_t cacheofs, // Output file sent to disk up to here
+    dropofs;      // Output file dropped from cache up to here
+
+  // Spill file- when the encoder falls behind, raw audio is moved here 
+  // from the output buffer, so that the buffer never fills. The encoder
+  // catches up from here. Each batch is stored as WRITEBATCH samples for
+  // each channel in turn
+  FILE *spillfd;
+  unsigned long spillwritten, // Batches written to spill file
+    spillread;                // Batches encoded from spill file
+  char spilldefer,  // Nonzero if all audio is spilled, and encoded only
+                    // once the stream stops
+    spillfailed;    // Nonzero if the spill file can't be written
+  sample_t **spillbuf; // One batch read back from the spill file
 
   // Number of bytes written to output file
   long int outputsize;
@@ -874,9 +1032,53 @@ class FileStreamer : public Processor, public EventListener {
   // Disk encode/disk write thread
   pthread_t encode_thread;
   int threadgo;
+};
+
+// MultiFileStreamer records several streams into one interleaved 
+// multichannel file- with one buffer and one encode thread for all of them.
+// Each stream is fed by a StreamTap, placed where that stream is taken in
+// the processing chain. The MultiFileStreamer itself must be placed after
+// all of its taps (last in the final chain), where it passes each fragment 
+// on to the encode thread
+class MultiFileStreamer : public FileStreamer {
+ public:
+  MultiFileStreamer(Fweelin *app, int nchannels, 
+                    nframes_t outbuflen = OUTPUTBUFLEN);
+
+  virtual void process(char pre, nframes_t len, AudioBuffers *ab);
 
-  // Encoder
-  iFileEncoder *enc;
+  // Called by taps in the realtime thread- puts len frames of nch channels
+  // for this fragment, starting at channel firstchan
+  void PutTap(int firstchan, int nch, sample_t **in, nframes_t len) {
+    if (tapping && GetStatus() == STATUS_RUNNING &&
+        PutFrames(firstchan,nch,in,len))
+      dropfragment = 1;
+  };
+
+  // Number of streams recorded
+  int GetNumStreams() { return numtaps; };
+  void AddTap() { numtaps++; };
+
+ private:
+  char tapping,      // Nonzero if taps are putting the current fragment
+    dropfragment;    // Nonzero if the current fragment didn't fit
+  int numtaps;
+};
+
+// StreamTap feeds one input (or mix) into a MultiFileStreamer- it records
+// to channel firstchan (and the next channel, if stereo)
+class StreamTap : public Processor {
+ public:
+  StreamTap(Fweelin *app, MultiFileStreamer *fs, int input_idx, char stereo,
+            int firstchan);
+
+  virtual void process(char pre, nframes_t len, AudioBuffers *ab);
+
+ private:
+  MultiFileStreamer *fs;
+  int input_idx,     // Index of input to record
+    firstchan;       // First channel in file to record to
+  char stereo;       // Recording in stereo?
 };
 
 // PassthroughProcessor creates a monitor mix of several given inputs into one output
@@ -59,3 +59,106 @@ CoreDataType GetCoreDataType(char *name) {
     return T_invalid;
 };
 
+SymbolTable::SymbolTable(int initsize) : num(0) {
+  // Round up to power of 2
+  size = 1;
+  while (size < initsize)
+    size <<= 1;
+  tbl = new Entry[size];
+};
+
+SymbolTable::~SymbolTable() {
+  for (int i = 0; i < size; i++)
+    if (tbl[i].name != 0)
+      delete[] tbl[i].name;
+  delete[] tbl;
+};
+
+// FNV-1a
+unsigned int SymbolTable::HashName(const char *name) {
+  unsigned int h = 2166136261u;
+  for (; *name != '\0'; name++) {
+    h ^= (unsigned char) *name;
+    h *= 16777619u;
+  }
+  return h;
+};
+
+unsigned int SymbolTable::HashKey(uint64_t key) {
+  uint64_t k = key;
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  return (unsigned int) k;
+};
+
+int SymbolTable::FindSlot(Entry *tbl, int sz, const char *name, uint64_t key,
+                          unsigned int hash) {
+  // Linear probe
+  int i = hash & (sz-1);
+  while (tbl[i].used) {
+    if (name != 0) {
+      if (tbl[i].name != 0 && !strcmp(tbl[i].name,name))
+        return i;
+    } else if (tbl[i].name == 0 && tbl[i].key == key)
+      return i;
+    i = (i+1) & (sz-1);
+  }
+
+  return i;
+};
+
+void SymbolTable::Grow() {
+  int nwsize = size << 1;
+  Entry *nw = new Entry[nwsize];
+  for (int i = 0; i < size; i++)
+    if (tbl[i].used) {
+      Entry *e = &tbl[i];
+      unsigned int hash = (e->name != 0 ? HashName(e->name) : 
+                           HashKey(e->key));
+      nw[FindSlot(nw,nwsize,e->name,e->key,hash)] = *e;
+    }
+
+  delete[] tbl;
+  tbl = nw;
+  size = nwsize;
+};
+
+void SymbolTable::Set(const char *name, void *data) {
+  // Keep the table at most half full
+  if ((num+1)*2 > size)
+    Grow();
+
+  Entry *e = &tbl[FindSlot(tbl,size,name,0,HashName(name))];
+  if (!e->used) {
+    e->name = new char[strlen(name)+1];
+    strcpy(e->name,name);
+    e->used = 1;
+    num++;
+  }
+  e->data = data;
+};
+
+void *SymbolTable::Get(const char *name) {
+  Entry *e = &tbl[FindSlot(tbl,size,name,0,HashName(name))];
+  return (e->used ? e->data : 0);
+};
+
+void SymbolTable::SetKey(uint64_t key, void *data) {
+  if ((num+1)*2 > size)
+    Grow();
+
+  Entry *e = &tbl[FindSlot(tbl,size,0,key,HashKey(key))];
+  if (!e->used) {
+    e->key = key;
+    e->used = 1;
+    num++;
+  }
+  e->data = data;
+};
+
+void *SymbolTable::GetKey(uint64_t key) {
+  Entry *e = &tbl[FindSlot(tbl,size,0,key,HashKey(key))];
+  return (e->used ? e->data : 0);
+};
+
@@ -21,6 +21,7 @@
 
 #include <jack/ringbuffer.h>
 #include <assert.h>
+#include <stdint.h>
 
 
 enum CoreDataType {
@@ -523,6 +524,56 @@ class UserVariable {
   UserVariable *next;
 };
 
+// Hashed table of named symbols (or integer keys), each mapped to a
+// data pointer. Names are interned- the table keeps its own copy. Setting a
+// name that is already in the table replaces its data, so later
+// declarations shadow earlier ones. Symbols are added when the config is
+// parsed- adding is not thread safe with lookups.
+class SymbolTable {
+ public:
+  SymbolTable(int initsize = 64);
+  ~SymbolTable();
+
+  // Map name to data
+  void Set(const char *name, void *data);
+  // Returns the data mapped to name, or 0 if name is not in the table
+  void *Get(const char *name);
+
+  // Map integer key to data
+  void SetKey(uint64_t key, void *data);
+  // Returns the data mapped to key, or 0 if key is not in the table
+  void *GetKey(uint64_t key);
+
+  inline int GetNumSymbols() { return num; };
+
+ private:
+
+  class Entry {
+  public:
+    Entry() : name(0), key(0), data(0), used(0) {};
+
+    char *name; // Interned name, or 0 for integer key
+    uint64_t key;
+    void *data;
+    char used;
+  };
+
+  static unsigned int HashName(const char *name);
+  static unsigned int HashKey(uint64_t key);
+
+  // Find the slot for name or key in table tbl of size sz
+  // (a used slot with that name/key, or the empty slot where it goes)
+  static int FindSlot(Entry *tbl, int sz, const char *name, uint64_t key, 
+                      unsigned int hash);
+
+  // Double the size of the table
+  void Grow();
+
+  Entry *tbl;
+  int size, // Size of table (power of 2)
+    num;    // Number of symbols stored
+};
+
 // Abstract class to allow updating RT data structures with a new # of reader and writer threads
 class RTDataStruct_Updater {
   friend class RT_RWThreads;
@@ -594,6 +645,10 @@ public:
     // Update existing buffers with new writer thread
     UpdateRTStructs();
   };
+
+  // Returns the number of reader and writer threads that can still be
+  // registered
+  static int GetNumFree () { return MAX_RW_THREADS - num_rw_threads; };
   
   // RT data structures are automatically registered and unregistered here.
   // This allows them to be notified of additional reader or writer threads that are starting later.
@@ -828,6 +883,16 @@ public:
   // Returns the item at the given index. To modify the item, change to the BUSY state first.
   inline T *GetItemAtIdx (int idx) { return &items[idx]; };
 
+  // Returns the number of items with the given state- only a snapshot, as
+  // other threads may be changing states
+  inline int CountItemsWithState (int state) {
+    int cnt = 0;
+    for (int i = 0; i < num_items; i++)
+      if (items[i].item_status == state)
+        cnt++;
+    return cnt;
+  };
+
 private:
 
   RTStoreItem *items;
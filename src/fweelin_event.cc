@@ -45,8 +45,11 @@
 #include "fweelin_event.h"
 
 #define EVENT_QUEUE_SIZE 100  // Number of events in event queue, per writer thread
+#define EVENT_RCU_SLEEP 1000  // Microseconds between checks while waiting for
+                              // dispatch to release old listener tables
 
 EventTypeTable *Event::ett = 0;
+SymbolTable *Event::evtsyms = 0;
 
 // Events are allocated in blocks using the Memory Manager
 
@@ -77,9 +80,9 @@ EventTypeTable *Event::ett = 0;
     } \
     break; 
 
-// Event with slow (guaranteed non-RT) delivery using block allocation
-// with default number of instances preallocated
-#define SET_ETYPE_SLOW(etyp,nm,typ) \
+// Event with slow (guaranteed non-RT) delivery through the given dispatch
+// lane, using block allocation with default number of instances preallocated
+#define SET_ETYPE_SLOW_LANE(etyp,nm,typ,ln) \
   case etyp : \
     { \
       Event *proto = \
@@ -92,6 +95,7 @@ EventTypeTable *Event::ett = 0;
                              PREALLOC_DEFAULT_NUM_INSTANCES, \
                              1); \
       ett[i].slowdelivery = 1; \
+      ett[i].lane = ln; \
       int paramidx = -1, j = 0; \
       for (; j < proto->GetNumParams() && \
            proto->GetParam(j).max_index == -1; j++); \
@@ -101,6 +105,14 @@ EventTypeTable *Event::ett = 0;
     } \
     break; 
 
+// Slow delivery event in the time-critical lane
+#define SET_ETYPE_SLOW(etyp,nm,typ) \
+  SET_ETYPE_SLOW_LANE(etyp,nm,typ,EVENT_LANE_CRITICAL)
+
+// Slow delivery event in the background lane
+#define SET_ETYPE_SLOW_BG(etyp,nm,typ) \
+  SET_ETYPE_SLOW_LANE(etyp,nm,typ,EVENT_LANE_BACKGROUND)
+
 // Event with normal (direct method call) delivery using SINGLE INSTANCE allocation with
 // default number of instances preallocated
 #define SET_ETYPE_NO_BLOCK(etyp,nm,typ) \
@@ -154,6 +166,10 @@ void Event::SetupEventTypeTable(MemoryManager *mmgr) {
       // Events marked SET_ETYPE_SLOW will always run from the nonRT event
       // thread. This means they will be delivered after SET_ETYPE events if
       // a sequence of events is sent.
+      //
+      // Events marked SET_ETYPE_SLOW_BG (display, browsers, saving, OSC)
+      // run from the background dispatch thread, so they can't hold up
+      // SET_ETYPE_SLOW events like loop triggers and selections.
 
 #define MIDI_EVENT_PREALLOCATION 50 // How many MIDI events to preallocate.
 
@@ -174,14 +190,14 @@ void Event::SetupEventTypeTable(MemoryManager *mmgr) {
       SET_ETYPE_NUMPREALLOC(T_EV_Input_MIDIClock,"midiclock",MIDIClockInputEvent,MIDI_EVENT_PREALLOCATION);
       SET_ETYPE_NUMPREALLOC(T_EV_Input_MIDIStartStop,"midistartstop",MIDIStartStopInputEvent,MIDI_EVENT_PREALLOCATION);
 
-      SET_ETYPE_SLOW(T_EV_ALSAMixerControlSet,"alsa-mixer-control-set",ALSAMixerControlSetEvent);
+      SET_ETYPE_SLOW_BG(T_EV_ALSAMixerControlSet,"alsa-mixer-control-set",ALSAMixerControlSetEvent);
 
       SET_ETYPE(T_EV_LoopClicked,"loop-clicked",LoopClickedEvent);
 
       SET_ETYPE(T_EV_GoSub,"go-sub",GoSubEvent);
       SET_ETYPE(T_EV_StartSession,"start-freewheeling",StartSessionEvent);
       SET_ETYPE(T_EV_StartInterface,"start-interface",StartInterfaceEvent);
-      SET_ETYPE_SLOW(T_EV_ExitSession,"exit-freewheeling",ExitSessionEvent);
+      SET_ETYPE_SLOW_BG(T_EV_ExitSession,"exit-freewheeling",ExitSessionEvent);
 
       SET_ETYPE(T_EV_SlideMasterInVolume,"slide-master-in-volume",
                 SlideMasterInVolumeEvent);
@@ -231,6 +247,8 @@ void Event::SetupEventTypeTable(MemoryManager *mmgr) {
       SET_ETYPE(T_EV_SetSyncType,"set-sync-type",SetSyncTypeEvent);
       SET_ETYPE(T_EV_SetSyncSpeed,"set-sync-speed",SetSyncSpeedEvent);
       SET_ETYPE(T_EV_SetMidiSync,"set-midi-sync",SetMidiSyncEvent);
+      SET_ETYPE(T_EV_SetMidiSyncReceive,"set-midi-sync-receive",
+                SetMidiSyncReceiveEvent);
       
       SET_ETYPE(T_EV_SetVariable,"set-variable",SetVariableEvent);
       SET_ETYPE(T_EV_ToggleVariable,"toggle-variable",ToggleVariableEvent);
@@ -249,30 +267,30 @@ void Event::SetupEventTypeTable(MemoryManager *mmgr) {
           VideoShowParamSetBankEvent);
       SET_ETYPE(T_EV_VideoShowParamSetPage,"video-show-paramset-page",
           VideoShowParamSetPageEvent);
-      SET_ETYPE_SLOW(T_EV_VideoShowSnapshotPage,"video-show-snapshot-page",
-                     VideoShowSnapshotPageEvent);
-      SET_ETYPE_SLOW(T_EV_VideoShowLoop,"video-show-loop",VideoShowLoopEvent);
-      SET_ETYPE_SLOW(T_EV_VideoShowLayout,"video-show-layout",
-                     VideoShowLayoutEvent);
-      SET_ETYPE_SLOW(T_EV_VideoSwitchInterface,"video-switch-interface",
-                     VideoSwitchInterfaceEvent);
-      SET_ETYPE_SLOW(T_EV_VideoShowDisplay,"video-show-display",
-                     VideoShowDisplayEvent);
-      SET_ETYPE_SLOW(T_EV_VideoShowHelp,"video-show-help",
-                     VideoShowHelpEvent);
-      SET_ETYPE_SLOW(T_EV_VideoFullScreen,"video-full-screen",
-                     VideoFullScreenEvent);
-      SET_ETYPE_SLOW(T_EV_ShowDebugInfo,"show-debug-info",
-                     ShowDebugInfoEvent);
-
-      SET_ETYPE_SLOW(T_EV_ToggleDiskOutput,"toggle-disk-output",
-                     ToggleDiskOutputEvent);
+      SET_ETYPE_SLOW_BG(T_EV_VideoShowSnapshotPage,"video-show-snapshot-page",
+                        VideoShowSnapshotPageEvent);
+      SET_ETYPE_SLOW_BG(T_EV_VideoShowLoop,"video-show-loop",VideoShowLoopEvent);
+      SET_ETYPE_SLOW_BG(T_EV_VideoShowLayout,"video-show-layout",
+                        VideoShowLayoutEvent);
+      SET_ETYPE_SLOW_BG(T_EV_VideoSwitchInterface,"video-switch-interface",
+                        VideoSwitchInterfaceEvent);
+      SET_ETYPE_SLOW_BG(T_EV_VideoShowDisplay,"video-show-display",
+                        VideoShowDisplayEvent);
+      SET_ETYPE_SLOW_BG(T_EV_VideoShowHelp,"video-show-help",
+                        VideoShowHelpEvent);
+      SET_ETYPE_SLOW_BG(T_EV_VideoFullScreen,"video-full-screen",
+                        VideoFullScreenEvent);
+      SET_ETYPE_SLOW_BG(T_EV_ShowDebugInfo,"show-debug-info",
+                        ShowDebugInfoEvent);
+
+      SET_ETYPE_SLOW_BG(T_EV_ToggleDiskOutput,"toggle-disk-output",
+                        ToggleDiskOutputEvent);
       SET_ETYPE(T_EV_SetAutoLoopSaving,"set-auto-loop-saving",
                 SetAutoLoopSavingEvent);
-      SET_ETYPE_SLOW(T_EV_SaveLoop,"save-loop",SaveLoopEvent);
-      SET_ETYPE_SLOW(T_EV_SaveNewScene,"save-new-scene",SaveNewSceneEvent);
-      SET_ETYPE_SLOW(T_EV_SaveCurrentScene,"save-current-scene",
-                     SaveCurrentSceneEvent);
+      SET_ETYPE_SLOW_BG(T_EV_SaveLoop,"save-loop",SaveLoopEvent);
+      SET_ETYPE_SLOW_BG(T_EV_SaveNewScene,"save-new-scene",SaveNewSceneEvent);
+      SET_ETYPE_SLOW_BG(T_EV_SaveCurrentScene,"save-current-scene",
+                        SaveCurrentSceneEvent);
       SET_ETYPE(T_EV_SetLoadLoopId,"set-load-loop-id",SetLoadLoopIdEvent);
       SET_ETYPE(T_EV_SetDefaultLoopPlacement,"set-default-loop-placement",
                 SetDefaultLoopPlacementEvent);
@@ -303,26 +321,28 @@ void Event::SetupEventTypeTable(MemoryManager *mmgr) {
       SET_ETYPE_SLOW(T_EV_SwapSnapshots,"swap-snapshots",
                      SwapSnapshotsEvent);
       
-      SET_ETYPE_SLOW(T_EV_BrowserMoveToItem,"browser-move-to-item",
-                     BrowserMoveToItemEvent);
-      SET_ETYPE_SLOW(T_EV_BrowserMoveToItemAbsolute,
-                     "browser-move-to-item-absolute",
-                     BrowserMoveToItemAbsoluteEvent);
-      SET_ETYPE_SLOW(T_EV_BrowserSelectItem,"browser-select-item",
-                     BrowserSelectItemEvent);
-      SET_ETYPE_SLOW(T_EV_BrowserRenameItem,"browser-rename-item",
-                     BrowserRenameItemEvent);
+      SET_ETYPE_SLOW_BG(T_EV_BrowserMoveToItem,"browser-move-to-item",
+                        BrowserMoveToItemEvent);
+      SET_ETYPE_SLOW_BG(T_EV_BrowserMoveToItemAbsolute,
+                        "browser-move-to-item-absolute",
+                        BrowserMoveToItemAbsoluteEvent);
+      SET_ETYPE_SLOW_BG(T_EV_BrowserSelectItem,"browser-select-item",
+                        BrowserSelectItemEvent);
+      SET_ETYPE_SLOW_BG(T_EV_BrowserRenameItem,"browser-rename-item",
+                        BrowserRenameItemEvent);
       SET_ETYPE(T_EV_BrowserItemBrowsed,"browser-item-browsed",
                 BrowserItemBrowsedEvent);
-      SET_ETYPE_SLOW(T_EV_PatchBrowserMoveToBank,"patchbrowser-move-to-bank",
-                     PatchBrowserMoveToBankEvent);
-      SET_ETYPE_SLOW(T_EV_PatchBrowserMoveToBankByIndex,
-                     "patchbrowser-move-to-bank-by-index",
-                     PatchBrowserMoveToBankByIndexEvent);
-
-      SET_ETYPE_SLOW(T_EV_TransmitPlayingLoopsToDAW,
-                     "transmit-playing-loops-to-daw",
-                     TransmitPlayingLoopsToDAWEvent);
+      SET_ETYPE_SLOW_BG(T_EV_PatchBrowserMoveToBank,"patchbrowser-move-to-bank",
+                        PatchBrowserMoveToBankEvent);
+      SET_ETYPE_SLOW_BG(T_EV_PatchBrowserMoveToBankByIndex,
+                        "patchbrowser-move-to-bank-by-index",
+                        PatchBrowserMoveToBankByIndexEvent);
+
+      SET_ETYPE_SLOW_BG(T_EV_TransmitPlayingLoopsToDAW,
+                        "transmit-playing-loops-to-daw",
+                        TransmitPlayingLoopsToDAWEvent);
+      SET_ETYPE_SLOW_BG(T_EV_ReportBindingProfile,"report-binding-profile",
+                        ReportBindingProfileEvent);
 
       // Internal events-- don't try to bind to these
 
@@ -341,6 +361,49 @@ void Event::SetupEventTypeTable(MemoryManager *mmgr) {
       break;
     }
   }
+
+  // High-rate events where only the latest value matters-
+  // when these back up in a dispatch lane, intermediate values are dropped
+  // (see EventDispatchLane::IsSuperseded). MIDI input is delivered fast,
+  // so it is coalesced per binding instead (see EventBinding::coalesce).
+  // Mouse motion is coalesced as it is read (see SDLIO)
+  ett[T_EV_Input_MouseMotion].coalesce = 1;
+  ett[T_EV_ALSAMixerControlSet].coalesce = 1;
+
+  // Hash event and parameter names for config parsing
+  evtsyms = new SymbolTable(evnum*2);
+  for (int i = 0; i < evnum; i++) {
+    if (ett[i].name != 0 && evtsyms->Get(ett[i].name) == 0)
+      evtsyms->Set(ett[i].name,(void *) (long) (i+1));
+    if (ett[i].proto != 0) {
+      Event *proto = ett[i].proto;
+      ett[i].params = new SymbolTable(proto->GetNumParams()*2);
+      char byvalvar = 0;
+      for (int j = 0; j < proto->GetNumParams(); j++) {
+        EventParameter param = proto->GetParam(j);
+        if (param.name != 0 && ett[i].params->Get(param.name) == 0)
+          ett[i].params->Set(param.name,(void *) (long) (j+1));
+        if (param.dtype == T_variable)
+          byvalvar = 1;
+      }
+
+      if (byvalvar) {
+        // A UserVariable member points into itself- the event must not
+        // be copied bytewise through the queues (see EVT_DEFINE_BY_REF)
+        union {
+          char buf[EVENT_RECORD_SIZE];
+          double align_dbl;
+        } tmp;
+        Event *cp = proto->CopyInto(tmp.buf,EVENT_RECORD_SIZE);
+        if (cp != 0) {
+          cp->~Event();
+          printf("EVENT: ERROR: Event '%s' holds variables but travels by "
+                 "value!\n",ett[i].name);
+          exit(1);
+        }
+      }
+    }
+  }
 };
 
 void Event::TakedownEventTypeTable() {
@@ -355,9 +418,14 @@ void Event::TakedownEventTypeTable() {
 
     // so the prototype base instance is already deleted
     ett[i].proto = 0;
+
+    if (ett[i].params != 0)
+      delete ett[i].params;
   }
 
   delete[] ett;
+  delete evtsyms;
+  evtsyms = 0;
 };
 
 Event *Event::GetEventByType(EventType typ, char wait) {
@@ -420,34 +488,22 @@ Event *Event::GetEventByName(char *evtname, char wait) {
     exit(1);
   }
 
-  int evnum = (int) EventType(T_EV_Last);
-  for (int i = 0; i < evnum; i++) {
-    if (ett[i].name != 0) 
-      if (!strcmp(evtname, ett[i].name))
-        return GetEventByType((EventType) i,wait);
-  }
-
-  return 0;
+  EventType typ = GetEventTypeByName(evtname);
+  return (typ == T_EV_Last ? 0 : GetEventByType(typ,wait));
 };
 
-EventManager::EventManager () : eq(0), needs_wakeup(0), threadgo(1) {
-  printf("Start event manager.\n");
-
-  // Create listener structure..
-  int evnum = (int) EventType(T_EV_Last);
-  listeners = new EventListenerItem *[evnum];
-  for (int i = 0; i < evnum; i++)
-    listeners[i] = 0;
+EventDispatchLane::EventDispatchLane (EventManager *mgr, EventLane lane) :
+  mgr(mgr), lane(lane), eq(0), needs_wakeup(0) {
+  batch = new EventRecord[EVENT_QUEUE_SIZE];
 
   pthread_mutex_init(&dispatch_thread_lock,0);
-  pthread_mutex_init(&listener_list_lock,0);
   pthread_cond_init(&dispatch_ready,0);
 
   const static size_t STACKSIZE = 1024*128;
   pthread_attr_t attr;
   pthread_attr_init(&attr);
   pthread_attr_setstacksize(&attr,STACKSIZE);
-  printf("EVENT: Stacksize: %zd.\n",STACKSIZE);
+  printf("EVENT: Lane %d stacksize: %zd.\n",(int) lane,STACKSIZE);
 
   // Hold dispatch thread until ready
   pthread_mutex_lock(&dispatch_thread_lock);
@@ -455,7 +511,7 @@ EventManager::EventManager () : eq(0), needs_wakeup(0), threadgo(1) {
   // Start an event dispatch thread
   int ret = pthread_create(&dispatch_thread,
                            &attr,
-                           run_dispatch_thread,
+                           EventManager::run_dispatch_thread,
                            static_cast<void *>(this));
   if (ret != 0) {
     printf("(eventmanager) pthread_create failed, exiting");
@@ -466,18 +522,25 @@ EventManager::EventManager () : eq(0), needs_wakeup(0), threadgo(1) {
   struct sched_param schp;
   memset(&schp, 0, sizeof(schp));
 
-  // Event dispatch thread is NOT RT
+  if (lane == EVENT_LANE_CRITICAL) {
+    // Time-critical lane runs at the lowest RT priority- above the
+    // background lane and UI, but below MIDI and audio
+    schp.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    if (pthread_setschedparam(dispatch_thread, SCHED_FIFO, &schp) == 0)
+      return;
+    printf("EVENT: Can't set realtime thread for lane %d, "
+           "will use nonRT!\n",(int) lane);
+  }
+
+  // Background event dispatch thread is NOT RT
   schp.sched_priority = sched_get_priority_max(SCHED_OTHER);
   if (pthread_setschedparam(dispatch_thread, SCHED_OTHER, &schp) != 0) {
     printf("EVENT: Can't set hi priority thread, will use regular!\n");
   }
 };
 
-EventManager::~EventManager() {
-  //printf("Event Manager: cleanup... this: %p\n",this);   
-  
-  // Terminate the dispatch thread
-  threadgo = 0;
+EventDispatchLane::~EventDispatchLane () {
+  // Terminate the dispatch thread- EventManager has cleared threadgo
   pthread_mutex_lock (&dispatch_thread_lock);
   pthread_cond_signal (&dispatch_ready);
   pthread_mutex_unlock (&dispatch_thread_lock);
@@ -485,22 +548,85 @@ EventManager::~EventManager() {
 
   pthread_cond_destroy (&dispatch_ready);
   pthread_mutex_destroy (&dispatch_thread_lock);
+
+  delete[] batch;
+  if (eq != 0)
+    delete eq;
+};
+
+char EventDispatchLane::IsSuperseded(int n, int batchlen) {
+  Event *ev = batch[n].Get();
+  EventType typ = ev->GetType();
+  if (!Event::ett[(int) typ].coalesce || ev->echo)
+    return 0; // Echoes go out exactly as they came in
+
+  long key = ev->GetCoalesceKey();
+  if (key == 0)
+    return 0;
+
+  for (int i = n+1; i < batchlen; i++) {
+    Event *nx = batch[i].Get();
+    if (nx->GetType() == typ && nx->from == ev->from &&
+        nx->GetCoalesceKey() == key)
+      return 1;
+  }
+
+  return 0;
+};
+
+EventManager::EventManager () : retired(0), threadgo(1) {
+  printf("Start event manager.\n");
+
+  // Create listener structure..
+  int evnum = (int) EventType(T_EV_Last);
+  listeners = new EventListenerTable *[evnum];
+  for (int i = 0; i < evnum; i++)
+    listeners[i] = 0;
+  listener_rcu = new RT_RCU();
+
+  coalesced = new long[evnum];
+  for (int i = 0; i < evnum; i++)
+    coalesced[i] = 0;
+
+  pthread_mutex_init(&listener_list_lock,0);
+  pthread_rwlock_init(&unreg_read_lock,0);
+
+  // Start one dispatch thread per lane
+  for (int i = 0; i < EVENT_NUM_LANES; i++)
+    lanes[i] = new EventDispatchLane(this,(EventLane) i);
+};
+
+EventManager::~EventManager() {
+  //printf("Event Manager: cleanup... this: %p\n",this);   
+  
+  // Terminate the dispatch threads
+  threadgo = 0;
+  for (int i = 0; i < EVENT_NUM_LANES; i++)
+    delete lanes[i];
+
   pthread_mutex_destroy (&listener_list_lock);
+  pthread_rwlock_destroy (&unreg_read_lock);
   
   int evnum = (int) EventType(T_EV_Last);
+  for (int i = 0; i < evnum; i++)
+    if (coalesced[i] != 0)
+      printf("EVENT: Coalesced %ld '%s' events.\n",coalesced[i],
+             Event::ett[i].name);
+  delete[] coalesced;
+
   for (int i = 0; i < evnum; i++) {
     // Erase listeners
-    EventListenerItem *cur = listeners[i];
-    while (cur != 0) {
-      EventListenerItem *tmp = cur->next; 
-      delete cur;
-      cur = tmp;
-    }
+    if (listeners[i] != 0)
+      listeners[i]->RTDelete();
+  }
+  while (retired != 0) {
+    EventListenerTable *tmp = retired->next_retired;
+    retired->RTDelete();
+    retired = tmp;
   }
   
   delete[] listeners;
-  if (eq != 0)
-    delete eq;
+  delete listener_rcu;
   
   // Takedown event type table
   // printf(" .. ETT takedown (this: %p)\n",this);   
@@ -514,10 +640,12 @@ EventManager::~EventManager() {
 void EventManager::FinalPrep() {
   printf("EVENT: Create ringbuffers and begin.\n");
 
-  eq = new SRMWRingBuffer<Event *>(EVENT_QUEUE_SIZE);
+  for (int i = 0; i < EVENT_NUM_LANES; i++) {
+    lanes[i]->eq = new SRMWRingBuffer<EventRecord>(EVENT_QUEUE_SIZE);
 
-  // Start processing
-  pthread_mutex_unlock(&dispatch_thread_lock);
+    // Start processing
+    pthread_mutex_unlock(&lanes[i]->dispatch_thread_lock);
+  }
 };
 
 // Event queue functions ** NOT THREADSAFE **
@@ -555,70 +683,108 @@ void EventManager::RemoveEvent(Event **first, Event *prev, Event **cur) {
   *cur = tmp;
 };
 
+void EventManager::UnlinkEvent(Event **first, Event *prev, Event **cur) {
+  Event *tmp = (*cur)->next;
+  if (prev != 0)
+    prev->next = tmp;
+  else
+    *first = tmp;
+  (*cur)->next = 0;
+  *cur = tmp;
+};
+
 // ** End event queue functions
 
 // Broadcast through dispatch thread!
 // RT and threadsafe, so long as you allocate your event with RTNew()
 void EventManager::BroadcastEvent(Event *ev,
-                    EventProducer *source) {
+                                  EventProducer *source,
+                                  char deleteonsend) {
   // printf("*** THREAD (BROADCAST): %li\n",pthread_self());
 
+  EventRecord rec;
+  if (deleteonsend)
+    rec.Take(ev); // Hand over the preallocated event
+  else if ((ev = rec.CopyFrom(ev)) == 0) {
+    printf("EVENT: BroadcastEvent failed- can't copy event!\n");
+    return;
+  }
+
   ev->from = source;
   //ev->time = mygettime();
 
-  // Write to queue
-  if (eq->WriteElement(ev) != 0) {
+  // Write to the queue for this event's lane
+  EventDispatchLane *l = lanes[Event::ett[(int) ev->GetType()].lane];
+  if (l->eq->WriteElement(rec) != 0) {
     printf("EVENT: BroadcastEvent failed!\n");
     return;
   }
 
   // Wakeup dispatch thread
-  WakeupIfNeeded(1);
+  l->WakeupIfNeeded(1);
 
   // printf("EVENT: SENT: %s!\n",Event::ett[(int) ev->GetType()].name);
 };
 
 void *EventManager::run_dispatch_thread (void *ptr) {
-  EventManager *inst = static_cast<EventManager *>(ptr);
+  EventDispatchLane *l = static_cast<EventDispatchLane *>(ptr);
+  EventManager *inst = l->mgr;
 
-  pthread_mutex_lock(&inst->dispatch_thread_lock);
+  pthread_mutex_lock(&l->dispatch_thread_lock);
 
   while (inst->threadgo) {
     // printf("EVENT: start process queue\n");
 
-    // Scan through all events
-    Event *cur = inst->eq->ReadElement();
-    while (cur != 0) {
-      //printf("broadcast thread\n");
-      // Print time elapsed since broadcast
-      //double dt = (mygettime()-cur->time) * 1000;
-      //printf("Evt dispatch- dt: %2.2f ms\n",dt);
+    // Scan through all events- read them in batches, so that coalescing
+    // events superseded by a later event in the same batch can be dropped
+    int n;
+    do {
+      n = 0;
+      while (n < EVENT_QUEUE_SIZE) {
+        l->batch[n] = l->eq->ReadElement();
+        if (l->batch[n].IsEmpty())
+          break;
+        n++;
+      }
 
-      if (cur->GetMgr() == 0)
-        printf("EVENT: WARNING: Broadcast from RT nonRT event!!\n");
+      for (int i = 0; i < n; i++) {
+        Event *cur = l->batch[i].Get();
 
-      // printf("EVENT: DISPATCH: %s!\n",Event::ett[(int) cur->GetType()].name);
-      inst->BroadcastEventNow(cur,cur->from,0,0); // Force delivery now,
-                                                  // don't erase til we
-                                                  // advance
+        //printf("broadcast thread\n");
+        // Print time elapsed since broadcast
+        //double dt = (mygettime()-cur->time) * 1000;
+        //printf("Evt dispatch- dt: %2.2f ms\n",dt);
 
-      cur->RTDelete();
-      cur = inst->eq->ReadElement();
-    }
+        if (!l->batch[i].IsInline() && cur->GetMgr() == 0)
+          printf("EVENT: WARNING: Broadcast from RT nonRT event!!\n");
+
+        if (l->IsSuperseded(i,n))
+          inst->CountCoalesced(cur->GetType());
+        else {
+          // printf("EVENT: DISPATCH: %s!\n",
+          //        Event::ett[(int) cur->GetType()].name);
+          inst->BroadcastEventNow(cur,cur->from,0,0); // Force delivery now,
+                                                      // don't erase til we
+                                                      // advance
+        }
+
+        l->batch[i].Release();
+      }
+    } while (n > 0);
 
     // No more events in queue
     // printf("EVENT: end process queue\n");
 
     // Wait for wakeup
-    pthread_cond_wait (&inst->dispatch_ready, &inst->dispatch_thread_lock);
+    pthread_cond_wait (&l->dispatch_ready, &l->dispatch_thread_lock);
 
     // printf("EVENT: WAKEUP!\n");
-    inst->needs_wakeup = 0; // Woken!
+    l->needs_wakeup = 0; // Woken!
   }
 
-  printf("Event Manager: end dispatch thread\n");
+  printf("Event Manager: end dispatch thread (lane %d)\n",(int) l->lane);
 
-  pthread_mutex_unlock(&inst->dispatch_thread_lock);
+  pthread_mutex_unlock(&l->dispatch_thread_lock);
 
   return 0;
 };
@@ -629,23 +795,31 @@ void *EventManager::run_dispatch_thread (void *ptr) {
 void EventManager::ListenEvent(EventListener *callme,
                  EventProducer *from, EventType type,
                  char block_self_calls) {
-  EventListenerItem *nw = new EventListenerItem(callme,from,type,
-                                                block_self_calls);
-
   pthread_mutex_lock(&listener_list_lock);
 
-  // Add to the listeners list
+  // Copy the current table, adding the new listener at the end of its part
   int evnum = (int) type;
-  EventListenerItem *cur = listeners[evnum];
-  if (cur == 0)
-    listeners[evnum] = nw; // That was easy, now we have 1 item
-  else {
-    while (cur->next != 0)
-      cur = cur->next;
-    cur->next = nw; // Link up the last item to new1
-  }
+  EventListenerTable *old = listeners[evnum];
+  int old_any = (old != 0 ? old->num_any : 0),
+    old_from = (old != 0 ? old->num_from : 0);
+  EventListenerTable *nw = 
+    ::new EventListenerTable(old_any + (from == 0 ? 1 : 0),
+                             old_from + (from != 0 ? 1 : 0));
+  EventListenerEntry *dst = nw->items;
+  for (int i = 0; i < old_any; i++)
+    *dst++ = old->GetAny()[i];
+  if (from == 0)
+    *dst++ = EventListenerEntry(callme,from,block_self_calls);
+  for (int i = 0; i < old_from; i++)
+    *dst++ = old->GetFrom()[i];
+  if (from != 0)
+    *dst++ = EventListenerEntry(callme,from,block_self_calls);
+
+  listener_rcu->Update((volatile Preallocated **) &listeners[evnum],nw);
 
   pthread_mutex_unlock(&listener_list_lock);
+
+  ReclaimListeners(old);
 };
 
 // Not RT safe!
@@ -653,27 +827,79 @@ void EventManager::UnlistenEvent(EventListener *callme,
                    EventProducer *from, EventType type) {
   pthread_mutex_lock(&listener_list_lock);
 
-  // Remove from the listeners list
   int evnum = (int) type;
-  EventListenerItem *cur = listeners[evnum],
-    *prev = 0;
+  EventListenerTable *old = listeners[evnum];
+  if (old == 0) {
+    pthread_mutex_unlock(&listener_list_lock);
+    return;
+  }
 
   // Search for those listening to 'from' & 'type'
-  while (cur != 0 && (cur->callwhom != callme ||
-                      cur->eventsfrom != from)) {
-    prev = cur;
-    cur = cur->next;
+  EventListenerEntry *part = (from == 0 ? old->GetAny() : old->GetFrom());
+  int partnum = (from == 0 ? old->num_any : old->num_from),
+    idx = 0;
+  while (idx < partnum && (part[idx].callwhom != callme ||
+                           part[idx].eventsfrom != from))
+    idx++;
+
+  if (idx == partnum) {
+    // Not listening
+    pthread_mutex_unlock(&listener_list_lock);
+    return;
   }
 
-  if (cur != 0) {
-    // Got it, unlink!
-    if (prev != 0)
-      prev->next = cur->next;
-    else
-      listeners[evnum] = cur->next;
-    delete cur;
+  // Got it, copy all others to a new table
+  int nw_any = old->num_any - (from == 0 ? 1 : 0),
+    nw_from = old->num_from - (from != 0 ? 1 : 0);
+  EventListenerTable *nw = 0;
+  if (nw_any + nw_from > 0) {
+    nw = ::new EventListenerTable(nw_any,nw_from);
+    EventListenerEntry *dst = nw->items;
+    for (int i = 0; i < old->num_any + old->num_from; i++)
+      if (&old->items[i] != &part[idx])
+        *dst++ = old->items[i];
   }
 
+  listener_rcu->Update((volatile Preallocated **) &listeners[evnum],nw);
+
   pthread_mutex_unlock(&listener_list_lock);
+
+  ReclaimListeners(old);
 };
 
+void EventManager::ReclaimListeners(EventListenerTable *old) {
+  if (old == 0)
+    return;
+
+  // Unregistered readers can't be waited on through RCU- if any is 
+  // reading now, it may hold the old table
+  char unreg_reading = (pthread_rwlock_trywrlock(&unreg_read_lock) != 0);
+  if (!unreg_reading)
+    pthread_rwlock_unlock(&unreg_read_lock);
+
+  if (listener_rcu->IsReadLocked() || unreg_reading) {
+    // We are listening or unlistening from inside a dispatch, so we are
+    // one of the readers we would wait for (or an unregistered thread is
+    // reading). Free the old table on a later update.
+    pthread_mutex_lock(&listener_list_lock);
+    old->next_retired = retired;
+    retired = old;
+    pthread_mutex_unlock(&listener_list_lock);
+    return;
+  }
+
+  // Take any tables retired earlier
+  pthread_mutex_lock(&listener_list_lock);
+  EventListenerTable *ret = retired;
+  retired = 0;
+  pthread_mutex_unlock(&listener_list_lock);
+
+  // Wait until no dispatch can be holding the old tables, then free them
+  listener_rcu->Synchronize(EVENT_RCU_SLEEP);
+  old->RTDelete();
+  while (ret != 0) {
+    EventListenerTable *tmp = ret->next_retired;
+    ret->RTDelete();
+    ret = tmp;
+  }
+};
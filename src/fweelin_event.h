@@ -20,6 +20,7 @@
 
 #include <linux/limits.h>
 #include <pthread.h>
+#include <new>
 
 #include <SDL/SDL.h>
 extern "C"
@@ -73,8 +74,32 @@ double mygettime(void);
 #define EVT_NEW_BLOCK(typ,etyp) ::new typ[Event::GetMemMgrByType(etyp)-> \
                                           GetBlockSize()]
 
+// Copy this event into memsize bytes at mem, by value
+#define EVT_DEFINE_COPYINTO(typ) \
+  virtual Event *CopyInto(void *mem, size_t memsize) { \
+    if (sizeof(typ) > memsize) \
+      return 0; \
+    Event *cp = ::new (mem) typ(); \
+    *cp = *this; \
+    return cp; \
+  };
+
 // Basic defines for within an Event
 #define EVT_DEFINE(typ,etyp) \
+  typ() { Recycle(); }; \
+  \
+  virtual Preallocated *NewInstance() { \
+    return EVT_NEW_BLOCK(typ,etyp); \
+  }; \
+  virtual EventType GetType() { return etyp; }; \
+  EVT_DEFINE_COPYINTO(typ) \
+  FWMEM_DEFINE_DELBLOCK
+
+// Event that never travels by value- for events holding a UserVariable,
+// whose value pointer points into the variable itself. Event records are
+// copied bytewise through the dispatch queues, which would leave it
+// pointing into the old copy
+#define EVT_DEFINE_BY_REF(typ,etyp) \
   typ() { Recycle(); }; \
   \
   virtual Preallocated *NewInstance() { \
@@ -88,6 +113,7 @@ double mygettime(void);
     return EVT_NEW_BLOCK(typ,etyp); \
   }; \
   virtual EventType GetType() { return etyp; }; \
+  EVT_DEFINE_COPYINTO(typ) \
   FWMEM_DEFINE_DELBLOCK
 
 #define EVT_DEFINE_NO_BLOCK(typ,etyp) \
@@ -96,7 +122,8 @@ double mygettime(void);
   virtual Preallocated *NewInstance() { \
     return ::new typ(); \
   }; \
-  virtual EventType GetType() { return etyp; };
+  virtual EventType GetType() { return etyp; }; \
+  EVT_DEFINE_COPYINTO(typ)
 
 // List of all types of events
 enum EventType {
@@ -181,6 +208,7 @@ enum EventType {
   T_EV_SetSyncType,
   T_EV_SetSyncSpeed,
   T_EV_SetMidiSync,
+  T_EV_SetMidiSyncReceive,
   
   T_EV_ToggleSelectLoop,
   T_EV_SelectOnlyPlayingLoops,
@@ -224,11 +252,14 @@ enum EventType {
 
   T_EV_TransmitPlayingLoopsToDAW,
 
+  T_EV_ReportBindingProfile,
+
   T_EV_Last
 };
 
 #include "fweelin_datatypes.h"
 #include "fweelin_block.h"
+#include "fweelin_rcu.h"
 
 // Gets the offset of given variable into the current class
 #define FWEELIN_GETOFS(a) ((long)&a - (long)this)
@@ -257,13 +288,26 @@ class EventParameter {
                  // for an indexed parameter, or -1 for an unindexed param
 };
 
+// Slow-delivery events are dispatched through one of these lanes. Each lane
+// has its own queue and dispatch thread, so that a slow listener in the
+// background lane (UI, disk, OSC) can't delay triggers in the time-critical
+// lane. Order is kept within a lane, but not between lanes.
+enum EventLane {
+  EVENT_LANE_CRITICAL,   // Loop triggers, records, pulses, selections
+  EVENT_LANE_BACKGROUND, // Display, browsers, saving, OSC
+
+  EVENT_NUM_LANES
+};
+
 // Table of all event types and memory managers for them
 class EventTypeTable {
  public:
   EventTypeTable (char *name = 0, PreallocatedType *mgr = 0,
-                  Event *proto = 0, int paramidx = -1, char slowdelivery = 0) :
+                  Event *proto = 0, int paramidx = -1, char slowdelivery = 0,
+                  char coalesce = 0, EventLane lane = EVENT_LANE_CRITICAL) :
     name(name), pretype(mgr), proto(proto), paramidx(paramidx), 
-    slowdelivery(slowdelivery) {};
+    slowdelivery(slowdelivery), coalesce(coalesce), lane(lane), 
+    params(0) {};
 
   char *name;
   PreallocatedType *pretype;
@@ -274,6 +318,13 @@ class EventTypeTable {
   char slowdelivery; // Nonzero if this event should be delivered slow, in
                      // a nonRT thread. This is useful for events that cause
                      // nonRT-safe operations to be executed.
+  char coalesce; // Nonzero if this is a high-rate event where only the
+                 // latest value matters. When several events of this type
+                 // with the same coalescing key are waiting, only the
+                 // latest is delivered (see Event::GetCoalesceKey).
+  EventLane lane; // Which dispatch lane this event goes through when
+                  // broadcast through the dispatch thread
+  SymbolTable *params; // Parameter names to parameter index + 1
 };
 
 // Events can be allocated in realtime using class Preallocated
@@ -288,9 +339,26 @@ class Event : public Preallocated {
     next = 0;
     time.tv_sec = 0;
     time.tv_nsec = 0;
+    intype = T_EV_None;
     echo = 0;
+    superseded = 0;
   };
 
+  // Stamp this event as user input arriving now- the stamp travels with
+  // all events derived from this one, so that we can measure the latency
+  // from input to audio
+  inline void StampInput() {
+    clock_gettime(CLOCK_MONOTONIC,&time);
+    intype = (unsigned char) GetType();
+  };
+  // Carry over the input stamp from the event src
+  inline void CopyStamp(Event *src) {
+    time = src->time;
+    intype = src->intype;
+  };
+  // Nonzero if this event derives from stamped input
+  inline char IsStamped() { return intype != T_EV_None; };
+
   virtual void operator = (const Event &/*evt*/) {};
   virtual EventType GetType() { return T_EV_None; };  
   // Returns the number of parameters this event has
@@ -299,6 +367,14 @@ class Event : public Preallocated {
   virtual EventParameter GetParam(int /*param_n*/) {
     return EventParameter();
   };
+  // Returns the key under which this event is coalesced with others of
+  // its type- two waiting events with the same key carry the same control,
+  // so the earlier one can be dropped. Zero means never coalesce.
+  virtual long GetCoalesceKey() { return 0; };
+  // Constructs a copy of this event in the memsize bytes at mem, without
+  // going through the memory manager. Returns the copy, or 0 if this event
+  // doesn't fit.
+  virtual Event *CopyInto(void */*mem*/, size_t /*memsize*/) { return 0; };
 
   // Get the memory manager for the given type
   static inline PreallocatedType *GetMemMgrByType(EventType typ) {
@@ -315,8 +391,22 @@ class Event : public Preallocated {
   static int GetParamIdxByType(EventType typ) { return ett[typ].paramidx; };
   // Returns the string name of the given event type
   static char *GetEventName(EventType typ) { return ett[typ].name; };
+  // Returns the type of the event named 'evtname', or T_EV_Last if there
+  // is no such event
+  static EventType GetEventTypeByName(char *evtname) {
+    long ret = (long) evtsyms->Get(evtname);
+    return (ret == 0 ? T_EV_Last : (EventType) (ret-1));
+  };
+  // Returns the index of the parameter named 'name' for the event with given
+  // type, or -1 if there is no such parameter
+  static int GetParamIdxByName(EventType typ, char *name) {
+    if (ett[typ].params == 0)
+      return -1;
+    return (int) (long) ett[typ].params->Get(name) - 1;
+  };
 
   static EventTypeTable *ett;
+  static SymbolTable *evtsyms; // Event names to event type + 1
   static void SetupEventTypeTable(MemoryManager *mmgr);
   static void TakedownEventTypeTable();
 
@@ -326,14 +416,86 @@ class Event : public Preallocated {
   EventListener *to;
   // In an event queue, this stores pointer to next event
   Event *next;
-  // Time to send event
+  // Time (CLOCK_MONOTONIC) when the input this event derives from arrived
   struct timespec time;
+  // Type of the input event this event derives from, or T_EV_None
+  unsigned char intype;
   // Event is being echoed to MIDI outputs?
   // If echo is nonzero, the event is sent through the patch routing
   // for the currently selected patch- affecting the port(s) and channel(s)
   // where the event is sent. If echo is 0, the event is sent out as described
   // in the event (ie via outport and midichannel parameters).
   char echo;
+  // Nonzero if this is an input event that a later input for the same
+  // control already replaces- bindings that only care about the latest
+  // value (coalesce="1") skip it
+  char superseded;
+};
+
+// Events up to this many bytes of parameters travel by value
+#define EVENT_INLINE_PARAM_SIZE 64
+#define EVENT_RECORD_SIZE (sizeof(Event) + EVENT_INLINE_PARAM_SIZE)
+
+// A fixed-size record that holds one event- small events are stored
+// inside the record by value, so they need no RTNew/RTDelete. Larger events
+// are held by pointer to a preallocated instance. Records are what the
+// event dispatch queues carry- and are copied bytewise there, so events
+// that point into themselves must not be stored by value
+// (see EVT_DEFINE_BY_REF).
+class EventRecord {
+ public:
+  // Empty record- SRMWRingBuffer::ReadElement returns 0 when there's
+  // nothing to read
+  EventRecord (int /*empty*/ = 0) : ev(0), isinline(0) {};
+
+  // Returns the event held in this record, or 0 if empty. Valid until the
+  // record is copied or released.
+  inline Event *Get() { return (isinline ? (Event *) data.buf : ev); };
+  inline char IsEmpty() { return (!isinline && ev == 0); };
+  inline char IsInline() { return isinline; };
+
+  // Store a copy of src in this record- by value if it fits, otherwise in
+  // a new preallocated instance. Returns the copy, or 0 if no instance
+  // could be allocated.
+  inline Event *CopyFrom(Event *src) {
+    Event *cp = src->CopyInto(data.buf,EVENT_RECORD_SIZE);
+    if (cp != 0)
+      isinline = 1;
+    else {
+      cp = (Event *) src->RTNew();
+      if (cp == 0)
+        return 0;
+      *cp = *src;
+      ev = cp;
+    }
+    cp->CopyStamp(src);
+
+    return cp;
+  };
+
+  // Take over the preallocated event src- it will be erased on Release()
+  inline void Take(Event *src) { ev = src; };
+
+  // Erase the event held in this record
+  inline void Release() {
+    if (isinline) {
+      ((Event *) data.buf)->~Event();
+      isinline = 0;
+    } else if (ev != 0) {
+      ev->RTDelete();
+      ev = 0;
+    }
+  };
+
+ private:
+  Event *ev;     // Preallocated event, if not inline
+  char isinline; // Nonzero if the event is stored in data
+
+  union {
+    char buf[EVENT_RECORD_SIZE];
+    void *align_ptr;
+    double align_dbl;
+  } data;
 };
 
 // GoSub is really an event that encapsulates other events
@@ -518,7 +680,6 @@ class MouseMotionInputEvent : public Event {
 
     return EventParameter();
   };    
-
   int x, y;   // Coordinates of mouse motion (on screen)
 };
 
@@ -555,7 +716,6 @@ class MIDIControllerInputEvent : public Event {
 
     return EventParameter();
   };    
-
   int outport, // # of MIDI output to send event to
     channel,   // MIDI channel
     ctrl,      // controller #
@@ -593,7 +753,6 @@ class MIDIChannelPressureInputEvent : public Event {
 
     return EventParameter();
   };    
-
   int outport, // # of MIDI output to send event to
       channel, // MIDI channel
       val;     // Channel pressure value
@@ -666,7 +825,6 @@ class MIDIPitchBendInputEvent : public Event {
 
     return EventParameter();
   };    
-
   int outport, // # of MIDI output to send event to
     channel,   // MIDI channel
     val;       // pitch bend value
@@ -721,11 +879,13 @@ public:
   EVT_DEFINE(MIDIClockInputEvent,T_EV_Input_MIDIClock);
   virtual void Recycle() {
     outport = 1;
+    frameofs = -1;
     Event::Recycle();
   };
   virtual void operator = (const Event &src) {
     MIDIClockInputEvent &s = (MIDIClockInputEvent &) src;
     outport = s.outport;
+    frameofs = s.frameofs;
   };
   virtual int GetNumParams() { return 1; };
   virtual EventParameter GetParam(int n) { 
@@ -738,6 +898,8 @@ public:
   };    
   
   int outport; // # of MIDI output to send event to
+  int frameofs; // Frame within the current audio period where the clock
+                // falls- or -1 to send immediately
 };
 
 class MIDIStartStopInputEvent : public Event {
@@ -746,12 +908,14 @@ public:
   virtual void Recycle() {
     outport = 1;
     start = 0;
+    frameofs = -1;
     Event::Recycle();
   };
   virtual void operator = (const Event &src) {
     MIDIStartStopInputEvent &s = (MIDIStartStopInputEvent &) src;
     outport = s.outport;
     start = s.start;
+    frameofs = s.frameofs;
   };
   virtual int GetNumParams() { return 2; };
   virtual EventParameter GetParam(int n) { 
@@ -767,11 +931,13 @@ public:
   
   int outport; // # of MIDI output to send event to
   char start;  // 1- MIDI Start, 0- MIDI Stop
+  int frameofs; // Frame within the current audio period where the message
+                // falls- or -1 to send immediately
 };
 
 class SetVariableEvent : public Event {
  public:
-  EVT_DEFINE(SetVariableEvent,T_EV_SetVariable);
+  EVT_DEFINE_BY_REF(SetVariableEvent,T_EV_SetVariable);
   virtual void Recycle() {
     maxjumpcheck = 0;
     Event::Recycle();
@@ -800,7 +966,6 @@ class SetVariableEvent : public Event {
 
     return EventParameter();
   };    
-
   UserVariable *var;  // Variable to set
   UserVariable value, // Value to set it to
     maxjump;          // Maximum jump in variable between current value and new value
@@ -844,7 +1009,7 @@ class ToggleVariableEvent : public Event {
 
 class SplitVariableMSBLSBEvent : public Event {
  public:
-  EVT_DEFINE(SplitVariableMSBLSBEvent,T_EV_SplitVariableMSBLSB);
+  EVT_DEFINE_BY_REF(SplitVariableMSBLSBEvent,T_EV_SplitVariableMSBLSB);
   virtual void Recycle() {
     Event::Recycle();
   };
@@ -992,7 +1157,7 @@ class ParamSetSetParamEvent : public Event {
 
 class LogFaderVolToLinearEvent : public Event {
  public:
-  EVT_DEFINE(LogFaderVolToLinearEvent,T_EV_LogFaderVolToLinear);
+  EVT_DEFINE_BY_REF(LogFaderVolToLinearEvent,T_EV_LogFaderVolToLinear);
   virtual void Recycle() {
     Event::Recycle();
   };
@@ -1069,6 +1234,9 @@ class ALSAMixerControlSetEvent : public Event {
 
     return EventParameter();
   };
+  virtual long GetCoalesceKey() { 
+    return (numid < 0 ? 0 : (((long) hwid << 24) | numid) + 1);
+  };
 
   int hwid,   // Hardware interface ID for alsa (ie hwid=0 is hw:0)
     numid;    // ALSA mixer control numid (ie 'amixer cset numid=5')
@@ -2393,6 +2561,27 @@ public:
   int midisync; // Nonzero to transmit MIDI sync, zero for no MIDI sync
 };
 
+class SetMidiSyncReceiveEvent : public Event {
+public:
+  EVT_DEFINE(SetMidiSyncReceiveEvent,T_EV_SetMidiSyncReceive);
+  virtual void operator = (const Event &src) {
+    SetMidiSyncReceiveEvent &s = (SetMidiSyncReceiveEvent &) src;
+    midisyncreceive = s.midisyncreceive;
+  };
+  virtual int GetNumParams() { return 1; };
+  virtual EventParameter GetParam(int n) { 
+    switch (n) {
+      case 0:
+        return EventParameter("midisyncreceive",
+                              FWEELIN_GETOFS(midisyncreceive),T_int);
+    }
+    
+    return EventParameter();
+  };    
+  
+  int midisyncreceive; // Nonzero to follow incoming MIDI clock
+};
+
 class ToggleSelectLoopEvent : public Event {
  public:
   EVT_DEFINE(ToggleSelectLoopEvent,T_EV_ToggleSelectLoop);
@@ -2772,30 +2961,90 @@ class TransmitPlayingLoopsToDAWEvent : public Event {
   EVT_DEFINE(TransmitPlayingLoopsToDAWEvent,T_EV_TransmitPlayingLoopsToDAW);
 };
 
-// Consider making EventListenerItem a Preallocated type to improve performance
-// when adding/removing listeners-- this will happen more often now that
-// PulseSyncEvent and other BMG type tasks are being merged into EMG
-class EventListenerItem {
+// ReportBindingProfile dumps hit and timing counters for all input bindings
+// to stdout, or to an OSC monitor if osc is nonzero.
+// If reset is nonzero, counters are cleared after the report.
+class ReportBindingProfileEvent : public Event {
  public:
-  EventListenerItem(EventListener *callwhom, 
-                    EventProducer *eventsfrom,
-                    EventType oftype, char block_self_calls) :
-    callwhom(callwhom), eventsfrom(eventsfrom), oftype(oftype),
-    block_self_calls(block_self_calls), next(0) {};
+  EVT_DEFINE(ReportBindingProfileEvent,T_EV_ReportBindingProfile);
+  virtual void Recycle() {
+    osc = 0;
+    reset = 0;
+    Event::Recycle();
+  };
+  virtual void operator = (const Event &src) {
+    ReportBindingProfileEvent &s = (ReportBindingProfileEvent &) src;
+    osc = s.osc;
+    reset = s.reset;
+  };
+  virtual int GetNumParams() { return 2; };
+  virtual EventParameter GetParam(int n) { 
+    switch (n) {
+    case 0:
+      return EventParameter("osc",FWEELIN_GETOFS(osc),T_char);
+    case 1:
+      return EventParameter("reset",FWEELIN_GETOFS(reset),T_char);
+    }
+
+    return EventParameter();
+  };    
+
+  char osc,   // Nonzero to transmit report over OSC
+    reset;    // Nonzero to clear counters after report
+};
+
+// One listener, as stored in an EventListenerTable
+class EventListenerEntry {
+ public:
+  EventListenerEntry(EventListener *callwhom = 0, 
+                     EventProducer *eventsfrom = 0,
+                     char block_self_calls = 0) :
+    callwhom(callwhom), eventsfrom(eventsfrom), 
+    block_self_calls(block_self_calls) {};
 
   // Call this listener..
   EventListener *callwhom;
-  // When events from this event producer..
+  // When events from this event producer are produced
   EventProducer *eventsfrom;
-  // And this type.. are produced
-  EventType oftype;
 
   // If nonzero, this flag stops a producer's events from calling itself
   // if that producer is also a listener
   char block_self_calls;
+};
+
+// Flat table of all listeners for one event type.
+//
+// Listeners are pre-split by source filter- first come those listening to
+// events from any producer, then those listening to one given producer.
+// A table is never modified once dispatch can see it. ListenEvent and 
+// UnlistenEvent build a new table and publish it through RCU, so dispatch
+// walks a contiguous array without taking any lock.
+class EventListenerTable : public Preallocated {
+ public:
+  EventListenerTable(int num_any, int num_from) :
+    num_any(num_any), num_from(num_from), next_retired(0) {
+    int num = num_any + num_from;
+    items = (num > 0 ? new EventListenerEntry[num] : 0);
+  };
+  virtual ~EventListenerTable() {
+    if (items != 0)
+      delete[] items;
+  };
 
-  // Pointer to next list item
-  EventListenerItem *next;
+  // Tables are not preallocated- they are only created by nonRT writers
+  virtual Preallocated *NewInstance() { 
+    return ::new EventListenerTable(num_any,num_from);
+  };
+
+  inline EventListenerEntry *GetAny() { return items; };
+  inline EventListenerEntry *GetFrom() { return items + num_any; };
+
+  int num_any,               // Number of listeners for events from any producer
+    num_from;                // Number of listeners for events from one producer
+  EventListenerEntry *items; // num_any + num_from listeners
+
+  // Next table in EventManager's list of retired tables
+  EventListenerTable *next_retired;
 };
 
 // EventManager manages generic event types
@@ -2810,7 +3059,61 @@ class EventListenerItem {
 // Events can be sent through RT safe methods.. the dispatch is
 // optimized by event type, to eliminate lengthy searches for
 // eventlisteners
+class EventManager;
+
+// One dispatch lane- a queue and the thread that delivers from it
+class EventDispatchLane {
+ public:
+  EventDispatchLane(EventManager *mgr, EventLane lane);
+  ~EventDispatchLane();
+
+  // Wakeup the dispatch thread for this lane. Non blocking, RT safe.
+  inline void WakeupIfNeeded(char always_wakeup = 0) {
+    if (always_wakeup || needs_wakeup) {
+      /* if (!always_wakeup)
+        printf("EVENT: Woken because of priority inversion\n"); */
+
+      // Wake up the dispatch thread
+      if (pthread_mutex_trylock (&dispatch_thread_lock) == 0) {
+        pthread_cond_signal (&dispatch_ready);
+        pthread_mutex_unlock (&dispatch_thread_lock);
+      }
+      else {
+        // Priority inversion - we are interrupting the event dispatch thread while it's processing eq
+        // This is not an issue, because eq uses SRMWRingBuffer. However, we the event dispatch thread
+        // may go to sleep, missing the new messages until it's woken again. So, set a flag and the RT audio
+        // thread will wake it up next process cycle.
+
+        if (always_wakeup) {
+          // printf("EVENT: WARNING: Priority inversion during event broadcast!\n"); // ,Event::ett[(int) ev->GetType()].name);
+          needs_wakeup = 1;
+        }
+      }
+    }
+  };
+
+  // Returns nonzero if event n in the dispatch batch is superseded by a
+  // later event in the batch with the same type and coalescing key
+  char IsSuperseded(int n, int batchlen);
+
+  EventManager *mgr;
+  EventLane lane;
+
+  // Event queue- for calling listeners in lowpriority
+  SRMWRingBuffer<EventRecord> *eq;
+  // Events read from eq by the dispatch thread, waiting to be delivered
+  EventRecord *batch;
+
+  volatile char needs_wakeup; // Event dispatch thread needs wakeup? (priority inversion)
+
+  pthread_t dispatch_thread;
+  pthread_mutex_t dispatch_thread_lock;
+  pthread_cond_t  dispatch_ready;
+};
+
 class EventManager {
+  friend class EventDispatchLane;
+
  public:
   EventManager();
   ~EventManager();
@@ -2824,6 +3127,8 @@ class EventManager {
   static Event *DeleteQueue(Event *first);
   static void QueueEvent(Event **first, Event *nw);
   static void RemoveEvent(Event **first, Event *prev, Event **cur);
+  // Like RemoveEvent, but the event is only unlinked, not deleted
+  static void UnlinkEvent(Event **first, Event *prev, Event **cur);
 
   // Broadcast immediately (RT safe only if listeners' receive methods are RT safe - depends on event)!
   inline void BroadcastEventNow(Event *ev, 
@@ -2834,17 +3139,38 @@ class EventManager {
     
     // Check if this event is slow-delivery only
     if (allowslowdelivery && Event::ett[evnum].slowdelivery)
-      BroadcastEvent(ev,source);
+      BroadcastEvent(ev,source,deleteonsend);
     else {
       // Scan through the listeners to see who to call
-      EventListenerItem *cur = listeners[evnum];
-      while (cur != 0) {
-        if ((cur->eventsfrom == 0 && 
-             (!cur->block_self_calls || source != (void *) cur->callwhom)) ||
-            source == 0 || cur->eventsfrom == source)
-          cur->callwhom->ReceiveEvent(ev,source);
-        cur = cur->next;
+      // Threads that aren't registered RCU readers (such as library
+      // threads started after the ring buffers are built) read under
+      // unreg_read_lock instead
+      char rcu = (listener_rcu->ReadLock(0) == 0);
+      if (!rcu)
+        pthread_rwlock_rdlock(&unreg_read_lock);
+
+      EventListenerTable *tbl = listeners[evnum];
+      if (tbl != 0) {
+        // Listeners for events from any producer
+        EventListenerEntry *cur = tbl->GetAny(),
+          *end = cur + tbl->num_any;
+        for (; cur != end; cur++)
+          if (!cur->block_self_calls || source == 0 || 
+              source != (void *) cur->callwhom)
+            cur->callwhom->ReceiveEvent(ev,source);
+
+        // Listeners for events from one producer
+        cur = end;
+        end = cur + tbl->num_from;
+        for (; cur != end; cur++)
+          if (source == 0 || cur->eventsfrom == source)
+            cur->callwhom->ReceiveEvent(ev,source);
       }
+
+      if (rcu)
+        listener_rcu->ReadUnlock();
+      else
+        pthread_rwlock_unlock(&unreg_read_lock);
       
       // This event has been broadcast.. erase it!.. use RTDelete()
       if (deleteonsend)
@@ -2854,8 +3180,11 @@ class EventManager {
 
   // Broadcast through dispatch thread!
   // RT safe! -- so long as you allocate your event with RTNew()
+  // If deleteonsend is zero, the caller keeps ev (it may be on the stack)
+  // and a copy is queued- by value, for small events
   void BroadcastEvent(Event *ev, 
-                      EventProducer *source);
+                      EventProducer *source,
+                      char deleteonsend = 1);
 
   // Not RT safe, but threadsafe!
   // Listen for the given event (optionally from the given producer) and callme
@@ -2868,46 +3197,44 @@ class EventManager {
   void UnlistenEvent(EventListener *callme,
                      EventProducer *from, EventType type);
 
-  // Wakeup the event dispatch thread. Non blocking, RT safe.
-  inline void WakeupIfNeeded(char always_wakeup = 0) {
-    if (always_wakeup || needs_wakeup) {
-      /* if (!always_wakeup)
-        printf("EVENT: Woken because of priority inversion\n"); */
-
-      // Wake up the dispatch thread
-      if (pthread_mutex_trylock (&dispatch_thread_lock) == 0) {
-        pthread_cond_signal (&dispatch_ready);
-        pthread_mutex_unlock (&dispatch_thread_lock);
-      }
-      else {
-        // Priority inversion - we are interrupting the event dispatch thread while it's processing eq
-        // This is not an issue, because eq uses SRMWRingBuffer. However, we the event dispatch thread
-        // may go to sleep, missing the new messages until it's woken again. So, set a flag and the RT audio
-        // thread will wake it up next process cycle.
+  // Count one event of the given type that was dropped because a later
+  // event with the same coalescing key superseded it. RT safe.
+  inline void CountCoalesced(EventType typ) { 
+    __sync_fetch_and_add(&coalesced[(int) typ],1); 
+  };
+  // Returns the number of events of the given type dropped by coalescing
+  inline long GetNumCoalesced(EventType typ) { 
+    return coalesced[(int) typ]; 
+  };
 
-        if (always_wakeup) {
-          // printf("EVENT: WARNING: Priority inversion during event broadcast!\n"); // ,Event::ett[(int) ev->GetType()].name);
-          needs_wakeup = 1;
-        }
-      }
-    }
+  // Wakeup the event dispatch threads. Non blocking, RT safe.
+  inline void WakeupIfNeeded(char always_wakeup = 0) {
+    for (int i = 0; i < EVENT_NUM_LANES; i++)
+      lanes[i]->WakeupIfNeeded(always_wakeup);
   };
 
 private:
 
   static void *run_dispatch_thread (void *ptr);
 
-  // For each event type, we store a list of listeners..
-  EventListenerItem **listeners;
-  // Event queue- for calling listeners in lowpriority
-  SRMWRingBuffer<Event *> *eq;
-
-  volatile char needs_wakeup; // Event dispatch thread needs wakeup? (priority inversion)
-  
-  pthread_t dispatch_thread;
-  pthread_mutex_t dispatch_thread_lock,
-    listener_list_lock;
-  pthread_cond_t  dispatch_ready;
+  // Frees a listener table that has been replaced, once no dispatch can
+  // be reading it. Call without listener_list_lock held.
+  void ReclaimListeners(EventListenerTable *old);
+
+  // For each event type, we store a table of listeners..
+  // (read through listener_rcu, written under listener_list_lock)
+  EventListenerTable **listeners;
+  RT_RCU *listener_rcu;
+  // Tables replaced from inside a dispatch, waiting to be freed
+  EventListenerTable *retired;
+  // Dispatch lanes- for calling listeners in lowpriority
+  EventDispatchLane *lanes[EVENT_NUM_LANES];
+  // For each event type, the number of events dropped by coalescing
+  volatile long *coalesced;
+
+  pthread_mutex_t listener_list_lock;
+  // Held for reading while unregistered threads read the listener tables
+  pthread_rwlock_t unreg_read_lock;
 
   int threadgo;
   
@@ -36,6 +36,124 @@ public:
   std::string name;  // Name of file
 };
 
+// Name of the library index file, inside the library path
+#define FWEELIN_LIBRARY_INDEX_NAME ".fweelin-index.xml"
+
+// One loop or scene in the library index
+class LibraryIndexEntry {
+public:
+  // Types of entries
+  const static char LOOP = 0,
+    SCENE = 1;
+
+  LibraryIndexEntry() : type(LOOP), c(UNKNOWN), mtime(0), len(0), nbeats(0),
+    pulselen(0), seen(0), next(0), bnext(0) { hash[0] = '\0'; };
+
+  char type;
+  char hash[SAVEABLE_HASH_LENGTH*2+1]; // Hash, as text
+  std::string file,   // Filename within library, with extension
+    name;             // Name given to the loop/scene, if any
+  codec c;            // Codec of audio file (loops)
+  time_t mtime;       // Time file was saved
+  nframes_t len;      // Length of loop (0 if not known yet)
+  long nbeats;        // Number of beats in loop
+  int pulselen;       // Length of pulse loop is synced to (0 for none)
+
+  char seen;          // Found in directory during rescan?
+  LibraryIndexEntry *next,  // Next in index
+    *bnext;                 // Next in hash bucket
+};
+
+// LibraryIndex keeps a list of all loops and scenes in the library, stored
+// on disk in the library itself. The browsers are filled from the index
+// and loop files are found through it, instead of scanning the library
+// directory. The library is only rescanned when it has changed behind our
+// back (its directory time no longer matches the index). Index entries are
+// checked against the disk when they are used.
+class LibraryIndex {
+public:
+  // Number of hash buckets- indexed by the first byte of the hash
+  const static int NUM_BUCKETS = 256;
+
+  // Reads the index from the library
+  LibraryIndex(Fweelin *app);
+  ~LibraryIndex();
+
+  // Nonzero if the index matches the library directory
+  char IsCurrent();
+
+  // Scans the library directory, adding new files to the index and
+  // removing files which are gone
+  void Rescan();
+
+  // Writes the index back to disk, if it has changed
+  void Write();
+
+  // Finds the loop with given stubname (library path, loop name and hash)
+  // in the index. Returns nonzero if found (and the file still exists)
+  char FindLoop(const char *stubname, LibraryFileInfo *ret);
+
+  // Adds or updates the loop/scene with given filename (full path with
+  // extension)- if we wrote the file ourselves, call FileWritten after
+  void Add(char type, const char *filename, codec c, time_t mtime,
+           nframes_t len = 0, long nbeats = 0, int pulselen = 0);
+
+  // Updates loop details, for the loop with given hash
+  void SetLoopInfo(unsigned char *hash, nframes_t len, long nbeats,
+                   int pulselen);
+
+  // The loop/scene with the same hash as 'newstub' (full path without
+  // extension) has been renamed to 'newstub'- 'before' is the directory
+  // time taken before the rename (see FileWritten)
+  void Renamed(char type, const char *newstub, long long before);
+
+  // We have written to the library ourselves- 'before' is GetDirTime() 
+  // taken before writing. If nobody else had changed the library by then,
+  // an index which was current still is
+  void FileWritten(long long before);
+
+  // Modification time of library directory, in nanoseconds
+  long long GetDirTime();
+
+  // Lock the index while walking through the entries
+  inline void Lock() { pthread_mutex_lock(&indexlock); };
+  inline void Unlock() { pthread_mutex_unlock(&indexlock); };
+  inline LibraryIndexEntry *GetFirst() { return first; };
+
+private:
+
+  // Splits the given filename (with or without path and extension) into
+  // hash and name- nonzero if the filename is not a loop/scene of this type
+  static int SplitName(char type, const char *filename, char *hash,
+                       std::string *name);
+  static int GetBucket(const char *hash);
+  // Full path of file for the given entry
+  std::string GetPath(LibraryIndexEntry *e);
+
+  LibraryIndexEntry *Find(char type, const char *hash);
+  void Remove(LibraryIndexEntry *e);
+  void Insert(LibraryIndexEntry *e);
+
+  // Notes that we have changed the library ourselves- adopts the new
+  // directory time only if the directory was unchanged before our write,
+  // otherwise someone else changed it and the index is no longer current
+  void Touch(long long before);
+
+  // Adds the files matching the given pattern to the index during rescan
+  void ScanFiles(char type, const char *pattern, codec c);
+
+  Fweelin *app;
+
+  LibraryIndexEntry *first,
+    *buckets[NUM_BUCKETS];
+
+  long long dirmtime; // Time of library directory when index was current
+  char current,       // Nonzero if index matches library directory
+    dirty;            // Nonzero if index needs to be written
+
+  pthread_mutex_t indexlock;
+};
+
 class LibraryHelper {
 public:
   // Returns the stub (base of filename) for a given loop in memory
@@ -91,6 +209,12 @@ public:
     struct stat st;
 
     LibraryFileInfo ret;
+
+    // Try the library index first
+    LibraryIndex *idx = (app->getLOOPMGR() != 0 ? 
+                         app->getLOOPMGR()->GetLibraryIndex() : 0);
+    if (idx != 0 && idx->FindLoop(stubname,&ret))
+      return ret;
     
     // Try exact filename with all format types
     for (codec i = FIRST_FORMAT; i < END_OF_FORMATS; i = (codec) (i+1)) {
@@ -102,6 +226,8 @@ public:
         ret.exists = 1;
         ret.c = i;
         ret.name = s;
+        if (idx != 0)
+          idx->Add(LibraryIndexEntry::LOOP,s.c_str(),i,st.st_mtime);
         return ret;
       }
     }
@@ -120,6 +246,9 @@ public:
             ret.exists = 1;
             ret.c = i;
             ret.name = globbuf.gl_pathv[j];
+            if (idx != 0)
+              idx->Add(LibraryIndexEntry::LOOP,globbuf.gl_pathv[j],i,
+                       st.st_mtime);
             globfree(&globbuf);
             return ret;
           }
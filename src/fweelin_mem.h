@@ -84,6 +84,12 @@ class PreallocatedType : public SListItem {
   void Cleanup();
 
   inline int GetBlockSize() { return prealloc_num_instances; };
+
+  // Returns the number of instances ready for RTNew right now
+  inline int GetNumReady() { 
+    return ready_list->CountItemsWithState(RTStore<PreallocatedInstance>::
+                                           ITEM_WAITING);
+  };
   
  private:
   
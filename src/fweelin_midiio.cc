@@ -183,13 +183,16 @@ int MidiIO::activate() {
   
   listen_events();
 
-  // Request initial patch from patch browser
+  // Default echo routes (until a patch is set), then request initial
+  // patch from patch browser
+  CompileRoutes();
   PatchBrowser *br = (PatchBrowser *) app->getBROWSER(B_Patch);
   if (br != 0)
     br->SetMIDIForPatch();
     
   // Prepare auto-bypass
   bp = new BypassInfo[fs->GetNumMIDIOuts()*MAX_MIDI_CHANNELS];
+  PrepareFeedback();
 
   inst->checkfreq = inst->app->getAUDIO()->get_srate(); // How often to check auto-bypass conditions for MIDI
 
@@ -319,20 +322,20 @@ void MidiIO::OutputNote (int port, int chan, char down, int notenum, int vel) {
                                 curPacket,0 /*Now*/,3,msg);
 };
 
-void MidiIO::OutputClock (int port) {
+void MidiIO::OutputClock (int port, int /*frameofs*/) {
   unsigned char msg = 0xF8;       
   curPacket = MIDIPacketListAdd(packetList,sizeof(obuf),
                                 curPacket,0 /*Now*/,1,&msg);
 };
 
 
-void MidiIO::OutputStart (int port) {
+void MidiIO::OutputStart (int port, int /*frameofs*/) {
   unsigned char msg = 0xFA;       
   curPacket = MIDIPacketListAdd(packetList,sizeof(obuf),
                                 curPacket,0 /*Now*/,1,&msg);
 };
 
-void MidiIO::OutputStop (int port) {
+void MidiIO::OutputStop (int port, int /*frameofs*/) {
   unsigned char msg = 0xFC;       
   curPacket = MIDIPacketListAdd(packetList,sizeof(obuf),
                                 curPacket,0 /*Now*/,1,&msg);
@@ -348,6 +351,12 @@ void MidiIO::OutputEndOnPort (int port) {
   MIDI_TRANSMIT(port);
 };
 
+// MIDI sync is transmitted as it is generated- only controller feedback
+// waits for the end of the period
+void MidiIO::FlushOutput () {
+  FlushFeedback();
+};
+
 #else // __MACOSX__
 
 // ******** LINUX MIDI
@@ -386,12 +395,64 @@ char MidiIO::open_midi (int num_in, int num_out) {
       return -1;
     }
   }
+
+  // Queue for scheduling MIDI sync output ahead of time- the audio thread
+  // may already be running, so only publish the queue once it is started
+  int q = snd_seq_alloc_named_queue(seq_handle, MIDI_CLIENT_NAME);
+  if (q < 0)
+    printf("MIDI: Can't allocate queue- MIDI sync will be sent "
+           "unscheduled.\n");
+  else {
+    snd_seq_start_queue(seq_handle, q, 0);
+    snd_seq_drain_output(seq_handle);
+    seq_queue = q;
+  }
   
   return 0;
 }
 
 int MidiIO::activate() {
-  // Linux MIDI handling using ALSA seq on its own thread
+  if (app->getCFG()->IsJackMIDI()) {
+    // JACK MIDI ports are read and written in the audio thread- the MIDI
+    // thread handles the input
+    printf("MIDI: Using JACK MIDI ports.\n");
+
+    jackmidi = 1;
+    numins = 1;
+    numouts = app->getCFG()->GetNumMIDIOuts();
+    checkfreq = app->getAUDIO()->get_srate();
+    jack_lastofs = new nframes_t[numouts];
+    memset(jack_lastofs,0,sizeof(nframes_t) * numouts);
+    jack_outq = new SRMWRingBuffer<JackMIDIMsg>(JACK_MIDI_QUEUE_SIZE);
+    jack_inq = new SRMWRingBuffer<JackMIDIInMsg>(JACK_MIDI_IN_QUEUE_SIZE);
+    listen_events();
+
+    int ret = start_midi_thread();
+    if (ret != 0)
+      return ret;
+  } else {
+    int ret = start_midi_thread();
+    if (ret != 0)
+      return ret;
+  }
+
+  // Default echo routes (until a patch is set), then request initial
+  // patch from patch browser
+  CompileRoutes();
+  PatchBrowser *br = (PatchBrowser *) app->getBROWSER(B_Patch);
+  if (br != 0)
+    br->SetMIDIForPatch();
+
+  // Prepare auto-bypass
+  bp = new BypassInfo[app->getCFG()->GetNumMIDIOuts()*MAX_MIDI_CHANNELS];
+  PrepareFeedback();
+
+  return 0;
+}
+
+int MidiIO::start_midi_thread() {
+  // Linux MIDI handling using ALSA seq (or JACK MIDI input) on its own 
+  // thread
   printf("MIDI: Starting MIDI thread..\n");
 
   const static size_t STACKSIZE = 1024*64;
@@ -403,7 +464,8 @@ int MidiIO::activate() {
   midithreadgo = 1;
   int ret = pthread_create(&midi_thread,
                            &attr,
-                           run_midi_thread,
+                           (jackmidi ? run_jack_midi_thread : 
+                            run_midi_thread),
                            this);
   if (ret != 0) {
     printf("(start) pthread_create failed, exiting");
@@ -437,24 +499,268 @@ int MidiIO::activate() {
     printf("MIDI: Can't set realtime thread, will use nonRT!\n");
   }
 
-  // Request initial patch from patch browser
-  PatchBrowser *br = (PatchBrowser *) app->getBROWSER(B_Patch);
-  if (br != 0)
-    br->SetMIDIForPatch();
-
-  // Prepare auto-bypass
-  bp = new BypassInfo[app->getCFG()->GetNumMIDIOuts()*MAX_MIDI_CHANNELS];
-
   return 0;
 }
 
 void MidiIO::close() {
   printf("MIDI: begin close...\n");
-  midithreadgo = 0;
-  pthread_join(midi_thread,0);
+  if (jackmidi) {
+    unlisten_events();
+
+    midithreadgo = 0;
+    pthread_mutex_lock(&jack_in_lock);
+    pthread_cond_signal(&jack_in_ready);
+    pthread_mutex_unlock(&jack_in_lock);
+    pthread_join(midi_thread,0);
+  } else {
+    midithreadgo = 0;
+    pthread_join(midi_thread,0);
+  }
   printf("MIDI: end\n");
 }
 
+EventType MidiIO::GetJackCoalescedType (void *inbuf, int n, int batchlen) {
+  jack_midi_event_t ev, nx;
+  if (jack_midi_event_get(&ev, inbuf, n) != 0 || ev.size < 3)
+    return T_EV_None;
+
+  EventType typ;
+  unsigned char status = ev.buffer[0] & 0xF0;
+  switch (status) {
+  case 0xB0:
+    // Always deliver the extremes and the sustain pedal- as for ALSA input
+    if (ev.buffer[1] == MIDI_CC_SUSTAIN ||
+        ev.buffer[2] == 0 || ev.buffer[2] >= 127)
+      return T_EV_None;
+    typ = T_EV_Input_MIDIController;
+    break;
+  case 0xE0:
+    typ = T_EV_Input_MIDIPitchBend;
+    break;
+  default:
+    return T_EV_None;
+  }
+
+  if (!Event::ett[(int) typ].coalesce)
+    return T_EV_None;
+
+  for (int i = n+1; i < batchlen; i++)
+    if (jack_midi_event_get(&nx, inbuf, i) == 0 && nx.size >= 3 &&
+        nx.buffer[0] == ev.buffer[0] &&
+        (status != 0xB0 || nx.buffer[1] == ev.buffer[1]))
+      return typ;
+
+  return T_EV_None;
+}
+
+void MidiIO::JackProcess (void *inbuf, void **outbufs, nframes_t nframes) {
+  // Prepare outputs for this period
+  for (int i = 0; i < numouts; i++) {
+    jack_midi_clear_buffer(outbufs[i]);
+    jack_lastofs[i] = 0;
+  }
+  jack_outbufs = outbufs;
+  jack_nframes = nframes;
+
+  // Messages sent from other threads go out at the start of the period
+  if (jack_outq != 0) {
+    JackMIDIMsg msg = jack_outq->ReadElement();
+    while (msg.len > 0) {
+      OutputJack(msg.port,msg.data,msg.len);
+      msg = jack_outq->ReadElement();
+    }
+  }
+
+  // Queue input for the MIDI thread- events in this buffer arrived 
+  // during the last period
+  double periodstart = MIDIClockSlave::GetTime() - 
+    (double) nframes / app->getAUDIO()->get_srate();
+  int n = jack_midi_get_event_count(inbuf),
+    queued = 0;
+  for (int i = 0; i < n; i++) {
+    jack_midi_event_t ev;
+    if (jack_midi_event_get(&ev, inbuf, i) != 0 || ev.size < 1 || 
+        ev.size > 3)
+      continue;
+
+    JackMIDIInMsg msg;
+    // Frame accurate arrival time, for MIDI sync
+    msg.t = periodstart + (double) ev.time / app->getAUDIO()->get_srate();
+    msg.len = ev.size;
+    memcpy(msg.data,ev.buffer,ev.size);
+    // A later event in this period may carry the same control
+    msg.superseded = (ev.buffer[0] < MIDI_STATUS_SPP &&
+                      GetJackCoalescedType(inbuf,i,n) != T_EV_None);
+    if (jack_inq->WriteElement(msg) != 0)
+      printf("MIDI: Can't queue JACK MIDI input!\n");
+    else
+      queued++;
+  }
+
+  if (queued > 0 || jack_in_wakeup)
+    WakeupJackMIDIThread();
+}
+
+void MidiIO::WakeupJackMIDIThread () {
+  if (pthread_mutex_trylock(&jack_in_lock) == 0) {
+    jack_in_wakeup = 0;
+    pthread_cond_signal(&jack_in_ready);
+    pthread_mutex_unlock(&jack_in_lock);
+  } else
+    // MIDI thread is between checking the queue and sleeping- it may miss
+    // this input, so wake it again next period
+    jack_in_wakeup = 1;
+}
+
+void *MidiIO::run_jack_midi_thread (void *ptr) {
+  MidiIO *inst = static_cast<MidiIO *>(ptr);
+
+  printf("MIDI: JACK MIDI input thread start..\n");
+
+  pthread_mutex_lock(&inst->jack_in_lock);
+  while (inst->midithreadgo) {
+    JackMIDIInMsg msg = inst->jack_inq->ReadElement();
+    if (msg.len == 0) {
+      // Every second, wake up anyway to check auto-bypass conditions
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME,&ts);
+      ts.tv_sec++;
+      pthread_cond_timedwait(&inst->jack_in_ready,&inst->jack_in_lock,&ts);
+      pthread_mutex_unlock(&inst->jack_in_lock);
+      inst->CheckBypass();
+      pthread_mutex_lock(&inst->jack_in_lock);
+      continue;
+    }
+    pthread_mutex_unlock(&inst->jack_in_lock);
+
+    // Check whether to unbypass used channels
+    inst->CheckUnbypass();
+
+    for (; msg.len > 0; msg = inst->jack_inq->ReadElement()) {
+      unsigned char *buf = msg.data;
+      if (buf[0] >= MIDI_STATUS_SPP) {
+        // MIDI sync
+        if (buf[0] != MIDI_STATUS_SPP)
+          inst->ReceiveSyncEvent(buf[0],msg.t);
+        else if (msg.len >= 3)
+          inst->ReceiveSyncEvent(buf[0],msg.t,(buf[2] << 7) | buf[1]);
+        continue;
+      }
+      if (msg.len < 2)
+        continue;
+
+      inst->insuperseded = msg.superseded;
+
+      int chan = buf[0] & 0x0F;
+      switch (buf[0] & 0xF0) {
+      case 0xB0:
+        if (msg.len >= 3)
+          inst->ReceiveControlChangeEvent(chan,buf[1],buf[2]);
+        break;
+
+      case 0xD0:
+        inst->ReceiveChannelPressureEvent(chan,buf[1]);
+        break;
+
+      case 0xC0:
+        inst->ReceiveProgramChangeEvent(chan,buf[1]);
+        break;
+
+      case 0xE0:
+        if (msg.len >= 3)
+          inst->ReceivePitchBendEvent(chan,
+                                      ((buf[2] << 7) | buf[1]) - 8192);
+        break;
+
+      case 0x90:
+        if (msg.len >= 3)
+          inst->ReceiveNoteOnEvent(chan,buf[1],buf[2]);
+        break;
+
+      case 0x80:
+        if (msg.len >= 3)
+          inst->ReceiveNoteOffEvent(chan,buf[1],buf[2]);
+        break;
+      }
+    }
+    inst->insuperseded = 0;
+
+    inst->CheckBypass();
+    pthread_mutex_lock(&inst->jack_in_lock);
+  }
+  pthread_mutex_unlock(&inst->jack_in_lock);
+
+  printf("MIDI: JACK MIDI input thread done\n");
+  return 0;
+}
+
+void MidiIO::OutputJack (int port, unsigned char *data, unsigned char len,
+                         int frameofs) {
+  if (port < 0 || port >= numouts)
+    return;
+
+  if (jack_outbufs == 0 || !app->getAUDIO()->IsAudioThread()) {
+    // Not in the audio thread- send at the start of the next period
+    JackMIDIMsg msg;
+    msg.port = port;
+    msg.len = len;
+    memcpy(msg.data,data,len);
+    if (jack_outq == 0 || jack_outq->WriteElement(msg) != 0)
+      printf("MIDI: Can't queue JACK MIDI message!\n");
+    return;
+  }
+
+  // Sync messages carry their own frame, others go out as early as they
+  // can- events on a port must be in order
+  nframes_t ofs = (frameofs >= 0 ? (nframes_t) frameofs : 0);
+  if (ofs >= jack_nframes)
+    ofs = jack_nframes-1;
+  if (ofs < jack_lastofs[port])
+    ofs = jack_lastofs[port];
+  if (jack_midi_event_write(jack_outbufs[port],ofs,data,len) != 0)
+    printf("MIDI: JACK MIDI output buffer full!\n");
+  else
+    jack_lastofs[port] = ofs;
+}
+
+EventType MidiIO::GetCoalescedType (snd_seq_event_t *batch, int n, 
+                                    int batchlen) {
+  snd_seq_event_t *ev = &batch[n];
+  EventType typ;
+  switch (ev->type) {
+  case SND_SEQ_EVENT_CONTROLLER:
+    // Always deliver the extremes and the sustain pedal- button-style
+    // controllers send 127 then 0 and both edges are needed
+    if (ev->data.control.param == MIDI_CC_SUSTAIN ||
+        ev->data.control.value <= 0 || ev->data.control.value >= 127)
+      return T_EV_None;
+    typ = T_EV_Input_MIDIController;
+    break;
+  case SND_SEQ_EVENT_CHANPRESS:
+    typ = T_EV_Input_MIDIChannelPressure;
+    break;
+  case SND_SEQ_EVENT_PITCHBEND:
+    typ = T_EV_Input_MIDIPitchBend;
+    break;
+  default:
+    return T_EV_None;
+  }
+
+  if (!Event::ett[(int) typ].coalesce)
+    return T_EV_None;
+
+  for (int i = n+1; i < batchlen; i++) {
+    snd_seq_event_t *nx = &batch[i];
+    if (nx->type == ev->type && 
+        nx->data.control.channel == ev->data.control.channel &&
+        (ev->type != SND_SEQ_EVENT_CONTROLLER || 
+         nx->data.control.param == ev->data.control.param))
+      return typ;
+  }
+
+  return T_EV_None;
+}
+
 void *MidiIO::run_midi_thread(void *ptr)
 {
   MidiIO *inst = static_cast<MidiIO *>(ptr);
@@ -488,76 +794,105 @@ void *MidiIO::run_midi_thread(void *ptr)
       // Check whether to unbypass used channels
       inst->CheckUnbypass();
 
-      // Read event(s)      
+      // Read event(s)- all events waiting are read in as one batch, so
+      // that controller sweeps can be coalesced
       snd_seq_event_t *ev;
+      snd_seq_event_t inbatch[MIDI_INPUT_BATCH];
       // static int cnt = 0;
       do {
-        snd_seq_event_input(inst->seq_handle, &ev);
-        switch (ev->type) {
-#ifdef FWEELIN_LOG_UNHANDLED_MIDI_EVTS
-          case SND_SEQ_EVENT_QFRAME:
-            printf("MTC quarterframe\n");
-            break;
-            
-          case SND_SEQ_EVENT_CLOCK:
-            if (cnt % 24 == 0)
-              printf("clock: %d\n",cnt);
-            cnt++;
-            //printf("clock: %d\n",ev->data.time.tick);
-            //printf("clock: %d\n",ev->data.time.time.tv_sec);
-            //printf("clock: %d\n",ev->data.queue.param.time.time.tv_sec);
+        // Arrival time for MIDI sync in this batch
+        double intime = MIDIClockSlave::GetTime();
+        int n = 0;
+        do {
+          if (snd_seq_event_input(inst->seq_handle, &ev) < 0)
             break;
+          inbatch[n++] = *ev;
+          snd_seq_free_event(ev);
+        } while (n < MIDI_INPUT_BATCH &&
+                 snd_seq_event_input_pending(inst->seq_handle, 0) > 0);
+
+        for (int i = 0; i < n; i++) {
+          ev = &inbatch[i];
+          // A later event in this batch may carry the same control
+          inst->insuperseded = (GetCoalescedType(inbatch,i,n) != T_EV_None);
+
+          switch (ev->type) {
+#ifdef FWEELIN_LOG_UNHANDLED_MIDI_EVTS
+            case SND_SEQ_EVENT_QFRAME:
+              printf("MTC quarterframe\n");
+              break;
             
-          case SND_SEQ_EVENT_TICK:
-            printf("MIDI: 'tick' not yet implemented\n");
-            break;
+            case SND_SEQ_EVENT_TICK:
+              printf("MIDI: 'tick' not yet implemented\n");
+              break;
             
-          case SND_SEQ_EVENT_TEMPO:
-            printf("MIDI: 'tempo' not yet implemented\n");
-            break;
+            case SND_SEQ_EVENT_TEMPO:
+              printf("MIDI: 'tempo' not yet implemented\n");
+              break;
 #endif // FWEELIN_LOG_UNHANDLED_MIDI_EVTS
             
-          case SND_SEQ_EVENT_CONTROLLER: 
-            // Control Change
-            inst->ReceiveControlChangeEvent(ev->data.control.channel,
-                                            ev->data.control.param,
-                                            ev->data.control.value);
-            break;
-
-          case SND_SEQ_EVENT_CHANPRESS:
-            // Channel aftertouch 
-            inst->ReceiveChannelPressureEvent(ev->data.control.channel,
+            case SND_SEQ_EVENT_CONTROLLER: 
+              // Control Change
+              inst->ReceiveControlChangeEvent(ev->data.control.channel,
+                                              ev->data.control.param,
                                               ev->data.control.value);
-            break;
+              break;
 
-          case SND_SEQ_EVENT_PGMCHANGE:
-            // Program Change
-            inst->ReceiveProgramChangeEvent(ev->data.control.channel,
-                                            ev->data.control.value);
-            break;
+            case SND_SEQ_EVENT_CHANPRESS:
+              // Channel aftertouch 
+              inst->ReceiveChannelPressureEvent(ev->data.control.channel,
+                                                ev->data.control.value);
+              break;
+
+            case SND_SEQ_EVENT_PGMCHANGE:
+              // Program Change
+              inst->ReceiveProgramChangeEvent(ev->data.control.channel,
+                                              ev->data.control.value);
+              break;
             
-          case SND_SEQ_EVENT_PITCHBEND:
-            // Pitch Bend
-            inst->ReceivePitchBendEvent(ev->data.control.channel,
-                                        ev->data.control.value);
-            break;
+            case SND_SEQ_EVENT_PITCHBEND:
+              // Pitch Bend
+              inst->ReceivePitchBendEvent(ev->data.control.channel,
+                                          ev->data.control.value);
+              break;
             
-          case SND_SEQ_EVENT_NOTEON:
-            // Note On
-            inst->ReceiveNoteOnEvent(ev->data.control.channel,
-                                     ev->data.note.note,
-                                     ev->data.note.velocity);
-            break;
+            case SND_SEQ_EVENT_NOTEON:
+              // Note On
+              inst->ReceiveNoteOnEvent(ev->data.control.channel,
+                                       ev->data.note.note,
+                                       ev->data.note.velocity);
+              break;
             
-          case SND_SEQ_EVENT_NOTEOFF: 
-            // Note Off
-            inst->ReceiveNoteOffEvent(ev->data.control.channel,
-                                      ev->data.note.note,
-                                      ev->data.note.velocity);
-            break;
+            case SND_SEQ_EVENT_NOTEOFF: 
+              // Note Off
+              inst->ReceiveNoteOffEvent(ev->data.control.channel,
+                                        ev->data.note.note,
+                                        ev->data.note.velocity);
+              break;
+
+            case SND_SEQ_EVENT_CLOCK:
+              inst->ReceiveSyncEvent(MIDI_STATUS_CLOCK,intime);
+              break;
+
+            case SND_SEQ_EVENT_START:
+              inst->ReceiveSyncEvent(MIDI_STATUS_START,intime);
+              break;
+
+            case SND_SEQ_EVENT_CONTINUE:
+              inst->ReceiveSyncEvent(MIDI_STATUS_CONTINUE,intime);
+              break;
+
+            case SND_SEQ_EVENT_STOP:
+              inst->ReceiveSyncEvent(MIDI_STATUS_STOP,intime);
+              break;
+
+            case SND_SEQ_EVENT_SONGPOS:
+              inst->ReceiveSyncEvent(MIDI_STATUS_SPP,intime,
+                                     ev->data.control.value);
+              break;
+          }
         }
-        
-        snd_seq_free_event(ev);
+        inst->insuperseded = 0;
       } while (snd_seq_event_input_pending(inst->seq_handle, 0) > 0);
     }
     
@@ -577,12 +912,23 @@ void MidiIO::OutputController (int port, int chan, int ctrl, int val) {
   else if (val < 0)
     val = 0;
 
+  if (jackmidi) {
+    unsigned char msg[3] = { (unsigned char) (0xB0 | chan), 
+                             (unsigned char) ctrl, (unsigned char) val };
+    OutputJack(port,msg,3);
+    return;
+  }
+
   snd_seq_event_t outev;
   snd_seq_ev_set_subs(&outev);
   snd_seq_ev_set_direct(&outev);
   snd_seq_ev_set_source(&outev,out_ports[port]);
   snd_seq_ev_set_controller(&outev,chan,ctrl,val);
-  snd_seq_event_output_direct(seq_handle, &outev);
+  if (app->getAUDIO()->IsAudioThread())
+    // Don't block the audio thread- batched with the period's output
+    OutputBuffered(&outev);
+  else
+    snd_seq_event_output_direct(seq_handle, &outev);
 };
 
 void MidiIO::OutputProgramChange (int port, int chan, int val) {
@@ -591,6 +937,13 @@ void MidiIO::OutputProgramChange (int port, int chan, int val) {
   else if (val < 0)
     val = 0;
 
+  if (jackmidi) {
+    unsigned char msg[2] = { (unsigned char) (0xC0 | chan), 
+                             (unsigned char) val };
+    OutputJack(port,msg,2);
+    return;
+  }
+
   snd_seq_event_t outev;
   snd_seq_ev_set_subs(&outev);
   snd_seq_ev_set_direct(&outev);
@@ -605,6 +958,13 @@ void MidiIO::OutputChannelPressure (int port, int chan, int val) {
   else if (val < 0)
     val = 0;
 
+  if (jackmidi) {
+    unsigned char msg[2] = { (unsigned char) (0xD0 | chan), 
+                             (unsigned char) val };
+    OutputJack(port,msg,2);
+    return;
+  }
+
   snd_seq_event_t outev;
   snd_seq_ev_set_subs(&outev);
   snd_seq_ev_set_direct(&outev);
@@ -614,6 +974,19 @@ void MidiIO::OutputChannelPressure (int port, int chan, int val) {
 };
 
 void MidiIO::OutputPitchBend (int port, int chan, int val) {
+  if (jackmidi) {
+    int v = val + 8192;
+    if (v < 0)
+      v = 0;
+    else if (v > 16383)
+      v = 16383;
+    unsigned char msg[3] = { (unsigned char) (0xE0 | chan), 
+                             (unsigned char) (v & 0x7F), 
+                             (unsigned char) (v >> 7) };
+    OutputJack(port,msg,3);
+    return;
+  }
+
   snd_seq_event_t outev;
   snd_seq_ev_set_subs(&outev);
   snd_seq_ev_set_direct(&outev);
@@ -623,6 +996,14 @@ void MidiIO::OutputPitchBend (int port, int chan, int val) {
 };
 
 void MidiIO::OutputNote (int port, int chan, char down, int notenum, int vel) {
+  if (jackmidi) {
+    unsigned char msg[3] = { (unsigned char) ((down ? 0x90 : 0x80) | chan), 
+                             (unsigned char) (notenum & 0x7F), 
+                             (unsigned char) (vel & 0x7F) };
+    OutputJack(port,msg,3);
+    return;
+  }
+
   snd_seq_event_t outev;
   snd_seq_ev_set_subs(&outev);
   snd_seq_ev_set_direct(&outev);
@@ -634,45 +1015,140 @@ void MidiIO::OutputNote (int port, int chan, char down, int notenum, int vel) {
   snd_seq_event_output_direct(seq_handle, &outev);
 };
 
-void MidiIO::OutputClock (int port) {
+// MIDI sync messages generated in the audio thread carry their frame offset
+// within the period. They are scheduled on our queue one period ahead-
+// the same delay as the audio- and are buffered and sent together at
+// the end of the period (FlushOutput). Only the audio thread uses the
+// output buffer- all other output is direct.
+//
+// Times are absolute queue times, counted from the start of the period-
+// so how long the period took to process doesn't shift them.
+void MidiIO::OutputSync (snd_seq_event_t *outev, int frameofs) {
+  snd_seq_ev_set_fixed(outev);
+  if (frameofs < 0 || seq_queue < 0 || !app->getAUDIO()->IsAudioThread()) {
+    snd_seq_ev_set_direct(outev);
+    snd_seq_event_output_direct(seq_handle, outev);
+    return;
+  }
+
+  nframes_t srate = app->getAUDIO()->get_srate();
+  if (!periodtimevalid) {
+    // First sync message this period- find the queue time when the
+    // period started
+    snd_seq_queue_status_t *status;
+    snd_seq_queue_status_alloca(&status);
+    if (snd_seq_get_queue_status(seq_handle, seq_queue, status) < 0) {
+      snd_seq_ev_set_direct(outev);
+      snd_seq_event_output_direct(seq_handle, outev);
+      return;
+    }
+
+    const snd_seq_real_time_t *now = 
+      snd_seq_queue_status_get_real_time(status);
+    long long elapsed = (long long) 
+      app->getAUDIO()->GetFramesSinceCycleStart() * 1000000000LL / srate,
+      start = (long long) now->tv_sec * 1000000000LL + now->tv_nsec - elapsed;
+    if (start < 0)
+      start = 0;
+    periodtime.tv_sec = start / 1000000000LL;
+    periodtime.tv_nsec = start % 1000000000LL;
+    periodtimevalid = 1;
+  }
+
+  long long t = (long long) periodtime.tv_sec * 1000000000LL + 
+    periodtime.tv_nsec +
+    (long long) (frameofs + app->getBUFSZ()) * 1000000000LL / srate;
+  snd_seq_real_time_t rt;
+  rt.tv_sec = t / 1000000000LL;
+  rt.tv_nsec = t % 1000000000LL;
+  snd_seq_ev_schedule_real(outev, seq_queue, 0, &rt);
+  OutputBuffered(outev);
+};
+
+void MidiIO::OutputBuffered (snd_seq_event_t *outev) {
+  if (snd_seq_event_output_buffer(seq_handle, outev) < 0) {
+    // Buffer full- send what we have and try again
+    snd_seq_drain_output(seq_handle);
+    if (snd_seq_event_output_buffer(seq_handle, outev) < 0) {
+      printf("MIDI: Can't queue MIDI message!\n");
+      return;
+    }
+  }
+  numqueued++;
+};
+
+void MidiIO::FlushOutput () {
+  // Controller feedback due this period goes out with the rest
+  FlushFeedback();
+
+  jack_outbufs = 0; // End of period- JACK buffers no longer valid
+  periodtimevalid = 0;
+
+  if (numqueued > 0) {
+    snd_seq_drain_output(seq_handle);
+    numqueued = 0;
+  }
+};
+
+void MidiIO::OutputClock (int port, int frameofs) {
+  if (jackmidi) {
+    unsigned char msg = MIDI_STATUS_CLOCK;
+    OutputJack(port,&msg,1,frameofs);
+    return;
+  }
+
   snd_seq_event_t outev;
+  snd_seq_ev_clear(&outev);
   snd_seq_ev_set_subs(&outev);
-  snd_seq_ev_set_direct(&outev);
   snd_seq_ev_set_source(&outev,out_ports[port]);
   outev.type = SND_SEQ_EVENT_CLOCK;
-  snd_seq_ev_set_fixed(&outev);
-  snd_seq_event_output_direct(seq_handle, &outev);  
+  OutputSync(&outev,frameofs);
 };
 
-void MidiIO::OutputStart (int port) {
+void MidiIO::OutputStart (int port, int frameofs) {
+  if (jackmidi) {
+    unsigned char msg = MIDI_STATUS_START;
+    OutputJack(port,&msg,1,frameofs);
+    return;
+  }
+
   snd_seq_event_t outev;
+  snd_seq_ev_clear(&outev);
   snd_seq_ev_set_subs(&outev);
-  snd_seq_ev_set_direct(&outev);
   snd_seq_ev_set_source(&outev,out_ports[port]);
   outev.type = SND_SEQ_EVENT_START;
-  snd_seq_ev_set_fixed(&outev);
-  snd_seq_event_output_direct(seq_handle, &outev);  
+  OutputSync(&outev,frameofs);
 };
 
-void MidiIO::OutputSPP (int port) {
+void MidiIO::OutputSPP (int port, int frameofs) {
+  if (jackmidi) {
+    unsigned char msg[3] = { MIDI_STATUS_SPP, 0, 0 }; // Always start at the beginning
+    OutputJack(port,msg,3,frameofs);
+    return;
+  }
+
   snd_seq_event_t outev;
+  snd_seq_ev_clear(&outev);
   snd_seq_ev_set_subs(&outev);
-  snd_seq_ev_set_direct(&outev);
   snd_seq_ev_set_source(&outev,out_ports[port]);
   outev.type = SND_SEQ_EVENT_SONGPOS;
   outev.data.control.value = 0; // Always start at the beginning
-  snd_seq_ev_set_fixed(&outev);
-  snd_seq_event_output_direct(seq_handle, &outev);
+  OutputSync(&outev,frameofs);
 };
 
-void MidiIO::OutputStop (int port) {
+void MidiIO::OutputStop (int port, int frameofs) {
+  if (jackmidi) {
+    unsigned char msg = MIDI_STATUS_STOP;
+    OutputJack(port,&msg,1,frameofs);
+    return;
+  }
+
   snd_seq_event_t outev;
+  snd_seq_ev_clear(&outev);
   snd_seq_ev_set_subs(&outev);
-  snd_seq_ev_set_direct(&outev);
   snd_seq_ev_set_source(&outev,out_ports[port]);
   outev.type = SND_SEQ_EVENT_STOP;
-  snd_seq_ev_set_fixed(&outev);
-  snd_seq_event_output_direct(seq_handle, &outev);  
+  OutputSync(&outev,frameofs);
 };
 
 // Events are sent directly- no buffer emptying necessary
@@ -687,7 +1163,8 @@ MidiIO::MidiIO (Fweelin *app) : bendertune(0), curbender(0),
                                 echoport(1), echochan(-1), curpatch(0), 
                                 numins(0), numouts(0), app(app), 
                                 
-                                checkfreq(40000), lastchecktime(0), 
+                                insuperseded(0), checkfreq(40000), 
+                                lastchecktime(0), 
                                 
 #ifdef __MACOSX__
                                 client(0), in_ports(0), out_ports(0), out_sources(0), dest(0), 
@@ -695,14 +1172,27 @@ MidiIO::MidiIO (Fweelin *app) : bendertune(0), curbender(0),
                                 packetList((MIDIPacketList *) obuf),
 #else
                                 seq_handle(0), in_ports(0), out_ports(0),
+                                seq_queue(-1), numqueued(0),
+                                periodtimevalid(0),
+                                jackmidi(0), jack_outbufs(0), jack_nframes(0),
+                                jack_lastofs(0), jack_outq(0), jack_inq(0),
+                                jack_in_wakeup(0),
                                 midithreadgo(0),
 #endif
-                                bp(0), midisyncxmit(0)
+                                curroutes(&routetables[0]), nextroutes(1),
+                                bp(0), fb(0), fbdirty(0), fbinterval(0),
+                                fbsent(0), fbdropped(0), fbcoalesced(0),
+                                midisyncxmit(0), midisyncrecv(0)
 {
   note_def_port = new int[MAX_MIDI_NOTES];
-  note_patch = new PatchItem *[MAX_MIDI_NOTES];
+  note_routes = new MIDIRouteTable *[MAX_MIDI_NOTES];
   memset(note_def_port,0,sizeof(int) * MAX_MIDI_NOTES);
-  memset(note_patch,0,sizeof(PatchItem *) * MAX_MIDI_NOTES);  
+  memset(note_routes,0,sizeof(MIDIRouteTable *) * MAX_MIDI_NOTES);  
+
+#ifndef __MACOSX__
+  pthread_mutex_init(&jack_in_lock,0);
+  pthread_cond_init(&jack_in_ready,0);
+#endif
 };
 
 void MidiIO::listen_events () {
@@ -741,49 +1231,50 @@ void MidiIO::unlisten_events () {
   app->getEMG()->UnlistenEvent(this,0,T_EV_Input_MIDIStartStop);
 }
 
+// Incoming MIDI events are built on the stack and broadcast directly-
+// no preallocated instance is needed
 void MidiIO::ReceiveNoteOffEvent (int channel, int notenum, int vel) {
   // Note Off
-  MIDIKeyInputEvent *mevt = (MIDIKeyInputEvent *)
-  Event::GetEventByType(T_EV_Input_MIDIKey);
-  mevt->down = 0;
-  mevt->channel = channel;
-  mevt->notenum = notenum;
-  if (mevt->notenum < 0 || mevt->notenum >= MAX_MIDI_NOTES) {
-    printf("MIDI: Bad MIDI note #%d!\n",mevt->notenum);
-    mevt->notenum = 0;
-  }
-  mevt->vel = vel;
-  mevt->outport = note_def_port[mevt->notenum];
+  MIDIKeyInputEvent mevt;
+  mevt.StampInput();
+  mevt.down = 0;
+  mevt.channel = channel;
+  mevt.notenum = notenum;
+  if (mevt.notenum < 0 || mevt.notenum >= MAX_MIDI_NOTES) {
+    printf("MIDI: Bad MIDI note #%d!\n",mevt.notenum);
+    mevt.notenum = 0;
+  }
+  mevt.vel = vel;
+  mevt.outport = note_def_port[mevt.notenum];
   if (app->getCFG()->IsDebugInfo())
     printf("MIDI: Note %d off, channel %d velocity %d\n",
-           mevt->notenum, mevt->channel, mevt->vel);
-  app->getEMG()->BroadcastEventNow(mevt, this);
+           mevt.notenum, mevt.channel, mevt.vel);
+  app->getEMG()->BroadcastEventNow(&mevt, this, 1, 0);
 };
 
 void MidiIO::ReceiveNoteOnEvent (int channel, int notenum, int vel) {
-  MIDIKeyInputEvent *mevt = (MIDIKeyInputEvent *)
-  Event::GetEventByType(T_EV_Input_MIDIKey);
-  mevt->channel = channel;
-  mevt->notenum = notenum;
-  if (mevt->notenum < 0 || mevt->notenum >= MAX_MIDI_NOTES) {
-    printf("MIDI: Bad MIDI note #%d!\n",mevt->notenum);
-    mevt->notenum = 0;
-  }
-  mevt->vel = vel;
+  MIDIKeyInputEvent mevt;
+  mevt.StampInput();
+  mevt.channel = channel;
+  mevt.notenum = notenum;
+  if (mevt.notenum < 0 || mevt.notenum >= MAX_MIDI_NOTES) {
+    printf("MIDI: Bad MIDI note #%d!\n",mevt.notenum);
+    mevt.notenum = 0;
+  }
+  mevt.vel = vel;
   if (vel > 0) {
-    mevt->down = 1;
-    note_def_port[mevt->notenum] = mevt->outport = echoport;
-    note_patch[mevt->notenum] = curpatch;
+    mevt.down = 1;
+    note_def_port[mevt.notenum] = mevt.outport = echoport;
   } else {
-    mevt->down = 0;
-    mevt->outport = note_def_port[mevt->notenum];
+    mevt.down = 0;
+    mevt.outport = note_def_port[mevt.notenum];
   }
   if (app->getCFG()->IsDebugInfo())
     printf("MIDI: Note %d %s, channel %d velocity %d\n",
-           mevt->notenum,
-           (mevt->down ? "on" : "off"),
-           mevt->channel, mevt->vel);
-  app->getEMG()->BroadcastEventNow(mevt, this);
+           mevt.notenum,
+           (mevt.down ? "on" : "off"),
+           mevt.channel, mevt.vel);
+  app->getEMG()->BroadcastEventNow(&mevt, this, 1, 0);
 }
 
 void MidiIO::ReceivePitchBendEvent (int channel, int value) {
@@ -792,63 +1283,188 @@ void MidiIO::ReceivePitchBendEvent (int channel, int value) {
   // Perform tune
   value += bendertune;
   
-  MIDIPitchBendInputEvent *mevt = (MIDIPitchBendInputEvent *)
-    Event::GetEventByType(T_EV_Input_MIDIPitchBend);
-  mevt->outport = echoport;
-  mevt->channel = channel;
-  mevt->val = value;
+  MIDIPitchBendInputEvent mevt;
+  mevt.StampInput();
+  mevt.superseded = insuperseded;
+  mevt.outport = echoport;
+  mevt.channel = channel;
+  mevt.val = value;
   if (app->getCFG()->IsDebugInfo())
     printf("MIDI: Pitchbend channel %d value %d\n",
-           mevt->channel,mevt->val);
-  app->getEMG()->BroadcastEventNow(mevt, this);
+           mevt.channel,mevt.val);
+  app->getEMG()->BroadcastEventNow(&mevt, this, 1, 0);
 }         
 
 void MidiIO::ReceiveChannelPressureEvent (int channel, int value) {
-  MIDIChannelPressureInputEvent *mevt = (MIDIChannelPressureInputEvent *)
-    Event::GetEventByType(T_EV_Input_MIDIChannelPressure);
-  mevt->outport = echoport;
-  mevt->channel = channel;
-  mevt->val = value;
+  MIDIChannelPressureInputEvent mevt;
+  mevt.StampInput();
+  mevt.superseded = insuperseded;
+  mevt.outport = echoport;
+  mevt.channel = channel;
+  mevt.val = value;
   if (app->getCFG()->IsDebugInfo())
     printf("MIDI: Channel pressure channel %d value %d\n",
-           mevt->channel,mevt->val);
-  app->getEMG()->BroadcastEventNow(mevt, this);
+           mevt.channel,mevt.val);
+  app->getEMG()->BroadcastEventNow(&mevt, this, 1, 0);
 }         
 
 void MidiIO::ReceiveProgramChangeEvent (int channel, int value) {
-  MIDIProgramChangeInputEvent *mevt = (MIDIProgramChangeInputEvent *)
-    Event::GetEventByType(T_EV_Input_MIDIProgramChange);
-  mevt->outport = echoport;
-  mevt->channel = channel;
-  mevt->val = value;
+  MIDIProgramChangeInputEvent mevt;
+  mevt.StampInput();
+  mevt.outport = echoport;
+  mevt.channel = channel;
+  mevt.val = value;
   if (app->getCFG()->IsDebugInfo())
     printf("MIDI: Program change channel %d value %d\n",
-           mevt->channel,mevt->val);
-  app->getEMG()->BroadcastEventNow(mevt, this);
+           mevt.channel,mevt.val);
+  app->getEMG()->BroadcastEventNow(&mevt, this, 1, 0);
 }         
 
 void MidiIO::ReceiveControlChangeEvent (int channel, int ctrl, int value) {
-  MIDIControllerInputEvent *mevt = (MIDIControllerInputEvent *)
-    Event::GetEventByType(T_EV_Input_MIDIController);
-  mevt->outport = echoport;
-  mevt->channel = channel;
-  mevt->ctrl = ctrl;
-  mevt->val = value;
+  MIDIControllerInputEvent mevt;
+  mevt.StampInput();
+  mevt.superseded = insuperseded;
+  mevt.outport = echoport;
+  mevt.channel = channel;
+  mevt.ctrl = ctrl;
+  mevt.val = value;
   if (app->getCFG()->IsDebugInfo())
-    printf("MIDI: Controller %d channel %d value %d\n",mevt->ctrl,
-           mevt->channel,mevt->val);
-  app->getEMG()->BroadcastEventNow(mevt, this);
+    printf("MIDI: Controller %d channel %d value %d\n",mevt.ctrl,
+           mevt.channel,mevt.val);
+  app->getEMG()->BroadcastEventNow(&mevt, this, 1, 0);
 }
 
+void MidiIO::ReceiveSyncEvent (int status, double t, int value) {
+  switch (status) {
+  case MIDI_STATUS_CLOCK :
+    clockslave.Clock(t);
+    break;
+  case MIDI_STATUS_START :
+    clockslave.Start();
+    break;
+  case MIDI_STATUS_CONTINUE :
+    clockslave.Continue();
+    break;
+  case MIDI_STATUS_STOP :
+    clockslave.Stop();
+    break;
+  case MIDI_STATUS_SPP :
+    clockslave.SongPosition(value);
+    break;
+  default :
+    return;
+  }
+
+  if (app->getCFG()->IsDebugInfo() && status != MIDI_STATUS_CLOCK)
+    printf("MIDI: Sync message 0x%X (value %d)\n",status,value);
+}
+
+const double MIDIClockSlave::DLL_BANDWIDTH = 0.5;
+
+void MIDIClockSlave::Clock (double t) {
+  BeginWrite();
+
+  if (numclocks == 0 || (numclocks > 1 && fabs(t-t1) > 4*e2)) {
+    // First clock, or clock was interrupted- restart the loop
+    numclocks = 1;
+  } else if (numclocks == 1) {
+    // Second clock gives the first estimate of the period
+    e2 = t-t0;
+    t1 = t+e2;
+    numclocks++;
+  } else {
+    // Second order delay-locked loop, critically damped- filters the
+    // jitter in clock arrival times into a smooth period estimate
+    double omega = 2*M_PI*DLL_BANDWIDTH*e2,
+      b = sqrt(2)*omega,
+      c = omega*omega,
+      e = t-t1;
+    t1 += b*e + e2;
+    e2 += c*e;
+    if (numclocks < LOCK_CLOCKS)
+      numclocks++;
+  }
+  t0 = t;
+
+  if (running)
+    tick++;
+
+  EndWrite();
+};
+
+void MIDIClockSlave::Start () {
+  BeginWrite();
+  // The first clock after start is the downbeat
+  tick = -1;
+  running = 1;
+  EndWrite();
+};
+
+void MIDIClockSlave::Continue () {
+  BeginWrite();
+  running = 1;
+  EndWrite();
+};
+
+void MIDIClockSlave::Stop () {
+  BeginWrite();
+  running = 0;
+  EndWrite();
+};
+
+void MIDIClockSlave::SongPosition (int sixteenths) {
+  BeginWrite();
+  // One sixteenth note is 6 clocks- the next clock plays at this position
+  tick = sixteenths * MIDI_CLOCK_FREQUENCY / 4 - 1;
+  EndWrite();
+};
+
+char MIDIClockSlave::GetState (double now, double &period, double &nexttime,
+                               long &nexttick) {
+  for (int tries = 0; tries < 4; tries++) {
+    unsigned int s1 = seq;
+    if (s1 & 1)
+      continue; // Being written
+    __sync_synchronize();
+    char ok = (running && numclocks >= LOCK_CLOCKS);
+    period = e2;
+    nexttime = t1;
+    nexttick = tick+1;
+    __sync_synchronize();
+    if (seq == s1)
+      // Consistent- but is the clock still arriving?
+      return (ok && now < nexttime + 2*period);
+  }
+
+  return 0;
+};
+
 MidiIO::~MidiIO() {
+  if (fb != 0) {
+    printf("MIDI: Controller feedback- %d sent, %d duplicates dropped, "
+           "%d coalesced\n",fbsent,fbdropped,fbcoalesced);
+    delete[] fb;
+    delete[] fbdirty;
+  }
   delete[] note_def_port;
-  delete[] note_patch;
+  delete[] note_routes;
   if (in_ports != 0)
     delete[] in_ports;
   if (out_ports != 0)
     delete[] out_ports;
   if (bp != 0)
     delete[] bp;
+#ifndef __MACOSX__
+  if (jack_lastofs != 0)
+    delete[] jack_lastofs;
+  if (jack_outq != 0)
+    delete jack_outq;
+  if (jack_inq != 0)
+    delete jack_inq;
+
+  pthread_cond_destroy(&jack_in_ready);
+  pthread_mutex_destroy(&jack_in_lock);
+#endif
     
 #ifdef __MACOSX__
   if (out_sources != 0)
@@ -960,6 +1576,9 @@ void MidiIO::SetMIDIForPatch (int def_port, PatchItem *patch) {
     }
   }
 
+  // Echo goes through the new settings from here on
+  CompileRoutes();
+
   if (outportschanged) { // If ports changed
     // Enable/Disable FluidSynth engine
     FluidSynthEnableEvent *fsevt = (FluidSynthEnableEvent *)
@@ -984,7 +1603,6 @@ void MidiIO::ReceiveEvent(Event *ev, EventProducer */*from*/) {
     }
     return;
     
-#ifdef FWEELIN_EXPERIMENTAL_MIDI_ECHO
   case T_EV_SetMidiEchoPort :
     {
       SetMidiEchoPortEvent *pev = (SetMidiEchoPortEvent *) ev;
@@ -993,9 +1611,10 @@ void MidiIO::ReceiveEvent(Event *ev, EventProducer */*from*/) {
       if (CRITTERS)
         printf("MIDI: Received SetMidiEchoPort "
                "(port #: %d)\n", pev->echoport);
-      if (pev->echoport >= 0 && pev->echoport <= numouts)
+      if (pev->echoport >= 0 && pev->echoport <= numouts) {
         echoport = pev->echoport;
-      else
+        CompileRoutes();
+      } else
         printf("MIDI: Invalid port #%d (valid range 0-%d)\n",
                pev->echoport,numouts);
     }
@@ -1010,9 +1629,9 @@ void MidiIO::ReceiveEvent(Event *ev, EventProducer */*from*/) {
         printf("MIDI: Received SetMidiEchoChannel "
                "(channel #: %d)\n", cev->echochannel);
       echochan = cev->echochannel;
+      CompileRoutes();
     }
     return;
-#endif // FWEELIN_EXPERIMENTAL_MIDI_ECHO
     
   default:
     break;
@@ -1022,7 +1641,8 @@ void MidiIO::ReceiveEvent(Event *ev, EventProducer */*from*/) {
   EchoEvent(ev);
 }
 
-int MidiIO::EchoEventToPortChannel (Event *ev, int port, int channel, int bypasschannel) {
+int MidiIO::EchoEventToPortChannel (Event *ev, int port, int channel, int bypasschannel,
+                                    char echo) {
   FloConfig *fs = app->getCFG(); 
   static int midi_clock_count = 0;
 
@@ -1033,8 +1653,7 @@ int MidiIO::EchoEventToPortChannel (Event *ev, int port, int channel, int bypass
   switch (ev->GetType()) {
   case T_EV_Input_MIDIClock :
     {
-      // MIDIClockInputEvent *clkevt = (MIDIClockInputEvent *) ev;
-      OutputClock(ret = port);
+      OutputClock(ret = port,((MIDIClockInputEvent *) ev)->frameofs);
 
       midi_clock_count++;
       if (midi_clock_count >= MIDI_CLOCK_FREQUENCY) {
@@ -1050,10 +1669,11 @@ int MidiIO::EchoEventToPortChannel (Event *ev, int port, int channel, int bypass
       MIDIStartStopInputEvent *ssevt = (MIDIStartStopInputEvent *) ev;
       if (ssevt->start) {
         midi_clock_count = 0;
-        OutputSPP(ret = port);  // Output song position pointer first
-        OutputStart(port);      // Then start message
+        // Output song position pointer first, then start message
+        OutputSPP(ret = port,ssevt->frameofs);
+        OutputStart(port,ssevt->frameofs);
       } else
-        OutputStop(ret = port);
+        OutputStop(ret = port,ssevt->frameofs);
     } 
     break;
     
@@ -1065,9 +1685,13 @@ int MidiIO::EchoEventToPortChannel (Event *ev, int port, int channel, int bypass
         bc = (bypasschannel == -1 ? c : bypasschannel);
       ret = p;
       
-      OutputController(p,c,
-                       mcev->ctrl,
-                       mcev->val);
+      if (!echo && fb != 0 && mcev->ctrl != MIDI_CC_SUSTAIN)
+        // Generated by the configuration- controller feedback
+        OutputFeedback(p,c,mcev->ctrl,mcev->val);
+      else
+        OutputController(p,c,
+                         mcev->ctrl,
+                         mcev->val);
 
       if (mcev->ctrl == MIDI_CC_SUSTAIN) {
         BypassInfo *b = getBP(p,bc);
@@ -1170,7 +1794,7 @@ void MidiIO::EchoEvent (Event *ev) {
       numxmitports = app->getCFG()->GetNumMIDISyncOuts();
     for (int i = 0; i < numxmitports; i++) {
       OutputStartOnPort();
-      int port = EchoEventToPortChannel(ev,xmitports[i],-1,-1);
+      int port = EchoEventToPortChannel(ev,xmitports[i],-1,-1,ev->echo);
       OutputEndOnPort(port);
     } 
   } else if (!ev->echo) {
@@ -1180,78 +1804,240 @@ void MidiIO::EchoEvent (Event *ev) {
     // Send to the exact port and channel specified
 
     OutputStartOnPort();
-    int port = EchoEventToPortChannel(ev,-1,-1,-1);
+    int port = EchoEventToPortChannel(ev,-1,-1,-1,0);
     OutputEndOnPort(port);
-  } else {
+  } else
     // Echo of unused MIDI event- use patch logic
-    
-    // Handle special note off case- ensure note off sent to right place(s)
-    PatchItem *ev_patch = 0;
-    int ev_port = 0;
-    if (ev->GetType() == T_EV_Input_MIDIKey &&
-        !((MIDIKeyInputEvent *) ev)->down &&
-        note_patch[((MIDIKeyInputEvent *) ev)->notenum] != 0) {
-      // Use patch which was used when note was pressed
-      ev_patch = note_patch[((MIDIKeyInputEvent *) ev)->notenum];
-      ev_port = note_def_port[((MIDIKeyInputEvent *) ev)->notenum];
-    } else {
-      // Use current patch for all other events
-      ev_patch = curpatch;
-      ev_port = echoport;
+    EchoRouted(ev);
+};
+
+void MidiIO::EchoRouted (Event *ev) {
+  // Pin the current table for the whole echo, so it can't be recompiled
+  // underneath us. Count ourselves as a reader first, then check that
+  // the table is still current
+  MIDIRouteTable *cur;
+  for (;;) {
+    cur = curroutes;
+    __sync_fetch_and_add(&cur->readers,1);
+    if (cur == curroutes)
+      break;
+    __sync_fetch_and_sub(&cur->readers,1);
+  }
+
+  MIDIRouteTable *tbl = cur,
+    *release = 0;
+  int row = MIDI_ROUTE_ANY;
+
+  // Handle special note off case- ensure note off sent to right place(s)
+  if (ev->GetType() == T_EV_Input_MIDIKey) {
+    MIDIKeyInputEvent *note = (MIDIKeyInputEvent *) ev;
+    if (note->notenum < 0 || note->notenum >= MAX_MIDI_NOTES) {
+      __sync_fetch_and_sub(&cur->readers,1);
+      return;
     }
-    
-    // DEBUG
-    // printf("MIDI: Echo port: %d Patch: %p\n",ev_port,ev_patch);
-    
-    if (ev_patch != 0 && ev_patch->IsCombi()) {
-      // Combi patch- keyboard split into zones, possible multichannel output
-      
-      int curport = -1;
-      for (int i = 0; i < ev_patch->numzones; i++) {
-        CombiZone *z = ev_patch->GetZone(i);
-        
-        int notenum = -1;
-        MIDIKeyInputEvent *note = 0;
-        if (ev->GetType() == T_EV_Input_MIDIKey) {
-          note = (MIDIKeyInputEvent *) ev;
-          notenum = note->notenum;
-        }
-        
-        if (notenum == -1 || (notenum >= z->kr_lo && notenum <= z->kr_hi)) {
-          int z_port = (z->port_r ? z->port : echoport);
-          if (curport == -1 || z_port != curport) {
-            // Starting with a new port
-            if (curport > 0 && curport <= numouts)
-              OutputEndOnPort(curport-1);
-            
-            if (z_port > 0 && z_port <= numouts)
-              OutputStartOnPort();
-            curport = z_port;
-          }
-          
-          if (curport > 0 && curport <= numouts)
-            EchoEventToPortChannel(ev,curport-1,z->channel,z->bypasschannel);
-          else if (curport == 0) {
-#if USE_FLUIDSYNTH
-            app->getFLUIDP()->ReceiveMIDIEvent(ev);
-#endif
-          }
-        }
-      }
-    } else {   
-      if (ev_port > 0 && ev_port <= numouts) {
-        // Single channel output- easy case
+    row = note->notenum;
+
+    MIDIRouteTable *held = note_routes[row];
+    if (note->down) {
+      // Remember which table this note was played with
+      if (held != 0)
+        __sync_fetch_and_sub(&held->held,1);
+      __sync_fetch_and_add(&tbl->held,1);
+      note_routes[row] = tbl;
+    } else if (held != 0) {
+      // Use table which was current when note was pressed
+      tbl = release = held;
+      note_routes[row] = 0;
+    }
+  }
+
+  // DEBUG
+  // printf("MIDI: Echo row: %d Routes: %d\n",row,tbl->numroutes[row]);
+
+  int curport = -1;
+  MIDIRoute *r = tbl->routes[row];
+  for (int i = 0; i < tbl->numroutes[row]; i++, r++) {
+    if (r->port != curport) {
+      // Starting with a new port
+      if (curport > 0)
+        OutputEndOnPort(curport-1);
+      if (r->port > 0)
         OutputStartOnPort();
-        EchoEventToPortChannel(ev,ev_port-1,
-                               (echochan != -1 && ev_patch != 0 ? 
-                                ev_patch->channel : echochan),ev_patch->bypasschannel);
-        OutputEndOnPort(ev_port-1);
-      } else if (ev_port == 0) {
+      curport = r->port;
+    }
+
+    if (curport > 0)
+      EchoEventToPortChannel(ev,curport-1,r->channel,r->bypasschannel,1);
+    else {
 #if USE_FLUIDSYNTH
-        app->getFLUIDP()->ReceiveMIDIEvent(ev);
+      app->getFLUIDP()->ReceiveMIDIEvent(ev);
 #endif
+    }
+  }
+  if (curport > 0)
+    OutputEndOnPort(curport-1);
+
+  if (release != 0)
+    __sync_fetch_and_sub(&release->held,1);
+  __sync_fetch_and_sub(&cur->readers,1);
+};
+
+void MidiIO::CompileRoutes () {
+  // Find a table that no held note is still using
+  MIDIRouteTable *tbl = 0;
+  for (int i = 0; i < MIDI_ROUTE_TABLES && tbl == 0; i++) {
+    MIDIRouteTable *t = &routetables[nextroutes];
+    nextroutes = (nextroutes+1) % MIDI_ROUTE_TABLES;
+    if (t != curroutes && t->held <= 0 && t->readers == 0)
+      tbl = t;
+  }
+  if (tbl == 0) {
+    // Too many patch changes with notes held- some note offs may go astray
+    printf("MIDI: WARNING: All route tables have notes held, reusing one\n");
+    tbl = &routetables[nextroutes];
+    if (tbl == curroutes) {
+      nextroutes = (nextroutes+1) % MIDI_ROUTE_TABLES;
+      tbl = &routetables[nextroutes];
+    }
+    nextroutes = (nextroutes+1) % MIDI_ROUTE_TABLES;
+
+    // Echoes are short- wait for any in progress on this table to finish
+    while (__sync_fetch_and_add(&tbl->readers,0) != 0)
+      sched_yield();
+  }
+
+  tbl->Clear();
+  char full = 0;
+  if (curpatch != 0 && curpatch->IsCombi()) {
+    // Combi patch- keyboard split into zones, possible multichannel output
+    for (int i = 0; i < curpatch->numzones; i++) {
+      CombiZone *z = curpatch->GetZone(i);
+      int z_port = (z->port_r ? z->port : echoport);
+      if (z_port < 0 || z_port > numouts)
+        continue;
+
+      int lo = MAX(z->kr_lo,0),
+        hi = MIN(z->kr_hi,MAX_MIDI_NOTES-1);
+      for (int n = lo; n <= hi; n++)
+        full |= tbl->Add(n,z_port,z->channel,z->bypasschannel);
+      full |= tbl->Add(MIDI_ROUTE_ANY,z_port,z->channel,z->bypasschannel);
+    }
+  } else if (echoport >= 0 && echoport <= numouts) {
+    // Single channel output- easy case
+    int c = (echochan != -1 && curpatch != 0 ? curpatch->channel : echochan),
+      bc = (curpatch != 0 ? curpatch->bypasschannel : -1);
+    for (int n = 0; n <= MIDI_ROUTE_ANY; n++)
+      tbl->Add(n,echoport,c,bc);
+  }
+
+  if (full)
+    printf("MIDI: Too many overlapping zones in patch (max %d per key)\n",
+           MIDI_ROUTE_MAX_DEST);
+
+  // Publish
+  __sync_synchronize();
+  curroutes = tbl;
+};
+
+void MidiIO::PrepareFeedback () {
+  float rate = app->getCFG()->GetMIDIFeedbackRate();
+  if (rate <= 0.0)
+    return; // Controller feedback is sent as it is generated
+
+  int nouts = app->getCFG()->GetNumMIDIOuts();
+  fb = new FeedbackState[nouts*MIDI_FEEDBACK_CTRLS];
+  fbdirty = new unsigned int[nouts*MIDI_FEEDBACK_WORDS];
+  memset(fbdirty,0,sizeof(unsigned int) * nouts*MIDI_FEEDBACK_WORDS);
+  fbinterval = (nframes_t) (app->getAUDIO()->get_srate() / rate);
+};
+
+void MidiIO::OutputFeedback (int port, int chan, int ctrl, int val) {
+  if (port < 0 || port >= numouts || chan < 0 || chan >= MAX_MIDI_CHANNELS ||
+      ctrl < 0 || ctrl >= 128) {
+    OutputController(port,chan,ctrl,val);
+    return;
+  }
+  if (val > 127)
+    val = 127;
+  else if (val < 0)
+    val = 0;
+
+  int idx = chan*128 + ctrl;
+  FeedbackState *f = &fb[port*MIDI_FEEDBACK_CTRLS + idx];
+  int pend = __atomic_load_n(&f->pending,__ATOMIC_ACQUIRE);
+  do {
+    if (pend == val || 
+        (pend == -1 && __atomic_load_n(&f->sent,__ATOMIC_ACQUIRE) == val)) {
+      // Controller already has (or will have) this value
+      fbdropped++;
+      return;
+    }
+    // Send on the next flush- if the audio thread took the pending value
+    // meanwhile, look again
+  } while (!__atomic_compare_exchange_n(&f->pending,&pend,val,0,
+                                        __ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE));
+  if (pend != -1)
+    fbcoalesced++; // Replaced a value that was never sent
+
+  __sync_fetch_and_or(&fbdirty[port*MIDI_FEEDBACK_WORDS + idx/32],
+                      1U << (idx%32));
+};
+
+void MidiIO::FlushFeedback () {
+  if (fb == 0)
+    return;
+
+  nframes_t now = app->getRP()->GetSampleCnt();
+  for (int p = 0; p < numouts; p++) {
+    unsigned int *dirty = &fbdirty[p*MIDI_FEEDBACK_WORDS];
+    FeedbackState *pfb = &fb[p*MIDI_FEEDBACK_CTRLS];
+    char started = 0;
+
+    for (int w = 0; w < MIDI_FEEDBACK_WORDS; w++) {
+      if (__atomic_load_n(&dirty[w],__ATOMIC_ACQUIRE) == 0)
+        continue;
+
+      unsigned int bits = __sync_fetch_and_and(&dirty[w],0),
+        keep = 0;
+      while (bits != 0) {
+        int b = __builtin_ctz(bits);
+        bits &= bits-1;
+
+        FeedbackState *f = &pfb[w*32 + b];
+        if (f->sent != -1 && now - f->lastsent < fbinterval) {
+          // Sent too recently- wait
+          keep |= 1U << b;
+          continue;
+        }
+
+        int v = __atomic_load_n(&f->pending,__ATOMIC_ACQUIRE);
+        if (v == -1)
+          continue;
+        // Mark sent before clearing pending, so a writer never sees
+        // neither- if a new value arrived meanwhile, it stays pending
+        int prev = f->sent;
+        __atomic_store_n(&f->sent,v,__ATOMIC_RELEASE);
+        int expect = v;
+        __atomic_compare_exchange_n(&f->pending,&expect,-1,0,
+                                    __ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE);
+        if (v == prev)
+          continue;
+
+        if (!started) {
+          OutputStartOnPort();
+          started = 1;
+        }
+        OutputController(p,(w*32 + b) / 128,(w*32 + b) % 128,v);
+        f->lastsent = now;
+        fbsent++;
       }
+
+      if (keep != 0)
+        __sync_fetch_and_or(&dirty[w],keep);
     }
+
+    if (started)
+      OutputEndOnPort(p);
   }
 };
 
@@ -24,12 +24,27 @@
 #define OBUF_LEN 128    
 #else
 #include <alsa/asoundlib.h>
+#include <jack/midiport.h>
+// Max number of incoming MIDI events read in as one batch
+#define MIDI_INPUT_BATCH 64
+// Number of MIDI messages from non-audio threads that can wait for the
+// next audio period, when using JACK MIDI
+#define JACK_MIDI_QUEUE_SIZE 256
+// Number of incoming JACK MIDI messages that can wait for the MIDI thread
+#define JACK_MIDI_IN_QUEUE_SIZE 1024
 #endif
 
 #include "fweelin_event.h"
 
 #define MIDI_CLOCK_FREQUENCY 24   // 24 MIDI clock messages per quarter note (beat) MIDI standard
 
+// MIDI system realtime/common status bytes for sync
+#define MIDI_STATUS_SPP 0xF2
+#define MIDI_STATUS_CLOCK 0xF8
+#define MIDI_STATUS_START 0xFA
+#define MIDI_STATUS_CONTINUE 0xFB
+#define MIDI_STATUS_STOP 0xFC
+
 class Fweelin;
 class PatchItem;
 
@@ -50,6 +65,144 @@ public:
     bypasscc;           // MIDI CC to send for bypass
 };
 
+// Follows an external MIDI clock. Incoming clock messages are timestamped
+// and run through a delay-locked loop, which filters out their jitter and
+// estimates the clock period (tempo) and the time of the next clock
+// (phase). The MIDI input side writes, and the audio thread reads a
+// consistent copy through a sequence count- neither side ever waits.
+class MIDIClockSlave {
+public:
+  // Bandwidth of the loop filter (Hz)- lower is smoother but follows
+  // tempo changes more slowly
+  const static double DLL_BANDWIDTH;
+  // Number of clocks needed before the loop is considered locked
+  const static int LOCK_CLOCKS = 4;
+
+  MIDIClockSlave() : seq(0), running(0), tick(0), numclocks(0),
+    t0(0), t1(0), e2(0) {};
+
+  // Current time (s) in the timebase used for clocks
+  static inline double GetTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  };
+
+  // MIDI input side- t is the time the message arrived
+  void Clock (double t);
+  void Start ();
+  void Continue ();
+  void Stop ();
+  void SongPosition (int sixteenths);
+
+  // Audio side- gets the clock period (s), the predicted time of the next
+  // clock, and its index counted from MIDI start (0 is the downbeat).
+  // Returns zero if the clock is stopped, not yet locked, or has stopped
+  // arriving as of time 'now'.
+  char GetState (double now, double &period, double &nexttime, 
+                 long &nexttick);
+
+private:
+  inline void BeginWrite() { seq++; __sync_synchronize(); };
+  inline void EndWrite() { __sync_synchronize(); seq++; };
+
+  volatile unsigned int seq; // Odd while the state is being written
+
+  char running;  // Nonzero between MIDI start/continue and stop
+  long tick;     // Index of the last clock received (-1 before the first)
+  int numclocks; // Clocks since the loop was (re)started
+  double t0,     // Time of the last clock
+    t1,          // Predicted time of the next clock
+    e2;          // Filtered clock period
+};
+
+// One destination for echoed MIDI
+class MIDIRoute {
+public:
+  int port,        // Output port (ascending from 1), or 0 for FluidSynth
+    channel,       // Output channel, or -1 to keep the incoming channel
+    bypasschannel; // Channel for auto-bypass, or -1 to use output channel
+};
+
+// Row in a route table for events without a note (controllers, bender..)
+#define MIDI_ROUTE_ANY MAX_MIDI_NOTES
+// Number of route tables in rotation- notes held down keep the table they
+// were played with, so their note offs go to the same places
+#define MIDI_ROUTE_TABLES 4
+// Maximum destinations for one note (overlapping combi zones)
+#define MIDI_ROUTE_MAX_DEST 16
+
+// The current patch, compiled for echo- for each note, the list of
+// destinations. Rebuilt only when the patch or echo settings change,
+// so the echo of each event is a table lookup
+class MIDIRouteTable {
+public:
+  MIDIRouteTable () : held(0), readers(0) { Clear(); };
+
+  inline void Clear () { memset(numroutes,0,sizeof(numroutes)); };
+
+  // Adds a destination for the given note (or MIDI_ROUTE_ANY)
+  // Returns nonzero if there is no room
+  inline char Add (int row, int port, int channel, int bypasschannel) {
+    if (numroutes[row] >= MIDI_ROUTE_MAX_DEST)
+      return 1;
+    MIDIRoute *r = &routes[row][numroutes[row]++];
+    r->port = port;
+    r->channel = channel;
+    r->bypasschannel = bypasschannel;
+    return 0;
+  };
+
+  MIDIRoute routes[MIDI_ROUTE_ANY+1][MIDI_ROUTE_MAX_DEST];
+  int numroutes[MIDI_ROUTE_ANY+1];
+
+  volatile int held,  // Number of notes held down that were routed here
+    readers;          // Number of echoes reading this table right now
+};
+
+// Controller feedback output- last value sent and value waiting to be sent
+// for one port/channel/controller. The sending threads set 'pending' and
+// the audio thread sends it and clears it, so both values are only
+// accessed atomically
+#define MIDI_FEEDBACK_CTRLS (MAX_MIDI_CHANNELS*128)
+#define MIDI_FEEDBACK_WORDS (MIDI_FEEDBACK_CTRLS/32) // Dirty bits per port
+class FeedbackState {
+public:
+  FeedbackState () : sent(-1), pending(-1), lastsent(0) {};
+
+  int sent,           // Last value sent (-1 for none)
+    pending;          // Value waiting to be sent (-1 for none)
+  nframes_t lastsent; // Sample count when last sent (audio thread only)
+};
+
+#ifndef __MACOSX__
+// One short MIDI message waiting to be written to a JACK MIDI output
+class JackMIDIMsg {
+public:
+  // Empty message- SRMWRingBuffer::ReadElement returns 0 when there's
+  // nothing to read
+  JackMIDIMsg (int /*empty*/ = 0) : port(0), len(0) {};
+
+  int port;
+  unsigned char len,
+    data[3];
+};
+
+// One incoming JACK MIDI message, passed from the audio thread to the MIDI
+// thread
+class JackMIDIInMsg {
+public:
+  // Empty message- SRMWRingBuffer::ReadElement returns 0 when there's
+  // nothing to read
+  JackMIDIInMsg (int /*empty*/ = 0) : t(0), len(0), superseded(0) {};
+
+  double t;            // Time the message arrived
+  unsigned char len,
+    data[3];
+  char superseded;     // Later message in the same period has same control
+};
+#endif
+
 class MidiIO : public EventProducer, public EventListener {
   friend class Fweelin;
   
@@ -59,6 +212,19 @@ public:
 
   void ReceiveEvent(Event *ev, EventProducer */*from*/);
 
+  // Is this MIDI input type echoed through the patch routes when unbound?
+  static inline char IsRoutedInput (EventType typ) {
+    return (typ == T_EV_Input_MIDIKey || 
+            typ == T_EV_Input_MIDIController ||
+            typ == T_EV_Input_MIDIProgramChange ||
+            typ == T_EV_Input_MIDIPitchBend);
+  };
+
+  // Echo an unbound MIDI input event straight out through the route table.
+  // Called by the input matrix in the MIDI input thread, in place of
+  // broadcasting an echo copy of the event
+  inline void EchoInput (Event *ev) { EchoRouted(ev); };
+
   int activate ();
   void close ();
 
@@ -80,6 +246,8 @@ public:
   // at the same time. 
   
   // Zones can overlap, so that one key sends to multiple channels/ports
+  //
+  // The settings are compiled into a route table for echo.
   void SetMIDIForPatch (int def_port, PatchItem *patch);
 
   // Send bank and program change messages where appropriate for the given
@@ -93,9 +261,25 @@ public:
   void SetMIDIInput (int idx);
 #endif
   
+  // Send all MIDI sync messages queued during this audio period-
+  // called by the audio thread at the end of each period
+  void FlushOutput ();
+
+#ifndef __MACOSX__
+  // JACK MIDI- called by the audio thread at the start of each period with
+  // the input port buffer and one buffer per output port. Incoming events
+  // are queued here and broadcast from the MIDI thread- handling them can
+  // reach code that isn't realtime safe.
+  void JackProcess (void *inbuf, void **outbufs, nframes_t nframes);
+#endif
+
   // MIDI Sync
   inline int GetMIDISyncTransmit() { return midisyncxmit; };
   inline void SetMIDISyncTransmit(int midisyncxmit) { this->midisyncxmit = midisyncxmit; };
+  // Nonzero if the pulse follows incoming MIDI clock
+  inline char GetMIDISyncReceive() { return midisyncrecv; };
+  inline void SetMIDISyncReceive(char midisyncrecv) { this->midisyncrecv = midisyncrecv; };
+  inline MIDIClockSlave *GetClockSlave() { return &clockslave; };
   
   // Value to offset bender amounts by-- used to do tuning from
   // bender
@@ -139,23 +323,45 @@ protected:
   void OutputPitchBend (int port, int chan, int val);
   void OutputNote (int port, int chan, char down, int notenum, int vel);
 
-  // MIDI Sync messages
-  void OutputClock (int port);
-  void OutputSPP (int port);
-  void OutputStart (int port);
-  void OutputStop (int port);
+  // MIDI Sync messages- frameofs is the frame in the current audio period
+  // where the message belongs, or -1 to send it now
+  void OutputClock (int port, int frameofs = -1);
+  void OutputSPP (int port, int frameofs = -1);
+  void OutputStart (int port, int frameofs = -1);
+  void OutputStop (int port, int frameofs = -1);
   
   // Start/End pass messages
   void OutputStartOnPort ();           // First message for this port in this pass
   void OutputEndOnPort (int /*port*/); // Last message for this port in this pass
 
   // Echo MIDI event to a single port and channel, and update bypass settings for the given channel
+  // If echo is nonzero, the event is passthrough of MIDI input, otherwise
+  // it was generated by the configuration (controllers go to feedback)
   // Return the port echoed to
-  int EchoEventToPortChannel (Event *ev, int port, int channel, int bypasschannel);
+  int EchoEventToPortChannel (Event *ev, int port, int channel, int bypasschannel,
+                              char echo);
 
   // Echo MIDI event back to MIDI outs, according to current patch settings
   void EchoEvent (Event *ev);
 
+  // Echo MIDI event through the route table for the current patch
+  // (always passthrough- never controller feedback)
+  void EchoRouted (Event *ev);
+
+  // Controller feedback (controller messages generated by the
+  // configuration)- duplicates of the value last sent are dropped, and
+  // each controller is sent at most 'midifeedbackrate' times a second.
+  // The latest value waits, and goes out from the audio thread with the
+  // rest of the period's output
+  void OutputFeedback (int port, int chan, int ctrl, int val);
+  void FlushFeedback ();
+  void PrepareFeedback (); // Allocates feedback state (at activate)
+
+  // Compile current patch and echo settings into a free route table and
+  // make it current- a table is free when no held note and no echo in
+  // progress is using it
+  void CompileRoutes ();
+
   // Receive incoming MIDI events from the system and broadcast FreeWheeling
   // MIDI events internally
   void ReceiveNoteOffEvent (int channel, int notenum, int vel);
@@ -164,6 +370,13 @@ protected:
   void ReceiveChannelPressureEvent (int channel, int value);
   void ReceiveProgramChangeEvent (int channel, int value);
   void ReceiveControlChangeEvent (int channel, int ctrl, int value);
+  // Nonzero while receiving an event that a later event in the same input
+  // batch supersedes (see GetCoalescedType)- the event is still delivered
+  // and echoed, but is flagged so that coalescing bindings skip it
+  char insuperseded;
+  // Incoming MIDI sync (MIDI_STATUS_*)- t is the time the message arrived,
+  // value is the song position for SPP
+  void ReceiveSyncEvent (int status, double t, int value = 0);
 
   // Send bank and program change message to port/channel
   void SendBankProgramChangeToPortChannel (int bank, int program, 
@@ -187,31 +400,90 @@ protected:
 
   void static MidiInputProc (const MIDIPacketList *pktlist, void *refCon, void *connRefCon);  
 #else
+  // Start the MIDI thread- ALSA, or JACK MIDI input
+  int start_midi_thread ();
   // Midi event handler thread
   static void *run_midi_thread (void *ptr);
+  // Handler thread for JACK MIDI input queued by JackProcess
+  static void *run_jack_midi_thread (void *ptr);
+  // Wake the JACK MIDI thread- non blocking, RT safe. If the thread is busy,
+  // it is woken again at the start of the next period.
+  void WakeupJackMIDIThread ();
+
+  // If event n in the given batch of incoming events is superseded by a
+  // later event in the batch for the same control, returns the type of
+  // coalescing event it generates- otherwise T_EV_None
+  static EventType GetCoalescedType (snd_seq_event_t *batch, int n, 
+                                     int batchlen);
+
+  // Queue the sync message outev for frame frameofs in the current audio
+  // period, or send it immediately if no frame is given or we are not in
+  // the audio thread
+  void OutputSync (snd_seq_event_t *outev, int frameofs);
+  // Add outev to the output buffer, drained at the end of the audio
+  // period (audio thread only)
+  void OutputBuffered (snd_seq_event_t *outev);
+  // Write one MIDI message to a JACK MIDI output- directly in the audio
+  // thread, or through jack_outq from other threads. Sync messages give
+  // their frame in frameofs, others go out with the input that caused them
+  void OutputJack (int port, unsigned char *data, unsigned char len,
+                   int frameofs = -1);
+  // Like GetCoalescedType, for raw MIDI in a JACK input buffer
+  static EventType GetJackCoalescedType (void *inbuf, int n, int batchlen);
 
   snd_seq_t *seq_handle;
   int *in_ports, *out_ports;
+  int seq_queue,  // ALSA queue that schedules MIDI sync output, or -1
+    numqueued;    // Number of messages in the output buffer this period
+  char periodtimevalid;          // Nonzero once periodtime is known
+  snd_seq_real_time_t periodtime; // Queue time at the start of this period
+
+  // JACK MIDI
+  char jackmidi;             // Nonzero if using JACK MIDI ports
+  void **jack_outbufs;       // Output port buffers- valid during a period
+  nframes_t jack_nframes,    // Length of the current period
+    *jack_lastofs;           // Frame of the last event written, per port
+  SRMWRingBuffer<JackMIDIMsg> *jack_outq; // From non-audio threads
+  SRMWRingBuffer<JackMIDIInMsg> *jack_inq; // Input, to the MIDI thread
+  pthread_mutex_t jack_in_lock;
+  pthread_cond_t jack_in_ready;
+  volatile char jack_in_wakeup; // MIDI thread needs another wakeup
 
   pthread_t midi_thread;
   char midithreadgo;
 #endif
   
-  // For each MIDI note on the scale, what default port and patch was the note
-  // played with? This allows us to send note off(s) to the right place(s), 
-  // even when the patch is changed while notes are held
+  // For each MIDI note on the scale, what default port and route table
+  // was the note played with? This allows us to send note off(s) to the
+  // right place(s), even when the patch is changed while notes are held
   
   // Note: this assumes only 1 keyboard
   int *note_def_port; 
-  PatchItem **note_patch;
+  MIDIRouteTable **note_routes;
+
+  // Echo routes- current table and the tables in rotation
+  MIDIRouteTable routetables[MIDI_ROUTE_TABLES],
+    * volatile curroutes;
+  int nextroutes; // Next table to try when compiling
   
   // Data for automatic toggling of Soft-synth Bypass based on active MIDI channels
   // One instance for each MIDI channel and port
   BypassInfo *bp;
   BypassInfo *getBP (int port, int channel);
   
+  // Controller feedback state- one for each controller on each channel and
+  // port (0 if feedback output is off), with a dirty bit for each waiting
+  FeedbackState *fb;
+  unsigned int *fbdirty;
+  nframes_t fbinterval; // Minimum time (samples) between sends
+  int fbsent,           // Feedback statistics
+    fbdropped,
+    fbcoalesced;
+  
   // MIDI Sync
   int midisyncxmit;  // Nonzero if we should transmit MIDI sync messages
+  char midisyncrecv; // Nonzero if the pulse follows incoming MIDI clock
+  MIDIClockSlave clockslave;
 };
 
 #endif
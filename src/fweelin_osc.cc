@@ -47,7 +47,8 @@
 #include "fweelin_osc.h"
 #include "fweelin_looplibrary.h"
 
-OSCClient::OSCClient(Fweelin *app) : app(app), qtractor_addr(0) {
+OSCClient::OSCClient(Fweelin *app) : app(app), qtractor_addr(0), 
+  profile_addr(0) {
   printf("OSC: Start.\n");
 
   // Init mutex/conditions
@@ -61,6 +62,8 @@ OSCClient::~OSCClient() {
 
   if (qtractor_addr != 0)
     lo_address_free(qtractor_addr);
+  if (profile_addr != 0)
+    lo_address_free(profile_addr);
 
   app->getEMG()->UnlistenEvent(this,0,T_EV_TransmitPlayingLoopsToDAW);
 
@@ -172,6 +175,61 @@ void OSCClient::SendPlayingLoops() {
   pthread_mutex_unlock(&osc_client_lock);
 }
 
+// Sends one /fweelin/profile/input message per input type, and one
+// /fweelin/profile/binding message per binding that was checked or fired
+void OSCClient::SendBindingProfile() {
+  pthread_mutex_lock(&osc_client_lock);
+
+  if (profile_addr == 0) {
+    char portbuf[256];
+    snprintf(portbuf,255,"%d",app->getCFG()->GetOSCProfilePort());
+    profile_addr = lo_address_new(NULL, portbuf);
+  }
+
+  if (profile_addr != 0) {
+    InputMatrix *im = app->getCFG()->GetInputMatrix();
+    int evnum = (int) EventType(T_EV_Last_Bindable);
+    for (int i = 0; i < evnum; i++) {
+      int nbuckets = im->GetNumBindingBuckets((EventType) i);
+      InputProfile *ip = im->GetInputProfile((EventType) i);
+      if (nbuckets == 0 || ip->events == 0)
+        continue;
+
+      char *inname = Event::GetEventName((EventType) i);
+      // input name, events, matched, scanned, max scanned, time (ns)
+      if (lo_send(profile_addr, "/fweelin/profile/input", "shhhhh",
+                  inname, (int64_t) ip->events, (int64_t) ip->matched,
+                  (int64_t) ip->scanned, (int64_t) ip->maxscan,
+                  (int64_t) ip->time) == -1) {
+        printf("OSC: Error %d: %s\n", lo_address_errno(profile_addr), 
+               lo_address_errstr(profile_addr));
+        break;
+      }
+
+      for (int j = 0; j < nbuckets; j++) {
+        EventBinding *cur = im->GetBindingBucket((EventType) i,j);
+        for (int k = 0; cur != 0; k++, cur = cur->next) {
+          BindingProfile *bp = &cur->prof;
+          if (bp->condevals == 0 && bp->hits == 0)
+            continue;
+
+          // input name, bucket, index in bucket, output name, 
+          // hits, conditions checked, failed, time (ns)
+          lo_send(profile_addr, "/fweelin/profile/binding", "siishhhh",
+                  inname, j, k, 
+                  Event::GetEventName(cur->boundproto->GetType()),
+                  (int64_t) bp->hits, (int64_t) bp->condevals, 
+                  (int64_t) bp->fails, (int64_t) bp->time);
+        }
+      }
+    }
+  } else
+    printf("OSC: Couldn't open an OSC connection for profile on port %d\n",
+           app->getCFG()->GetOSCProfilePort());
+
+  pthread_mutex_unlock(&osc_client_lock);
+}
+
 // Open or refresh connection to qtractor
 char OSCClient::open_qtractor_connection() {
   if (qtractor_addr != 0)
@@ -34,6 +34,10 @@ public:
 
   void ReceiveEvent(Event *ev, EventProducer */*from*/);
 
+  // Send binding profile counters to a monitor via OSC- called by the
+  // InputMatrix when it reports the profile
+  void SendBindingProfile();
+
 protected:
   // Core app
   Fweelin *app;
@@ -51,6 +55,9 @@ protected:
   lo_address qtractor_addr;
   //
 
+  // Profile monitor
+  lo_address profile_addr;
+
   pthread_mutex_t osc_client_lock;
 };
 
@@ -29,6 +29,9 @@
 //
 // RT_RCU protects one or more pointers to Preallocated objects.
 // (More than one pointer can be protected only if they are independent pointers (update can only happen atomically to one pointer)).
+//
+// Read-side critical sections may be nested within one thread- only the outermost ReadLock/ReadUnlock pair
+// marks the reader as locked and unlocked.
 class RT_RCU : public RTDataStruct_Updater {
   friend class RT_RWThreads;
 
@@ -37,32 +40,47 @@ public:
   // Create an RCU helper class T
   RT_RCU () : global_time_count(1), last_update_time(0), num_readers(RT_RWThreads::num_rw_threads) {
     reader_lock_times = new uint32_t[MAX_RW_THREADS];
-    for (int i = 0; i < MAX_RW_THREADS; i++)
+    reader_nest = new int[MAX_RW_THREADS];
+    for (int i = 0; i < MAX_RW_THREADS; i++) {
       reader_lock_times[i] = 0;
+      reader_nest[i] = 0;
+    }
 
     // Register this RCU
     RT_RWThreads::RegisterRTDataStruct(this);
   };
-  ~RT_RCU() {
+  virtual ~RT_RCU() {
     // Unregister this RCU
     RT_RWThreads::UnregisterRTDataStruct(this);
 
     delete[] reader_lock_times;
+    delete[] reader_nest;
   };
   
   // Instance methods
   
   // Begin read-side critical section - RT and thread-safe
-  inline int ReadLock () {
+  // Returns nonzero if the calling thread is not a registered reader
+  // (warning about it, unless warn is zero)
+  inline int ReadLock (char warn = 1) {
     if (num_readers != RT_RWThreads::num_rw_threads) {
-      printf("CORE: ERROR: RT_RCU thread count mismatch.\n");
-      exit(1);
+      // A new thread may be registering right now- wait for the update to finish
+      pthread_mutex_lock(&RT_RWThreads::register_rtstruct_lock);
+      pthread_mutex_unlock(&RT_RWThreads::register_rtstruct_lock);
+      if (num_readers != RT_RWThreads::num_rw_threads) {
+        printf("CORE: ERROR: RT_RCU thread count mismatch.\n");
+        exit(1);
+      }
     }
 
     // Determine which read thread we are
     pthread_t id = pthread_self();
     for (int i = 0; i < num_readers; i++)
       if (pthread_equal(id,RT_RWThreads::ids[i])) {
+        // Nested lock- the outermost section already protects us
+        if (reader_nest[i]++ > 0)
+          return 0;
+
         // Increment global time count atomically, storing old value
         // (then, no two threads will ever lock with the same time count)
         uint32_t cnt = __sync_fetch_and_add(&global_time_count,1);
@@ -77,21 +95,31 @@ public:
         return 0;
       }
 
-    printf("CORE: RT_RCU ReadLock from unregistered read thread: %lu!\n",id);
+    if (warn)
+      printf("CORE: RT_RCU ReadLock from unregistered read thread: %lu!\n",id);
     return -1;
   };
 
   // End read-side critical section - RT and thread-safe
   inline int ReadUnlock () {
     if (num_readers != RT_RWThreads::num_rw_threads) {
-      printf("CORE: ERROR: RT_RCU thread count mismatch.\n");
-      exit(1);
+      // A new thread may be registering right now- wait for the update to finish
+      pthread_mutex_lock(&RT_RWThreads::register_rtstruct_lock);
+      pthread_mutex_unlock(&RT_RWThreads::register_rtstruct_lock);
+      if (num_readers != RT_RWThreads::num_rw_threads) {
+        printf("CORE: ERROR: RT_RCU thread count mismatch.\n");
+        exit(1);
+      }
     }
 
     // Determine which read thread we are
     pthread_t id = pthread_self();
     for (int i = 0; i < num_readers; i++)
       if (pthread_equal(id,RT_RWThreads::ids[i])) {
+        // Still inside an outer read-side critical section?
+        if (--reader_nest[i] > 0)
+          return 0;
+
         // Reset state of this reader thread to unlocked
         reader_lock_times[i] = 0;
 
@@ -103,6 +131,17 @@ public:
     return -1;
   };
   
+  // Returns nonzero if the calling thread is inside a read-side critical section.
+  // A writer must not Synchronize() from inside its own read-side section- it would wait on itself forever.
+  inline char IsReadLocked () {
+    pthread_t id = pthread_self();
+    for (int i = 0; i < num_readers; i++)
+      if (pthread_equal(id,RT_RWThreads::ids[i]))
+        return (reader_nest[i] > 0);
+
+    return 0;
+  };
+
   // Update your reference from old_ptr to new_ptr.
   // *old_ptr = new_ptr;
   // Does this atomically, remembering the time when it was done
@@ -156,6 +195,7 @@ private:
       exit(1);
     } else {
       // Fixed size structure used, no problem.
+      num_readers = new_num_rw_threads;
     }
   };
 
@@ -164,6 +204,7 @@ private:
     last_update_time;                    // Time when the ptr this RT_RCU protects
   volatile uint32_t *reader_lock_times;  // Every reader thread has a value that says what was the global_time_count when it was locked, or 0
                                          // if that reader thread is unlocked.
+  int *reader_nest;                      // Nesting depth of read-side critical sections, for each reader thread
   int num_readers;                       // Local copy of RT_RWThreads::num_rw_threads
 };
 
@@ -624,38 +624,48 @@ void *SDLIO::run_sdl_thread(void *ptr)
   while (inst->sdlthreadgo) {
     if (SDL_WaitEvent(&event)) {
       switch (event.type) {
+      // Input events are built on the stack and broadcast directly-
+      // no preallocated instance is needed
       case SDL_JOYBUTTONDOWN :
       case SDL_JOYBUTTONUP :
         {
-          JoystickButtonInputEvent *jevt = (JoystickButtonInputEvent *) 
-              Event::GetEventByType(T_EV_Input_JoystickButton);
+          JoystickButtonInputEvent jevt;
+          jevt.StampInput();
             
-          jevt->joystick = event.jbutton.which;
-          jevt->button = event.jbutton.button;
-          jevt->down = (event.type == SDL_JOYBUTTONUP ? 0 : 1);
-          inst->app->getEMG()->BroadcastEventNow(jevt, inst);
+          jevt.joystick = event.jbutton.which;
+          jevt.button = event.jbutton.button;
+          jevt.down = (event.type == SDL_JOYBUTTONUP ? 0 : 1);
+          inst->app->getEMG()->BroadcastEventNow(&jevt, inst, 1, 0);
             
           if (inst->app->getCFG()->IsDebugInfo())
             printf("JOYSTICK: Joystick #%d, button #%d %s\n",
-                   jevt->joystick,jevt->button,
-                   (jevt->down ? "pressed" : "released"));
+                   jevt.joystick,jevt.button,
+                   (jevt.down ? "pressed" : "released"));
         }
         break;
 
       case SDL_MOUSEMOTION :
         {
-          MouseMotionInputEvent *mevt = (MouseMotionInputEvent *) 
-              Event::GetEventByType(T_EV_Input_MouseMotion);
+          // Coalesce- if more motion is already waiting, skip this one
+          SDL_Event nextmotion;
+          if (Event::ett[T_EV_Input_MouseMotion].coalesce &&
+              SDL_PeepEvents(&nextmotion,1,SDL_PEEKEVENT,
+                             SDL_MOUSEMOTIONMASK) > 0) {
+            inst->app->getEMG()->CountCoalesced(T_EV_Input_MouseMotion);
+            break;
+          }
+
+          MouseMotionInputEvent mevt;
             
-          mevt->x = event.motion.x;
-          mevt->y = event.motion.y;
-          inst->app->getEMG()->BroadcastEventNow(mevt, inst);
+          mevt.x = event.motion.x;
+          mevt.y = event.motion.y;
+          inst->app->getEMG()->BroadcastEventNow(&mevt, inst, 1, 0);
             
           // No debug info for mouse motion
 #if 0
           if (inst->app->getCFG()->IsDebugInfo())
             printf("MOUSE: Motion: (%d,%d)\n",
-                   mevt->x, mevt->y);
+                   mevt.x, mevt.y);
 #endif
         }
 
@@ -666,20 +676,19 @@ void *SDLIO::run_sdl_thread(void *ptr)
       case SDL_MOUSEBUTTONDOWN :
       case SDL_MOUSEBUTTONUP :
         {
-          MouseButtonInputEvent *mevt = (MouseButtonInputEvent *) 
-              Event::GetEventByType(T_EV_Input_MouseButton);
+          MouseButtonInputEvent mevt;
             
-          mevt->button = event.button.button;
-          mevt->down = (event.type == SDL_MOUSEBUTTONUP ? 0 : 1);
-          mevt->x = event.button.x;
-          mevt->y = event.button.y;
-          inst->app->getEMG()->BroadcastEventNow(mevt, inst);
+          mevt.button = event.button.button;
+          mevt.down = (event.type == SDL_MOUSEBUTTONUP ? 0 : 1);
+          mevt.x = event.button.x;
+          mevt.y = event.button.y;
+          inst->app->getEMG()->BroadcastEventNow(&mevt, inst, 1, 0);
             
           if (inst->app->getCFG()->IsDebugInfo())
             printf("MOUSE: Button #%d %s @ (%d,%d)\n",
-                   mevt->button,
-                   (mevt->down ? "pressed" : "released"),
-                   mevt->x, mevt->y);
+                   mevt.button,
+                   (mevt.down ? "pressed" : "released"),
+                   mevt.x, mevt.y);
         }
 
         //printf("button: %d x: %d y: %d\n",
@@ -695,17 +704,17 @@ void *SDLIO::run_sdl_thread(void *ptr)
             inst->keyheld[sym] = 1;
             
             // Now generate an input event..
-            KeyInputEvent *kevt = (KeyInputEvent *) 
-              Event::GetEventByType(T_EV_Input_Key);
+            KeyInputEvent kevt;
+            kevt.StampInput();
             
-            kevt->down = 1;
-            kevt->keysym = sym;
-            kevt->unicode = event.key.keysym.unicode;
-            inst->app->getEMG()->BroadcastEventNow(kevt, inst);
+            kevt.down = 1;
+            kevt.keysym = sym;
+            kevt.unicode = event.key.keysym.unicode;
+            inst->app->getEMG()->BroadcastEventNow(&kevt, inst, 1, 0);
             
             if (inst->app->getCFG()->IsDebugInfo())
               printf("KEYBOARD: Key pressed: %d (%s)\n",
-                     kevt->keysym, GetSDLName(sym));
+                     kevt.keysym, GetSDLName(sym));
             inst->handle_key(event.key.keysym.scancode,1);
           } else {
             printf("KEYBOARD: Invalid key\n");
@@ -720,16 +729,16 @@ void *SDLIO::run_sdl_thread(void *ptr)
             inst->keyheld[sym] = 0;
             
             // Now generate an input event..
-            KeyInputEvent *kevt = (KeyInputEvent *) 
-              Event::GetEventByType(T_EV_Input_Key);
-            kevt->down = 0;
-            kevt->keysym = sym;
-            kevt->unicode = event.key.keysym.unicode;
-            inst->app->getEMG()->BroadcastEventNow(kevt, inst);
+            KeyInputEvent kevt;
+            kevt.StampInput();
+            kevt.down = 0;
+            kevt.keysym = sym;
+            kevt.unicode = event.key.keysym.unicode;
+            inst->app->getEMG()->BroadcastEventNow(&kevt, inst, 1, 0);
             
             if (inst->app->getCFG()->IsDebugInfo())
               printf("KEYBOARD: Key released: %d (%s)\n",
-                     kevt->keysym, GetSDLName(sym));
+                     kevt.keysym, GetSDLName(sym));
             inst->handle_key(event.key.keysym.scancode,0);
             break;
           } else
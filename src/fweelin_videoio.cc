@@ -1493,6 +1493,8 @@ void VideoIO::video_event_loop ()
   int num_streams = 0;          // Number of output streams
   char *stream_type = "";       // Type (extension) of output stream
   double streamoutsize = 0.0;   // Last checked size of all output streams.
+  long int streamoverruns = 0,  // Last checked overruns in output streams
+    streamdropped = 0;
 
   video_time = 0;
   double video_start = mygettime();
@@ -1821,10 +1823,18 @@ void VideoIO::video_event_loop ()
         checksizecnt = 0;
 
         streamoutsize = app->getSTREAMSTATS(stream_type,num_streams);
+        streamoverruns = app->getSTREAMER_Overruns(streamdropped);
       }
 
-      sprintf(tmp,"%s   %.1f mb  (%d streams)",
-          app->getSTREAMOUTNAME_DISPLAY().c_str(),streamoutsize,num_streams);
+      if (streamoverruns > 0)
+        sprintf(tmp,"%s   %.1f mb  (%d streams)  %ld overruns, %.1f s lost",
+                app->getSTREAMOUTNAME_DISPLAY().c_str(),streamoutsize,
+                num_streams,streamoverruns,
+                (float) streamdropped / app->getAUDIO()->get_srate());
+      else
+        sprintf(tmp,"%s   %.1f mb  (%d streams)",
+                app->getSTREAMOUTNAME_DISPLAY().c_str(),streamoutsize,
+                num_streams);
     }
     draw_text(screen,mainfont,tmp,patchx,patchy-OCY(22),gray);
 
@@ -1833,6 +1843,23 @@ void VideoIO::video_event_loop ()
     if (curscene != 0)
       draw_text(screen,mainfont,curscene->name,0,0,gray);
 
+    // Input to audio latency, in debug mode
+    if (app->getCFG()->IsDebugInfo()) {
+      LatencyStats *lat = app->getRP()->GetLatencyStats();
+      int laty = OCY(20), sy = 0;
+      for (int i = 0; i < LatencyStats::NUM_PATHS; i++)
+        if (lat->GetCount(i) > 0) {
+          snprintf(tmp,255,"%s -> %s: %ld   median %.1f  99%% %.1f  "
+                   "max %.1f ms",
+                   Event::GetEventName(LatencyStats::GetPathInput(i)),
+                   LatencyStats::GetPathTargetName(i),lat->GetCount(i),
+                   lat->GetPercentile(i,50),lat->GetPercentile(i,99),
+                   lat->GetMax(i));
+          draw_text(screen,mainfont,tmp,0,laty,gray,0,0,0,&sy);
+          laty += sy;
+        }
+    }
+
     // **
 
     // Draw displays